@@ -86,6 +86,8 @@ extern int __cr_barrier_wait_interruptible(cr_barrier_t *barrier);
 
 /* Tracing wrappers 
  * Note that CR_KTRACE_BARRIER(...) preprocesses to empty when not tracing.
+ * The blocking ones also fire the blcr_barrier tracepoint (cr_trace.h)
+ * with the time spent blocked.
  */
 #define cr_barrier_notify(b) (void)({ \
 	_cr_barrier_uflow_wrap_void(cr_barrier_notify, b);\
@@ -93,30 +95,38 @@ extern int __cr_barrier_wait_interruptible(cr_barrier_t *barrier);
     })
 #define cr_barrier_enter(b) ({ \
 	int _res; \
+	u64 _t0 = cr_trace_start(blcr_barrier); \
 	CR_KTRACE_BARRIER("ENTER(" #b ") begin");\
 	_res = _cr_barrier_uflow_wrap_int(cr_barrier_enter, b);\
 	CR_KTRACE_BARRIER("ENTER(" #b ") returning %d", _res);\
+	trace_blcr_barrier(#b, _res, cr_trace_since(_t0));\
 	(_res); \
     })
 #define cr_barrier_enter_interruptible(b) ({ \
 	int _res; \
+	u64 _t0 = cr_trace_start(blcr_barrier); \
 	CR_KTRACE_BARRIER("ENTER_INTERRUPTIBLE(" #b ") begin");\
 	_res = _cr_barrier_uflow_wrap_int(cr_barrier_enter_interruptible, b);\
 	CR_KTRACE_BARRIER("ENTER_INTERRUPTIBLE(" #b ") returning %d", _res);\
+	trace_blcr_barrier(#b, _res, cr_trace_since(_t0));\
 	(_res); \
     })
 #define cr_barrier_wait(b) ({ \
 	int _res; \
+	u64 _t0 = cr_trace_start(blcr_barrier); \
 	CR_KTRACE_BARRIER("WAIT(" #b ") begin");\
 	_res = __cr_barrier_wait(b);\
 	CR_KTRACE_BARRIER("WAIT(" #b ") returning %d", _res);\
+	trace_blcr_barrier(#b, _res, cr_trace_since(_t0));\
 	(_res); \
     })
 #define cr_barrier_wait_interruptible(b) ({ \
 	int _res; \
+	u64 _t0 = cr_trace_start(blcr_barrier); \
 	CR_KTRACE_BARRIER("WAIT_INTERRUPTIBLE(" #b ") begin");\
 	_res = __cr_barrier_wait_interruptible(b);\
 	CR_KTRACE_BARRIER("WAIT_INTERRUPTIBLE(" #b ") returning %d", _res);\
+	trace_blcr_barrier(#b, _res, cr_trace_since(_t0));\
 	(_res); \
     })
 #define cr_barrier_test(b) ({ \
@@ -135,17 +145,21 @@ extern int __cr_barrier_wait_interruptible(cr_barrier_t *barrier);
 #define cr_barrier_once(b, block) ({ \
 	cr_barrier_t *_b = (b); \
 	int _res, _block = (block); \
+	u64 _t0 = _block ? cr_trace_start(blcr_barrier) : 0; \
 	if (_block) CR_KTRACE_BARRIER("ONCE(" #b ", 1) begin");\
 	_res = _block ? __cr_barrier_wait(_b) : __cr_barrier_test(_b); \
 	CR_KTRACE_BARRIER("ONCE(" #b ", %d) returning %d", _block, _res);\
+	if (_block) trace_blcr_barrier(#b, _res, cr_trace_since(_t0));\
 	(_res); \
     })
 #define cr_barrier_once_interruptible(b, block) ({ \
 	cr_barrier_t *_b = (b); \
 	int _res, _block = (block); \
+	u64 _t0 = _block ? cr_trace_start(blcr_barrier) : 0; \
 	if (_block) CR_KTRACE_BARRIER("ONCE_INTERRUPTIBLE(" #b ", 1) begin");\
 	_res = _block ? __cr_barrier_wait_interruptible(_b) : __cr_barrier_test(_b); \
 	CR_KTRACE_BARRIER("ONCE_INTERRUPTIBLE(" #b ", %d) returning %d", _block, _res);\
+	if (_block) trace_blcr_barrier(#b, _res, cr_trace_since(_t0));\
 	(_res); \
     })
 	
@@ -44,6 +44,11 @@ static int release_request(cr_chkpt_req_t *req)
 	result = atomic_dec_and_test(&req->ref_count);
 	if (result) {
 		CRI_ASSERT(list_empty(&req->procs));
+		if (!req->result && atomic_read(&req->completed) &&
+		    !(req->flags & CR_CHKPT_DRYRUN)) {
+			cr_stats_commit(&req->stats);
+		}
+		cr_toc_free(req);
 		cr_loc_free(&req->dest);
 		cr_release_objectmap(req->map);
 		fput(req->ctrl_file);
@@ -73,6 +78,9 @@ static void release_proc_req(cr_chkpt_proc_req_t *proc_req)
 		if (proc_req->mmaps_tbl) {
 			vfree(proc_req->mmaps_tbl);
 		}
+		if (proc_req->exclude) {
+			vfree(proc_req->exclude);
+		}
 #if CRI_DEBUG
 		if (proc_req->tmp_fd >= 0) {
 	    		CR_ERR("Leaking tmp_fd");
@@ -283,6 +291,8 @@ static cr_chkpt_req_t * alloc_request(struct file *ctrl_file)
 		cr_barrier_init(&req->postdump_barrier, 0);
 		req->ctrl_file = cr_filp_reopen(ctrl_file, O_WRONLY);
 		req->errbuf = cr_errbuf_alloc();
+		cr_stats_init(&req->stats);
+		req->toc = NULL;
 	} else {
                 goto out_freemap;
 	}
@@ -369,6 +379,7 @@ lookup_proc_req(cr_chkpt_req_t *req, struct task_struct *task)
 	    init_MUTEX(&result->serial_mutex);
 	    list_add_tail(&result->list, &req->procs);
 	    init_waitqueue_head(&result->wait);
+	    spin_lock_init(&result->helper.lock);
 	    result->saved_sa.sa.sa_handler = SIG_ERR;
 	    result->forced_sa.sa.sa_handler = SIG_ERR;
 	    result->ctrl_fd = -1;
@@ -547,6 +558,8 @@ static int add_task(cr_chkpt_req_t *req, struct task_struct *task)
 	atomic_inc(&req->postdump_barrier.count);
 	cr_task->chkpt_req = req;
 	cr_task->chkpt_proc_req = proc_req;
+	memset(cr_task->cp_time, 0, sizeof(cr_task->cp_time));
+	memset(&cr_task->cp_hand, 0, sizeof(cr_task->cp_hand));
 	list_add_tail(&cr_task->req_list, &req->tasks);
 	list_add_tail(&cr_task->proc_req_list, &proc_req->tasks);
 	atomic_inc(&req->ref_count);
@@ -886,10 +899,26 @@ retry:
 		goto out_release;
 	}
 
-	// Validate the destination file descriptor
-	result = cr_loc_init(req->errbuf, &req->dest, ureq->cr_fd, filp, /* is_write= */ 1);
+	if (req->flags & CR_CHKPT_DRYRUN) {
+		// Nothing is written, and the targets are left running
+		req->signal = 0;
+		result = cr_loc_init_sink(&req->dest, filp);
+		if (result) {
+			CR_ERR_REQ(req, "Failed to initialize dry-run destination");
+			goto out_release;
+		}
+	} else {
+		// Validate the destination file descriptor
+		result = cr_loc_init(req->errbuf, &req->dest, ureq->cr_fd, filp, /* is_write= */ 1);
+		if (result) {
+			CR_ERR_REQ(req, "Failed to initialize destination file descriptor");
+			goto out_release;
+		}
+	}
+
+	// Table of contents (if requested) needs to know the destination
+	result = cr_toc_init(req);
 	if (result) {
-		CR_ERR_REQ(req, "Failed to initialize destination file descriptor");
 		goto out_release;
 	}
 
@@ -933,6 +962,8 @@ retry:
 
 		goto out_release;
 	} else {
+		trace_blcr_chkpt_req(req->target, req->checkpoint_scope, req->flags);
+
 		// Send the triggers
 		cr_trigger_phase1(req);
 
@@ -1358,6 +1389,7 @@ int cr_chkpt_task_complete(cr_task_t *cr_task, int block)
 	CR_BARRIER_NOTIFY(cr_task, &proc_req->post_complete_barrier);
 	if (block) (void)cr_barrier_wait_interruptible(&proc_req->post_complete_barrier);
 	CR_ASSERT_STEP_EQ(cr_task, CR_CHKPT_STEP_DONE);
+	cr_stats_end(&req->stats);
 
 	delete_from_req(req, cr_task);
 	release_request(req);
@@ -1522,6 +1554,80 @@ out:
     return retval;
 }
 
+// CR_OP_HAND_EXCLUDE: libcr passes the ranges of memory to leave out.
+// Only the first call for a given process is kept.
+int cr_hand_exclude(struct file *filp, struct cr_exclude_args __user *arg)
+{
+	struct cr_exclude_args args;
+	struct cr_exclude_range *tbl = NULL;
+	cr_chkpt_proc_req_t *proc_req;
+	cr_chkpt_req_t *req;
+	cr_task_t *cr_task;
+	unsigned long prev_end = 0;
+	unsigned int i;
+	int retval;
+
+	CR_KTRACE_FUNC_ENTRY();
+
+	retval = -EFAULT;
+	if (copy_from_user(&args, arg, sizeof(args))) {
+		goto out;
+	}
+	retval = -EINVAL;
+	if (!args.count || (args.count > CR_EXCLUDE_MAX)) {
+		goto out;
+	}
+
+	retval = -ENOMEM;
+	tbl = vmalloc(args.count * sizeof(*tbl));
+	if (!tbl) {
+		goto out;
+	}
+	retval = -EFAULT;
+	if (copy_from_user(tbl, (void __user *)(unsigned long)args.ranges,
+			   args.count * sizeof(*tbl))) {
+		goto out;
+	}
+
+	// Must be page aligned, sorted and disjoint, and within our address space
+	retval = -EINVAL;
+	for (i = 0; i < args.count; ++i) {
+		const struct cr_exclude_range *r = &tbl[i];
+		if ((r->start & ~PAGE_MASK) || (r->end & ~PAGE_MASK) ||
+		    (r->start >= r->end) || (r->end > TASK_SIZE) ||
+		    (r->start < prev_end) || (r->how > CR_EXCLUDE_UNMAP)) {
+			goto out;
+		}
+		prev_end = r->end;
+	}
+
+	retval = -ESRCH;
+	cr_task = cr_task_get(current);
+	if (!cr_task) {
+		goto out;
+	}
+	req = cr_task->chkpt_req;
+	if (req) {
+		proc_req = cr_task->chkpt_proc_req;
+		write_lock(&req->lock);
+		if (!proc_req->exclude) {
+			proc_req->exclude = tbl;
+			proc_req->exclude_count = args.count;
+			tbl = NULL;
+		}
+		write_unlock(&req->lock);
+		retval = 0;
+	}
+	cr_task_put(cr_task);
+
+out:
+	if (tbl) {
+		vfree(tbl);
+	}
+	CR_KTRACE_FUNC_EXIT("Returning %d", retval);
+	return retval;
+}
+
 // Last arg indicates if we hold the req->lock.
 void cr_chkpt_advance_to(cr_task_t *cr_task, int end_step, int hold_lock) {
 	cr_chkpt_req_t *req = cr_task->chkpt_req;
@@ -1635,6 +1741,42 @@ out:
     return retval;
 }
 
+/**
+ * cr_chkpt_stats
+ * @filp: The filp for the checkpoint request
+ * @arg:  Pointer to user's struct cr_chkpt_stats
+ *
+ * Copies the phase times and counters of the request to arg.
+ * Like the log, these remain available until the request is reaped.
+ *
+ * Returns:   0 on success, or negative error code.
+ */
+int cr_chkpt_stats(struct file *filp, struct cr_chkpt_stats __user *arg)
+{
+    cr_pdata_t *priv;
+    cr_chkpt_req_t *req;
+    int retval;
+
+    CR_KTRACE_FUNC_ENTRY();
+
+    retval = -EINVAL;
+    priv = filp->private_data;
+    if (priv == NULL) {
+        CR_ERR("%s: private_data is NULL!", __FUNCTION__);
+        goto out;
+    }
+    req = priv->chkpt_req;
+    if ((req == NULL) || (req == CR_CHKPT_RESTARTED)) {
+        goto out;
+    }
+
+    retval = cr_stats_copy(&req->stats, arg);
+
+out:
+    CR_KTRACE_FUNC_EXIT("Returning %d", retval);
+    return retval;
+}
+
 #ifdef CONFIG_COMPAT
 int cr_chkpt_req32(struct file *file, struct cr_compat_chkpt_args __user *req)
 {
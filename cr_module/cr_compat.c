@@ -62,6 +62,14 @@ long cr_compat_ctrl_ioctl(struct file *file, unsigned op, unsigned long arg)
 	case CR_OP_HAND_CHKPT_INFO:
 		return cr_chkpt_info32(file, (struct cr_compat_chkpt_info __user *)compat_ptr(arg));
 
+	case CR_OP_HAND_TIMES:
+		/* No conversion needed, all members are 64-bit */
+		return cr_hand_times(file, (struct cr_hand_times __user *)compat_ptr(arg));
+
+	case CR_OP_HAND_EXCLUDE:
+		/* No conversion needed, all members are 64-bit */
+		return cr_hand_exclude(file, (struct cr_exclude_args __user *)compat_ptr(arg));
+
 	case CR_OP_HAND_DONE:
 		return cr_hand_complete(file, arg);
 
@@ -80,6 +88,10 @@ long cr_compat_ctrl_ioctl(struct file *file, unsigned op, unsigned long arg)
 	case CR_OP_CHKPT_LOG:
 		return cr_chkpt_log32(file, (struct cr_compat_log_args __user *)compat_ptr(arg));
 
+	case CR_OP_CHKPT_STATS:
+		/* No conversion needed, all members are 64-bit */
+		return cr_chkpt_stats(file, (struct cr_chkpt_stats __user *)compat_ptr(arg));
+
 	//
 	// Calls from cr_restart:
 	//
@@ -120,6 +132,10 @@ long cr_compat_ctrl_ioctl(struct file *file, unsigned op, unsigned long arg)
 		return match ? 0 : -CR_EVERSION;
 	    }
 
+	case CR_OP_STRIPE:
+		/* No conversion needed, all members are 64-bit */
+		return cr_stripe_open((struct cr_stripe_args __user *)compat_ptr(arg));
+
 	default:
 		CR_KTRACE_BADPARM("unknown op %x", _IOC_NR(op));
 		return -ENOTTY;
@@ -50,6 +50,9 @@ static int validate_file(struct file *file, int is_write)
 		retval = PTR_ERR(file);
 		// Fall through to failure
 	} else {
+		// A striped file has an anonymous inode, w/o a name or a type
+		const int striped = cr_is_stripe_file(file);
+
 		dentry = file->f_dentry;
 		inode = dentry->d_inode;
 	
@@ -57,13 +60,14 @@ static int validate_file(struct file *file, int is_write)
 		        retval = -EMLINK;
 			// Don't dump to a file w/ multiple links
 			// Fall through to failure
-		} else if (d_unhashed(dentry)) {
+		} else if (d_unhashed(dentry) && !striped) {
 			// Fail due to NFS or autofs timeouts.
 			// Fall through to failure
 		} else if (!S_ISREG(inode->i_mode) &&
 			   !S_ISCHR(inode->i_mode) &&
 			   !S_ISSOCK(inode->i_mode) &&
-			   !S_ISFIFO(inode->i_mode)) {
+			   !S_ISFIFO(inode->i_mode) &&
+			   !striped) {
 			// Fall through to failure
 		} else if(!(file->f_mode & (is_write ? FMODE_WRITE : FMODE_READ))) {
 		        retval = -EBADF;
@@ -153,6 +157,11 @@ int cr_loc_init(cr_errbuf_t *eb, cr_location_t *loc, int fd, struct file *from,
 		return -EINVAL;
 	}
 
+	if (cr_is_stripe_file(filp)) {
+	        CR_KTRACE_LOW_LVL("Calling do_init_reg on striped fd %d", fd);
+		return do_init_reg(loc, filp);
+	}
+
 	switch (filp->f_dentry->d_inode->i_mode & S_IFMT) {
 	case S_IFREG: case S_IFCHR: case S_IFIFO: case S_IFSOCK:
 	        CR_KTRACE_LOW_LVL("Calling do_init_reg on fd %d", fd);
@@ -174,6 +183,30 @@ int cr_loc_init(cr_errbuf_t *eb, cr_location_t *loc, int fd, struct file *from,
 	}
 }
 
+// cr_loc_init_sink(loc, from)
+//
+// Set up the "destination" of a dry run (CR_CHKPT_DRYRUN).
+// This is a private reopen of the ctrl file 'from', so it has its own f_pos
+// to count the bytes a real checkpoint would have written (see cr_io_sink).
+//
+// Returns 0 on success, negative error code on failure.
+int cr_loc_init_sink(cr_location_t *loc, struct file *from)
+{
+	struct file *filp;
+
+	memset(loc, 0, sizeof(*loc));
+	loc->is_write = 1;
+
+	filp = cr_filp_reopen(from, O_WRONLY);
+	if (IS_ERR(filp)) {
+		return PTR_ERR(filp);
+	}
+
+	loc->filp = filp;
+	init_MUTEX(&loc->mutex);
+	return 0;
+}
+
 // cr_loc_free(loc)
 //
 // Free the checkpoint destination, decrementing use counts as appropriate.
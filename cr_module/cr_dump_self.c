@@ -539,39 +539,35 @@ cr_save_file_locks(cr_chkpt_proc_req_t *proc_req, struct file *filp)
     return retval;
 }
 
+/* Number of fds collected per acquisition of file_lock */
+#define CR_FD_BATCH	(PAGE_SIZE / sizeof(struct cr_file_info))
+
+/*
+ * Collect up to CR_FD_BATCH open files, starting at *next_fd, taking a
+ * reference on each.  Only the open-fds bitmap is scanned, so the cost
+ * is independent of the size of the fd table.
+ *
+ * Returns the number collected, and advances *next_fd.
+ */
 static int
-cr_save_all_files(cr_chkpt_proc_req_t *proc_req)
+cr_collect_open_files(cr_chkpt_proc_req_t *proc_req, int *next_fd, int max_fds,
+		      struct cr_file_info *batch)
 {
-    int retval;
-    int fd;
+    struct files_struct *files = current->files;
     struct file *cf_filp = proc_req->file;
-    struct cr_file_info file_info;
-    struct file *filp;
-    int max_fds;
-
-    CR_KTRACE_FUNC_ENTRY("");
-
-    /* save the files info, and get max_fds as a side-effect */
-    CR_KTRACE_HIGH_LVL("    ...files_struct");
-    retval = cr_save_files_struct(proc_req, current->files);
-    if (retval < 0) {
-        CR_ERR_PROC_REQ(proc_req, "cr_save_all_files: Error saving files_struct");
-        goto out_nolocks;
-    }
-    max_fds = retval;
+    cr_fdtable_t *fdt;
+    int count = 0;
+    int fd;
 
-    CR_KTRACE_HIGH_LVL("    ...files");
-    /* now save the per file info */
-    spin_lock(&current->files->file_lock);
-    for (fd = 0; fd < max_fds; ++fd) {
-        /*
-         * We have to do our own fget here to avoid a possible race on
-         * file close.  (Probably impossible, but just to be on the safe
-         * side.
-         */
+    spin_lock(&files->file_lock);
+    rcu_read_lock();
+    fdt = cr_fdtable(files);
+    for (fd = cr_next_open_fd(*next_fd, max_fds, fdt);
+	 (fd < max_fds) && (count < CR_FD_BATCH);
+	 fd = cr_next_open_fd(fd + 1, max_fds, fdt)) {
+        struct file *filp = fcheck(fd);
 
-        /* loop around again if the file is not open or not to be saved */
-        filp = fcheck(fd);
+        /* skip if the file is not yet installed or not to be saved */
         if (! filp) {
             continue;
         }
@@ -580,102 +576,165 @@ cr_save_all_files(cr_chkpt_proc_req_t *proc_req)
             continue;
         }
 
+        /*
+         * We have to do our own fget here to avoid a possible race on
+         * file close.  (Probably impossible, but just to be on the safe
+         * side.
+         */
         get_file(filp);
 
-        // CR_KTRACE_LOW_LVL("fd %d is open", fd);
+	memset(&batch[count], 0, sizeof(*batch));
+	batch[count].cr_type = cr_file_info_obj;
+        cr_get_fd_info(files, fd, &batch[count]);
+	++count;
+    }
+    rcu_read_unlock();
+    spin_unlock(&files->file_lock);
 
-	memset(&file_info, 0, sizeof(file_info));
-	file_info.cr_type = cr_file_info_obj;
+    *next_fd = fd;
+    return count;
+}
 
-        /* now save data for this file descriptor */
-        cr_get_fd_info(current->files, fd, &file_info);
+static int
+cr_save_one_file(cr_chkpt_proc_req_t *proc_req, struct file *filp,
+		 struct cr_file_info *file_info)
+{
+    const int fd = file_info->fd;
+    int retval;
 
-        spin_unlock(&current->files->file_lock);
+    /* Ensure up-to-date inode information (e.g. on a network fs) */
+    retval = cr_fstat(proc_req->req->map, filp);
+    if (retval) {
+        CR_ERR_PROC_REQ(proc_req, "Unable to fstat() file"); 
+        goto out;
+    }
 
-        /* Ensure up-to-date inode information (e.g. on a network fs) */
-        retval = cr_fstat(proc_req->req->map, filp);
-        if (retval) {
-            CR_ERR_PROC_REQ(proc_req, "Unable to fstat() file"); 
-            fput(filp);
-            goto out_nolocks;
-        }
+    /* write out the file header */
+    retval = cr_get_file_info(proc_req, filp, file_info);
+    if (retval) {
+        retval = -EBADF;
+        CR_ERR_PROC_REQ(proc_req, "Unable to determine file info!"); 
+        goto out;
+    }
+    retval = cr_save_file_info(proc_req, file_info);
+    if (retval < 0) {
+        CR_ERR_PROC_REQ(proc_req, "%s: cr_save_file_info failed", __FUNCTION__);
+        goto out;
+    }
 
-        /* write out the file header */
-        retval = cr_get_file_info(proc_req, filp, &file_info);
-        if (retval) {
-            retval = -EBADF;
-            CR_ERR_PROC_REQ(proc_req, "Unable to determine file info!"); 
-            fput(filp);
-            goto out_nolocks;
-        }
-        retval = cr_save_file_info(proc_req, &file_info);
-        if (retval < 0) {
-            CR_ERR_PROC_REQ(proc_req, "%s: cr_save_file_info failed", __FUNCTION__);
-            fput(filp);
-            goto out_nolocks;
-        }
+    switch(file_info->cr_file_type) {
+    case cr_open_file:
+        CR_KTRACE_LOW_LVL("    ...%d is regular file.", fd);
+        retval = cr_save_open_file(proc_req, filp);
+        break;
+    case cr_open_directory:
+        CR_KTRACE_LOW_LVL("    ...%d is open directory.", fd);
+        retval = cr_save_open_dir(proc_req, filp);
+        break; 
+    case cr_open_link:
+        CR_KTRACE_LOW_LVL("    ...%d is open symlink.", fd);
+        retval = cr_save_open_link(proc_req, filp);
+        break;
+    case cr_open_fifo:
+        CR_KTRACE_LOW_LVL("    ...%d is open fifo.", fd);
+        retval = cr_save_open_fifo(proc_req, filp);
+        break;
+    case cr_open_socket:
+        CR_KTRACE_LOW_LVL("    ...%d is open socket.", fd);
+        retval = cr_save_open_socket(proc_req, filp);
+        break;
+    case cr_open_chr:
+        CR_KTRACE_LOW_LVL("    ...%d is open character device.", fd);
+        retval = cr_save_open_chr(proc_req, filp);
+        break;
+    case cr_open_blk:
+        CR_KTRACE_LOW_LVL("    ...%d is an open block device.", fd);
+        retval = cr_save_open_blk(proc_req, filp);
+        break;
+    case cr_open_dup:
+        CR_KTRACE_LOW_LVL("    ...%d is dup of %p", fd, file_info->orig_filp);
+        retval = cr_save_open_dup(proc_req, filp);
+        break;
+    case cr_open_chkpt_req:
+        CR_KTRACE_LOW_LVL("    ...%d is a checkpoint request.", fd);
+        retval = cr_save_open_chkpt_req(proc_req, filp);
+        break;
+    case cr_bad_file_type:
+        /* fall through */
+    default:
+        retval = -EBADF;
+        break;
+    }
 
-        switch(file_info.cr_file_type) {
-        case cr_open_file:
-            CR_KTRACE_LOW_LVL("    ...%d is regular file.", fd);
-            retval = cr_save_open_file(proc_req, filp);
-            break;
-        case cr_open_directory:
-            CR_KTRACE_LOW_LVL("    ...%d is open directory.", fd);
-            retval = cr_save_open_dir(proc_req, filp);
-            break; 
-        case cr_open_link:
-            CR_KTRACE_LOW_LVL("    ...%d is open symlink.", fd);
-            retval = cr_save_open_link(proc_req, filp);
-            break;
-        case cr_open_fifo:
-            CR_KTRACE_LOW_LVL("    ...%d is open fifo.", fd);
-            retval = cr_save_open_fifo(proc_req, filp);
-            break;
-        case cr_open_socket:
-            CR_KTRACE_LOW_LVL("    ...%d is open socket.", fd);
-            retval = cr_save_open_socket(proc_req, filp);
-            break;
-        case cr_open_chr:
-            CR_KTRACE_LOW_LVL("    ...%d is open character device.", fd);
-            retval = cr_save_open_chr(proc_req, filp);
-            break;
-        case cr_open_blk:
-            CR_KTRACE_LOW_LVL("    ...%d is an open block device.", fd);
-            retval = cr_save_open_blk(proc_req, filp);
-            break;
-        case cr_open_dup:
-            CR_KTRACE_LOW_LVL("    ...%d is dup of %p", fd, file_info.orig_filp);
-            retval = cr_save_open_dup(proc_req, filp);
-            break;
-        case cr_open_chkpt_req:
-            CR_KTRACE_LOW_LVL("    ...%d is a checkpoint request.", fd);
-            retval = cr_save_open_chkpt_req(proc_req, filp);
-            break;
-        case cr_bad_file_type:
-            /* fall through */
-        default:
-            retval = -EBADF;
-            break;
-        }
+    if (retval < 0) {
+        retval = -EBADF;
+        CR_ERR_PROC_REQ(proc_req, "Unable to save open file!");
+        goto out;
+    }
 
-        if (retval < 0) {
-            fput(filp);
-            retval = -EBADF;
-            CR_ERR_PROC_REQ(proc_req, "Unable to save open file!");
-            goto out_nolocks;
-        }
+    /* Now write out any locks we had on the file (unimplemented). */
+    // CR_KTRACE_LOW_LVL("    ...locks on %d", fd);
+    (void)cr_save_file_locks(proc_req, filp);
+    retval = 0;
 
-        /* Now write out any locks we had on the file. */
-        // CR_KTRACE_LOW_LVL("    ...locks on %d", fd);
-        retval = cr_save_file_locks(proc_req, filp);
+out:
+    return retval;
+}
 
-        /* We did the fget() manually with the lock held. */
-        fput(filp);
+static int
+cr_save_all_files(cr_chkpt_proc_req_t *proc_req)
+{
+    int retval;
+    int next_fd, count, i;
+    struct cr_file_info file_info;
+    struct cr_file_info *batch;
+    int max_fds;
+    int saved = 0;
 
-        spin_lock(&current->files->file_lock);
+    CR_KTRACE_FUNC_ENTRY("");
+
+    batch = (struct cr_file_info *)__get_free_page(GFP_KERNEL);
+    if (!batch) {
+        retval = -ENOMEM;
+        goto out_nolocks;
+    }
+
+    /* save the files info, and get max_fds as a side-effect */
+    CR_KTRACE_HIGH_LVL("    ...files_struct");
+    retval = cr_save_files_struct(proc_req, current->files);
+    if (retval < 0) {
+        CR_ERR_PROC_REQ(proc_req, "cr_save_all_files: Error saving files_struct");
+        goto out_free;
+    }
+    max_fds = retval;
+
+    CR_KTRACE_HIGH_LVL("    ...files");
+    /* now save the per file info, a batch at a time */
+    next_fd = 0;
+    while ((count = cr_collect_open_files(proc_req, &next_fd, max_fds, batch)) != 0) {
+        for (i = 0; i < count; ++i) {
+            struct file *filp = batch[i].orig_filp;
+            loff_t pos = proc_req->file->f_pos;
+            u64 t0 = cr_trace_start(blcr_file);
+            retval = cr_save_one_file(proc_req, filp, &batch[i]);
+            trace_blcr_file(1, batch[i].fd, batch[i].cr_file_type,
+                            proc_req->file->f_pos - pos, retval, cr_trace_since(t0));
+            if (retval >= 0) {
+                cr_toc_add(proc_req->req, CR_TOC_FD, pos, proc_req->file->f_pos - pos,
+                           batch[i].fd, batch[i].cr_file_type);
+            }
+            /* We did the fget() manually with the lock held. */
+            fput(filp);
+            if (retval < 0) {
+                /* drop the references not yet used */
+                while (++i < count) {
+                    fput((struct file *)batch[i].orig_filp);
+                }
+                goto out_free;
+            }
+            ++saved;
+        }
     }
-    spin_unlock(&current->files->file_lock);
 
     /* now write one last record to indicate that there are no files left. */
     memset(&file_info, 0, sizeof(file_info));
@@ -685,9 +744,12 @@ cr_save_all_files(cr_chkpt_proc_req_t *proc_req)
     retval = cr_save_file_info(proc_req, &file_info);
     if (retval < 0) {
         CR_ERR_PROC_REQ(proc_req, "%s: cr_save_file_info failed", __FUNCTION__);
-        goto out_nolocks;
+        goto out_free;
     }
+    cr_stats_add(&proc_req->req->stats, CR_STATS_FDS, saved);
 
+out_free:
+    free_page((unsigned long)batch);
 out_nolocks:
     return retval;
 }
@@ -753,6 +815,20 @@ cr_save_header(cr_chkpt_proc_req_t *proc_req, struct file *filp)
     return result;
 }
 
+// Charge bytes written since the last charge to the given counter.
+// No bytes are seen for destinations (e.g. pipes) that don't advance f_pos.
+// Must be called w/ proc_req->serial_mutex held.
+static void
+cr_stats_charge(cr_chkpt_proc_req_t *proc_req, int counter)
+{
+    loff_t pos = proc_req->file->f_pos;
+
+    if (pos > proc_req->stats_pos) {
+        cr_stats_add(&proc_req->req->stats, counter, pos - proc_req->stats_pos);
+    }
+    proc_req->stats_pos = pos;
+}
+
 // Create a vmadump file
 static int cr_do_vmadump(cr_task_t *cr_task, int i_am_leader)
 {
@@ -760,7 +836,8 @@ static int cr_do_vmadump(cr_task_t *cr_task, int i_am_leader)
     cr_chkpt_proc_req_t *proc_req = cr_task->chkpt_proc_req;
     struct file *filp = proc_req->file;
     int result=0;
-    loff_t bytes;
+    loff_t bytes, pos;
+    u64 t0;
 
     CR_NO_LOCKS();
 
@@ -773,6 +850,9 @@ static int cr_do_vmadump(cr_task_t *cr_task, int i_am_leader)
         /* Determine surviving thread count */
         struct list_head *l;
         int count = 0;
+
+        proc_req->stats_pos = filp->f_pos;
+        proc_req->toc_pos = filp->f_pos;
         list_for_each(l, &proc_req->tasks) { ++count; }
         if (count != proc_req->thread_count) {
             CR_WARN_PROC_REQ(proc_req, "Adjusting thread count for tgid %d from %d to %d",
@@ -790,10 +870,13 @@ static int cr_do_vmadump(cr_task_t *cr_task, int i_am_leader)
     /* Now dump out the task linkage */
     if (!test_and_set_bit(0, &proc_req->done_linkage)) {
         CR_KTRACE_LOW_LVL("Writing the per-process linkage.");
+        pos = filp->f_pos;
         result = cr_save_linkage(proc_req, filp);
         if (result < 0) {
 	    goto out_early_mutex;
         }
+        cr_toc_add(req, CR_TOC_LINKAGE, pos, filp->f_pos - pos, 0, 0);
+        cr_stats_charge(proc_req, CR_STATS_BYTES_OTHER);
     }
     up(&proc_req->serial_mutex);
 
@@ -803,6 +886,7 @@ static int cr_do_vmadump(cr_task_t *cr_task, int i_am_leader)
     CR_ASSERT_STEP_EQ(cr_task, CR_CHKPT_STEP_VMADUMP);
 
     result = 0;
+    t0 = cr_stats_now();
     bytes = cr_freeze_threads(proc_req, req->flags, i_am_leader);
     if (bytes < 0) {
 	result = (int)bytes;
@@ -815,35 +899,57 @@ static int cr_do_vmadump(cr_task_t *cr_task, int i_am_leader)
     /* Need a barrier here to ensure all threads write their regs before the next
      * write to the file.
      */
+    cr_stats_mark(cr_task, CR_CP_VMADUMP);
     if (CR_BARRIER_ENTER(cr_task, &proc_req->vmadump_barrier)) {
 	CR_KTRACE_LOW_LVL("process finished vmadump");
     }
+    cr_stats_phase(&req->stats, CR_STATS_VMADUMP, t0);
 
     down(&proc_req->serial_mutex);
     if (!test_and_set_bit(0, &proc_req->done_fs)) {
+        /* All threads have passed vmadump_barrier, so their regs are counted */
+        cr_stats_charge(proc_req, CR_STATS_BYTES_VMADUMP);
+
         /* dump fs_struct (cwd, umask, etc.) */
         CR_KTRACE_HIGH_LVL("Writing the fs struct...");
+        pos = filp->f_pos;
         result = cr_save_fs_struct(proc_req);
         if (result < 0) {
 	    goto out_mutex;
         }
+        cr_toc_add(req, CR_TOC_FS, pos, filp->f_pos - pos, 0, 0);
+        cr_stats_charge(proc_req, CR_STATS_BYTES_OTHER);
+    }
+
+    if (!test_and_set_bit(0, &proc_req->done_prefetch)) {
+        /* revalidate attrs of open and mapped files concurrently */
+        CR_KTRACE_HIGH_LVL("Prefetching file attributes...");
+        cr_fstat_prefetch(req->map);
     }
 
     if (!test_and_set_bit(0, &proc_req->done_mmaps_maps)) {
         CR_KTRACE_HIGH_LVL("Writing the mmap()s table (if any)...");
+        t0 = cr_stats_now();
+        pos = filp->f_pos;
         result = cr_save_mmaps_maps(proc_req);
         if (result < 0) {
 	    goto out_mutex;
         }
+        cr_toc_add(req, CR_TOC_MMAPS_MAPS, pos, filp->f_pos - pos, 0, 0);
+        cr_stats_phase(&req->stats, CR_STATS_MMAPS_MAPS, t0);
+        cr_stats_charge(proc_req, CR_STATS_BYTES_MMAPS);
     }
 
     if (!test_and_set_bit(0, &proc_req->done_itimers)) {
         /* itimers */
         CR_KTRACE_HIGH_LVL("Writing POSIX interval timers...");
+        pos = filp->f_pos;
         result = cr_save_itimers(proc_req);
         if (result < 0) {
             goto out_mutex;
         }
+        cr_toc_add(req, CR_TOC_ITIMERS, pos, filp->f_pos - pos, 0, 0);
+        cr_stats_charge(proc_req, CR_STATS_BYTES_OTHER);
     }
 
     /* Wait for all tasks in all procs to leave user space before saving files
@@ -856,24 +962,38 @@ static int cr_do_vmadump(cr_task_t *cr_task, int i_am_leader)
      * section for simplicity.
      */
     CR_ASSERT_STEP_GT(cr_task, CR_CHKPT_STEP_PRESHARED);
+    t0 = cr_stats_now();
     cr_barrier_wait(&req->preshared_barrier);
+    cr_stats_phase(&req->stats, CR_STATS_PRESHARED, t0);
 
     if (!test_and_set_bit(0, &proc_req->done_mmaps_data)) {
         CR_KTRACE_HIGH_LVL("Writing mmap()ed pages (if any)...");
+        t0 = cr_stats_now();
         bytes = cr_save_mmaps_data(proc_req);
         if (bytes < 0) {
 	    result = (int)bytes;
 	    goto out_mutex;
         }
+        cr_stats_phase(&req->stats, CR_STATS_MMAPS_DATA, t0);
+        cr_stats_charge(proc_req, CR_STATS_BYTES_MMAPS);
     }
 
     if (!test_and_set_bit(0, &proc_req->done_files)) {
         /* dump the open files */
         CR_KTRACE_HIGH_LVL("Writing the open file section...");
+        t0 = cr_stats_now();
+        pos = filp->f_pos;
         result = cr_save_all_files(proc_req);
         if (result < 0) {
 	    goto out_mutex;
         }
+        cr_stats_phase(&req->stats, CR_STATS_FILES, t0);
+        cr_stats_charge(proc_req, CR_STATS_BYTES_FILES);
+        cr_toc_add(req, CR_TOC_FILES, pos, filp->f_pos - pos, 0, 0);
+
+        /* The files are the last of this process's section */
+        cr_toc_add(req, CR_TOC_PROC, proc_req->toc_pos, filp->f_pos - proc_req->toc_pos,
+                   current->tgid, proc_req->thread_count);
     }
 
     result = 0; // XXX
@@ -962,6 +1082,8 @@ int cr_dump_self(struct file *filp, unsigned long flags)
 	}
 
 	cr_task->chkpt_flags = flags;
+	cr_stats_arrive(&req->stats);
+	cr_stats_mark(cr_task, CR_CP_PRESHARED);
 
 	// Ensure shared state save can start as soon as all tasks reach kernel space
         CR_ASSERT_STEP_EQ(cr_task, CR_CHKPT_STEP_PRESHARED);
@@ -1000,15 +1122,19 @@ int cr_dump_self(struct file *filp, unsigned long flags)
 	}
 	read_unlock(&req->lock);
 	if (!test_and_set_bit(0, &req->done_header)) {
+	    loff_t pos = dest_filp->f_pos;
             result = cr_save_file_header(req, dest_filp);
             if (result < 0) {
 		req->result = result;
+            } else {
+		cr_toc_add(req, CR_TOC_FILE_HEADER, pos, dest_filp->f_pos - pos, 0, 0);
             }
 	    /* result is checked after phase barrier */
 	}
 	up(&req->serial_mutex);
 
 	// If we have a Phase1 then start Phase2 when complete.
+	cr_stats_mark(cr_task, CR_CP_PHASE);
 	cr_signal_phase_barrier(cr_task, /* block= */1, /* need_lock= */1);
 
 	/* Check to see if error/abort has occurred */
@@ -1019,6 +1145,7 @@ int cr_dump_self(struct file *filp, unsigned long flags)
 	read_unlock(&req->lock);
 
 	// Synchronize to ensure all tasks in the current process have stopped running.
+	cr_stats_mark(cr_task, CR_CP_PREDUMP);
 	once = cr_signal_predump_barrier(cr_task, /* block= */ 1);
 	if (once < 0) {
 		goto cleanup_unlocked;
@@ -1077,10 +1204,18 @@ int cr_dump_self(struct file *filp, unsigned long flags)
 	if (result < 0) { // Check postdump_barrier result
 	    req->result = result;
 	} else if (!test_and_set_bit(0, &req->done_trailer)) {
+	    loff_t pos = dest_filp->f_pos;
             CR_KTRACE_LOW_LVL("Writing the trailer.");
             result = cr_save_header(NULL, dest_filp);
+            if (result >= 0) {
+		cr_toc_add(req, CR_TOC_TRAILER, pos, dest_filp->f_pos - pos, 0, 0);
+		// Every task has passed every barrier by now
+		result = cr_toc_save(req, dest_filp);
+            }
             if (result < 0) {
 		req->result = result;
+            } else if (req->flags & CR_CHKPT_CRITPATH) {
+		cr_stats_critpath(req);
             }
         }
 	result = req->result;
@@ -0,0 +1,195 @@
+/*
+ * Berkeley Lab Checkpoint/Restart (BLCR) for Linux is Copyright (c)
+ * 2008, The Regents of the University of California, through Lawrence
+ * Berkeley National Laboratory (subject to receipt of any required
+ * approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Portions may be copyrighted by others, as may be noted in specific
+ * copyright notices within specific files.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Cache of files opened to restore file-backed mappings.
+ *
+ * Each shared library or executable has several VMAs, and every process
+ * in a restart maps the same handful of them.  So the first open of a
+ * given saved name (after relocation) and open flags is kept for the life
+ * of the restart request, and later opens just take another reference.
+ * Only successful opens are cached.
+ *
+ * A cached file carries the credentials of the task that opened it, and
+ * the tasks of one restart need not share credentials.  So the key also
+ * includes the opener's fsuid and fsgid, and every hit repeats the access
+ * check for the caller (which covers its supplementary groups) and is
+ * treated as a miss if that fails.
+ */
+
+#include "cr_module.h"
+
+#define CR_FILECACHE_SIZE	64
+
+struct cr_filecache_entry {
+	struct list_head	list;
+	struct file		*filp;
+	int			flags;
+	uid_t			fsuid;	// of the opener
+	gid_t			fsgid;	// of the opener
+	unsigned int		hash;
+	char			name[0];	// saved (not relocated) name
+};
+
+struct cr_filecache_s {
+	spinlock_t		lock;
+	struct list_head	table[CR_FILECACHE_SIZE];
+};
+
+static unsigned int hash_it(const char *name)
+{
+	unsigned int h = 0;
+
+	while (*name) {
+		h = (h * 31) + (unsigned char)*(name++);
+	}
+	return h;
+}
+
+// Returns NULL on failure, which just disables caching
+cr_filecache_t cr_alloc_filecache(void)
+{
+	cr_filecache_t cache = kmalloc(sizeof(*cache), GFP_KERNEL);
+
+	if (cache) {
+		int i;
+		spin_lock_init(&cache->lock);
+		for (i = 0; i < CR_FILECACHE_SIZE; ++i) {
+			INIT_LIST_HEAD(&cache->table[i]);
+		}
+	}
+
+	return cache;
+}
+
+void cr_release_filecache(cr_filecache_t cache)
+{
+	int i;
+
+	if (!cache) return;
+
+	for (i = 0; i < CR_FILECACHE_SIZE; ++i) {
+		struct cr_filecache_entry *entry, *next;
+		list_for_each_entry_safe(entry, next, &cache->table[i], list) {
+			fput(entry->filp);
+			kfree(entry);
+		}
+	}
+	kfree(cache);
+}
+
+static struct cr_filecache_entry *
+find_entry(cr_filecache_t cache, const char *name, unsigned int hash, int flags)
+{
+	cr_cred_t cred = cr_current_cred();
+	struct cr_filecache_entry *entry;
+
+	list_for_each_entry(entry, &cache->table[hash % CR_FILECACHE_SIZE], list) {
+		if ((entry->hash == hash) && (entry->flags == flags) &&
+		    (entry->fsuid == cr_from_kuid(cred->fsuid)) &&
+		    (entry->fsgid == cr_from_kgid(cred->fsgid)) &&
+		    !strcmp(entry->name, name)) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+// Access the caller needs to a file opened w/ the given flags
+static int flags_to_mask(int flags)
+{
+	switch (flags & O_ACCMODE) {
+	case O_WRONLY:	return MAY_WRITE;
+	case O_RDWR:	return MAY_READ | MAY_WRITE;
+	default:	return MAY_READ;
+	}
+}
+
+// Returns a new reference to a file previously opened w/ the given name and flags,
+// by a task w/ the same fsuid and fsgid, or NULL if there is none.
+// Also NULL if the caller could not have opened the file itself.
+struct file *cr_filecache_get(cr_filecache_t cache, const char *name, int flags)
+{
+	struct cr_filecache_entry *entry;
+	struct file *filp = NULL;
+
+	if (!cache) goto out;
+
+	spin_lock(&cache->lock);
+	entry = find_entry(cache, name, hash_it(name), flags);
+	if (entry) {
+		filp = entry->filp;
+		get_file(filp);
+	}
+	spin_unlock(&cache->lock);
+
+	// Repeat the access check of an open, which may sleep, outside the lock
+	if (filp && cr_permission(filp->f_dentry->d_inode, flags_to_mask(flags))) {
+		fput(filp);
+		filp = NULL;
+	}
+
+out:
+	return filp;
+}
+
+// Offer a newly opened file to the cache.
+// Returns the file the caller should use (and own one reference to), which
+// is a previously cached one (and filp put) if another task got there first.
+struct file *cr_filecache_add(cr_filecache_t cache, const char *name, int flags, struct file *filp)
+{
+	struct cr_filecache_entry *entry, *new_entry;
+	const unsigned int hash = hash_it(name);
+	const size_t len = strlen(name);
+
+	if (!cache) goto out;
+
+	new_entry = kmalloc(sizeof(*new_entry) + len + 1, GFP_KERNEL);
+	if (!new_entry) goto out;	// Not fatal, just not cached
+	new_entry->filp = filp;
+	new_entry->flags = flags;
+	new_entry->fsuid = cr_from_kuid(cr_current_cred()->fsuid);
+	new_entry->fsgid = cr_from_kgid(cr_current_cred()->fsgid);
+	new_entry->hash = hash;
+	memcpy(new_entry->name, name, len + 1);
+
+	spin_lock(&cache->lock);
+	entry = find_entry(cache, name, hash, flags);
+	if (!entry) {
+		get_file(filp);	// the cache's reference
+		list_add(&new_entry->list, &cache->table[hash % CR_FILECACHE_SIZE]);
+		new_entry = NULL;
+	} else {
+		get_file(entry->filp);
+	}
+	spin_unlock(&cache->lock);
+
+	if (new_entry) {
+		// Lost a race w/ another task opening the same file
+		kfree(new_entry);
+		fput(filp);
+		filp = entry->filp;
+	}
+
+out:
+	return filp;
+}
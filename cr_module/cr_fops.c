@@ -173,6 +173,14 @@ static int ctrl_ioctl(struct inode *inode, struct file *file,
 		result = cr_chkpt_info(file, (struct cr_chkpt_info __user *)arg);
 		break;
 
+	case CR_OP_HAND_TIMES:
+		result = cr_hand_times(file, (struct cr_hand_times __user *)arg);
+		break;
+
+	case CR_OP_HAND_EXCLUDE:
+		result = cr_hand_exclude(file, (struct cr_exclude_args __user *)arg);
+		break;
+
 	case CR_OP_HAND_DONE:
 		result = cr_hand_complete(file, arg);
 		break;
@@ -197,6 +205,10 @@ static int ctrl_ioctl(struct inode *inode, struct file *file,
 		result = cr_chkpt_log(file, (struct cr_log_args __user *)arg);
 		break;
 
+	case CR_OP_CHKPT_STATS:
+		result = cr_chkpt_stats(file, (struct cr_chkpt_stats __user *)arg);
+		break;
+
 	//
 	// Calls from cr_restart:
 	//
@@ -243,6 +255,10 @@ static int ctrl_ioctl(struct inode *inode, struct file *file,
 		break;
 	    }
 
+	case CR_OP_STRIPE:
+		result = cr_stripe_open((struct cr_stripe_args __user *)arg);
+		break;
+
 	default:
 		CR_KTRACE_BADPARM("unknown op %x", _IOC_NR(op));
 	}
@@ -484,17 +500,21 @@ int cr_init_ioctl32(void)
 	register_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_HAND_PHASE2), &ctrl_ioctl32);
 	register_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_HAND_SRC), &ctrl_ioctl32);
 	register_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_HAND_CHKPT_INFO), &ctrl_ioctl32);
+	register_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_HAND_TIMES), &ctrl_ioctl32);
+	register_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_HAND_EXCLUDE), &ctrl_ioctl32);
 	register_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_HAND_DONE), &ctrl_ioctl32);
 	register_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_CHKPT_REQ), &ctrl_ioctl32);
 	register_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_CHKPT_REAP), &ctrl_ioctl32);
 	register_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_CHKPT_FWD), &ctrl_ioctl32);
 	register_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_CHKPT_LOG), &ctrl_ioctl32);
+	register_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_CHKPT_STATS), &ctrl_ioctl32);
 	register_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_RSTRT_REQ), &ctrl_ioctl32);
 	register_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_RSTRT_REAP), &ctrl_ioctl32);
 	register_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_RSTRT_CHILD), &ctrl_ioctl32);
 	register_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_RSTRT_PROCS), &ctrl_ioctl32);
 	register_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_RSTRT_LOG), &ctrl_ioctl32);
 	register_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_VERSION), &ctrl_ioctl32);
+	register_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_STRIPE), &ctrl_ioctl32);
 	return 0;
 }
 
@@ -507,17 +527,21 @@ int cr_cleanup_ioctl32(void)
 	unregister_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_HAND_PHASE2));
 	unregister_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_HAND_SRC));
 	unregister_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_HAND_CHKPT_INFO));
+	unregister_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_HAND_TIMES));
+	unregister_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_HAND_EXCLUDE));
 	unregister_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_HAND_DONE));
 	unregister_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_CHKPT_REQ));
 	unregister_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_CHKPT_REAP));
 	unregister_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_CHKPT_FWD));
 	unregister_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_CHKPT_LOG));
+	unregister_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_CHKPT_STATS));
 	unregister_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_RSTRT_REQ));
 	unregister_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_RSTRT_REAP));
 	unregister_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_RSTRT_CHILD));
 	unregister_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_RSTRT_PROCS));
 	unregister_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_RSTRT_LOG));
 	unregister_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_VERSION));
+	unregister_ioctl32_conversion(CR_IOCTL32_MAP(CR_OP_STRIPE));
 	return 0;
 }
 #endif
@@ -33,6 +33,8 @@
 #include <asm/uaccess.h>
 #include <linux/dnotify.h>
 #include <linux/mman.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
 
 #if CRI_DEBUG
   /* Rates (as in 1-in-X) for artificial I/O faults */
@@ -94,6 +96,12 @@ cr_uwrite(cr_errbuf_t *eb, struct file *file, const void *buf, size_t count)
     ssize_t bytes_left = count;
     const char *p = buf;
 
+    if (cr_io_sink(file)) {
+	/* Dry run: count the bytes w/o touching (or faulting in) the data */
+	file->f_pos += count;
+	return count;
+    }
+
     while (bytes_left) {
        const ssize_t w = vfs_write(file, p, CR_TRIM_XFER(bytes_left), &file->f_pos);
        if (w <= 0) {
@@ -121,6 +129,62 @@ out:
     return retval; 
 }
 
+/* Like cr_uread(), but at an explicit offset and w/o touching file->f_pos.
+ * Used by threads reading disjoint ranges of one context file concurrently.
+ */
+ssize_t
+cr_uread_at(cr_errbuf_t *eb, struct file *file, void *buf, size_t count, loff_t pos)
+{
+    ssize_t retval;
+    ssize_t bytes_left = count;
+    char *p = buf;
+
+    while (bytes_left) {
+       const ssize_t r = vfs_read(file, p, CR_TRIM_XFER(bytes_left), &pos);
+       if (r <= 0) {
+	   CR_ERR_EB(eb, "vfs_read returned %ld", (long int)r);
+	   retval = r;
+	   if (!retval) retval = -EIO; /* Map zero -> EIO */
+	   goto out;
+       }
+       bytes_left -= r;
+       p += r;
+    }
+    retval = count;
+
+out:
+    return retval;
+}
+
+/* Like cr_uwrite(), but at an explicit offset and w/o touching file->f_pos.
+ * Used by threads writing disjoint ranges of one context file concurrently.
+ */
+ssize_t
+cr_uwrite_at(cr_errbuf_t *eb, struct file *file, const void *buf, size_t count, loff_t pos)
+{
+    ssize_t retval;
+    ssize_t bytes_left = count;
+    const char *p = buf;
+
+    if (cr_io_sink(file)) return count;
+
+    while (bytes_left) {
+       const ssize_t w = vfs_write(file, p, CR_TRIM_XFER(bytes_left), &pos);
+       if (w <= 0) {
+	   CR_ERR_EB(eb, "vfs_write returned %ld", (long int)w);
+	   retval = w;
+	   if (!retval) retval = -EIO; /* Map zero -> EIO */
+	   goto out;
+       }
+       bytes_left -= w;
+       p += w;
+    }
+    retval = count;
+
+out:
+    return retval;
+}
+
 ssize_t
 cr_kread(cr_errbuf_t *eb, struct file *file, void *buf, size_t count)
 {
@@ -632,6 +696,13 @@ cr_sendfile(cr_errbuf_t *eb, struct file *dst_filp, struct file *src_filp, loff_
     if (!count) return 0;
     if (!src_ppos) src_ppos = &src_filp->f_pos;
 
+    if (cr_io_sink(dst_filp)) {
+	/* Dry run: the source is not read at all */
+	*src_ppos += count;
+	dst_filp->f_pos += count;
+	return count;
+    }
+
 #ifdef HPAGE_SIZE
     /* The generic methods don't work on hugetlbfs files */
     if (is_file_hugepages(src_filp)) {
@@ -1316,3 +1387,207 @@ int cr_fstat(cr_objectmap_t map, struct file *filp)
 
     return retval;
 }
+
+/* Concurrent revalidation ahead of the cr_fstat() calls for the open
+ * files and mapped files of the current process.
+ *
+ * On a network fs each getattr is a synchronous round trip, so doing
+ * them one-by-one from the save loops puts N round trips in the freeze
+ * window.  Instead we queue them to a module-wide unbound workqueue, so
+ * the number of concurrent getattr()s stays bounded however many
+ * processes are checkpointed at once, while the caller works alongside.
+ * The work items run with the caller's credentials (override_creds()),
+ * so a getattr is never done with more privilege than cr_fstat() has.
+ * Each success is recorded in the request's object map under the same
+ * key cr_fstat() uses, so the later calls find nothing left to do.
+ * Inodes are deduplicated (by dentry) across the whole request.
+ * Failures are not reported here: cr_fstat() will simply retry them.
+ *
+ * Without alloc_workqueue() or struct cred this is a no-op, and cr_fstat()
+ * does all the work as before.
+ */
+#if HAVE_ALLOC_WORKQUEUE && HAVE_TASK_CRED
+  #define CR_PREFETCH		1
+#else
+  #define CR_PREFETCH		0
+#endif
+#define CR_PREFETCH_ACTIVE	16	/* max concurrent work items, module-wide */
+#define CR_PREFETCH_WORKS	8	/* max work items queued per process */
+#define CR_PREFETCH_MIN		16	/* fewer files are left to cr_fstat() */
+
+#if CR_PREFETCH
+static struct workqueue_struct *cr_prefetch_wq = NULL;
+
+struct cr_prefetch_s {
+    cr_objectmap_t	map;
+    const struct cred	*cred;	/* of the checkpointed task */
+    struct file		**filps;
+    int			count;
+    int			next;
+    spinlock_t		lock;
+    atomic_t		running;
+    struct completion	done;
+};
+
+struct cr_prefetch_work_s {
+    struct work_struct		work;
+    struct cr_prefetch_s	*p;
+};
+
+static void
+cr_prefetch_loop(struct cr_prefetch_s *p)
+{
+    for (;;) {
+	struct file *filp = NULL;
+	struct kstat stat;
+
+	spin_lock(&p->lock);
+	if (p->next < p->count) filp = p->filps[p->next++];
+	spin_unlock(&p->lock);
+	if (!filp) break;
+
+	if (!cr_vfs_getattr(filp, &stat)) {
+	    cr_insert_object(p->map, 1 + (char *)filp->f_dentry, (void *)1UL, GFP_KERNEL);
+	}
+    }
+
+    /* Once this is seen, the caller may free everything */
+    if (atomic_dec_and_test(&p->running)) {
+	complete(&p->done);
+    }
+}
+
+static void
+cr_prefetch_work(struct work_struct *work)
+{
+    struct cr_prefetch_work_s *w = container_of(work, struct cr_prefetch_work_s, work);
+    const struct cred *old_cred;
+
+    old_cred = override_creds(w->p->cred);
+    cr_prefetch_loop(w->p);
+    revert_creds(old_cred);
+}
+#endif /* CR_PREFETCH */
+
+// Returns void since failure just disables the prefetch
+void
+cr_io_init(void)
+{
+#if CR_PREFETCH
+    cr_prefetch_wq = alloc_workqueue("cr_fstat", WQ_UNBOUND, CR_PREFETCH_ACTIVE);
+#endif
+}
+
+void
+cr_io_cleanup(void)
+{
+#if CR_PREFETCH
+    if (cr_prefetch_wq) {
+	destroy_workqueue(cr_prefetch_wq);
+	cr_prefetch_wq = NULL;
+    }
+#endif
+}
+
+void
+cr_fstat_prefetch(cr_objectmap_t map)
+{
+#if CR_PREFETCH
+    struct files_struct *files = current->files;
+    struct mm_struct *mm = current->mm;
+    struct vm_area_struct *vma;
+    struct cr_prefetch_work_s *works;
+    struct cr_prefetch_s p;
+    cr_fdtable_t *fdt;
+    int max_fds, fd, max, n, i, j;
+
+    if (!cr_prefetch_wq) return;
+
+    /* Size the table.  All threads are frozen, so these can't grow. */
+    spin_lock(&files->file_lock);
+    fdt = cr_fdtable(files);
+    max_fds = fdt->max_fds;
+    max = bitmap_weight((unsigned long *)CR_OPEN_FDS_BITS(fdt), max_fds);
+    spin_unlock(&files->file_lock);
+    if (mm) max += mm->map_count;
+    if (max < CR_PREFETCH_MIN) return;
+
+    p.filps = vmalloc(max * sizeof(struct file *));
+    if (!p.filps) return; /* cr_fstat() will do the work */
+
+    /* Collect open files ... */
+    n = 0;
+    spin_lock(&files->file_lock);
+    fdt = cr_fdtable(files);
+    for (fd = cr_next_open_fd(0, max_fds, fdt);
+	 (fd < max_fds) && (n < max);
+	 fd = cr_next_open_fd(fd + 1, max_fds, fdt)) {
+	struct file *filp = fcheck(fd);
+	if (filp) {
+	    get_file(filp);
+	    p.filps[n++] = filp;
+	}
+    }
+    spin_unlock(&files->file_lock);
+
+    /* ... and mapped files */
+    if (mm) {
+	down_read(&mm->mmap_sem);
+	for (vma = mm->mmap; vma && (n < max); vma = vma->vm_next) {
+	    if (vma->vm_file) {
+		get_file(vma->vm_file);
+		p.filps[n++] = vma->vm_file;
+	    }
+	}
+	up_read(&mm->mmap_sem);
+    }
+
+    /* Keep one file per dentry needing revalidation */
+    for (i = j = 0; i < n; ++i) {
+	struct dentry *dentry = p.filps[i]->f_dentry;
+	if (dentry->d_inode->i_op->getattr &&
+	    !cr_find_object(map, 1 + (char *)dentry, NULL) &&
+	    !cr_insert_object(map, 2 + (char *)dentry, (void *)1UL, GFP_KERNEL)) {
+	    p.filps[j++] = p.filps[i];
+	} else {
+	    fput(p.filps[i]);
+	}
+    }
+    n = j;
+
+    works = NULL;
+    if (n >= CR_PREFETCH_MIN) {
+	/* One work item per CR_PREFETCH_MIN files, the caller being one */
+	const int nworks = min(n / CR_PREFETCH_MIN, CR_PREFETCH_WORKS) - 1;
+
+	p.map = map;
+	p.cred = get_current_cred();
+	p.count = n;
+	p.next = 0;
+	spin_lock_init(&p.lock);
+	init_completion(&p.done);
+	atomic_set(&p.running, 1); /* ourself */
+	if (nworks > 0) {
+	    works = kmalloc(nworks * sizeof(*works), GFP_KERNEL);
+	}
+	if (works) {
+	    for (i = 0; i < nworks; ++i) {
+		works[i].p = &p;
+		INIT_WORK(&works[i].work, cr_prefetch_work);
+		atomic_inc(&p.running);
+		queue_work(cr_prefetch_wq, &works[i].work);
+	    }
+	}
+	/* Work alongside them, then wait for the stragglers */
+	cr_prefetch_loop(&p);
+	wait_for_completion(&p.done);
+	put_cred(p.cred);
+    }
+
+    for (i = 0; i < n; ++i) {
+	fput(p.filps[i]);
+    }
+    vfree(p.filps);
+    kfree(works);
+#endif /* CR_PREFETCH */
+}
@@ -126,6 +126,14 @@
   #define CR_CLOSE_ON_EXEC_BITS(_fdt)	((_fdt)->close_on_exec)
 #endif
 
+/* Scan the bitmaps rather than every slot: find the first fd >= _fd that
+ * is open (or close-on-exec), returning _max if there is none.
+ */
+#define cr_next_open_fd(_fd,_max,_fdt) \
+	find_next_bit((unsigned long *)CR_OPEN_FDS_BITS(_fdt), (_max), (_fd))
+#define cr_next_close_on_exec(_fd,_max,_fdt) \
+	find_next_bit((unsigned long *)CR_CLOSE_ON_EXEC_BITS(_fdt), (_max), (_fd))
+
 #if HAVE_CLOSE_ON_EXEC
   #if HAVE___SET_CLOSE_ON_EXEC
     #define cr_set_close_on_exec(_fd,_fdt)	__set_close_on_exec(_fd,_fdt)
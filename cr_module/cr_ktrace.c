@@ -32,6 +32,9 @@
 #include <asm/uaccess.h>
 #include "cr_ktrace.h"
 
+#define CREATE_TRACE_POINTS
+#include "cr_trace.h"
+
 static char  cr_trace_buf[4096];
 static CR_DEFINE_SPINLOCK(cr_trace_lock);
 
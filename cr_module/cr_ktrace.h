@@ -63,6 +63,8 @@
        _CR_EB_OUT(KERN_ERR, eb, fmt, ## args)
 #define CR_WARN_EB(eb, fmt, args...) \
        _CR_EB_OUT(KERN_WARNING, eb, fmt, ## args)
+#define CR_INFO_EB(eb, fmt, args...) \
+       _CR_EB_OUT(KERN_INFO, eb, fmt, ## args)
 
 /* Error/warning to errbuf of given req */
 /* NOTE: macro works same for chkpt or rstrt req */
@@ -74,6 +76,8 @@
        CR_ERR_EB(_cr_req_eb(req), fmt, ## args)
 #define CR_WARN_REQ(req, fmt, args...)  \
        CR_WARN_EB(_cr_req_eb(req), fmt, ## args)
+#define CR_INFO_REQ(req, fmt, args...)  \
+       CR_INFO_EB(_cr_req_eb(req), fmt, ## args)
 
 /* Error/warning to errbuf of given proc_req */
 /* NOTE: macro works same for chkpt or rstrt proc_req */
@@ -143,7 +143,29 @@ out_nopage:
     return filp;
 }
 
+static void
+cr_mmaps_prot(const struct cr_mmaps_desc *desc, int *prot_p, unsigned long *flags_p)
+{
+    int prot = 0;
+    unsigned long flags;
+
+    flags = MAP_FIXED | ((desc->flags & VM_MAYSHARE) ? MAP_SHARED : MAP_PRIVATE);
+    if (desc->flags & VM_READ)  prot |= PROT_READ;
+    if (desc->flags & VM_WRITE) prot |= PROT_WRITE;
+    if (desc->flags & VM_EXEC)  prot |= PROT_EXEC;
+    if (desc->flags & VM_GROWSDOWN) flags |= MAP_GROWSDOWN;
+  #ifdef VM_EXECUTABLE
+    if (desc->flags & VM_EXECUTABLE) flags |= MAP_EXECUTABLE;
+  #endif
+
+    *prot_p = prot;
+    *flags_p = flags;
+}
+
 /* Read the data from the context file
+ *
+ * The files behind all the maps are found (or created and populated)
+ * first, and then all are mmap()ed under a single hold of mmap_sem.
  *
  * Returns 0 on success, or <0 on error
  */
@@ -155,32 +177,35 @@ cr_load_mmaps_data(cr_rstrt_proc_req_t *proc_req)
     const struct cr_mmaps_desc *desc = proc_req->mmaps_tbl;
     struct mm_struct *mm = current->mm;
     struct vmadump_vma_header mapheader;
-    int retval, i;
+    struct vmadump_prots prots = { 0, 0, NULL };
+    struct file **filp_tbl = NULL;	// one reference each, or NULL if already mapped
+    unsigned long map_addr = 0;
+    int retval, i, n = 0;
     loff_t r;
 
     retval = 0;
-    for (i=0; i<count; ++i, ++desc) {
+    if (count) {
+	filp_tbl = vmalloc(count * sizeof(*filp_tbl));
+	if (!filp_tbl) {
+	    CR_ERR_PROC_REQ(proc_req, "Failed to allocate mmaps file table");
+	    retval = -ENOMEM;
+	    goto err;
+	}
+    }
+
+    for (n=0; n<count; ++n, ++desc) {
         struct file *filp = NULL;
 	unsigned long flags;
 	unsigned long len = desc->end - desc->start;
-	unsigned long map_addr;
-	int found, prot = 0;
-	    
-	prot = 0;
-	flags = MAP_FIXED | ((desc->flags & VM_MAYSHARE) ? MAP_SHARED : MAP_PRIVATE);
-        if (desc->flags & VM_READ)  prot |= PROT_READ;
-        if (desc->flags & VM_WRITE) prot |= PROT_WRITE;
-        if (desc->flags & VM_EXEC)  prot |= PROT_EXEC;
-        if (desc->flags & VM_GROWSDOWN) flags |= MAP_GROWSDOWN;
-      #ifdef VM_EXECUTABLE
-        if (desc->flags & VM_EXECUTABLE) flags |= MAP_EXECUTABLE;
-      #endif
+	int found, prot;
+
+	cr_mmaps_prot(desc, &prot, &flags);
 
 	/* "mmaps_id" was checkpoint-time inode, but we map to the first-restored filp */
         found = cr_find_object(proc_req->req->map, desc->mmaps_id, (void **)&filp);
 
 	if (found) {
-	    /* Nothing to prepare */
+	    get_file(filp);
 	} else if (desc->type != CR_SHANON_SHMEM) {
 	    /* create before mmap() */
 	    filp = cr_regenerate(proc_req, desc, desc->i_size);
@@ -189,13 +214,13 @@ cr_load_mmaps_data(cr_rstrt_proc_req_t *proc_req)
 		CR_ERR_PROC_REQ(proc_req, "cr_regenerate returned %d", retval);
 		goto err;
 	    }
+            (void)cr_insert_object(proc_req->req->map, desc->mmaps_id, (void *)filp, GFP_KERNEL);
 	} else {
-	    const int mmap_prot = PROT_READ|PROT_WRITE|PROT_EXEC;
             struct vm_area_struct *map;
 
 	    /* mmap() at offset 0, even if it needs to move later */
 	    down_write(&mm->mmap_sem);
-	    map_addr = cr_mmap_pgoff(NULL, desc->start, len, mmap_prot, flags, 0);
+	    map_addr = cr_mmap_pgoff(NULL, desc->start, len, prot|PROT_WRITE, flags, 0);
             map = find_vma(mm, desc->start);
 	    filp = (map && (map->vm_start == desc->start)) ? map->vm_file : NULL;
 	    up_write(&mm->mmap_sem);
@@ -210,30 +235,42 @@ cr_load_mmaps_data(cr_rstrt_proc_req_t *proc_req)
 		retval = (r < 0) ? r : -EIO;
 		goto err;
 	    }
+            (void)cr_insert_object(proc_req->req->map, desc->mmaps_id, (void *)filp, GFP_KERNEL);
 
-	    /* Fall through to 2nd mmap to ensure correct offset and protection */
-	    get_file(filp); /* So (re)mmap doesn't drop it */
+	    if (desc->pgoff) {
+		/* Needs a 2nd mmap to get the correct offset */
+		get_file(filp); /* So (re)mmap doesn't drop it */
+	    } else {
+		/* Already in place */
+		filp = NULL;
+	    }
 	}
+	filp_tbl[n] = filp;
+    }
 
-        down_write(&mm->mmap_sem);
-	map_addr = cr_mmap_pgoff(filp, desc->start, len, prot|PROT_WRITE, flags, desc->pgoff);
-	up_write(&mm->mmap_sem);
+    /* Now map all the files */
+    down_write(&mm->mmap_sem);
+    for (i=0, desc=proc_req->mmaps_tbl; i<count; ++i, ++desc) {
+	unsigned long flags;
+	int prot;
 
-        if (!found) {
-            (void)cr_insert_object(proc_req->req->map, desc->mmaps_id, (void *)filp, GFP_KERNEL);
-	    fput(filp);
-	}
+	if (!filp_tbl[i]) continue;
+	cr_mmaps_prot(desc, &prot, &flags);
+	map_addr = cr_mmap_pgoff(filp_tbl[i], desc->start, desc->end - desc->start,
+				 prot|PROT_WRITE, flags, desc->pgoff);
+	if (map_addr != desc->start) break;
+    }
+    up_write(&mm->mmap_sem);
 
-	if (!filp || (map_addr != desc->start)) {
+    if (i < count) {
 fail:
-	    CR_ERR_PROC_REQ(proc_req, "Failed to locate newborn mmap()ed space");
-            if ((map_addr != desc->start) && IS_ERR((void *) map_addr)) {
-                retval = map_addr;
-            } else {
-               retval = -EINVAL;
-            }
-	    goto err;
-	}
+	CR_ERR_PROC_REQ(proc_req, "Failed to locate newborn mmap()ed space");
+        if ((map_addr != desc->start) && IS_ERR((void *) map_addr)) {
+            retval = map_addr;
+        } else {
+            retval = -EINVAL;
+        }
+	goto err;
     }
 
     /* Load dirty pages of maps if any */
@@ -248,15 +285,18 @@ fail:
     		CR_ERR_PROC_REQ(proc_req, "Error in vmadump_load_page_list");
     		goto err;
     	}
-    	if (sys_mprotect(mapheader.start,mapheader.end - mapheader.start, dirty_pages_prot)) {
-		CR_WARN_PROC_REQ(proc_req, "mprotect failed. (ignoring)");
-	}
+	vmadump_prot_add(proc_req, &prots, mapheader.start, mapheader.end, dirty_pages_prot);
 	r = cr_kread(eb, proc_req->file, &mapheader, sizeof(mapheader));
     }
     if (r != sizeof(mapheader)) {
 	CR_ERR_PROC_REQ(proc_req, "mmaps_data: read header returned %d", (int)r);
     }
 err:
+    vmadump_prot_apply(proc_req, &prots);
+    for (i=0; i<n; ++i) {
+	if (filp_tbl[i]) fput(filp_tbl[i]);
+    }
+    vfree(filp_tbl);
     return retval;
 }
 
@@ -404,6 +444,7 @@ cr_save_mmaps_data(cr_chkpt_proc_req_t *proc_req)
 	struct inode *inode = filp->f_dentry->d_inode;
 	loff_t size = desc->i_size;
 	loff_t src_pos = 0;
+	loff_t pos = proc_req->file->f_pos;
 
 	/* NOTE: we currently rely on the restore order matching the save order */
         if (cr_insert_object(proc_req->req->map, inode, (void *)1UL, GFP_KERNEL)) {
@@ -427,11 +468,15 @@ cr_save_mmaps_data(cr_chkpt_proc_req_t *proc_req)
 	    goto err;
 	}
         retval += w;
+	cr_toc_add(proc_req->req, CR_TOC_MMAPS_DATA, pos, proc_req->file->f_pos - pos,
+		   desc->start, desc->end);
     }
 
     /* Save any dirty pages now */
     desc = proc_req->mmaps_tbl;
     for (i = 0; i < count; ++i, ++desc) {
+	loff_t pos = proc_req->file->f_pos;
+
 	if ((desc->type != CR_PSE) && (desc->type != CR_SHANON_HUGETLB)) continue;
 	if (desc->flags & VM_SHARED) continue; /* any dirty pages were saved w/ file */
 
@@ -453,6 +498,8 @@ cr_save_mmaps_data(cr_chkpt_proc_req_t *proc_req)
 	}
 	if (w < 0) goto err;
 	retval += w;
+	cr_toc_add(proc_req->req, CR_TOC_VMA, pos, proc_req->file->f_pos - pos,
+		   desc->start, desc->end);
     }
     /* Terminate maps list */
     head.start = head.end = ~0L;
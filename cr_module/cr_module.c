@@ -130,6 +130,8 @@ static int __init cr_init_module(void)
 		goto bad_object_init;
 	}
 
+	cr_io_init();
+
 	err = -ENOMEM;
 	cr_pdata_cachep = CR_KMEM_CACHE(cr_pdata_s);
 	if (!cr_pdata_cachep) goto no_pdata_cachep;
@@ -157,6 +159,7 @@ no_chkpt_req_cachep:
 no_task_cachep:
 	kmem_cache_destroy(cr_pdata_cachep);
 no_pdata_cachep:
+	cr_io_cleanup();
 	cr_object_cleanup();
 bad_object_init:
 	cr_rstrt_cleanup();
@@ -184,6 +187,7 @@ static void __exit cr_cleanup_module(void)
 #endif
 	cr_proc_cleanup();
 	cr_wd_flush();
+	cr_io_cleanup();
 	cr_object_cleanup();
 	cr_rstrt_cleanup();
 	kmem_cache_destroy(cr_rstrt_proc_req_cachep);
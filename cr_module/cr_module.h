@@ -69,6 +69,7 @@
 #include "cr_arch.h"		// Architecture-specific bits
 #include "cr_barrier.h"		// Code for kernel barriers.
 #include "cr_ktrace.h"		// Code for trace messages
+#include "cr_trace.h"		// Tracepoints for ftrace/perf
 
 // forward decls/typedefs for use w/i vmadump
 struct cr_chkpt_preq_s;
@@ -88,7 +89,7 @@ typedef struct cr_rstrt_preq_s cr_rstrt_proc_req_t;
 // context files not readable by the previous release.
 // Must correct CR_CONTEXT_VERSION_MIN in any public release that cannot
 // read context files produced by older versions.
-#define CR_CONTEXT_VERSION 9
+#define CR_CONTEXT_VERSION 10
 #define CR_CONTEXT_VERSION_MIN 8
 
 // cr_objectmap_t is an opaque type
@@ -99,6 +100,10 @@ typedef struct cr_objectmap_s *cr_objectmap_t;
 struct cr_rstrt_relocate_s;
 typedef struct cr_rstrt_relocate_s *cr_rstrt_relocate_t;
 
+// cr_filecache_t is an opaque type
+struct cr_filecache_s;
+typedef struct cr_filecache_s *cr_filecache_t;
+
 // Foward type decls:
 struct cr_mmaps_desc;
 
@@ -131,6 +136,39 @@ extern cr_kmem_cache_ptr cr_chkpt_proc_req_cachep;
 extern cr_kmem_cache_ptr cr_rstrt_req_cachep;
 extern cr_kmem_cache_ptr cr_rstrt_proc_req_cachep;
 
+// Threads of one process lending a hand to the vmadump leader (cr_vmadump.c)
+typedef struct cr_helper_s {
+	spinlock_t		lock;
+	long			(*fn)(void *);
+	void			*arg;
+	unsigned int		seq;		// bumped each time a job is posted
+	int			busy;		// threads (incl. the poster) still in fn()
+	int			parked;		// threads waiting for jobs
+	long			error;		// first error returned by fn()
+} cr_helper_t;
+
+// Points at which each task's arrival is timestamped (cr_stats.c)
+enum {
+	CR_CP_PRESHARED = 0,	// entry to cr_dump_self()
+	CR_CP_PHASE,
+	CR_CP_PREDUMP,
+	CR_CP_VMADUMP,
+	CR_CP_NPOINTS
+};
+
+// Phase times and counters of one checkpoint request (cr_stats.c)
+typedef struct cr_stats_s {
+	spinlock_t		lock;
+	u64			start;		// times from cr_stats_now()
+	u64			first;		// first/last arrival in cr_dump_self()
+	u64			last;
+	u64			end;		// last task completion
+	struct cr_chkpt_stats	s;
+} cr_stats_t;
+
+// Table of contents of a context file (cr_toc.c)
+typedef struct cr_toc_s cr_toc_t;
+
 // Kernel-side tracking of a checkpoint request
 struct cr_chkpt_preq_s { // grumble... need short name for KMEM_CACHE()
 	struct list_head	list;
@@ -154,6 +192,7 @@ struct cr_chkpt_preq_s { // grumble... need short name for KMEM_CACHE()
 	cr_bool_t               done_header;
 	cr_bool_t               done_linkage;
 	cr_bool_t               done_fs;
+	cr_bool_t               done_prefetch;
 	cr_bool_t               done_mmaps_maps;
 	cr_bool_t               done_itimers;
 	cr_bool_t               done_files;
@@ -167,6 +206,7 @@ struct cr_chkpt_preq_s { // grumble... need short name for KMEM_CACHE()
 	/* For vmadump thread management */
 	wait_queue_head_t	wait;
 	cr_bool_t               done_leader;
+	cr_helper_t		helper;
 
 	/* For special mmap()s tracking */
 	int                     mmaps_cnt;
@@ -178,6 +218,16 @@ struct cr_chkpt_preq_s { // grumble... need short name for KMEM_CACHE()
 
 	cr_bool_t		duplicate_flag;
 
+	/* File position at the last charge to req->stats (protected by serial_mutex) */
+	loff_t			stats_pos;
+
+	/* Memory to leave out, from CR_OP_HAND_EXCLUDE (set once, under req->lock) */
+	struct cr_exclude_range	*exclude;
+	unsigned int		exclude_count;
+
+	/* File position of our section header, for the table of contents */
+	loff_t			toc_pos;
+
 	/* For fd to pass to the signal handler */
 	int			ctrl_fd;	// >= 0 if any of our threads are "registered"...
 	int			tmp_fd;		// ...else open() at trigger, close() in OP_HAND_CHKPT
@@ -209,6 +259,8 @@ typedef struct cr_chkpt_req_s {
 	cr_barrier_t		postdump_barrier; // at end of dump
 	struct file		*ctrl_file;
 	cr_errbuf_t		*errbuf;
+	cr_stats_t		stats;
+	cr_toc_t		*toc;		// NULL unless CR_CHKPT_TOC
 } cr_chkpt_req_t;
 
 #define CR_CHKPT_RESTARTED ((cr_chkpt_req_t *)1UL)
@@ -248,6 +300,7 @@ struct cr_rstrt_preq_s { // grumble... need short name for KMEM_CACHE()
 	wait_queue_head_t	wait;
 	cr_bool_t               done_leader;
 	int			thaw_error;
+	cr_helper_t		helper;
 
 	/* To ensure req->signal (if non-zero) is delivered correctly */
 	cr_barrier_t		pre_complete_barrier;
@@ -287,6 +340,7 @@ typedef struct cr_rstrt_req_s {
 	int			signal;
 	cr_work_t		work;
 	cr_rstrt_relocate_t	relocate;	// For path relocations
+	cr_filecache_t		filecache;	// Files opened for mmap (may be NULL)
 	cr_errbuf_t		*errbuf;
 } cr_rstrt_req_t;
 
@@ -315,6 +369,10 @@ typedef struct cr_task_s {
 	int			step;		// Step in progress, for recovery if task dies
 	u32			self_exec_id;   // For detection of ill-timed exec()
 	unsigned long		chkpt_flags;	// flags supplied at checkpoint time
+
+	/* For the critical-path report (cr_stats.c), reset in add_task() */
+	u64			cp_time[CR_CP_NPOINTS];	// arrival times
+	struct cr_hand_times	cp_hand;	// from libcr
 } cr_task_t;
 
 // Private data attached to an instance of the file
@@ -365,6 +423,33 @@ enum {
 extern int cr_proc_init(void);
 extern void cr_proc_cleanup(void);
 
+// cr_stats.c
+extern u64 cr_stats_now(void);
+extern void cr_stats_init(cr_stats_t *stats);
+extern void cr_stats_arrive(cr_stats_t *stats);
+extern void cr_stats_phase(cr_stats_t *stats, int phase, u64 since);
+extern void cr_stats_add(cr_stats_t *stats, int counter, u64 val);
+extern void cr_stats_pages(cr_stats_t *stats, unsigned long chunks,
+			   unsigned long pages, unsigned long skipped);
+extern void cr_stats_end(cr_stats_t *stats);
+extern void cr_stats_commit(cr_stats_t *stats);
+extern int cr_stats_copy(cr_stats_t *stats, struct cr_chkpt_stats __user *arg);
+extern void cr_stats_mark(cr_task_t *cr_task, int point);
+extern int cr_hand_times(struct file *filp, struct cr_hand_times __user *arg);
+extern void cr_stats_critpath(cr_chkpt_req_t *req);
+extern struct file_operations cr_stats_fops;
+
+// cr_stripe.c
+extern int cr_stripe_open(struct cr_stripe_args __user *arg);
+extern int cr_is_stripe_file(struct file *filp);
+
+// cr_toc.c
+extern int cr_toc_init(cr_chkpt_req_t *req);
+extern void cr_toc_free(cr_chkpt_req_t *req);
+extern void cr_toc_add(cr_chkpt_req_t *req, unsigned int type, loff_t offset, loff_t length,
+		       unsigned long long addr, unsigned long long extra);
+extern int cr_toc_save(cr_chkpt_req_t *req, struct file *filp);
+
 // cr_fops.c
 extern struct file_operations cr_ctrl_fops;
 extern int cr_hand_complete(struct file *filp, unsigned int flags);
@@ -382,6 +467,7 @@ extern int cr_chkpt_req(struct file *filp, struct cr_chkpt_args __user *arg);
 extern unsigned int cr_chkpt_poll(struct file *filp, poll_table *wait);
 extern int cr_chkpt_reap(struct file *filp);
 extern int cr_chkpt_log(struct file *filp, struct cr_log_args __user *arg);
+extern int cr_chkpt_stats(struct file *filp, struct cr_chkpt_stats __user *arg);
 extern int cr_chkpt_task_complete(cr_task_t *cr_task, int block);
 extern int cr_chkpt_fwd(struct file *filp, struct cr_fwd_args __user *arg);
 extern void cr_chkpt_req_release(struct file *filp, cr_pdata_t *priv);
@@ -390,6 +476,7 @@ extern void cr_signal_phase_barrier(cr_task_t *cr_task, int block, int need_lock
 extern void cr_chkpt_advance_to(cr_task_t *cr_task, int step, int hold_lock);
 extern int cr_chkpt_abort(cr_task_t *cr_task, unsigned int flags);
 extern int cr_chkpt_info(struct file *filp, struct cr_chkpt_info __user *arg);
+extern int cr_hand_exclude(struct file *filp, struct cr_exclude_args __user *arg);
 
 // cr_async.c
 extern int cr_suspend(struct file *filp, struct timeval __user *arg);
@@ -427,6 +514,7 @@ extern int cr_loc_init(cr_errbuf_t *eb, cr_location_t *loc, int fd, struct file
 extern void cr_loc_free(cr_location_t *loc);
 extern struct file *cr_loc_get(cr_location_t *loc, int *shared);
 extern void cr_loc_put(cr_location_t *loc, struct file *filp);
+extern int cr_loc_init_sink(cr_location_t *loc, struct file *from);
 
 // cr_trigger.c
 extern int __cr_trigger_phase1(cr_chkpt_proc_req_t *proc_req);
@@ -435,9 +523,19 @@ extern int cr_trigger_phase1(cr_chkpt_req_t *req);
 extern int __cr_trigger_phase2(cr_chkpt_proc_req_t *proc_req);
 extern int cr_trigger_phase2(cr_chkpt_req_t *req, cr_chkpt_proc_req_t *proc_req);
 
+// cr_vmadump.c
+extern long cr_helper_run(cr_helper_t *h, wait_queue_head_t *wait,
+			  long (*fn)(void *), void *arg);
+#define cr_helpers(_proc_req) ((_proc_req)->helper.parked)
+
 // cr_io.c
+// A dry run (CR_CHKPT_DRYRUN) writes to a reopened ctrl file, which has no
+// write method of its own.  The cr_io.c writers just advance its f_pos.
+#define cr_io_sink(_filp) ((_filp)->f_op == &cr_ctrl_fops)
 extern ssize_t cr_uread(cr_errbuf_t *eb, struct file * file, void *buf, size_t count);
 extern ssize_t cr_uwrite(cr_errbuf_t *eb, struct file * file, const void *buf, size_t count);
+extern ssize_t cr_uread_at(cr_errbuf_t *eb, struct file * file, void *buf, size_t count, loff_t pos);
+extern ssize_t cr_uwrite_at(cr_errbuf_t *eb, struct file * file, const void *buf, size_t count, loff_t pos);
 extern ssize_t cr_kread(cr_errbuf_t *eb, struct file * file, void *buf, size_t count);
 extern ssize_t cr_kwrite(cr_errbuf_t *eb, struct file * file, const void *buf, size_t count);
 extern int cr_skip(struct file *filp, loff_t len);
@@ -461,6 +559,9 @@ extern struct file *cr_filp_reopen(struct file *orig_filp, int new_flags);
 extern int cr_fd_claim(int fd);
 extern int cr_dup_other(struct files_struct *files, struct file *filp);
 extern int cr_fstat(cr_objectmap_t, struct file *filp);
+extern void cr_fstat_prefetch(cr_objectmap_t map);
+extern void cr_io_init(void);
+extern void cr_io_cleanup(void);
 
 // cr_objects.c
 extern int cr_object_init(void);
@@ -487,6 +588,12 @@ extern const char *cr_relocate_path(cr_rstrt_relocate_t reloc, const char *path,
 extern void cr_free_reloc(cr_rstrt_relocate_t reloc);
 extern int cr_read_reloc(cr_rstrt_req_t *req, /*struct cr_rstrt_relocate*/ void __user *arg);
 
+// cr_filecache.c
+extern cr_filecache_t cr_alloc_filecache(void);
+extern void cr_release_filecache(cr_filecache_t cache);
+extern struct file *cr_filecache_get(cr_filecache_t cache, const char *name, int flags);
+extern struct file *cr_filecache_add(cr_filecache_t cache, const char *name, int flags, struct file *filp);
+
 // cr_creds.c
 extern int cr_load_creds(cr_rstrt_proc_req_t *proc_req);
 extern int cr_save_creds(cr_chkpt_proc_req_t *proc_req);
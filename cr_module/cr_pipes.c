@@ -720,9 +720,10 @@ cr_fifo_is_internal(cr_chkpt_req_t *req, struct inode *inode) {
 	rcu_read_lock();
 	fdt = cr_fdtable(task->files);
 	max_fds = fdt->max_fds;	/* Never shrinks, right? */
-        rcu_read_unlock();
 
-	for (fd = 0; !retval && (fd < max_fds); ++fd) {
+	for (fd = cr_next_open_fd(0, max_fds, fdt);
+	     !retval && (fd < max_fds);
+	     fd = cr_next_open_fd(fd + 1, max_fds, fdt)) {
 	    struct file *filp = fcheck_files(task->files, fd);
 	    if (!filp) continue;
 	    get_file(filp);
@@ -733,6 +734,7 @@ cr_fifo_is_internal(cr_chkpt_req_t *req, struct inode *inode) {
 	    fput(filp);
 	    retval = (have_reader && have_writer);
 	}
+        rcu_read_unlock();
 
 	spin_unlock(&task->files->file_lock);
 	if (retval) break;
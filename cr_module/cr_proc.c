@@ -41,12 +41,14 @@
  */
 static struct proc_dir_entry *proc_checkpoint;
 static struct proc_dir_entry *proc_ctrl;
+static struct proc_dir_entry *proc_stats;
 
 /**
  * cr_proc_init - Initialization code
  *
  * DESCRIPTION:
- * This function registers /proc/checkpoint and /proc/checkpoint/ctrl
+ * This function registers /proc/checkpoint, /proc/checkpoint/ctrl
+ * and /proc/checkpoint/stats
  */
 int __init cr_proc_init(void)
 {
@@ -77,6 +79,21 @@ int __init cr_proc_init(void)
 		return -ENOMEM;
 	}
 
+#if HAVE_PROC_CREATE
+	proc_stats = proc_create("stats", S_IFREG | S_IRUGO,
+				 proc_checkpoint, &cr_stats_fops);
+#else
+	proc_stats = create_proc_entry("stats", S_IFREG | S_IRUGO,
+				       proc_checkpoint);
+	if (proc_stats) {
+		proc_stats->proc_fops = &cr_stats_fops;
+	}
+#endif
+	if (proc_stats == NULL) {
+		CR_ERR("proc_create_entry(/proc/checkpoint/stats) failed");
+		return -ENOMEM;
+	}
+
 	return 0;
 }
 
@@ -84,16 +101,19 @@ int __init cr_proc_init(void)
  * cr_proc_cleanup - Initialization code
  *
  * DESCRIPTION:
- * This function removes /proc/checkpoint and /proc/checkpoint/ctrl
+ * This function removes /proc/checkpoint, /proc/checkpoint/ctrl
+ * and /proc/checkpoint/stats
  */
 void cr_proc_cleanup(void)
 {
 	CR_KTRACE_FUNC_ENTRY();
 
 #if HAVE_PROC_REMOVE
+	proc_remove(proc_stats);
 	proc_remove(proc_ctrl);
 	proc_remove(proc_checkpoint);
 #else
+	remove_proc_entry("stats", proc_checkpoint);
 	remove_proc_entry("ctrl", proc_checkpoint);
 	remove_proc_entry("checkpoint", cr_proc_root);
 #endif
@@ -103,6 +103,7 @@ alloc_rstrt_req(void)
 	INIT_LIST_HEAD(&req->linkage);
 	CR_INIT_WORK(&req->work, &rstrt_watchdog);
 	req->errbuf = cr_errbuf_alloc();
+	req->filecache = cr_alloc_filecache();	// NULL just disables caching
 	{
 	    struct files_struct *files = current->files;
 	    cr_fdtable_t *fdt;
@@ -176,6 +177,7 @@ release_rstrt_req(cr_rstrt_req_t *req)
 	put_task_struct(req->cr_restart_task);
 	cr_release_objectmap(req->map);
 	cr_free_reloc(req->relocate);
+	cr_release_filecache(req->filecache);
 	cr_errbuf_free(req->errbuf);
         kmem_cache_free(cr_rstrt_req_cachep, req);
         CR_MODULE_PUT();
@@ -700,6 +702,7 @@ int do_rstrt_request_restart(struct file *filp, struct cr_rstrt_args *ureq,
     }
 
     req->scope = cf_header.scope;  // Currently unused
+    trace_blcr_rstrt_req(req->scope, req->flags);
     
 
     // add watchdog, which gets its own reference
@@ -810,8 +813,11 @@ int do_rstrt_procs(struct file *filp, struct cr_section_header *cf_header)
     threads = cf_header->num_threads;
 
     if (threads == 0  /* EOF */) {
+	u64 t0 = cr_trace_start(blcr_linkage);
+
 	// XXX: additional serialization will be needed when restores are parallel
         retval = cr_restore_linkage(req);
+        trace_blcr_linkage(retval, cr_trace_since(t0));
         if (retval) {
 	    req->die = 1;
 	    goto out;
@@ -849,6 +855,7 @@ int do_rstrt_procs(struct file *filp, struct cr_section_header *cf_header)
 
         init_MUTEX(&proc_req->serial_mutex);
 	init_waitqueue_head(&proc_req->wait);
+	spin_lock_init(&proc_req->helper.lock);
 	INIT_LIST_HEAD(&proc_req->tasks);
 	INIT_LIST_HEAD(&proc_req->linkage);
 
@@ -1826,7 +1833,9 @@ cr_finish_all_file_restores(cr_rstrt_proc_req_t *proc_req, int max_fds)
 
     spin_lock(&current->files->file_lock);
     CR_KTRACE_LOW_LVL("current->files=%p", current->files);
-    for(fd=0; fd<max_fds; ++fd) {
+    for (fd = cr_next_open_fd(0, max_fds, cr_fdtable(current->files));
+         fd < max_fds;
+         fd = cr_next_open_fd(fd + 1, max_fds, cr_fdtable(current->files))) {
       struct file *filp;
       filp = fcheck(fd);
       if (filp) {
@@ -1856,18 +1865,20 @@ cr_restore_all_files(cr_rstrt_proc_req_t *proc_req)
     struct files_struct *files = current->files;
     struct file *filp;
     cr_fdtable_t *fdt;
+    loff_t pos;
+    u64 t0;
 
     /* close-on-exec() of caller's fds before we start restoring */
     CR_KTRACE_HIGH_LVL("close-on-exec of callers files");
     spin_lock(&files->file_lock);
     fdt = cr_fdtable(files);
-    for (i = 0; i < fdt->max_fds; ++i) {
-	if (cr_read_close_on_exec(i, fdt)) {
-	    spin_unlock(&files->file_lock);
-	    sys_close(i);
-	    spin_lock(&files->file_lock);
-	    fdt = cr_fdtable(files);
-        }
+    for (i = cr_next_close_on_exec(0, fdt->max_fds, fdt);
+	 i < fdt->max_fds;
+	 i = cr_next_close_on_exec(i + 1, fdt->max_fds, fdt)) {
+	spin_unlock(&files->file_lock);
+	sys_close(i);
+	spin_lock(&files->file_lock);
+	fdt = cr_fdtable(files);
     }
     spin_unlock(&files->file_lock);
 
@@ -1905,6 +1916,8 @@ cr_restore_all_files(cr_rstrt_proc_req_t *proc_req)
 
         CR_KTRACE_LOW_LVL("   fd=%d dnr=%d", file_info.fd, do_not_restore_flag);
 
+        pos = proc_req->file->f_pos;
+        t0 = cr_trace_start(blcr_file);
         switch(file_info.cr_file_type) {
         case cr_open_chkpt_req:
             retval = cr_restore_open_chkpt_req(proc_req, &file_info, do_not_restore_flag);
@@ -1941,6 +1954,8 @@ cr_restore_all_files(cr_rstrt_proc_req_t *proc_req)
             goto out;
             break;
         }
+        trace_blcr_file(0, file_info.fd, file_info.cr_file_type,
+                        proc_req->file->f_pos - pos, retval, cr_trace_since(t0));
 
         if (retval < 0) {
             CR_ERR_PROC_REQ(proc_req, "%s [%d]:  Unable to restore fd %d (type=%d,err=%d)",
@@ -1948,7 +1963,7 @@ cr_restore_all_files(cr_rstrt_proc_req_t *proc_req)
             goto out;
         }
 
-	/* Restore close-on-exec flag */
+	/* Restore close-on-exec flag and look up the new filp, in one go */
         spin_lock(&files->file_lock);
 	fdt = cr_fdtable(files);
         if (file_info.cloexec) {
@@ -1956,14 +1971,12 @@ cr_restore_all_files(cr_rstrt_proc_req_t *proc_req)
         } else {
 	    cr_clear_close_on_exec(file_info.fd, fdt);
 	}
+	filp = fcheck(file_info.fd);
 	spin_unlock(&files->file_lock);
 
         /* now acquire locks (unimplemented) */
         cr_restore_file_locks(proc_req, &file_info);
 
-	spin_lock(&files->file_lock);
-	filp = fcheck(file_info.fd);
-	spin_unlock(&files->file_lock);
         cr_insert_object(proc_req->req->map, file_info.orig_filp, filp, GFP_KERNEL);
     };
 
@@ -2081,7 +2094,9 @@ cr_hide_filp(struct file *filp, struct files_struct *files)
 
     spin_lock(&files->file_lock);
     fdt = cr_fdtable(files);
-    for (fd = 0; fd < fdt->max_fds; ++fd) {
+    for (fd = cr_next_open_fd(0, fdt->max_fds, fdt);
+	 fd < fdt->max_fds;
+	 fd = cr_next_open_fd(fd + 1, fdt->max_fds, fdt)) {
 	if (filp == fdt->fd[fd]) {
 	    ++found;
             rcu_assign_pointer(fdt->fd[fd], NULL);
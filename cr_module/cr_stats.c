@@ -0,0 +1,362 @@
+/*
+ * Berkeley Lab Checkpoint/Restart (BLCR) for Linux is Copyright (c)
+ * 2008, The Regents of the University of California, through Lawrence
+ * Berkeley National Laboratory (subject to receipt of any required
+ * approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Portions may be copyrighted by others, as may be noted in specific
+ * copyright notices within specific files.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Phase times and counters for checkpoint requests.
+ *
+ * Each request accumulates into its own cr_stats_t, taking a spinlock
+ * at most once per phase per thread (or per memory region), so this is
+ * always on.  When a request that checkpointed something is freed, its
+ * totals are folded into the module-wide figures under one more lock.
+ * The requester may fetch its own figures w/ CR_OP_CHKPT_STATS before
+ * the REAP, and everybody may read the cumulative ones (w/ a log2
+ * histogram per phase) from /proc/checkpoint/stats.
+ *
+ * Each task also timestamps its arrival at the synchronization points
+ * of cr_dump_self(), and libcr reports when its callbacks ran.  With
+ * CR_CHKPT_CRITPATH these are summarized in the request's log, to show
+ * which task (and callback) everybody else was waiting for.
+ */
+
+#include "cr_module.h"
+
+#include <linux/ktime.h>
+#include <linux/seq_file.h>
+#include <asm/uaccess.h>
+#include <asm/div64.h>
+
+// Histogram bucket k counts times in [2^(k-1), 2^k) microseconds
+// (taking 1us == 1024ns), with the last bucket open-ended.
+#define CR_STATS_NBUCKETS	32
+
+static CR_DEFINE_SPINLOCK(cr_stats_lock);
+static struct {
+	u64			requests;
+	u64			ns[CR_STATS_NPHASES];
+	u64			count[CR_STATS_NCOUNTS];
+	u64			hist[CR_STATS_NPHASES][CR_STATS_NBUCKETS];
+	struct cr_chkpt_stats	last;
+} cr_stats_global;
+
+static const char *cr_stats_phase_names[CR_STATS_NPHASES] = {
+	"signal", "callbacks", "preshared", "vmadump",
+	"mmaps_maps", "mmaps_data", "files", "total"
+};
+
+static const char *cr_stats_count_names[CR_STATS_NCOUNTS] = {
+	"bytes_vmadump", "bytes_mmaps", "bytes_files", "bytes_other",
+	"chunks", "pages", "skipped_pages", "fds"
+};
+
+u64 cr_stats_now(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+void cr_stats_init(cr_stats_t *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	spin_lock_init(&stats->lock);
+	stats->start = cr_stats_now();
+}
+
+// Called by each task on entry to cr_dump_self()
+void cr_stats_arrive(cr_stats_t *stats)
+{
+	u64 now = cr_stats_now();
+
+	spin_lock(&stats->lock);
+	if (!stats->first) stats->first = now;
+	stats->last = now;
+	spin_unlock(&stats->lock);
+}
+
+// Record a phase that began at 'since' and ends now.
+// The longest such interval (the one on the critical path) is kept.
+void cr_stats_phase(cr_stats_t *stats, int phase, u64 since)
+{
+	u64 delta = cr_stats_now() - since;
+
+	spin_lock(&stats->lock);
+	if (delta > stats->s.ns[phase]) stats->s.ns[phase] = delta;
+	spin_unlock(&stats->lock);
+}
+
+void cr_stats_add(cr_stats_t *stats, int counter, u64 val)
+{
+	spin_lock(&stats->lock);
+	stats->s.count[counter] += val;
+	spin_unlock(&stats->lock);
+}
+
+// Called by vmadump once per region
+void cr_stats_pages(cr_stats_t *stats, unsigned long chunks,
+		    unsigned long pages, unsigned long skipped)
+{
+	spin_lock(&stats->lock);
+	stats->s.count[CR_STATS_CHUNKS] += chunks;
+	stats->s.count[CR_STATS_PAGES] += pages;
+	stats->s.count[CR_STATS_SKIPPED_PAGES] += skipped;
+	spin_unlock(&stats->lock);
+}
+
+// Called as each task completes its checkpoint
+void cr_stats_end(cr_stats_t *stats)
+{
+	u64 now = cr_stats_now();
+
+	spin_lock(&stats->lock);
+	stats->end = now;
+	spin_unlock(&stats->lock);
+}
+
+// Fill in the phases derived from timestamps and take a snapshot
+static void cr_stats_snapshot(cr_stats_t *stats, struct cr_chkpt_stats *out)
+{
+	spin_lock(&stats->lock);
+	if (stats->first) {
+		stats->s.ns[CR_STATS_SIGNAL] = stats->first - stats->start;
+		stats->s.ns[CR_STATS_CALLBACKS] = stats->last - stats->first;
+	}
+	if (stats->end) {
+		stats->s.ns[CR_STATS_TOTAL] = stats->end - stats->start;
+	}
+	*out = stats->s;
+	spin_unlock(&stats->lock);
+}
+
+static int cr_stats_bucket(u64 ns)
+{
+	u64 us = ns >> 10;
+	int k = 0;
+
+	while (us && (k < CR_STATS_NBUCKETS - 1)) {
+		us >>= 1;
+		++k;
+	}
+	return k;
+}
+
+// Fold a finished request into the cumulative figures.
+// Called once, as the request is freed.
+void cr_stats_commit(cr_stats_t *stats)
+{
+	struct cr_chkpt_stats s;
+	int i;
+
+	cr_stats_snapshot(stats, &s);
+
+	spin_lock(&cr_stats_lock);
+	cr_stats_global.requests += 1;
+	for (i = 0; i < CR_STATS_NPHASES; ++i) {
+		cr_stats_global.ns[i] += s.ns[i];
+		cr_stats_global.hist[i][cr_stats_bucket(s.ns[i])] += 1;
+	}
+	for (i = 0; i < CR_STATS_NCOUNTS; ++i) {
+		cr_stats_global.count[i] += s.count[i];
+	}
+	cr_stats_global.last = s;
+	spin_unlock(&cr_stats_lock);
+}
+
+int cr_stats_copy(cr_stats_t *stats, struct cr_chkpt_stats __user *arg)
+{
+	struct cr_chkpt_stats s;
+
+	cr_stats_snapshot(stats, &s);
+	return copy_to_user(arg, &s, sizeof(s)) ? -EFAULT : 0;
+}
+
+/*
+ * Critical-path report (CR_CHKPT_CRITPATH)
+ */
+
+// Timestamp a task's arrival at one of the CR_CP_* points
+void cr_stats_mark(cr_task_t *cr_task, int point)
+{
+	cr_task->cp_time[point] = cr_stats_now();
+}
+
+// CR_OP_HAND_TIMES: libcr reports when this thread ran its callbacks
+int cr_hand_times(struct file *filp, struct cr_hand_times __user *arg)
+{
+	struct cr_hand_times times;
+	cr_task_t *cr_task;
+	int retval;
+
+	CR_KTRACE_FUNC_ENTRY();
+
+	retval = -EFAULT;
+	if (copy_from_user(&times, arg, sizeof(times))) {
+		goto out;
+	}
+
+	retval = -ESRCH;
+	cr_task = cr_task_get(current);
+	if (!cr_task) {
+		goto out;
+	}
+	if (cr_task->chkpt_req) {
+		cr_task->cp_hand = times;
+		retval = 0;
+	}
+	cr_task_put(cr_task);
+
+out:
+	CR_KTRACE_FUNC_EXIT("Returning %d", retval);
+	return retval;
+}
+
+static unsigned long cr_stats_us(u64 ns)
+{
+	do_div(ns, 1000);
+	return (unsigned long)ns;
+}
+
+// Append to the request's log which task arrived last at each point,
+// how long after the first, and which callback ran longest.
+//
+// Called by the task writing the trailer, when all tasks are past the
+// postdump barrier but still on req->tasks.
+void cr_stats_critpath(cr_chkpt_req_t *req)
+{
+	static const char *names[CR_CP_NPOINTS] = {
+		"preshared", "phase", "predump", "vmadump"
+	};
+	struct {
+		u64	first, last;
+		pid_t	pid;
+	} pt[CR_CP_NPOINTS];
+	struct cr_hand_times cb_slow, cb_long;
+	pid_t slow_pid = 0, long_pid = 0;
+	const u64 start = req->stats.start;
+	cr_task_t *cr_task;
+	int tasks = 0;
+	int i;
+
+	memset(pt, 0, sizeof(pt));
+	memset(&cb_slow, 0, sizeof(cb_slow));
+	memset(&cb_long, 0, sizeof(cb_long));
+
+	// Collect under the lock, print after
+	read_lock(&req->lock);
+	list_for_each_entry(cr_task, &req->tasks, req_list) {
+		const struct cr_hand_times *h = &cr_task->cp_hand;
+
+		++tasks;
+		for (i = 0; i < CR_CP_NPOINTS; ++i) {
+			const u64 t = cr_task->cp_time[i];
+			if (!t) continue;
+			if (!pt[i].first || (t < pt[i].first)) pt[i].first = t;
+			if (t > pt[i].last) {
+				pt[i].last = t;
+				pt[i].pid = cr_task->task->pid;
+			}
+		}
+		if (h->slow_ns > cb_slow.slow_ns) {
+			cb_slow = *h;
+			slow_pid = cr_task->task->pid;
+		}
+		if (h->cb_end && ((h->cb_end - h->cb_start) > (cb_long.cb_end - cb_long.cb_start))) {
+			cb_long = *h;
+			long_pid = cr_task->task->pid;
+		}
+	}
+	read_unlock(&req->lock);
+
+	CR_INFO_REQ(req, "critical path over %d tasks (times since the request):", tasks);
+	for (i = 0; i < CR_CP_NPOINTS; ++i) {
+		if (!pt[i].last) continue;
+		CR_INFO_REQ(req, "  %-9s last arrival pid %d at +%lu us, %lu us after the first",
+			    names[i], pt[i].pid, cr_stats_us(pt[i].last - start),
+			    cr_stats_us(pt[i].last - pt[i].first));
+	}
+	if (long_pid) {
+		CR_INFO_REQ(req, "  callbacks longest in pid %d: %lu us",
+			    long_pid, cr_stats_us(cb_long.cb_end - cb_long.cb_start));
+	}
+	if (slow_pid) {
+		CR_INFO_REQ(req, "  slowest callback pid %d id %lld (func 0x%llx): %lu us",
+			    slow_pid, cb_slow.slow_id, cb_slow.slow_func,
+			    cr_stats_us(cb_slow.slow_ns));
+	}
+}
+
+/*
+ * /proc/checkpoint/stats
+ */
+
+static int cr_stats_show(struct seq_file *m, void *v)
+{
+	u64 requests;
+	u64 ns[CR_STATS_NPHASES];
+	u64 count[CR_STATS_NCOUNTS];
+	struct cr_chkpt_stats last;
+	u64 (*hist)[CR_STATS_NBUCKETS];
+	int i, j;
+
+	// Snapshot first, so we don't print under a spinlock
+	hist = kmalloc(sizeof(cr_stats_global.hist), GFP_KERNEL);
+	if (!hist) return -ENOMEM;
+	spin_lock(&cr_stats_lock);
+	requests = cr_stats_global.requests;
+	memcpy(ns, cr_stats_global.ns, sizeof(ns));
+	memcpy(count, cr_stats_global.count, sizeof(count));
+	memcpy(hist, cr_stats_global.hist, sizeof(cr_stats_global.hist));
+	last = cr_stats_global.last;
+	spin_unlock(&cr_stats_lock);
+
+	seq_printf(m, "requests %llu\n", (unsigned long long)requests);
+	seq_printf(m, "# phase last_ns total_ns histogram(log2 us)\n");
+	for (i = 0; i < CR_STATS_NPHASES; ++i) {
+		seq_printf(m, "%s %llu %llu", cr_stats_phase_names[i],
+			   (unsigned long long)last.ns[i],
+			   (unsigned long long)ns[i]);
+		for (j = 0; j < CR_STATS_NBUCKETS; ++j) {
+			seq_printf(m, " %llu", (unsigned long long)hist[i][j]);
+		}
+		seq_putc(m, '\n');
+	}
+	seq_printf(m, "# counter last total\n");
+	for (i = 0; i < CR_STATS_NCOUNTS; ++i) {
+		seq_printf(m, "%s %llu %llu\n", cr_stats_count_names[i],
+			   (unsigned long long)last.count[i],
+			   (unsigned long long)count[i]);
+	}
+
+	kfree(hist);
+	return 0;
+}
+
+static int cr_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, cr_stats_show, NULL);
+}
+
+struct file_operations cr_stats_fops =
+{
+	owner:		THIS_MODULE,
+	open:		cr_stats_open,
+	read:		seq_read,
+	llseek:		seq_lseek,
+	release:	single_release,
+};
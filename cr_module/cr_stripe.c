@@ -0,0 +1,274 @@
+/*
+ * Berkeley Lab Checkpoint/Restart (BLCR) for Linux is Copyright (c)
+ * 2008, The Regents of the University of California, through Lawrence
+ * Berkeley National Laboratory (subject to receipt of any required
+ * approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Portions may be copyrighted by others, as may be noted in specific
+ * copyright notices within specific files.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Striped context files (CR_OP_STRIPE).
+ *
+ * A striped file is an anonymous file whose reads and writes at offset
+ * 'pos' go to stripe (pos / stripe_size) % count, at the matching offset
+ * in that stripe (see struct cr_stripe_args in blcr_common.h).  Because
+ * it honors the offset it is passed, it is seekable like the regular file
+ * it stands in for: the parallel page writers, the table of contents and
+ * the per-section statistics all work unchanged, and each helper's I/O
+ * lands directly in the stripe file(s) it covers.
+ */
+
+#include "cr_module.h"
+
+#if HAVE_4_ARG_ANON_INODE_GETFD
+#include <linux/anon_inodes.h>
+
+struct cr_stripe_s {
+	loff_t		size;		// logical length, under 'lock'
+	spinlock_t	lock;
+	u32		stripe_size;
+	unsigned int	count;
+	struct file	*filp[0];
+};
+
+// Map a logical offset to a stripe and the offset within it.
+// Returns the bytes left in that stripe unit.
+static size_t cr_stripe_map(struct cr_stripe_s *s, loff_t pos,
+			    struct file **filp, loff_t *offset)
+{
+	u64 unit = pos;
+	u32 rem = do_div(unit, s->stripe_size);
+	u32 idx = do_div(unit, s->count);	// now 'unit' is the row
+
+	*filp = s->filp[idx];
+	*offset = (loff_t)unit * s->stripe_size + rem;
+	return s->stripe_size - rem;
+}
+
+static ssize_t cr_stripe_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	struct cr_stripe_s *s = file->private_data;
+	loff_t pos = *ppos;
+	loff_t size;
+	ssize_t done = 0;
+
+	spin_lock(&s->lock);
+	size = s->size;
+	spin_unlock(&s->lock);
+
+	if (pos >= size) {
+		return 0;
+	}
+	if (count > size - pos) {
+		count = size - pos;
+	}
+
+	while (count) {
+		struct file *filp;
+		loff_t offset;
+		size_t len = cr_stripe_map(s, pos, &filp, &offset);
+		ssize_t r;
+
+		if (len > count) len = count;
+		r = vfs_read(filp, buf, len, &offset);
+		if (r <= 0) {
+			if (!done) done = r ? r : -EIO;	// a stripe is shorter than the manifest claims
+			break;
+		}
+		done += r;
+		pos += r;
+		buf += r;
+		count -= r;
+	}
+
+	if (done > 0) {
+		*ppos = pos;
+	}
+	return done;
+}
+
+static ssize_t cr_stripe_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct cr_stripe_s *s = file->private_data;
+	loff_t pos = *ppos;
+	ssize_t done = 0;
+
+	while (count) {
+		struct file *filp;
+		loff_t offset;
+		size_t len = cr_stripe_map(s, pos, &filp, &offset);
+		ssize_t w;
+
+		if (len > count) len = count;
+		w = vfs_write(filp, buf, len, &offset);
+		if (w <= 0) {
+			if (!done) done = w;
+			break;
+		}
+		done += w;
+		pos += w;
+		buf += w;
+		count -= w;
+	}
+
+	if (done > 0) {
+		*ppos = pos;
+		spin_lock(&s->lock);
+		if (pos > s->size) s->size = pos;
+		spin_unlock(&s->lock);
+	}
+	return done;
+}
+
+static loff_t cr_stripe_llseek(struct file *file, loff_t offset, int origin)
+{
+	struct cr_stripe_s *s = file->private_data;
+
+	switch (origin) {
+	case SEEK_END:
+		spin_lock(&s->lock);
+		offset += s->size;
+		spin_unlock(&s->lock);
+		break;
+	case SEEK_CUR:
+		offset += file->f_pos;
+		break;
+	case SEEK_SET:
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (offset < 0) {
+		return -EINVAL;
+	}
+	file->f_pos = offset;
+	return offset;
+}
+
+static int cr_stripe_release(struct inode *inode, struct file *file)
+{
+	struct cr_stripe_s *s = file->private_data;
+	unsigned int i;
+
+	for (i = 0; i < s->count; ++i) {
+		fput(s->filp[i]);
+	}
+	kfree(s);
+	return 0;
+}
+
+static struct file_operations cr_stripe_fops =
+{
+	owner:		THIS_MODULE,
+	read:		cr_stripe_read,
+	write:		cr_stripe_write,
+	llseek:		cr_stripe_llseek,
+	release:	cr_stripe_release,
+};
+
+int cr_is_stripe_file(struct file *filp)
+{
+	return (filp->f_op == &cr_stripe_fops);
+}
+
+// Returns a new fd, or negative error code.
+int cr_stripe_open(struct cr_stripe_args __user *arg)
+{
+	struct cr_stripe_args args;
+	struct cr_stripe_s *s;
+	struct file *filp;
+	unsigned int i;
+	unsigned int mode;
+	int retval;
+
+	CR_KTRACE_FUNC_ENTRY();
+
+	if (copy_from_user(&args, arg, sizeof(args))) {
+		return -EFAULT;
+	}
+	if (!args.count || (args.count > CR_STRIPE_MAX) ||
+	    !args.stripe_size || (args.stripe_size & ~PAGE_MASK) ||
+	    (args.stripe_size > 0x40000000ULL)) {
+		return -EINVAL;
+	}
+	mode = args.is_write ? FMODE_WRITE : FMODE_READ;
+
+	s = cr_kzalloc(sizeof(*s) + args.count * sizeof(struct file *), GFP_KERNEL);
+	if (!s) {
+		return -ENOMEM;
+	}
+	spin_lock_init(&s->lock);
+	s->stripe_size = args.stripe_size;
+	s->size = args.is_write ? 0 : args.length;
+
+	for (i = 0; i < args.count; ++i) {
+		filp = fget(args.fds[i]);
+		retval = -EBADF;
+		if (!filp) {
+			goto out_put;
+		}
+		s->filp[i] = filp;
+		s->count = i + 1;
+		if (!(filp->f_mode & mode)) {
+			goto out_put;
+		}
+		retval = -EINVAL;
+		if (!S_ISREG(filp->f_dentry->d_inode->i_mode) || (filp->f_flags & O_APPEND)) {
+			goto out_put;
+		}
+	}
+
+	retval = anon_inode_getfd("[blcr-stripe]", &cr_stripe_fops, s,
+				  args.is_write ? O_WRONLY : O_RDONLY);
+	if (retval < 0) {
+		goto out_put;
+	}
+
+	// Some kernels give an anon file only FMODE_READ and no FMODE_LSEEK
+	filp = fget(retval);
+	if (filp) {
+		if (filp->private_data == s) {
+			filp->f_mode |= mode;
+#ifdef FMODE_LSEEK
+			filp->f_mode |= FMODE_LSEEK | FMODE_PREAD | FMODE_PWRITE;
+#endif
+		}
+		fput(filp);
+	}
+	return retval;
+
+out_put:
+	for (i = 0; i < s->count; ++i) {
+		fput(s->filp[i]);
+	}
+	kfree(s);
+	return retval;
+}
+
+#else
+
+int cr_is_stripe_file(struct file *filp)
+{
+	return 0;
+}
+
+int cr_stripe_open(struct cr_stripe_args __user *arg)
+{
+	return -ENOSYS;
+}
+
+#endif /* HAVE_4_ARG_ANON_INODE_GETFD */
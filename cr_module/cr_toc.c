@@ -0,0 +1,179 @@
+/*
+ * Berkeley Lab Checkpoint/Restart (BLCR) for Linux is Copyright (c)
+ * 2008, The Regents of the University of California, through Lawrence
+ * Berkeley National Laboratory (subject to receipt of any required
+ * approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Portions may be copyrighted by others, as may be noted in specific
+ * copyright notices within specific files.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Table of contents of a context file (CR_CHKPT_TOC).
+ *
+ * The writers note the offset and length of each piece as they write it,
+ * and the task writing the trailer appends the whole list and a footer
+ * (see struct cr_toc_footer in blcr_common.h).  Entries are kept in
+ * page-sized blocks, so there is no large allocation however many VMAs or
+ * chunk arrays there are.  Offsets come from f_pos, so we only keep a
+ * table for a destination which is a single regular (or striped) file.
+ */
+
+#include "cr_module.h"
+
+struct cr_toc_block {
+	struct list_head	list;
+	unsigned int		count;
+	struct cr_toc_entry	e[0];
+};
+#define CR_TOC_PER_BLOCK \
+	((PAGE_SIZE - sizeof(struct cr_toc_block)) / sizeof(struct cr_toc_entry))
+
+struct cr_toc_s {
+	spinlock_t		lock;
+	struct list_head	blocks;
+	unsigned long long	count;
+	int			failed;		// an entry was lost to -ENOMEM
+};
+
+// Called once the destination is known.
+// Returns 0 or -ENOMEM.  A destination we can't index only gets a warning.
+int cr_toc_init(cr_chkpt_req_t *req)
+{
+	struct file *filp = req->dest.filp;
+	cr_toc_t *toc;
+
+	req->toc = NULL;
+	if (!(req->flags & CR_CHKPT_TOC)) {
+		return 0;
+	}
+	if (!filp || !(S_ISREG(filp->f_dentry->d_inode->i_mode) || cr_is_stripe_file(filp))) {
+		CR_WARN_REQ(req, "Table of contents requires a regular file destination - not written");
+		return 0;
+	}
+
+	toc = kmalloc(sizeof(*toc), GFP_KERNEL);
+	if (!toc) {
+		return -ENOMEM;
+	}
+	spin_lock_init(&toc->lock);
+	INIT_LIST_HEAD(&toc->blocks);
+	toc->count = 0;
+	toc->failed = 0;
+	req->toc = toc;
+
+	return 0;
+}
+
+void cr_toc_free(cr_chkpt_req_t *req)
+{
+	cr_toc_t *toc = req->toc;
+	struct cr_toc_block *blk, *next;
+
+	if (!toc) return;
+
+	list_for_each_entry_safe(blk, next, &toc->blocks, list) {
+		free_page((unsigned long)blk);
+	}
+	kfree(toc);
+	req->toc = NULL;
+}
+
+// Note that [offset, offset+length) of the context file holds an item of the given type.
+// May sleep.
+void cr_toc_add(cr_chkpt_req_t *req, unsigned int type, loff_t offset, loff_t length,
+		unsigned long long addr, unsigned long long extra)
+{
+	cr_toc_t *toc = req->toc;
+	struct cr_toc_block *blk, *new_blk = NULL;
+	struct cr_toc_entry *e;
+
+	if (!toc || (length < 0)) return;
+
+again:
+	spin_lock(&toc->lock);
+	blk = list_empty(&toc->blocks) ? NULL
+		: list_entry(toc->blocks.prev, struct cr_toc_block, list);
+	if (!blk || (blk->count == CR_TOC_PER_BLOCK)) {
+		if (!new_blk) {
+			spin_unlock(&toc->lock);
+			new_blk = (struct cr_toc_block *)__get_free_page(GFP_KERNEL);
+			if (!new_blk) {
+				toc->failed = 1;
+				return;
+			}
+			goto again;
+		}
+		new_blk->count = 0;
+		list_add_tail(&new_blk->list, &toc->blocks);
+		blk = new_blk;
+		new_blk = NULL;
+	}
+	e = &blk->e[blk->count++];
+	e->offset = offset;
+	e->length = length;
+	e->addr = addr;
+	e->extra = extra;
+	e->type = type;
+	e->pid = current->pid;
+	toc->count += 1;
+	spin_unlock(&toc->lock);
+
+	if (new_blk) {
+		// Lost a race w/ another task adding a block
+		free_page((unsigned long)new_blk);
+	}
+}
+
+// Append the table and footer.
+// Called by the one task writing the trailer, after all others are done.
+// Returns 0 on success (or when there is no table), or <0 on error.
+int cr_toc_save(cr_chkpt_req_t *req, struct file *filp)
+{
+	cr_toc_t *toc = req->toc;
+	struct cr_toc_block *blk;
+	struct cr_toc_footer footer;
+	ssize_t w;
+
+	if (!toc) return 0;
+
+	if (toc->failed) {
+		CR_WARN_REQ(req, "Table of contents incomplete (out of memory) - not written");
+		return 0;
+	}
+
+	memset(&footer, 0, sizeof(footer));
+	memcpy(footer.magic, CR_TOC_MAGIC, sizeof(CR_TOC_MAGIC));
+	footer.version = CR_TOC_VERSION;
+	footer.entry_size = sizeof(struct cr_toc_entry);
+	footer.offset = filp->f_pos;
+	footer.count = toc->count;
+
+	list_for_each_entry(blk, &toc->blocks, list) {
+		const size_t len = blk->count * sizeof(struct cr_toc_entry);
+
+		w = cr_kwrite(req->errbuf, filp, blk->e, len);
+		if (w != len) goto bad_write;
+	}
+
+	w = cr_kwrite(req->errbuf, filp, &footer, sizeof(footer));
+	if (w != sizeof(footer)) goto bad_write;
+
+	return 0;
+
+bad_write:
+	CR_ERR_REQ(req, "toc: write returned %d", (int)w);
+	return (w < 0) ? (int)w : -EIO;
+}
@@ -0,0 +1,286 @@
+/*
+ * Berkeley Lab Checkpoint/Restart (BLCR) for Linux is Copyright (c)
+ * 2008, The Regents of the University of California, through Lawrence
+ * Berkeley National Laboratory (subject to receipt of any required
+ * approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Portions may be copyrighted by others, as may be noted in specific
+ * copyright notices within specific files.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Static tracepoints (ftrace/perf event system "blcr").
+ *
+ * Unlike CR_KTRACE_*(), which formats text under one global lock, these
+ * cost a not-taken branch until enabled and then record binary data into
+ * per-cpu buffers, so they are usable on production systems:
+ *	echo 1 > /sys/kernel/debug/tracing/events/blcr/enable
+ *	perf record -e 'blcr:*' -a cr_checkpoint ...
+ *
+ * Durations are nanoseconds from cr_trace_start(blcr_<event>), which reads the
+ * clock only while blcr:<event> is enabled, to cr_trace_since().  They are
+ * 0 if the event was enabled in between.  Byte counts come from f_pos, so
+ * are 0 for destinations (e.g. pipes) that don't seek.
+ * Where a kernel lacks tracepoints, the trace_blcr_*() calls are empty
+ * inlines and cr_trace_start() is 0, so no code needs to be conditional.
+ *
+ * Exactly one file (cr_ktrace.c) defines CREATE_TRACE_POINTS before
+ * including this header a second time.
+ */
+
+#ifndef _CR_TRACE_DEFS
+#define _CR_TRACE_DEFS	1
+
+#if HAVE_TRACE_DEFINE_TRACE_H && defined(CONFIG_TRACEPOINTS)
+  #define CR_TRACEPOINTS	1
+  #if HAVE_TRACE_ENABLED
+    #define cr_trace_enabled(_ev)	trace_##_ev##_enabled()
+  #else
+    #define cr_trace_enabled(_ev)	1
+  #endif
+#else
+  #define CR_TRACEPOINTS	0
+  #define cr_trace_enabled(_ev)	0
+#endif
+
+#define cr_trace_start(_ev)	(cr_trace_enabled(_ev) ? cr_stats_now() : (u64)0)
+#define cr_trace_since(_t0)	((_t0) ? cr_stats_now() - (_t0) : (u64)0)
+
+// Longest barrier name recorded (as spelled in the source)
+#define CR_TRACE_NAMELEN	40
+
+#endif /* _CR_TRACE_DEFS */
+
+#if CR_TRACEPOINTS
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM blcr
+
+#if !defined(_CR_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _CR_TRACE_H	1
+
+#include <linux/tracepoint.h>
+
+// A checkpoint request has been built, just before phase1 is triggered
+TRACE_EVENT(blcr_chkpt_req,
+	TP_PROTO(pid_t target, int scope, unsigned int flags),
+	TP_ARGS(target, scope, flags),
+	TP_STRUCT__entry(
+		__field(pid_t,		pid)
+		__field(pid_t,		target)
+		__field(int,		scope)
+		__field(unsigned int,	flags)
+	),
+	TP_fast_assign(
+		__entry->pid = current->pid;
+		__entry->target = target;
+		__entry->scope = scope;
+		__entry->flags = flags;
+	),
+	TP_printk("pid=%d target=%d scope=%d flags=0x%x",
+		  __entry->pid, __entry->target, __entry->scope, __entry->flags)
+);
+
+// A restart request has validated its context file header
+TRACE_EVENT(blcr_rstrt_req,
+	TP_PROTO(int scope, unsigned int flags),
+	TP_ARGS(scope, flags),
+	TP_STRUCT__entry(
+		__field(pid_t,		pid)
+		__field(int,		scope)
+		__field(unsigned int,	flags)
+	),
+	TP_fast_assign(
+		__entry->pid = current->pid;
+		__entry->scope = scope;
+		__entry->flags = flags;
+	),
+	TP_printk("pid=%d scope=%d flags=0x%x",
+		  __entry->pid, __entry->scope, __entry->flags)
+);
+
+// A task leaves a blocking cr_barrier_*() call (see cr_barrier.h)
+TRACE_EVENT(blcr_barrier,
+	TP_PROTO(const char *name, int result, u64 ns),
+	TP_ARGS(name, result, ns),
+	TP_STRUCT__entry(
+		__field(pid_t,		pid)
+		__array(char,		name, CR_TRACE_NAMELEN)
+		__field(int,		result)
+		__field(u64,		ns)
+	),
+	TP_fast_assign(
+		__entry->pid = current->pid;
+		strncpy(__entry->name, name, CR_TRACE_NAMELEN - 1);
+		__entry->name[CR_TRACE_NAMELEN - 1] = '\0';
+		__entry->result = result;
+		__entry->ns = ns;
+	),
+	TP_printk("pid=%d barrier=%s result=%d ns=%llu",
+		  __entry->pid, __entry->name, __entry->result,
+		  (unsigned long long)__entry->ns)
+);
+
+// One VMA written by vmadump (bytes < 0 is an error)
+TRACE_EVENT(blcr_store_map,
+	TP_PROTO(unsigned long start, unsigned long end, long long bytes, u64 ns),
+	TP_ARGS(start, end, bytes, ns),
+	TP_STRUCT__entry(
+		__field(pid_t,		pid)
+		__field(unsigned long,	start)
+		__field(unsigned long,	end)
+		__field(long long,	bytes)
+		__field(u64,		ns)
+	),
+	TP_fast_assign(
+		__entry->pid = current->pid;
+		__entry->start = start;
+		__entry->end = end;
+		__entry->bytes = bytes;
+		__entry->ns = ns;
+	),
+	TP_printk("pid=%d start=0x%lx end=0x%lx bytes=%lld ns=%llu",
+		  __entry->pid, __entry->start, __entry->end, __entry->bytes,
+		  (unsigned long long)__entry->ns)
+);
+
+// One VMA recreated by vmadump (namelen > 0 if mapped from a file)
+TRACE_EVENT(blcr_load_map,
+	TP_PROTO(unsigned long start, unsigned long end, int namelen,
+		 long long bytes, int result, u64 ns),
+	TP_ARGS(start, end, namelen, bytes, result, ns),
+	TP_STRUCT__entry(
+		__field(pid_t,		pid)
+		__field(unsigned long,	start)
+		__field(unsigned long,	end)
+		__field(int,		namelen)
+		__field(long long,	bytes)
+		__field(int,		result)
+		__field(u64,		ns)
+	),
+	TP_fast_assign(
+		__entry->pid = current->pid;
+		__entry->start = start;
+		__entry->end = end;
+		__entry->namelen = namelen;
+		__entry->bytes = bytes;
+		__entry->result = result;
+		__entry->ns = ns;
+	),
+	TP_printk("pid=%d start=0x%lx end=0x%lx namelen=%d bytes=%lld result=%d ns=%llu",
+		  __entry->pid, __entry->start, __entry->end, __entry->namelen,
+		  __entry->bytes, __entry->result,
+		  (unsigned long long)__entry->ns)
+);
+
+// One list of page chunks written or read (chunks/pages are 0 on read)
+TRACE_EVENT(blcr_page_list,
+	TP_PROTO(int is_write, unsigned long chunks, unsigned long pages,
+		 long long bytes, u64 ns),
+	TP_ARGS(is_write, chunks, pages, bytes, ns),
+	TP_STRUCT__entry(
+		__field(pid_t,		pid)
+		__field(int,		is_write)
+		__field(unsigned long,	chunks)
+		__field(unsigned long,	pages)
+		__field(long long,	bytes)
+		__field(u64,		ns)
+	),
+	TP_fast_assign(
+		__entry->pid = current->pid;
+		__entry->is_write = is_write;
+		__entry->chunks = chunks;
+		__entry->pages = pages;
+		__entry->bytes = bytes;
+		__entry->ns = ns;
+	),
+	TP_printk("pid=%d %s chunks=%lu pages=%lu bytes=%lld ns=%llu",
+		  __entry->pid, __entry->is_write ? "write" : "read",
+		  __entry->chunks, __entry->pages, __entry->bytes,
+		  (unsigned long long)__entry->ns)
+);
+
+// One file descriptor saved or restored (type is enum cr_file_type)
+TRACE_EVENT(blcr_file,
+	TP_PROTO(int is_write, int fd, int type, long long bytes, int result, u64 ns),
+	TP_ARGS(is_write, fd, type, bytes, result, ns),
+	TP_STRUCT__entry(
+		__field(pid_t,		pid)
+		__field(int,		is_write)
+		__field(int,		fd)
+		__field(int,		type)
+		__field(long long,	bytes)
+		__field(int,		result)
+		__field(u64,		ns)
+	),
+	TP_fast_assign(
+		__entry->pid = current->pid;
+		__entry->is_write = is_write;
+		__entry->fd = fd;
+		__entry->type = type;
+		__entry->bytes = bytes;
+		__entry->result = result;
+		__entry->ns = ns;
+	),
+	TP_printk("pid=%d %s fd=%d type=%d bytes=%lld result=%d ns=%llu",
+		  __entry->pid, __entry->is_write ? "save" : "restore",
+		  __entry->fd, __entry->type, __entry->bytes, __entry->result,
+		  (unsigned long long)__entry->ns)
+);
+
+// Restart has restored pids and parent/child linkage for all tasks
+TRACE_EVENT(blcr_linkage,
+	TP_PROTO(int result, u64 ns),
+	TP_ARGS(result, ns),
+	TP_STRUCT__entry(
+		__field(pid_t,		pid)
+		__field(int,		result)
+		__field(u64,		ns)
+	),
+	TP_fast_assign(
+		__entry->pid = current->pid;
+		__entry->result = result;
+		__entry->ns = ns;
+	),
+	TP_printk("pid=%d result=%d ns=%llu",
+		  __entry->pid, __entry->result, (unsigned long long)__entry->ns)
+);
+
+#endif /* _CR_TRACE_H */
+
+// Out-of-tree module: found via -I$(srcdir) (see kbuild/Makefile.in)
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE cr_trace
+#include <trace/define_trace.h>
+
+#elif !defined(_CR_TRACE_H)
+#define _CR_TRACE_H	1
+
+static inline void trace_blcr_chkpt_req(pid_t target, int scope, unsigned int flags) { }
+static inline void trace_blcr_rstrt_req(int scope, unsigned int flags) { }
+static inline void trace_blcr_barrier(const char *name, int result, u64 ns) { }
+static inline void trace_blcr_store_map(unsigned long start, unsigned long end,
+					long long bytes, u64 ns) { }
+static inline void trace_blcr_load_map(unsigned long start, unsigned long end, int namelen,
+				       long long bytes, int result, u64 ns) { }
+static inline void trace_blcr_page_list(int is_write, unsigned long chunks, unsigned long pages,
+					long long bytes, u64 ns) { }
+static inline void trace_blcr_file(int is_write, int fd, int type,
+				   long long bytes, int result, u64 ns) { }
+static inline void trace_blcr_linkage(int result, u64 ns) { }
+
+#endif /* CR_TRACEPOINTS */
@@ -29,10 +29,106 @@
 
 #include "cr_module.h"
 
+/* Run fn(arg) in the calling thread (the vmadump leader) and in any
+ * other threads of the process parked in cr_helper_loop(), which is where
+ * cr_freeze_threads() and cr_thaw_threads() keep them waiting for it.
+ * Returns once every thread has left fn(), w/ the first error (if any).
+ *
+ * Since helpers may join late (or not at all), fn() must claim its work
+ * in small pieces and return as soon as none is left.
+ */
+long
+cr_helper_run(cr_helper_t *h, wait_queue_head_t *wait,
+	      long (*fn)(void *), void *arg)
+{
+    long retval;
+
+    spin_lock(&h->lock);
+    h->fn = fn;
+    h->arg = arg;
+    h->error = 0;
+    h->busy = 1;
+    h->seq++;
+    spin_unlock(&h->lock);
+    wake_up(wait);
+
+    retval = fn(arg);
+
+    spin_lock(&h->lock);
+    if ((retval < 0) && !h->error) h->error = retval;
+    h->busy--;
+    while (h->busy) {
+	spin_unlock(&h->lock);
+	wait_event(*wait, !h->busy);
+	spin_lock(&h->lock);
+    }
+    h->fn = NULL;
+    retval = h->error;
+    spin_unlock(&h->lock);
+
+    return retval;
+}
+
+/* Non-leader threads wait here for the leader's vmadump to finish
+ * (*done becomes non-zero), running any jobs it posts in the meantime.
+ *
+ * Returns 0, or -EINTR if interrupted.
+ */
+static long
+cr_helper_loop(cr_helper_t *h, wait_queue_head_t *wait, cr_bool_t *done)
+{
+    unsigned int seen = 0;
+    long retval = 0;
+
+    spin_lock(&h->lock);
+    h->parked++;
+    spin_unlock(&h->lock);
+
+    for (;;) {
+	long (*fn)(void *) = NULL;
+	void *arg = NULL;
+
+	if (wait_event_interruptible(*wait, *done || (h->seq != seen)) < 0) {
+	    retval = -EINTR;
+	    break;
+	}
+
+	spin_lock(&h->lock);
+	if (h->seq != seen) {
+	    seen = h->seq;
+	    if (h->fn) {
+		/* Job still running - join it */
+		fn = h->fn;
+		arg = h->arg;
+		h->busy++;
+	    }
+	}
+	spin_unlock(&h->lock);
+
+	if (fn) {
+	    long r = fn(arg);
+	    spin_lock(&h->lock);
+	    if ((r < 0) && !h->error) h->error = r;
+	    h->busy--;
+	    spin_unlock(&h->lock);
+	    wake_up(wait);
+	} else if (*done) {
+	    break;
+	}
+    }
+
+    spin_lock(&h->lock);
+    h->parked--;
+    spin_unlock(&h->lock);
+
+    return retval;
+}
+
 /* Let exactly one thread-group leader do a full undump, and
  * ensure everyone else does REGSONLY.
  * This and the matching logic at dump time together ensure that we
  * preserve the thread-group structure that was spawned in user-space.
+ * While they wait, the others help the leader load large regions.
  *
  * Returns original pid (>0), or <0 on error
  */
@@ -51,7 +147,7 @@ cr_thaw_threads(cr_rstrt_proc_req_t *proc_req, int flags, int i_am_leader)
 	proc_req->done_leader = 1;
 	wake_up(&proc_req->wait);
 	up(&proc_req->serial_mutex);
-    } else if (wait_event_interruptible(proc_req->wait, proc_req->done_leader) < 0) {
+    } else if (cr_helper_loop(&proc_req->helper, &proc_req->wait, &proc_req->done_leader) < 0) {
 	retval = -EINTR;
     } else if (proc_req->thaw_error) {
 	retval = proc_req->thaw_error;
@@ -72,6 +168,7 @@ cr_thaw_threads(cr_rstrt_proc_req_t *proc_req, int flags, int i_am_leader)
  * ensure everyone else does REGSONLY.
  * This and the matching logic at undump time together ensure that we
  * preserve the thread-group structure that was spawned in user-space.
+ * While they wait, the others help the leader dump large regions.
  *
  * Returns bytes written (>0), or <0 on error
  */
@@ -81,13 +178,16 @@ cr_freeze_threads(cr_chkpt_proc_req_t *proc_req, int flags, int i_am_leader)
     struct pt_regs *regs = get_pt_regs(current);
     loff_t retval = 0;
 
+    /* The other request flags mean something else (or nothing) to vmadump */
+    flags &= VMAD_DUMP_CR_FLAGS;
+
     if (i_am_leader) {
 	down(&proc_req->serial_mutex);
 	retval = vmadump_freeze_proc(proc_req, proc_req->file, regs, flags | VMAD_DUMP_NOSHANON);
 	proc_req->done_leader = 1;
 	wake_up(&proc_req->wait);
 	up(&proc_req->serial_mutex);
-    } else if (wait_event_interruptible(proc_req->wait, proc_req->done_leader) < 0) {
+    } else if (cr_helper_loop(&proc_req->helper, &proc_req->wait, &proc_req->done_leader) < 0) {
 	retval = -EINTR;
     } else {
         down(&proc_req->serial_mutex);
@@ -86,6 +86,17 @@
 //	This is how cr_get_checkpoint_info() is implemented.
 #define CR_OP_HAND_CHKPT_INFO	_IOR  (CR_IOCTL_BASE, 0x0a, struct cr_chkpt_info *)
 
+//  CR_OP_HAND_TIMES(struct cr_hand_times *)
+//	Called just before CR_OP_HAND_CHKPT to report when this thread ran
+//	its callbacks, for the critical-path report (CR_CHKPT_CRITPATH).
+#define CR_OP_HAND_TIMES	_IOW  (CR_IOCTL_BASE, 0x0b, struct cr_hand_times *)
+
+//  CR_OP_HAND_EXCLUDE(struct cr_exclude_args *)
+//	Called just before CR_OP_HAND_CHKPT, by a process which has asked
+//	to leave ranges of its memory out (cr_exclude_region()).  The first
+//	call by any thread of the process is the one used.
+#define CR_OP_HAND_EXCLUDE	_IOW  (CR_IOCTL_BASE, 0x0c, struct cr_exclude_args *)
+
 //
 // ioctl()s for cr_checkpoint:
 //   
@@ -115,6 +126,11 @@
 //	arg.buf is always nul-terminated if return >= 0.
 #define CR_OP_CHKPT_LOG	_IOR  (CR_IOCTL_BASE, 0x14, struct cr_log_args *)
 
+// CR_OP_CHKPT_STATS(struct cr_chkpt_stats *stats)
+//	Called to collect phase times and counters from a completed checkpoint.
+//	Like CR_OP_CHKPT_LOG, must be called before CR_OP_CHKPT_REAP.
+#define CR_OP_CHKPT_STATS _IOR  (CR_IOCTL_BASE, 0x15, struct cr_chkpt_stats *)
+
 //
 // ioctl()s for cr_restart:
 //   
@@ -166,5 +182,12 @@
 //      Return of 0 is success, meaning we support that version.
 #define CR_OP_VERSION		_IOW  (CR_IOCTL_BASE, 0x30, unsigned long)
 
+// CR_OP_STRIPE(struct cr_stripe_args *)
+//	Opens a new file descriptor for the stream striped across args.fds[].
+//	It is seekable, so it may be used as the destination or source of a
+//	request just like a regular file.
+//      Return is the new file descriptor, or negative on error.
+#define CR_OP_STRIPE		_IOW  (CR_IOCTL_BASE, 0x31, struct cr_stripe_args *)
+
 
 #endif
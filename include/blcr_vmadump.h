@@ -37,6 +37,7 @@
 #undef HAVE_BINFMT_VMADUMP
 
 /* Flags for dump/undump */
+#define VMAD_DUMP_WORKSET     0x0080  /* record resident pages of file maps */
 #define VMAD_DUMP_NOSHANON    0x0100  /* let BLCR dump shared anonymous mappings */
 #define VMAD_DUMP_NOEXEC      0x0200  /* let BLCR dump the executable */
 #define VMAD_DUMP_NOPRIVATE   0x0400  /* let BLCR dump private filenamed memory */
@@ -45,7 +46,14 @@
 /* Additional flags */
 #define VMAD_DUMP_REGSONLY 0x1000	/* Only thread-specific info */
 
+/* The CR_CHKPT_* request flags which vmadump sees, all others are masked */
+#define VMAD_DUMP_CR_FLAGS (VMAD_DUMP_WORKSET  | VMAD_DUMP_NOEXEC | \
+			    VMAD_DUMP_NOPRIVATE | VMAD_DUMP_NOSHARED)
+
 /* Check for mis-match */
+#if defined(CR_CHKPT_WORKSET) && (CR_CHKPT_WORKSET != VMAD_DUMP_WORKSET)
+  #error "Mismatch CR_CHKPT_WORKSET vs. VMAD_DUMP_WORKSET"
+#endif
 #if defined(CR_CHKPT_DUMP_EXEC) && (CR_CHKPT_DUMP_EXEC != VMAD_DUMP_NOEXEC)
   #error "Mismatch CR_CHKPT_DUMP_EXEC vs. VMAD_DUMP_EXEC"
 #endif
@@ -55,6 +63,13 @@
 #if defined(CR_CHKPT_DUMP_SHARED) && (CR_CHKPT_DUMP_SHARED != VMAD_DUMP_NOSHARED)
   #error "Mismatch CR_CHKPT_DUMP_SHARED vs. VMAD_DUMP_SHARED"
 #endif
+#if defined(CR_CHKPT_DRYRUN) && \
+    ((CR_CHKPT_PROHIBIT_SELF | CR_CHKPT_PTRACED_ALLOW | CR_CHKPT_PTRACED_SKIP | \
+      CR_CHKPT_PTRACER_SKIP | CR_CHKPT_ASYNC_ERR | CR_CHKPT_CRITPATH | \
+      CR_CHKPT_TOC | CR_CHKPT_DRYRUN) & \
+     (VMAD_DUMP_CR_FLAGS | VMAD_DUMP_NOSHANON | VMAD_DUMP_REGSONLY))
+  #error "Overlap of CR_CHKPT_* request-only flags and VMAD_DUMP_* flags"
+#endif
 
 #ifdef __KERNEL__
 #include "blcr_config.h"
@@ -63,6 +78,10 @@
 /* Overload the namelen flag to store ARCH-specific mappings */
 #define VMAD_NAMELEN_ARCH (PAGE_SIZE+1)
 
+/* ... and to refer to a name written earlier in the same process's map list.
+ * The low bits are the index of that name, counting from 0 in the order written. */
+#define VMAD_NAMELEN_REF 0x80000000UL
+
 #if defined(ARCH_HAS_SETUP_ADDITIONAL_PAGES)
   #define VMAD_HAVE_ARCH_MAPS 1
 #elif (defined(CR_KCODE_map_vsyscall) && HAVE_MAP_VSYSCALL)
@@ -79,6 +98,13 @@
   #define VMAD_HAVE_ARCH_MAPS 0
 #endif
 
+/* Capture/restore of NUMA placement needs the mempolicy syscalls */
+#if defined(CONFIG_NUMA) && defined(CR_KCODE_sys_mbind) && defined(CR_KCODE_sys_get_mempolicy)
+  #define VMAD_HAVE_NUMA 1
+#else
+  #define VMAD_HAVE_NUMA 0
+#endif
+
 #if VMAD_HAVE_ARCH_MAPS
   extern int vmad_is_arch_map(const struct vm_area_struct *map);
 #else
@@ -28,6 +28,7 @@
 #define _CRLIB_H	1
 
 #include <features.h>
+#include <stddef.h> // for size_t
 #include <sys/select.h> // for (struct timeval)
 #include <errno.h>
 #include <blcr_common.h>
@@ -116,6 +117,9 @@ typedef unsigned long cr_restart_handle_t;
 #define CR_THREAD_CONTEXT	0x4000000
 #define CR_SIGNAL_CONTEXT	0x2000000
 
+// Optional flag for thread-context callbacks (see cr_register_callback()).
+#define CR_CONCURRENT		0x8000000
+
 // cr_client_id for use by callbacks
 #define CR_ID_CALLBACK ((cr_client_id_t)(-1))
 
@@ -217,6 +221,12 @@ cr_init(void);
 // call.  This allows for use of cr_log_checkpoint() to collect kernel
 // messages that are associated with these error conditions.
 //
+// Setting CR_CHKPT_DRYRUN in args->cr_flags requests an estimate of the
+// size of the checkpoint rather than the checkpoint itself.  Callbacks run
+// as usual, but nothing is written and args->cr_fd and args->cr_signal are
+// ignored.  Use cr_stats_checkpoint() before reaping the request to collect
+// the bytes counted for each section.
+//
 extern int
 cr_request_checkpoint(cr_checkpoint_args_t *args, cr_checkpoint_handle_t *handle);
 
@@ -309,6 +319,29 @@ cr_wait_checkpoint(cr_checkpoint_handle_t *handle, struct timeval *timeout);
 extern int
 cr_log_checkpoint(cr_checkpoint_handle_t *handle, unsigned int len, char *msg);
 
+// cr_stats_checkpoint
+//
+// INOUT: handle   Pointer to opaque value filled in by cr_request_checkpoint()
+// OUT:   stats    Space to return the statistics.
+//
+// Returns:
+//   0 - success.
+// < 0 - an error occurred (see below for details)
+//
+// Collects the phase times and counters of the checkpoint request (see
+// struct cr_chkpt_stats in blcr_common.h).  As with cr_log_checkpoint(),
+// this must be called before the request is reaped.  The module-wide
+// totals are available from /proc/checkpoint/stats.
+//
+// Most likely errno values when returning < 0:
+// EINVAL	 No checkpoint request associated with the given handle.
+// EFAULT	 'stats' argument points outside caller's address space.
+// ENOTTY	 The kernel module predates this call.
+// Other values may be possible.
+//
+extern int
+cr_stats_checkpoint(cr_checkpoint_handle_t *handle, struct cr_chkpt_stats *stats);
+
 // cr_reap_checkpoint
 //
 // INOUT: handle   Pointer to opaque value filled in by cr_request_checkpoint()
@@ -647,6 +680,37 @@ cr_poll_restart_msg(cr_restart_handle_t *handle, struct timeval *timeout, char *
 extern int
 cr_poll_restart(cr_restart_handle_t *handle, struct timeval *timeout);
 
+// cr_open_striped
+//
+// IN: fds          Open regular files, one per stripe.
+// IN: count        Number of entries in fds[], at most CR_STRIPE_MAX.
+// IN: stripe_size  Bytes per stripe unit, a multiple of the page size.
+// IN: is_write     Non-zero to open the stream for writing.
+// IN: length       Length of the stream (ignored when is_write != 0).
+//
+// Returns:
+// >= 0 - a new file descriptor for the striped stream.
+//  < 0 - an error occurred (check errno for details)
+//
+// Opens one stream striped across several files (see struct cr_stripe_args
+// in blcr_common.h for the layout).  The result is seekable, and may be
+// passed as args->cr_fd to cr_request_checkpoint() (when is_write != 0) or
+// cr_request_restart() just as a regular file.  The stripes are held open
+// by the new descriptor, so the caller may close its own fds[] at any time.
+// When writing, lseek(fd, 0, SEEK_END) gives the length written.
+//
+// Most likely errno values when return < 0:
+// EBADF	 An entry in fds[] is not open, or lacks the needed access mode.
+// EINVAL	 count or stripe_size is invalid, or a stripe is not a regular
+// 		 file opened w/o O_APPEND.
+// ENOSYS	 The kernel does not support striped files.
+// ENOTTY	 The kernel module predates this call.
+// Other values may be possible.
+//
+extern int
+cr_open_striped(const int *fds, int count, unsigned long stripe_size,
+		int is_write, unsigned long long length);
+
 // cr_register_callback()
 //
 // Register a checkpoint callback.
@@ -680,6 +744,15 @@ cr_poll_restart(cr_restart_handle_t *handle, struct timeval *timeout);
 //	concurrently.  It is guaranteed, however, that all
 //	thread-context callbacks will reach their cr_checkpoint()
 //	calls before ANY of signal-context callbacks run.
+//	If CR_CONCURRENT is also given, the callback is instead run in
+//	a small pool of threads, concurrently with any other such
+//	callbacks and with the remaining thread-context callbacks.
+//	This is intended for independent callbacks with long-running
+//	quiesce steps, which then take as long as the slowest one
+//	rather than their sum.  Such a callback may call everything a
+//	thread-context callback may, but must not depend on running in
+//	any particular thread.  If the pool cannot grow, registration
+//	fails with the errno from pthread_create().
 //   CR_SIGNAL_CONTEXT:
 //	This type of registration is per-thread.  Thus, the ids
 //	returned from this call have only per-thread scope.  The
@@ -962,6 +1035,9 @@ cr_checkpoint(int flags);
 // CR_SIGNAL_CONTEXT or CR_THREAD_CONTEXT which was originally used to
 // register the invoking callback.
 //
+// From a CR_CONCURRENT callback, the replacement takes effect only once
+// the concurrent callbacks of the current checkpoint have all returned.
+//
 // Returns 0 on success, -1 on failure.
 //
 // Most likely errno values when return is -1:
@@ -1224,6 +1300,59 @@ cr_inc_persist(void);
 extern int
 cr_dec_persist(void);
 
+// cr_exclude_region()
+// THIS FUNCTION IS EXPERIMENTAL: USE AT YOUR OWN RISK
+//
+// Leave a range of the caller's memory out of its checkpoints.
+//
+// Intended for memory whose contents can be recomputed (scratch buffers,
+// caches, FFT workspaces and the like), to make context files smaller.
+// The value of 'how' is one of the following:
+//    CR_EXCLUDE_ZERO   The pages are not saved.  After a restart they are
+//                      still mapped, but read as zeros.
+//    CR_EXCLUDE_UNMAP  The pages are not saved.  After a restart they are
+//                      not mapped at all.
+//
+// Only the pages lying entirely within [addr, addr+len) are excluded.
+// A new call replaces any earlier one for the same pages, and the ranges
+// remain in effect (across restarts too) until cr_include_region().
+// Memory which is not mapped when a checkpoint is taken is ignored.
+//
+// Exclusions apply to private memory saved by the process itself.  They
+// do not apply to shared mappings.  For a private mapping of a file which
+// is saved by reference to the file, CR_EXCLUDE_ZERO pages come back with
+// the file's contents rather than zeros.  Restart does not check that the
+// application is prepared for what it finds in excluded memory: that is
+// its own responsibility (e.g. in a callback, on the RESTART branch).
+//
+// Returns 0 on success, -1 on failure.
+// Most likely errno values when returning -1:
+// CR_ENOINIT	Calling thread has not called cr_init()
+// EINVAL	Invalid 'how', or the range wraps around the address space.
+// ENOSPC	Too many disjoint ranges (limit is CR_EXCLUDE_MAX).
+// ENOMEM	Out of memory.
+//
+// If called from a callback, the change may or may not affect the
+// checkpoint which is in progress.
+//
+// This routine is thread-safe, but not reentrant (do not call it from a
+// signal handler).
+//
+extern int
+cr_exclude_region(void *addr, size_t len, int how);
+
+// cr_include_region()
+// THIS FUNCTION IS EXPERIMENTAL: USE AT YOUR OWN RISK
+//
+// Undo cr_exclude_region() for every page which [addr, addr+len) touches,
+// so that their contents are saved by later checkpoints.
+//
+// Returns 0 on success, -1 on failure, with errno values and restrictions
+// as for cr_exclude_region().
+//
+extern int
+cr_include_region(void *addr, size_t len);
+
 
 // PRIVATE interfaces:
 //
@@ -33,6 +33,7 @@
 #include <errno.h>	// for errno
 #include <sys/types.h>	// for pid_t
 #include <unistd.h>	// for getpid() and sysconf()
+#include <string.h>	// for memset()
 
 #include "cr_private.h"
 
@@ -53,6 +54,39 @@ static pthread_cond_t	thread_init_cond = PTHREAD_COND_INITIALIZER;
 static int		thread_state = CRI_THREAD_STOPPED;
 static pthread_t	my_thread;
 
+// Pool of threads to run CR_CONCURRENT callbacks.
+// Each job occupies a pool thread until do_checkpoint() is done, so a
+// checkpoint runs at most pool_threads of them concurrently (any others
+// run stacked in the checkpoint thread, as usual).
+#define CRI_POOL_MAX	16
+
+// Stuff for the pool, all protected by pool_lock:
+static pthread_mutex_t	pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	pool_cond = PTHREAD_COND_INITIALIZER;		// wakes workers
+static pthread_cond_t	pool_done_cond = PTHREAD_COND_INITIALIZER;	// wakes dispatcher
+static int		pool_threads;	// workers started
+static int		pool_wanted;	// CR_CONCURRENT registrations
+static struct {
+    cri_info_t		*owner;		// checkpoint thread's info
+    int			ids[CRI_POOL_MAX];
+    int			count;		// jobs in ids[] (0 if idle)
+    int			next;		// next job to claim
+    int			arrived;	// jobs at cr_checkpoint() or returned
+    int			finished;	// jobs returned
+    int			released;	// do_checkpoint() is done...
+    int			rc;		// ...and returned this
+    int			abort_flags;	// first abort requested by a job
+    int			slow_id;	// the job that took longest to arrive...
+    unsigned long long	slow_ns;	// ...and how long
+    struct {				// cr_replace_self() by jobs, applied
+	int		id;		// by the checkpoint thread in
+	cr_callback_t	func;		// cri_group_finish(), since the jobs
+	void		*arg;		// must not edit the owner's cr_cb[]
+	int		flags;		// or cr_run[] while it dispatches
+    }			replace[CRI_POOL_MAX];
+    int			replace_count;
+} group;
+
 //
 // Private functions
 //
@@ -84,6 +118,124 @@ static void thread_reset(void)
 	pthread_mutex_init(&thread_lock, NULL);
 	pthread_cond_init(&thread_init_cond, NULL);
 	thread_state = CRI_THREAD_STOPPED;
+
+	// The pool threads are gone too.  Any CR_CONCURRENT
+	// callbacks will run stacked until the pool is regrown.
+	pthread_mutex_init(&pool_lock, NULL);
+	pthread_cond_init(&pool_cond, NULL);
+	pthread_cond_init(&pool_done_cond, NULL);
+	pool_threads = 0;
+	pool_wanted = 0;
+	memset(&group, 0, sizeof(group));
+}
+
+// group_timer_stop()
+//
+// Note the time a job took to arrive, if the longest so far.
+// Kept in 'group' rather than the owner's info, which the checkpoint
+// thread may be updating concurrently w/ its own callbacks.
+//
+// Called w/ pool_lock held.
+static void group_timer_stop(cri_info_t *info)
+{
+    unsigned long long ns = cri_cb_timer_stop(info);
+
+    if (ns > group.slow_ns) {
+	group.slow_ns = ns;
+	group.slow_id = info->cb_cur;
+    }
+}
+
+// pool_main()
+//
+// This is the main loop of a thread running CR_CONCURRENT callbacks.
+// These threads are otherwise ordinary, and are checkpointed as such
+// (while blocked in cri_group_checkpoint()).
+static void* pool_main(void* arg)
+{
+    cri_info_t *info = cri_info_init();
+
+    // Must not inherit a mask blocking the checkpoint signal
+    {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, CR_SIGNUM);
+    pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    while (1) {
+	cri_info_t *owner;
+	int id, rc;
+
+	while (group.next >= group.count) {
+	    pthread_cond_wait(&pool_cond, &pool_lock);
+	}
+	id = group.ids[group.next++];
+	owner = group.owner;
+	pthread_mutex_unlock(&pool_lock);
+
+	// Run the callback as if in the checkpoint thread
+	info->cb_owner = owner;
+	info->run.token = owner->run.token;
+	info->run.id = id;
+	info->run.index = 1;	// Cleared on reaching cr_checkpoint()
+	cri_atomic_write(&info->cr_state, CR_STATE_ACTIVE);
+	cri_cb_timer_start(info, id);
+	rc = (*owner->cr_cb[id].func)(owner->cr_cb[id].arg);
+	if (rc) {
+	    LIBCR_TRACE(LIBCR_TRACE_INFO, "Callback %d returned %d - ABORTING\n", id, rc);
+	    (void)cri_syscall_token(info->run.token, CR_OP_HAND_ABORT, CR_CHECKPOINT_PERM_FAILURE);
+	    CRI_ABORT("Unexpected return from CR_OP_HAND_ABORT");
+	}
+	cri_atomic_write(&info->cr_state, CR_STATE_IDLE);
+	info->cb_owner = NULL;
+
+	pthread_mutex_lock(&pool_lock);
+	if (info->run.index) {
+	    group_timer_stop(info);
+	    group.arrived += 1;
+	}
+	group.finished += 1;
+	pthread_cond_broadcast(&pool_done_cond);
+    }
+
+    // NOT REACHED
+    return NULL;
+}
+
+// pool_grow()
+//
+// Note one more CR_CONCURRENT registration, starting a pool thread for
+// it if below the limit.  Returns 0 on success, or -1 w/ errno set.
+//
+// Called w/ thread_lock held and inside a critical section.
+static int pool_grow(void)
+{
+    pthread_attr_t attr;
+    pthread_t th;
+    int rc = 0;
+
+    pthread_mutex_lock(&pool_lock);
+    if ((pool_threads <= pool_wanted) && (pool_threads < CRI_POOL_MAX)) {
+	(void)pthread_attr_init(&attr);
+	(void)pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	rc = pthread_create(&th, &attr, &pool_main, NULL);
+	(void)pthread_attr_destroy(&attr);
+	if (!rc) {
+	    pool_threads += 1;
+	}
+    }
+    if (!rc) {
+	pool_wanted += 1;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (rc) {
+	errno = rc;
+	return -1;
+    }
+    return 0;
 }
 
 // thread_main()
@@ -263,7 +415,11 @@ cri_register_thread(cri_info_t		*info,
 
     pthread_mutex_lock(&thread_lock);
     thread_init();
-    result = cri_do_register(thread_info_p, func, arg, flags);
+    if ((flags & CR_CONCURRENT) && (pool_grow() < 0)) {
+	result = -1;
+    } else {
+	result = cri_do_register(thread_info_p, func, arg, flags);
+    }
     pthread_mutex_unlock(&thread_lock);
 
     return result;
@@ -281,8 +437,177 @@ cri_replace_thread(cri_info_t		*info,
     int retval;
 
     pthread_mutex_lock(&thread_lock);
-    retval = cri_do_replace(thread_info_p, id, func, arg, flags);
+    if ((flags & CR_CONCURRENT) && (pool_grow() < 0)) {
+	retval = -1;
+    } else {
+	retval = cri_do_replace(thread_info_p, id, func, arg, flags);
+    }
     pthread_mutex_unlock(&thread_lock);
 
     return retval;
 }
+
+// cri_group_start()
+//
+// Hand the CR_CONCURRENT callbacks to the pool.
+// Called by the checkpoint thread at the start of cr_checkpoint().
+void
+cri_group_start(cri_info_t *info)
+{
+    unsigned int pos;
+
+    // Room in cr_run[] for any replacement the jobs queue, so
+    // cri_group_finish() can apply them w/o failing.  Otherwise
+    // (ENOMEM) all the callbacks just run stacked.
+    if (!pool_threads || (cri_run_reserve(info) < 0)) return;
+
+    // Fetch once here, rather than from each pool thread
+    (void)cr_get_checkpoint_info();
+
+    pthread_mutex_lock(&pool_lock);
+    memset(&group, 0, sizeof(group));
+    for (pos = 0; (pos < info->cr_run_count) && (group.count < pool_threads); ++pos) {
+	const int id = info->cr_run[pos];
+	if (info->cr_cb[id].func && (info->cr_cb[id].flags & CR_CONCURRENT)) {
+	    group.ids[group.count++] = id;
+	}
+    }
+    if (group.count) {
+	group.owner = info;
+	pthread_cond_broadcast(&pool_cond);
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// cri_group_owns()
+//
+// Non-zero if callback 'id' was handed to the pool
+int
+cri_group_owns(int id)
+{
+    int i;
+
+    for (i = 0; i < group.count; ++i) {
+	if (group.ids[i] == id) return 1;
+    }
+    return 0;
+}
+
+// cri_group_join()
+//
+// Wait for all pool jobs to reach cr_checkpoint() (or return).
+// Returns the flags from the first to request an abort, if any.
+int
+cri_group_join(void)
+{
+    int flags;
+
+    if (!group.count) return 0;
+
+    pthread_mutex_lock(&pool_lock);
+    while (group.arrived < group.count) {
+	pthread_cond_wait(&pool_done_cond, &pool_lock);
+    }
+    cri_cb_timer_note(group.owner, group.slow_id, group.slow_ns);
+    flags = group.abort_flags;
+    pthread_mutex_unlock(&pool_lock);
+
+    return flags;
+}
+
+// cri_group_release()
+//
+// Let the pool jobs return from cr_checkpoint() w/ the result of
+// do_checkpoint() (or of the abort).  Safe to call more than once.
+void
+cri_group_release(cri_info_t *info)
+{
+    if (!group.count || group.released) return;
+
+    if (info->run.rc > 0) {
+	// Fetch once here, rather than from each pool thread
+	(void)cr_get_restart_info();
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    group.rc = info->run.rc;
+    group.released = 1;
+    pthread_cond_broadcast(&pool_cond);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// cri_group_finish()
+//
+// Wait for all pool jobs to return, then apply their replacements.
+// Called by the checkpoint thread while still ACTIVE, so these only
+// mark cr_run[] for cri_run_rebuild().
+void
+cri_group_finish(void)
+{
+    int i;
+
+    if (!group.count) return;
+
+    pthread_mutex_lock(&pool_lock);
+    while (group.finished < group.count) {
+	pthread_cond_wait(&pool_done_cond, &pool_lock);
+    }
+    for (i = 0; i < group.replace_count; ++i) {
+	(void)cri_do_replace(group.owner, group.replace[i].id, group.replace[i].func,
+			     group.replace[i].arg, group.replace[i].flags);
+    }
+    memset(&group, 0, sizeof(group));
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// cri_group_replace()
+//
+// cr_replace_self() as called from a CR_CONCURRENT callback in a pool
+// thread, w/ arguments already checked.  Queues the change for
+// cri_group_finish().  A later call for the same id supersedes.
+void
+cri_group_replace(cr_callback_id_t id, cr_callback_t func, void *arg, int flags)
+{
+    int i;
+
+    pthread_mutex_lock(&pool_lock);
+    for (i = 0; (i < group.replace_count) && (group.replace[i].id != id); ++i) {
+	/* nothing */
+    }
+    if (i == group.replace_count) {
+	// At most one id per job, and at most CRI_POOL_MAX jobs
+	group.replace_count += 1;
+    }
+    group.replace[i].id = id;
+    group.replace[i].func = func;
+    group.replace[i].arg = arg;
+    group.replace[i].flags = flags;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// cri_group_checkpoint()
+//
+// cr_checkpoint() as called from a CR_CONCURRENT callback in a pool thread
+int
+cri_group_checkpoint(cri_info_t *info, int flags)
+{
+    int rc;
+
+    pthread_mutex_lock(&pool_lock);
+    if ((flags & CR_CHECKPOINT_ABORT_MASK) && !group.abort_flags) {
+	group.abort_flags = flags;
+    }
+    if (info->run.index) {
+	info->run.index = 0;
+	group_timer_stop(info);
+	group.arrived += 1;
+	pthread_cond_broadcast(&pool_done_cond);
+    }
+    while (!group.released) {
+	pthread_cond_wait(&pool_cond, &pool_lock);
+    }
+    rc = group.rc;
+    pthread_mutex_unlock(&pool_lock);
+
+    return rc;
+}
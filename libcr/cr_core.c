@@ -33,6 +33,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include <limits.h>
+#include <time.h>
 #include <dlfcn.h>
 #include <features.h>
 
@@ -113,7 +114,7 @@ static inline void enter_idle_state(cri_info_t *info)
 #if LIBCR_TRACING
     int pid = (int)getpid();
 #endif
-    cri_info_t *info = cri_info_location();	// thread-specific
+    cri_info_t *info = cri_info_location_async();	// thread-specific
     const int token = siginfo->si_pid;
 
     LIBCR_TRACE(LIBCR_TRACE_INFO, "[%d] signal %d received", pid, signr);
@@ -195,6 +196,7 @@ int cr_checkpoint(int flags)
 {
     cri_info_t *info;	// thread-specific
     int my_id;
+    int my_cb;
     int outer_most;
     int index;
     int token;
@@ -207,10 +209,16 @@ int cr_checkpoint(int flags)
     // Checks for improper calls
     info = CRI_CB_INFO_OR_RETURN(-CR_ENOTCB);	// thread-specific
 
+    // Callbacks run in the pool just wait for do_checkpoint()
+    if (info->cb_owner) {
+	return cri_group_checkpoint(info, flags);
+    }
+
     // Save callers id and other bits from info->
     my_id = info->run.index;
+    my_cb = info->run.id;
     token = info->run.token;
-    outer_most = (my_id == info->cr_cb_count);
+    outer_most = (my_id == info->cr_run_count);
 
     // Loop calling callbacks until they have all been called and then
     // invoke do_checkpoint() to do the real work.
@@ -218,7 +226,27 @@ int cr_checkpoint(int flags)
     // This strange loop ensures that after the callback with (index == 0)
     // we next call do_checkpoint() even if callback0 is NULL or returns
     // without calling back into cr_checkpoint().
+    //
+    // In the checkpoint thread, any CR_CONCURRENT callbacks are first
+    // handed to a pool of threads, and then waited for just before
+    // do_checkpoint().
+    if (outer_most) {
+	memset(&info->cb_times, 0, sizeof(info->cb_times));
+	info->cb_times.slow_id = -1;
+	info->cb_times.cb_start = cri_clock_ns();
+	info->cb_cur_start = 0;
+	if (info->is_thread) {
+	    cri_group_start(info);
+	}
+    } else {
+	// Called back from the callback we were timing
+	cri_cb_timer_note(info, info->cb_cur, cri_cb_timer_stop(info));
+    }
     do {
+	if (info->is_thread && (info->run.index == 0)) {
+	    flags |= cri_group_join();
+	}
+
 	if (flags & CR_CHECKPOINT_ABORT_MASK) {
 	    // We've detected failure of the invoking callback
 	    // We we must now call the kernel and stop stacking of callbacks.
@@ -232,14 +260,18 @@ int cr_checkpoint(int flags)
     
 	index = --info->run.index;
 	if (index >= 0) {
-	    // Call the next callback, skipping NULLs
-
-	    if (info->cr_cb[index].func != NULL) {
-		info->run.id = index;
-		rc = (*info->cr_cb[index].func)(info->cr_cb[index].arg);
+	    // Call the next callback, skipping any replaced w/ NULL
+	    const int id = info->cr_run[index];
+
+	    if ((info->cr_cb[id].func != NULL) &&
+		!(info->is_thread && cri_group_owns(id))) {
+		info->run.id = id;
+		cri_cb_timer_start(info, id);
+		rc = (*info->cr_cb[id].func)(info->cr_cb[id].arg);
+		cri_cb_timer_note(info, id, cri_cb_timer_stop(info));
 		if (rc) {
 		    LIBCR_TRACE(LIBCR_TRACE_INFO, "Callback %d returned %d - ABORTING\n",
-				index, rc);
+				id, rc);
 		    (void)cri_syscall_token(token, CR_OP_HAND_ABORT, CR_CHECKPOINT_PERM_FAILURE);
 		    CRI_ABORT("Unexpected return from CR_OP_HAND_ABORT");
 		}
@@ -247,6 +279,10 @@ int cr_checkpoint(int flags)
 	} else {
 	    LIBCR_TRACE(LIBCR_TRACE_INFO, "[%d] CHECKPOINTING (flags=%d)",
 			pid, flags);
+	    info->cb_times.cb_end = cri_clock_ns();
+	    // Failure (e.g. ENOTTY from an older kernel) only loses the report
+	    (void)cri_syscall_token(token, CR_OP_HAND_TIMES, (uintptr_t)&info->cb_times);
+	    cri_exclude_report(token);
 	    info->run.rc = do_checkpoint(info->run.token, flags);
 	    if (info->run.rc < 0) {
 		LIBCR_TRACE(LIBCR_TRACE_INFO,
@@ -259,16 +295,26 @@ int cr_checkpoint(int flags)
 	}
     } while (info->run.index >= 0);
 
+    if (info->is_thread) {
+	cri_group_release(info);
+    }
+
     // Once the outer-most invocation calls CR_OP_HAND_{CONT,RSTRT}
     // the kernel might checkpoint us again.  Save the return value now
     // because a second checkpoint could modify info->run.rc.
     retval = info->run.rc;
 
     /* Restore saved id for possible use by the caller (in replace_self). */
-    info->run.id = my_id;
+    info->run.id = my_cb;
 
     // Perform cleanup only on the final/outer-most return
     if (outer_most) {
+	if (info->is_thread) {
+	    cri_group_finish();
+	}
+	if (info->cr_run_dirty) {
+	    cri_run_rebuild(info);
+	}
 	enter_idle_state(info);
 	cri_atomic_dec_and_test(&cri_live_count);
 	if (retval >= 0) {
@@ -343,6 +389,57 @@ void cri_checkpoint_info_init(cri_info_t *info)
     info->cr_restart_info.src = NULL;		// filled-in on demand
 }
 
+// cri_clock_ns()
+//
+// CLOCK_MONOTONIC in nanoseconds, which the kernel can compare w/ its own
+// timestamps.  Async-signal-safe.  Returns 0 if the clock is unavailable.
+unsigned long long cri_clock_ns(void)
+{
+    struct timespec ts;
+
+    if (__cri_clock_gettime(CLOCK_MONOTONIC, &ts, NULL) < 0) {
+	return 0;
+    }
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// cri_cb_timer_start()
+//
+// Start timing callback 'id' in this thread
+void cri_cb_timer_start(cri_info_t *info, int id)
+{
+    info->cb_cur = id;
+    info->cb_cur_start = cri_clock_ns();
+}
+
+// cri_cb_timer_stop()
+//
+// Stop timing the callback (if any) started in this thread.
+// A callback is timed until it calls cr_checkpoint() or returns,
+// whichever comes first.  Returns the time, or 0 if none was running.
+unsigned long long cri_cb_timer_stop(cri_info_t *info)
+{
+    unsigned long long ns;
+
+    if (!info->cb_cur_start) return 0;
+
+    ns = cri_clock_ns() - info->cb_cur_start;
+    info->cb_cur_start = 0;
+    return ns;
+}
+
+// cri_cb_timer_note()
+//
+// Keep callback 'id' in info->cb_times if it is the slowest so far
+void cri_cb_timer_note(cri_info_t *info, int id, unsigned long long ns)
+{
+    if (ns > info->cb_times.slow_ns) {
+	info->cb_times.slow_ns = ns;
+	info->cb_times.slow_id = id;
+	info->cb_times.slow_func = (unsigned long long)(uintptr_t)info->cr_cb[id].func;
+    }
+}
+
 // cri_info_free()
 //
 // dtor for thread-specific data
@@ -356,12 +453,13 @@ cri_info_free(void *val)
     cri_info_t *info = (cri_info_t *)val;
 
     if (info && !info->persist) {
+	cri_rb_slot_put(&cri_cs_lock, info->cs_slot);
 	free(info);
 	info = NULL;
     }
 
     // Clear if destroyed, reinstall otherwise:
-    pthread_setspecific(cri_info_key, info);
+    cri_info_set(info);
 }
 
 
@@ -386,9 +484,10 @@ cri_info_t* cri_info_init(void)
 	info->next_id = 0;
 	info->is_thread = 0;
 	info->persist = 0;
+	info->cs_slot = cri_rb_slot_get(&cri_cs_lock);
 	cri_atomic_write(&info->hold, CR_HOLD_DFLT);
 
-	rc = pthread_setspecific(cri_info_key, info);
+	rc = cri_info_set(info);
 	if (rc != 0) {
 	    CRI_ABORT("pthread_setspecific() returned %d", rc);
 	}
@@ -407,7 +506,7 @@ void cri_start_checkpoint(cri_info_t *info)
 #if LIBCR_TRACING
 	int pid = (int)getpid();
 #endif
-	info->run.index = info->cr_cb_count;
+	info->run.index = info->cr_run_count;
 	LIBCR_TRACE(LIBCR_TRACE_INFO, "[%d] START", pid);
 	(void) cr_checkpoint(0);
 	LIBCR_TRACE(LIBCR_TRACE_INFO, "[%d] DONE", pid);
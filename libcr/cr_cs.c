@@ -25,6 +25,7 @@
  */
 
 #include <errno.h>
+#include <string.h>
 
 #include "cr_private.h"
 
@@ -94,8 +95,8 @@ try_enter(cri_info_t *info) {
 
     if (old > 1) {
 	// Not the outermost, so proceed normally
-	cri_red_lock(&cri_cs_lock);
-    } else if (cri_atomic_read(&cri_live_count) || cri_red_trylock(&cri_cs_lock)) {
+	cri_red_lock(&cri_cs_lock, info->cs_slot);
+    } else if (cri_atomic_read(&cri_live_count) || cri_red_trylock(&cri_cs_lock, info->cs_slot)) {
 	// PENDING - let it proceed if ready, but retry regardless
 #if 1
         /* XXX: What the heck is this??
@@ -165,11 +166,116 @@ cri_do_leave(cri_info_t		*info,
 	     cr_client_id_t	id)
 {
     if (cri_atomic_read(&info->cr_state) != CR_STATE_ACTIVE) {
-	cri_red_unlock(&cri_cs_lock);
+	cri_red_unlock(&cri_cs_lock, info->cs_slot);
 	poll_checkpoint(info);
     }
 }
 
+// run_find()
+//
+// Binary search of info->cr_run[] for callback 'id'.
+// Returns the position of 'id', or where it would be inserted.
+static unsigned int
+run_find(cri_info_t *info, int id, int *found)
+{
+    unsigned int lo = 0;
+    unsigned int hi = info->cr_run_count;
+
+    while (lo < hi) {
+	unsigned int mid = lo + (hi - lo) / 2;
+	if (info->cr_run[mid] < id) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+    *found = (lo < info->cr_run_count) && (info->cr_run[lo] == id);
+    return lo;
+}
+
+// run_reserve()
+//
+// Ensure info->cr_run[] has room for 'count' ids.
+// Moving the array is safe even during a checkpoint, since dispatch
+// reads info->cr_run afresh for each callback.
+// Returns 0 on success, or -1 w/ errno set.
+static int
+run_reserve(cri_info_t *info, unsigned int count)
+{
+    if (count > info->cr_run_alloc) {
+	unsigned int alloc = info->cr_run_alloc ? info->cr_run_alloc : 16;
+	int *tmp;
+	while (alloc < count) alloc *= 2;
+	tmp = realloc(info->cr_run, alloc * sizeof(int));
+	if (!tmp) {
+	    // Assume that errno==ENOMEM as required Unix98 standard
+	    return -1;
+	}
+	info->cr_run = tmp;
+	info->cr_run_alloc = alloc;
+    }
+    return 0;
+}
+
+// run_insert()
+//
+// Add callback 'id' to info->cr_run[] if not already present.
+// During a checkpoint only ensures there will be room for it in
+// cri_run_rebuild(), since reordering would disturb the dispatch.
+// Returns 0 on success, or -1 w/ errno set.
+static int
+run_insert(cri_info_t *info, int id)
+{
+    unsigned int pos;
+    int found;
+
+    if (cri_atomic_read(&info->cr_state) == CR_STATE_ACTIVE) {
+	// Room for every id up to and including 'id'
+	if (run_reserve(info, info->cr_cb_count + 1) < 0) {
+	    return -1;
+	}
+	info->cr_run_dirty = 1;
+	return 0;
+    }
+
+    pos = run_find(info, id, &found);
+    if (found) return 0;
+
+    if (run_reserve(info, info->cr_run_count + 1) < 0) {
+	return -1;
+    }
+
+    memmove(&info->cr_run[pos + 1], &info->cr_run[pos],
+	    (info->cr_run_count - pos) * sizeof(int));
+    info->cr_run[pos] = id;
+    info->cr_run_count += 1;
+
+    return 0;
+}
+
+// run_remove()
+//
+// Drop callback 'id' from info->cr_run[], if present.
+// During a checkpoint this is left to cri_run_rebuild().
+static void
+run_remove(cri_info_t *info, int id)
+{
+    unsigned int pos;
+    int found;
+
+    if (cri_atomic_read(&info->cr_state) == CR_STATE_ACTIVE) {
+	info->cr_run_dirty = 1;
+	return;
+    }
+
+    pos = run_find(info, id, &found);
+    if (!found) return;
+
+    info->cr_run_count -= 1;
+    memmove(&info->cr_run[pos], &info->cr_run[pos + 1],
+	    (info->cr_run_count - pos) * sizeof(int));
+}
+
 // Not reentrant.  Must be called inside a critical section.
 static cr_callback_id_t
 cri_register_signal(cri_info_t*		info,
@@ -177,6 +283,11 @@ cri_register_signal(cri_info_t*		info,
 		    void*		arg,
 		    int			flags)
 {
+    if (flags & CR_CONCURRENT) {
+	// Only meaningful for thread-context callbacks
+	errno = EINVAL;
+	return -1;
+    }
     return cri_do_register(info, func, arg, flags);
 }
 
@@ -188,6 +299,11 @@ cri_replace_signal(cri_info_t		*info,
 		   void*		arg,
 		   int			flags)
 {
+    if (flags & CR_CONCURRENT) {
+	// Only meaningful for thread-context callbacks
+	errno = EINVAL;
+	return -1;
+    }
     return cri_do_replace(info, id, func, arg, flags);
 }
 
@@ -211,17 +327,25 @@ cri_do_register(cri_info_t	*info,
     if (indx < CR_MAX_CALLBACKS) {
 	int next = indx + 1;
 
-	// Grow on demand
-	info->cr_cb = realloc(info->cr_cb, next * sizeof(*info->cr_cb));
-	if (!info->cr_cb) {
-	    // Assume that errno==ENOMEM as required Unix98 standard
-	    return -1;
+	// Grow on demand, geometrically since there may be thousands
+	if (next > info->cr_cb_alloc) {
+	    unsigned int alloc = info->cr_cb_alloc ? 2 * info->cr_cb_alloc : 16;
+	    void *tmp = realloc(info->cr_cb, alloc * sizeof(*info->cr_cb));
+	    if (!tmp) {
+		// Assume that errno==ENOMEM as required Unix98 standard
+		return -1;
+	    }
+	    info->cr_cb = tmp;
+	    info->cr_cb_alloc = alloc;
 	}
 
 	// Set entry before advancing the count
 	info->cr_cb[indx].func  = func;
 	info->cr_cb[indx].arg   = arg;
 	info->cr_cb[indx].flags = flags;
+	if (func && (run_insert(info, indx) < 0)) {
+	    return -1;
+	}
 	info->cr_cb_count = next;
 
 	return indx;
@@ -250,6 +374,13 @@ cri_do_replace(cri_info_t	*info,
     if ((flags & CRI_CONTEXT_MASK) == (id & CRI_CONTEXT_MASK)) {
 	id &= ~CRI_CONTEXT_MASK;
 	if ((id >= 0) && (id < info->cr_cb_count)) {
+	    if (func) {
+		if (run_insert(info, id) < 0) {
+		    return -1;
+		}
+	    } else {
+		run_remove(info, id);
+	    }
 	    info->cr_cb[id].func  = func;
 	    info->cr_cb[id].arg   = arg;
 	    info->cr_cb[id].flags = flags;
@@ -264,6 +395,39 @@ cri_do_replace(cri_info_t	*info,
     return retval;
 }
 
+// cri_run_reserve()
+//
+// Ensure that no run_insert() until the next cri_run_rebuild() will move
+// info->cr_run[], as long as no new callbacks are registered meanwhile.
+// Returns 0 on success, or -1 w/ errno set.
+int
+cri_run_reserve(cri_info_t *info)
+{
+    return run_reserve(info, info->cr_cb_count + 1);
+}
+
+// cri_run_rebuild()
+//
+// Rebuild info->cr_run[] from info->cr_cb[] after a checkpoint during
+// which callbacks were registered or replaced.  Cannot fail, since
+// run_insert() reserved the space.
+//
+// Must be called before leaving the ACTIVE state.
+void
+cri_run_rebuild(cri_info_t *info)
+{
+    unsigned int count = 0;
+    unsigned int id;
+
+    for (id = 0; id < info->cr_cb_count; ++id) {
+	if (info->cr_cb[id].func) {
+	    info->cr_run[count++] = id;
+	}
+    }
+    info->cr_run_count = count;
+    info->cr_run_dirty = 0;
+}
+
 cr_callback_id_t
 cr_register_callback(cr_callback_t	func,
 		     void*		arg,
@@ -348,13 +512,24 @@ cr_replace_self(cr_callback_t	func,
 		int		flags)
 {
     cri_info_t *info = CRI_CB_INFO_OR_RETURN(-1);	// thread-specific
+    cri_info_t *owner = info->cb_owner ? info->cb_owner : info;
     cr_callback_id_t id;
 
     /* form the full id from the index and context */
     id = info->run.id;
-    id |= (info->cr_cb[id].flags & CRI_CONTEXT_MASK);
+    id |= (owner->cr_cb[id].flags & CRI_CONTEXT_MASK);
 
-    return cri_do_replace(info, id, func, arg, flags);
+    if (owner != info) {
+	// A pool thread: the checkpoint thread may be walking the owner's
+	// callbacks right now, so the change is applied when the group ends.
+	if ((flags & CRI_CONTEXT_MASK) != (id & CRI_CONTEXT_MASK)) {
+	    errno = EINVAL;
+	    return -1;
+	}
+	cri_group_replace(id, func, arg, flags);
+	return 0;
+    }
+    return cri_do_replace(owner, id, func, arg, flags);
 }
 
 int
@@ -403,6 +578,10 @@ const struct cr_checkpoint_info * cr_get_checkpoint_info(void)
     if (!info || cri_atomic_read(&info->cr_state) != CR_STATE_ACTIVE) {
 	return NULL;
     }
+    if (info->cb_owner) {
+	// In the pool: already fetched by the checkpoint thread
+	info = info->cb_owner;
+    }
 
     result =  &(info->cr_checkpoint_info);
     if (result->dest == NULL) {
@@ -437,6 +616,10 @@ const struct cr_restart_info * cr_get_restart_info(void)
     if (!info || cri_atomic_read(&info->cr_state) != CR_STATE_ACTIVE) {
 	return NULL;
     }
+    if (info->cb_owner) {
+	// In the pool: already fetched by the checkpoint thread
+	info = info->cb_owner;
+    }
 
     result =  &(info->cr_restart_info);
     result->requester = info->run.rc;	// Pid of cr_restart was returned from syscall
@@ -0,0 +1,224 @@
+/*
+ * Berkeley Lab Checkpoint/Restart (BLCR) for Linux is Copyright (c)
+ * 2008, The Regents of the University of California, through Lawrence
+ * Berkeley National Laboratory (subject to receipt of any required
+ * approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Portions may be copyrighted by others, as may be noted in specific
+ * copyright notices within specific files.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Ranges of memory the client asks to leave out of its checkpoints.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "cr_private.h"
+
+//
+// Private variables
+//
+
+// The ranges, sorted and disjoint.
+// They are only changed inside a critical section, so never while a
+// checkpoint is reading them.  The mutex orders concurrent changes.
+static struct cr_exclude_range *exclude_tbl = NULL;		// GLOBAL
+static unsigned int exclude_count = 0;				// GLOBAL
+static unsigned int exclude_alloc = 0;				// GLOBAL
+static pthread_mutex_t exclude_lock = PTHREAD_MUTEX_INITIALIZER;	// GLOBAL
+
+//
+// Private functions
+//
+
+// Make room for 'n' more entries.
+// Returns 0 on success, or -1 w/ errno set.
+static int
+exclude_reserve(unsigned int n)
+{
+    struct cr_exclude_range *tmp;
+    unsigned int alloc;
+
+    if (exclude_count + n <= exclude_alloc) {
+	return 0;
+    }
+    if (exclude_count + n > CR_EXCLUDE_MAX) {
+	errno = ENOSPC;
+	return -1;
+    }
+
+    alloc = exclude_alloc ? (2 * exclude_alloc) : 16;
+    if (alloc < exclude_count + n) alloc = exclude_count + n;
+    tmp = realloc(exclude_tbl, alloc * sizeof(*tmp));
+    if (!tmp) {
+	errno = ENOMEM;
+	return -1;
+    }
+    exclude_tbl = tmp;
+    exclude_alloc = alloc;
+    return 0;
+}
+
+// Take [start, end) out of the table.
+// Requires one free entry, in case a range must be split.
+static void
+exclude_remove(unsigned long long start, unsigned long long end)
+{
+    unsigned int i = 0;
+
+    while (i < exclude_count) {
+	struct cr_exclude_range *r = &exclude_tbl[i];
+
+	if ((r->end <= start) || (r->start >= end)) {
+	    ++i;
+	} else if ((r->start < start) && (r->end > end)) {
+	    // Split in two, and nothing else can overlap
+	    memmove(r + 1, r, (exclude_count - i) * sizeof(*r));
+	    r[0].end = start;
+	    r[1].start = end;
+	    ++exclude_count;
+	    return;
+	} else if (r->start < start) {
+	    r->end = start;
+	    ++i;
+	} else if (r->end > end) {
+	    r->start = end;
+	    ++i;
+	} else {
+	    memmove(r, r + 1, (exclude_count - i - 1) * sizeof(*r));
+	    --exclude_count;
+	}
+    }
+}
+
+// Add [start, end), which must not overlap any entry.
+// Merges with neighbors of the same kind, else requires one free entry.
+static void
+exclude_insert(unsigned long long start, unsigned long long end, int how)
+{
+    struct cr_exclude_range *r;
+    unsigned int i = 0;
+
+    while ((i < exclude_count) && (exclude_tbl[i].start < start)) ++i;
+
+    if (i && (exclude_tbl[i-1].end == start) && (exclude_tbl[i-1].how == how)) {
+	r = &exclude_tbl[i-1];
+	r->end = end;
+	if ((i < exclude_count) && (r[1].start == end) && (r[1].how == how)) {
+	    r->end = r[1].end;
+	    memmove(r + 1, r + 2, (exclude_count - i - 1) * sizeof(*r));
+	    --exclude_count;
+	}
+    } else if ((i < exclude_count) && (exclude_tbl[i].start == end) && (exclude_tbl[i].how == how)) {
+	exclude_tbl[i].start = start;
+    } else {
+	r = &exclude_tbl[i];
+	memmove(r + 1, r, (exclude_count - i) * sizeof(*r));
+	r->start = start;
+	r->end = end;
+	r->how = how;
+	++exclude_count;
+    }
+}
+
+// Common code for cr_exclude_region() and cr_include_region()
+// A 'how' of -1 means include.
+static int
+do_update(void *addr, size_t len, int how)
+{
+    cri_info_t *info = CRI_INFO_OR_RETURN(-1);	// thread-specific
+    const unsigned long long mask = (unsigned long long)getpagesize() - 1;
+    unsigned long long start, end;
+    int retval = 0;
+
+    if ((how < -1) || (how > CR_EXCLUDE_UNMAP) ||
+	((uintptr_t)addr + len < (uintptr_t)addr)) {
+	errno = EINVAL;
+	return -1;
+    }
+
+    if (how < 0) {
+	// Include any page the region touches
+	start = (uintptr_t)addr & ~mask;
+	end = ((uintptr_t)addr + len + mask) & ~mask;
+    } else {
+	// Exclude only the pages it covers entirely
+	start = ((uintptr_t)addr + mask) & ~mask;
+	end = ((uintptr_t)addr + len) & ~mask;
+    }
+    if (start >= end) {
+	return 0;
+    }
+
+    (void)cri_do_enter(info, CRI_ID_INTERNAL);
+    pthread_mutex_lock(&exclude_lock);
+    if (exclude_reserve((how < 0) ? 1 : 2) < 0) {
+	retval = -1;
+    } else {
+	exclude_remove(start, end);
+	if (how >= 0) {
+	    exclude_insert(start, end, how);
+	}
+    }
+    pthread_mutex_unlock(&exclude_lock);
+    cri_do_leave(info, CRI_ID_INTERNAL);
+
+    return retval;
+}
+
+//
+// Public functions
+//
+
+int
+cr_exclude_region(void *addr, size_t len, int how)
+{
+    if (how < 0) {
+	errno = EINVAL;
+	return -1;
+    }
+    return do_update(addr, len, how);
+}
+
+int
+cr_include_region(void *addr, size_t len)
+{
+    return do_update(addr, len, -1);
+}
+
+//
+// Internal functions
+//
+
+// Pass the table to the kernel, just before CR_OP_HAND_CHKPT.
+// Called while running callbacks, so no critical section can be held.
+// Failure (e.g. ENOTTY from an older kernel) only means everything is saved.
+void
+cri_exclude_report(int token)
+{
+    struct cr_exclude_args args;
+
+    if (!exclude_count) return;
+
+    args.ranges = (uintptr_t)exclude_tbl;
+    args.count = exclude_count;
+    (void)cri_syscall_token(token, CR_OP_HAND_EXCLUDE, (uintptr_t)&args);
+}
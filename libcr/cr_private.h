@@ -86,14 +86,27 @@ typedef struct cri_info_s {
     /* Count of critical sections */
     cri_atomic_t	cr_cs_count;
 
+    /* Our reader slot in cri_cs_lock (NULL if none were free) */
+    cri_rb_slot_t	*cs_slot;
+
     /* Vector of registered checkpoint callbacks and their private data */
     unsigned int	cr_cb_count;
+    unsigned int	cr_cb_alloc;	// Allocated length of cr_cb[]
     struct {
 	cr_callback_t		func;	// The function to invoke
 	void*			arg;	// The argument to the function
 	int			flags;	// The flags
     }			*cr_cb;
 
+    /* Ascending ids of the non-NULL entries in cr_cb[], so dispatch need
+     * not rescan NULLs.  Never reordered while a checkpoint walks it: changes
+     * made then just set cr_run_dirty, and it is rebuilt afterwards.  So it
+     * may hold ids set to NULL during a checkpoint, which dispatch skips. */
+    unsigned int	cr_run_count;
+    unsigned int	cr_run_alloc;
+    int			*cr_run;
+    int			cr_run_dirty;
+
     /* What identifier to return next from cr_init() */
     cr_client_id_t	next_id;
 
@@ -103,17 +116,25 @@ typedef struct cri_info_s {
     /* Are we the thread to run thread-context callbacks? */
     int			is_thread;
 
+    /* If running a CR_CONCURRENT callback, the info of the thread above */
+    struct cri_info_s	*cb_owner;
+
     /* Hold flags for CR_OP_HAND_DONE */
     cri_atomic_t	hold;
 
     /* Data needed to invoke all the callbacks in order */
     struct {
 	int			token;
-	int			index;	/* Counts down only */
+	int			index;	/* Position in cr_run[], counts down only */
 	int			id;	/* Tracks id of running callback (down and up again) */
 	int			rc;	/* Saves the return code */
     }			run;
 
+    /* Callback times for the kernel's critical-path report */
+    struct cr_hand_times	cb_times;
+    int				cb_cur;		/* id of callback being timed... */
+    unsigned long long		cb_cur_start;	/* ...since this time, or 0 */
+
     /* Thread-local info about the checkpoint request */
     struct cr_checkpoint_info	cr_checkpoint_info;
 
@@ -161,7 +182,34 @@ extern volatile cr_hook_fn_t cri_hook_tbl[CR_NUM_HOOKS];	// GLOBAL
     } while (0)
 
 // Location of the (possibly thread-specific) cr_info
-#define cri_info_location()	((cri_info_t *)pthread_getspecific(cri_info_key))
+// By default this is a TLS slot, which is cheaper than pthread_getspecific.
+// The static library uses the initial-exec model.  libcr.so may be
+// dlopen()ed, so it uses the default (global-dynamic) model, where the
+// first access to the slot in a thread may malloc() its TLS block.
+// That first access is the write in cri_info_set(), so handlers which
+// only run in threads w/ a cri_info are fine.  However, cri_sig_handler()
+// may run in a thread libcr never saw, and so uses
+// cri_info_location_async(), which in libcr.so is pthread_getspecific().
+// Build w/ -DCRI_USE_TLS=0 for the pthread_getspecific lookup everywhere.
+#ifndef CRI_USE_TLS
+  #define CRI_USE_TLS 1
+#endif
+#if CRI_USE_TLS && PIC
+  extern __thread cri_info_t *cri_info_tls;	// GLOBAL
+  #define cri_info_location()	(cri_info_tls)
+  #define cri_info_location_async()	((cri_info_t *)pthread_getspecific(cri_info_key))
+#elif CRI_USE_TLS
+  extern __thread cri_info_t *cri_info_tls	// GLOBAL
+	__attribute__((tls_model("initial-exec")));
+  #define cri_info_location()	(cri_info_tls)
+  #define cri_info_location_async()	cri_info_location()
+#else
+  #define cri_info_location()	((cri_info_t *)pthread_getspecific(cri_info_key))
+  #define cri_info_location_async()	cri_info_location()
+#endif
+
+// Install the cr_info for the calling thread
+extern int cri_info_set(cri_info_t *info);
 
 // Error-handling wrappers for cri_info_location()
 #define CRI_INFO_OR_RETURN(_val) ({                                           \
@@ -196,6 +244,15 @@ extern void cri_pthread_init(void);
   #define cri_atfork pthread_atfork
 #endif
 
+// Concurrent group of thread-context callbacks (see cr_async.c)
+extern void cri_group_start(cri_info_t *info);
+extern int cri_group_owns(int id);
+extern int cri_group_join(void);
+extern void cri_group_release(cri_info_t *info);
+extern void cri_group_finish(void);
+extern int cri_group_checkpoint(cri_info_t *info, int flags);
+extern void cri_group_replace(cr_callback_id_t, cr_callback_t, void*, int);
+
 // Register a callback
 extern cr_callback_id_t cri_do_register(cri_info_t*, cr_callback_t, void*, int);
 extern cr_callback_id_t cri_register_thread(cri_info_t*, cr_callback_t, void*, int);
@@ -204,11 +261,18 @@ extern cr_callback_id_t cri_register_thread(cri_info_t*, cr_callback_t, void*, i
 extern int cri_do_replace(cri_info_t*, cr_callback_id_t, cr_callback_t, void*, int);
 extern int cri_replace_thread(cri_info_t*, cr_callback_id_t, cr_callback_t, void*, int);
 
+// Apply the changes to the callbacks made during a checkpoint
+extern int cri_run_reserve(cri_info_t *info);
+extern void cri_run_rebuild(cri_info_t *info);
+
 // Enter/leave a critical section
 extern int cri_do_enter(cri_info_t *info, cr_client_id_t id);
 extern int cri_do_tryenter(cri_info_t *info, cr_client_id_t id);
 extern void cri_do_leave(cri_info_t *info, cr_client_id_t id);
 
+// Pass the ranges from cr_exclude_region() to the kernel (cr_exclude.c)
+extern void cri_exclude_report(int token);
+
 // Create or destroy cri_info_t
 extern cri_info_t* cri_info_init(void);
 extern void cri_info_free(void *);
@@ -216,6 +280,12 @@ extern void cri_info_free(void *);
 // Initialize checkpoint info
 extern void cri_checkpoint_info_init(cri_info_t *info);
 
+// Callback timing
+extern unsigned long long cri_clock_ns(void);
+extern void cri_cb_timer_start(cri_info_t *info, int id);
+extern unsigned long long cri_cb_timer_stop(cri_info_t *info);
+extern void cri_cb_timer_note(cri_info_t *info, int id, unsigned long long ns);
+
 // cr_sig_sync.c
 extern int cri_barrier_enter(cri_atomic_t *x);
 
@@ -50,13 +50,34 @@ cri_atfork(void (*prepare)(void), void (*parent)(void), void (*child)(void))
 // Holds thread-specific data key for cri_info
 pthread_key_t cri_info_key;
 
+#if CRI_USE_TLS
+// Holds the cri_info of each thread
+__thread cri_info_t *cri_info_tls = NULL;
+#endif
+
+// Install the cri_info for the calling thread
+int
+cri_info_set(cri_info_t *info)
+{
+#if CRI_USE_TLS
+    cri_info_tls = info;
+#endif
+    return pthread_setspecific(cri_info_key, info);
+}
+
 // atfork callback to reset the state
 static void
 child_reset(void)
 {
+    cri_info_t *info = cri_info_location();
+
     cri_rb_init(&cri_cs_lock);
     cri_atomic_write(&cri_live_count, 0);
-    cri_info_free(cri_info_location());
+    if (info) {
+	// The reset released all slots (the other threads are gone)
+	info->cs_slot = cri_rb_slot_get(&cri_cs_lock);
+    }
+    cri_info_free(info);
 }
 
 #if !HAVE___REGISTER_ATFORK
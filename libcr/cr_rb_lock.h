@@ -32,95 +32,336 @@
  * State == 0	Nobody holds the lock
  * State == +n  Lock is held by n Reds
  * State == -n  Lock is held by n Blacks
+ *
+ * Contended acquires spin (yielding) briefly and then block on a futex.
+ * Since we must still allow entering/leaving critical sections from signal
+ * context, the slow path uses only atomics and the raw futex syscall.
+ * Waiters announce themselves in 'waiters' and sleep on 'seq', which is
+ * bumped by any release that might let them proceed.
+ *
+ * Reds are by far the common case, so a Red may instead use a per-thread
+ * slot (see cri_rb_slot_get()).  A slotted Red increments only its own
+ * slot's count, and then checks that State is not negative.  A Black
+ * first makes State negative, and then waits for all slot counts to drain.
+ * So an uncontended slotted Red writes only thread-local cache lines.
+ *
+ * Slot 'held' counts the Reds actually held, while 'count' also includes
+ * any acquisitions in progress.  If a signal handler must block for the
+ * Blacks while an interrupted acquisition on the same thread is still
+ * counted, it hides that count (to let the Blacks run) and bumps 'revoked'
+ * so the interrupted acquisition knows to retry.
  */
 
 #ifndef _CR_RB_LOCK_H
 #define _CR_RB_LOCK_H 1
 
 #include "cr_atomic.h"	// for cri_atomic_t
+#include "cr_yield.h"	// for cri_yield() and cri_futex_*()
+
+// Max number of per-thread slots; threads beyond this use State
+#define CRI_RB_NSLOTS	256
+
+// Keep each slot on its own cache line
+#define CRI_RB_CACHELINE	64
 
-// XXX:
-// If contention is common then look for a way to block rather than spinning
-// on the value of x.  This would be much easier if we stopped allowing
-// an application/library to enter/leave critical sections from signal context.
+typedef struct {
+    cri_atomic_t	count;		// Reds held or being acquired
+    cri_atomic_t	held;		// Reds held (owning thread only)
+    cri_atomic_t	revoked;	// bumped when a handler hides 'count'
+    cri_atomic_t	in_use;		// slot is claimed by a thread
+} __attribute__((aligned(CRI_RB_CACHELINE))) cri_rb_slot_t;
 
-typedef cri_atomic_t cri_rb_lock_t;
+typedef struct {
+    cri_atomic_t	state;		// as described above
+    cri_atomic_t	waiters;	// threads blocked (or about to block)
+    cri_atomic_t	seq;		// futex word, bumped on release
+    cri_atomic_t	nslots;		// high-water mark of claimed slots
+    cri_rb_slot_t	slot[CRI_RB_NSLOTS];
+} cri_rb_lock_t;
 
 #define	CRI_RB_LOCK_INITIALIZER	{0,}
 
+// How many times to yield before blocking on the futex
+#define CRI_RB_SPIN	4
+
 // cri_rb_init()
+//
+// Also releases all slots (as after fork())
 CR_INLINE void cri_rb_init(cri_rb_lock_t 	*x)
 {
-    cri_atomic_write(x, 0);
+    int i;
+
+    for (i = 0; i < CRI_RB_NSLOTS; ++i) {
+	cri_rb_slot_t *s = &x->slot[i];
+	cri_atomic_write(&s->count, 0);
+	cri_atomic_write(&s->held, 0);
+	cri_atomic_write(&s->revoked, 0);
+	cri_atomic_write(&s->in_use, 0);
+    }
+    cri_atomic_write(&x->nslots, 0);
+    cri_atomic_write(&x->state, 0);
+    cri_atomic_write(&x->waiters, 0);
+    cri_atomic_write(&x->seq, 0);
+}
+
+// cri_rb_add()
+//
+// Atomically adds delta to *p, returning the new value
+CR_INLINE unsigned int cri_rb_add(cri_atomic_t *p, unsigned int delta)
+{
+    unsigned int old;
+
+    do {
+	old = cri_atomic_read(p);
+    } while (!cri_cmp_swap(p, old, old + delta));
+    return old + delta;
+}
+
+// cri_rb_slot_get()
+//
+// Claims a slot for the calling thread, or returns NULL if none are left.
+// Not signal safe (but need not be, as it is called at thread init).
+CR_INLINE cri_rb_slot_t *cri_rb_slot_get(cri_rb_lock_t *x)
+{
+    unsigned int i, n;
+
+    for (i = 0; i < CRI_RB_NSLOTS; ++i) {
+	cri_rb_slot_t *s = &x->slot[i];
+	if (!cri_atomic_read(&s->in_use) && cri_cmp_swap(&s->in_use, 0, 1)) {
+	    do {
+		n = cri_atomic_read(&x->nslots);
+	    } while ((n <= i) && !cri_cmp_swap(&x->nslots, n, i + 1));
+	    return s;
+	}
+    }
+    return NULL;
+}
+
+// cri_rb_slot_put()
+//
+// Releases a slot, which must not hold any Reds
+CR_INLINE void cri_rb_slot_put(cri_rb_lock_t *x, cri_rb_slot_t *s)
+{
+    if (s) {
+	cri_atomic_write(&s->in_use, 0);
+    }
+}
+
+// cri_rb_slot_reds()
+//
+// Non-zero if any slot holds (or is acquiring) a Red
+CR_INLINE int cri_rb_slot_reds(cri_rb_lock_t *x)
+{
+    unsigned int i, n = cri_atomic_read(&x->nslots);
+
+    for (i = 0; i < n; ++i) {
+	if (cri_atomic_read(&x->slot[i].count)) return 1;
+    }
+    return 0;
+}
+
+// cri_rb_wait()
+//
+// Slow path: wait for the state to change sign (or become 0).
+// 'sign' is +1 if a Red is waiting for the Blacks, -1 for the reverse.
+// With 'sign' of 0, a Black waits for the slotted Reds to drain.
+CR_INLINE void cri_rb_wait(cri_rb_lock_t *x, int sign, int *count)
+{
+    unsigned int seq;
+    int blocked;
+
+    if (*count < CRI_RB_SPIN) {
+	cri_yield(count);
+	return;
+    }
+
+    seq = cri_atomic_read(&x->seq);
+    cri_atomic_inc(&x->waiters);
+    // Recheck after announcing ourself, or we could miss the wakeup
+    if (sign) {
+	blocked = (sign * (int)cri_atomic_read(&x->state) < 0);
+    } else {
+	blocked = cri_rb_slot_reds(x);
+    }
+    if (blocked) {
+	cri_futex_wait(&x->seq, seq, count);
+    }
+    (void)cri_atomic_dec_and_test(&x->waiters);
+}
+
+// cri_rb_wake()
+//
+// Called by whoever returned the state (or a slot count) to 0
+CR_INLINE void cri_rb_wake(cri_rb_lock_t *x)
+{
+    if (cri_atomic_read(&x->waiters)) {
+	cri_atomic_inc(&x->seq);
+	cri_futex_wake(&x->seq, INT_MAX);
+    }
+}
+
+// cri_rb_slot_release()
+//
+// Drops one from a slot's count, waking any waiting Blacks on reaching 0
+CR_INLINE void cri_rb_slot_release(cri_rb_lock_t *x, cri_rb_slot_t *s)
+{
+    if (cri_atomic_dec_and_test(&s->count)) {
+	cri_rb_wake(x);
+    }
+}
+
+// cri_rb_slot_try()
+//
+// Fast path for a slotted Red.
+// Returns 0 on success, or non-zero if there are Blacks.
+CR_INLINE int cri_rb_slot_try(cri_rb_lock_t *x, cri_rb_slot_t *s)
+{
+    unsigned int revoked = cri_atomic_read(&s->revoked);
+
+    cri_atomic_inc(&s->count);
+    if (cri_atomic_read(&s->held)) {
+	// Nested: this thread already excludes the Blacks
+	cri_atomic_inc(&s->held);
+	return 0;
+    }
+    if ((int)cri_atomic_read(&x->state) >= 0) {
+	cri_atomic_inc(&s->held);
+	if (cri_atomic_read(&s->revoked) == revoked) {
+	    return 0;
+	}
+	// A signal handler hid our count before we held the Red
+	(void)cri_atomic_dec_and_test(&s->held);
+    }
+    cri_rb_slot_release(x, s);
+    return 1;
+}
+
+// cri_rb_slot_wait()
+//
+// Wait for the Blacks, after a failed cri_rb_slot_try().
+// Any count that remains belongs to an acquisition we interrupted (we are
+// in a signal handler), which must be hidden while we wait.
+CR_INLINE void cri_rb_slot_wait(cri_rb_lock_t *x, cri_rb_slot_t *s, int *count)
+{
+    unsigned int hidden = cri_atomic_read(&s->count);
+
+    if (hidden) {
+	cri_atomic_inc(&s->revoked);
+	if (!cri_rb_add(&s->count, -hidden)) {
+	    cri_rb_wake(x);
+	}
+    }
+    while ((int)cri_atomic_read(&x->state) < 0) {
+	cri_rb_wait(x, 1, count);
+    }
+    if (hidden) {
+	(void)cri_rb_add(&s->count, hidden);
+    }
 }
 
 // cri_red_lock()
 //
 // Acquires the lock by incrementing x iff (x >= 0)
+// With a slot, increments the slot count iff (x >= 0) instead.
 //
-CR_INLINE void cri_red_lock(cri_rb_lock_t	*x)
+CR_INLINE void cri_red_lock(cri_rb_lock_t	*x, cri_rb_slot_t *s)
 {
+    int count = 0;
     int old;
 
+    if (s) {
+	while (cri_rb_slot_try(x, s)) {
+	    cri_rb_slot_wait(x, s, &count);
+	}
+	return;
+    }
+
     do {
-	CRI_WHILE_COND_YIELD((old = cri_atomic_read(x)) < 0);
-    } while (!cri_cmp_swap(x, old, old + 1));
+	while ((old = cri_atomic_read(&x->state)) < 0) {
+	    cri_rb_wait(x, 1, &count);
+	}
+    } while (!cri_cmp_swap(&x->state, old, old + 1));
 }
 
 // cri_red_trylock()
 //
 // Acquires the lock by incrementing x iff (x >= 0)
 // Returns 0 on success
-CR_INLINE int cri_red_trylock(cri_rb_lock_t	*x)
+CR_INLINE int cri_red_trylock(cri_rb_lock_t	*x, cri_rb_slot_t *s)
 {
     int old;
 
+    if (s) {
+	return cri_rb_slot_try(x, s);
+    }
+
     do {
-	if ((old = cri_atomic_read(x)) < 0) return 1;
-    } while (!cri_cmp_swap(x, old, old + 1));
+	if ((old = cri_atomic_read(&x->state)) < 0) return 1;
+    } while (!cri_cmp_swap(&x->state, old, old + 1));
     return 0;
 }
 
 // cri_red_unlock()
 //
-// Releases the lock by decrementing state
-CR_INLINE void cri_red_unlock(cri_rb_lock_t	*x)
+// Releases the lock by decrementing state (or the slot count)
+CR_INLINE void cri_red_unlock(cri_rb_lock_t	*x, cri_rb_slot_t *s)
 {
-    (void)cri_atomic_dec_and_test(x);
+    if (s) {
+	// Order matters: a handler may run between these two steps
+	(void)cri_atomic_dec_and_test(&s->held);
+	cri_rb_slot_release(x, s);
+    } else if (cri_atomic_dec_and_test(&x->state)) {
+	cri_rb_wake(x);
+    }
 }
 
 // cri_black_lock()
 //
-// Acquires the lock by decrementing state iff (state <= 0).
+// Acquires the lock by decrementing state iff (state <= 0),
+// and then waiting for any slotted Reds to drain.
 CR_INLINE void cri_black_lock(cri_rb_lock_t	*x)
 {
+    int count = 0;
     int old;
 
     do {
-	CRI_WHILE_COND_YIELD((old = cri_atomic_read(x)) > 0);
-    } while (!cri_cmp_swap(x, old, old - 1));
+	while ((old = cri_atomic_read(&x->state)) > 0) {
+	    cri_rb_wait(x, -1, &count);
+	}
+    } while (!cri_cmp_swap(&x->state, old, old - 1));
+
+    count = 0;
+    while (cri_rb_slot_reds(x)) {
+	cri_rb_wait(x, 0, &count);
+    }
 }
 
-// cri_red_trylock()
+// cri_black_unlock()
 //
-// Acquires the lock by decrementing x iff (x <= 0)
+// Releases the lock by incrementing state
+CR_INLINE void cri_black_unlock(cri_rb_lock_t	*x)
+{
+    if (!cri_rb_add(&x->state, 1)) {
+	cri_rb_wake(x);
+    }
+}
+
+// cri_black_trylock()
+//
+// Acquires the lock by decrementing x iff (x <= 0) and no slotted Reds
 // Returns 0 on success
 CR_INLINE int cri_black_trylock(cri_rb_lock_t	*x)
 {
     int old;
 
     do {
-	if ((old = cri_atomic_read(x)) > 0) return 1;
-    } while (!cri_cmp_swap(x, old, old - 1));
+	if ((old = cri_atomic_read(&x->state)) > 0) return 1;
+    } while (!cri_cmp_swap(&x->state, old, old - 1));
+    if (cri_rb_slot_reds(x)) {
+	cri_black_unlock(x);
+	return 1;
+    }
     return 0;
 }
 
-// cri_black_unlock()
-//
-// Releases the lock by incrementing state
-CR_INLINE void cri_black_unlock(cri_rb_lock_t	*x)
-{
-    cri_atomic_inc(x);
-}
-
 #endif /* _CR_RB_LOCK_H */
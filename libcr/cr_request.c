@@ -33,6 +33,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <signal.h>
 #include <errno.h>
 
@@ -368,6 +369,13 @@ int cr_log_checkpoint(cr_checkpoint_handle_t *handle, unsigned int len, char *ms
     return cri_syscall_token(token, CR_OP_CHKPT_LOG, (uintptr_t)&req);
 }
 
+// Collect phase times and counters
+int cr_stats_checkpoint(cr_checkpoint_handle_t *handle, struct cr_chkpt_stats *stats)
+{
+    int token = cri_chkpt_hndl_get_token(handle);
+    return cri_syscall_token(token, CR_OP_CHKPT_STATS, (uintptr_t)stats);
+}
+
 // Collect the result
 int cr_reap_checkpoint(cr_checkpoint_handle_t *handle)
 {
@@ -564,6 +572,38 @@ int cr_poll_restart(cr_restart_handle_t *handle, struct timeval *timeout) {
     return cr_poll_restart_msg(handle, timeout, NULL);
 }
 
+// Open one stream striped across several files
+int cr_open_striped(const int *fds, int count, unsigned long stripe_size,
+		    int is_write, unsigned long long length)
+{
+    struct cr_stripe_args req;
+    int token, i, rc;
+
+    if ((count < 1) || (count > CR_STRIPE_MAX)) {
+	errno = EINVAL;
+	return -1;
+    }
+
+    token = cri_connect_token();
+    if (token < 0) {
+	return token;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.stripe_size = stripe_size;
+    req.length      = is_write ? 0 : length;
+    req.count       = count;
+    req.is_write    = !!is_write;
+    for (i = 0; i < count; ++i) {
+	req.fds[i] = fds[i];
+    }
+
+    rc = cri_syscall_token(token, CR_OP_STRIPE, (uintptr_t)&req);
+    cri_disconnect_token(token); /* Might silently fail? */
+
+    return rc;
+}
+
 //
 // LEGACY checkpoint request interfaces, in terms of the current ones:
 //
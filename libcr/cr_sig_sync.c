@@ -32,8 +32,25 @@
 #define CRI_SL_DEBUG	0
 
 #define CRI_SL_LOCKED	0x27182818U	/* decimal digits of e */
+#define CRI_SL_WAITERS	0x31415926U	/* decimal digits of pi */
 #define CRI_SL_UNLOCKED	CR_SPINLOCK_INITIALIZER
 
+/* Contended spinlocks block on a futex rather than spinning.
+ * The lock word itself is the futex: CRI_SL_WAITERS means "locked and
+ * someone may be sleeping", which tells the unlocker to issue a wakeup.
+ */
+
+#if CRI_SL_DEBUG
+static void cri_sl_check(cri_atomic_t *p)
+{
+    cri_atomic_t tmp = cri_atomic_read(p);
+
+    if ((tmp != CRI_SL_LOCKED) && (tmp != CRI_SL_WAITERS) && (tmp != CRI_SL_UNLOCKED)) {
+	CRI_ABORT("Spinlock %p has invalid state %x", p, tmp);
+    }
+}
+#endif
+
 void cr_spinlock_init(cr_spinlock_t *x)
 {
     cri_atomic_t *p = (cri_atomic_t *)x;
@@ -44,17 +61,21 @@ void cr_spinlock_init(cr_spinlock_t *x)
 void cr_spinlock_lock(cr_spinlock_t *x)
 {
     cri_atomic_t *p = (cri_atomic_t *)x;
+    int count = 0;
 
     if (!cri_cmp_swap(p, CRI_SL_UNLOCKED, CRI_SL_LOCKED)) {
 #if CRI_SL_DEBUG
-	cri_atomic_t tmp = cri_atomic_read(p);
-
-	if ((tmp != CRI_SL_LOCKED) && (tmp != CRI_SL_UNLOCKED)) {
-	    CRI_ABORT("Spinlock %p has invalid state %x", p, tmp);
-	}
+	cri_sl_check(p);
 #endif
 
-	CRI_DO_YIELD_WHILE_COND(!cri_cmp_swap(p, CRI_SL_UNLOCKED, CRI_SL_LOCKED));
+	/* Mark the lock as having waiters before each sleep, and take it
+	 * in the same state, since we can't know if we were the only one. */
+	do {
+	    if ((cri_atomic_read(p) == CRI_SL_WAITERS) ||
+		cri_cmp_swap(p, CRI_SL_LOCKED, CRI_SL_WAITERS)) {
+		cri_futex_wait(p, CRI_SL_WAITERS, &count);
+	    }
+	} while (!cri_cmp_swap(p, CRI_SL_UNLOCKED, CRI_SL_WAITERS));
     }
 }
 
@@ -62,19 +83,20 @@ void cr_spinlock_unlock(cr_spinlock_t *x)
 {
     cri_atomic_t *p = (cri_atomic_t *)x;
 
-#if CRI_SL_DEBUG
     if (!cri_cmp_swap(p, CRI_SL_LOCKED, CRI_SL_UNLOCKED)) {
+#if CRI_SL_DEBUG
 	cri_atomic_t tmp = cri_atomic_read(p);
 
 	if (tmp == CRI_SL_UNLOCKED) {
 	    CRI_ABORT("Spinlock %p is not locked", p);
-	} else {
+	} else if (tmp != CRI_SL_WAITERS) {
 	    CRI_ABORT("Spinlock %p has invalid state %x", p, tmp);
 	}
-    }
-#else
-    cri_atomic_write(p, CRI_SL_UNLOCKED);
 #endif
+	/* Only the holder can change WAITERS, so a plain write suffices */
+	cri_atomic_write(p, CRI_SL_UNLOCKED);
+	cri_futex_wake(p, 1);
+    }
 }
 
 int cr_spinlock_trylock(cr_spinlock_t *x)
@@ -86,11 +108,7 @@ int cr_spinlock_trylock(cr_spinlock_t *x)
 
 #if CRI_SL_DEBUG
     if (!retval) {
-	cri_atomic_t tmp = cri_atomic_read(p);
-
-	if ((tmp != CRI_SL_LOCKED) && (tmp != CRI_SL_UNLOCKED)) {
-	    CRI_ABORT("Spinlock %p has invalid state %x", p, tmp);
-	}
+	cri_sl_check(p);
     }
 #endif
 
@@ -103,7 +121,14 @@ int cri_barrier_enter(cri_atomic_t *p)
 
     retval = cri_atomic_dec_and_test(p);
     if (!retval) {
-	CRI_DO_YIELD_WHILE_COND(cri_atomic_read(p));
+	unsigned int val;
+	int count = 0;
+
+	while ((val = cri_atomic_read(p)) != 0) {
+	    cri_futex_wait(p, val, &count);
+	}
+    } else {
+	cri_futex_wake(p, INT_MAX);
     }
 
     return retval;
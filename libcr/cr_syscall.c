@@ -181,6 +181,22 @@ cri_syscall1(int, __cri_exit, __NR_exit, int)
   }
 #endif
 cri_syscall4(int, __cri_ksigaction, __NR_rt_sigaction, int, const struct k_sigaction*, struct k_sigaction*, size_t)
+#ifdef __NR_clock_gettime
+  cri_syscall2(int, __cri_clock_gettime, __NR_clock_gettime, int, struct timespec*)
+#else
+  int __cri_clock_gettime(int clk_id, struct timespec *tp, int *errno_p) {
+    if (errno_p) { *errno_p = ENOSYS; }
+    return -1;
+  }
+#endif
+#ifdef __NR_futex
+  cri_syscall4(int, __cri_futex, __NR_futex, volatile unsigned int*, int, int, const struct timespec*)
+#else
+  int __cri_futex(volatile unsigned int *uaddr, int op, int val, const struct timespec *timeout, int *errno_p) {
+    if (errno_p) { *errno_p = ENOSYS; }
+    return -1;
+  }
+#endif
 
 /* Special-case the checkpoint call (which is still an ioctl) to allow for
  * arch-specific code that deals with caller-saved registers (which don't
@@ -76,5 +76,8 @@ extern int __cri_exit(int code, int * errno_p);
 extern int __cri_exit_group(int code, int * errno_p);
 extern int __cri_ksigaction(int signum, const struct k_sigaction *act,
 			    struct k_sigaction *oldact, size_t setsize, int * errno_p);
+extern int __cri_clock_gettime(int clk_id, struct timespec *tp, int * errno_p);
+extern int __cri_futex(volatile unsigned int *uaddr, int op, int val,
+		       const struct timespec *timeout, int * errno_p);
 
 #endif	/* _CR_SYSCALL_H */
@@ -34,6 +34,8 @@
 
 #include <time.h>
 #include <signal.h>
+#include <errno.h>
+#include <limits.h>
 
 /* how many calls to cri_sched_yield() before sleeping */
 #define CRI_MAX_YIELD	50		/* times to yield before sleeping */
@@ -61,6 +63,32 @@ CR_INLINE void cri_yield(int *count)
     }
 }
 
+/* Futex ops (from linux/futex.h, which we avoid depending on).
+   We use the non-private forms since a cr_spinlock_t may be shared. */
+#define CRI_FUTEX_WAIT	0
+#define CRI_FUTEX_WAKE	1
+
+/* Block until *p no longer holds val or we are woken.
+   Uses only the raw syscall and a local errno, so it is safe in
+   signal context.  Returns early (spuriously) if a signal arrives.
+   Falls back to cri_yield() if the kernel lacks futex support. */
+CR_INLINE void cri_futex_wait(cri_atomic_t *p, unsigned int val, int *count)
+{
+    int err = 0;
+
+    if ((__cri_futex(p, CRI_FUTEX_WAIT, (int)val, NULL, &err) < 0) && (err == ENOSYS)) {
+	cri_yield(count);
+    }
+}
+
+/* Wake up to n waiters blocked in cri_futex_wait() on p */
+CR_INLINE void cri_futex_wake(cri_atomic_t *p, int n)
+{
+    int err = 0;
+
+    (void)__cri_futex(p, CRI_FUTEX_WAKE, n, NULL, &err);
+}
+
 #if 0
 #	include <stdio.h>
 #	define CRI_YIELD_DEBUG(COND)	fprintf(stderr, "Yield: " #COND "\n")
@@ -0,0 +1,121 @@
+/*
+ * Berkeley Lab Checkpoint/Restart (BLCR) for Linux is Copyright (c)
+ * 2008, The Regents of the University of California, through Lawrence
+ * Berkeley National Laboratory (subject to receipt of any required
+ * approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Portions may be copyrighted by others, as may be noted in specific
+ * copyright notices within specific files.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "crut_util.h"
+
+// Two CR_CONCURRENT callbacks which can only get past their rendezvous
+// if they run at the same time (otherwise the alarm will fire).
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int arrived = 0;
+static int finished = 0;
+
+static void rendezvous(void)
+{
+    pthread_mutex_lock(&lock);
+    arrived += 1;
+    pthread_cond_broadcast(&cond);
+    while (arrived < 2) {
+	pthread_cond_wait(&cond, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static int cb(void* arg)
+{
+    int ret;
+
+    rendezvous();
+    if (arg) {
+	printf("%s", (char *)arg);
+    }
+    if (!cr_get_checkpoint_info()) {
+	printf("XXX cr_get_checkpoint_info() returned NULL\n");
+    }
+    ret = cr_checkpoint(0);
+    if (ret) {
+	printf("XXX cr_checkpoint() unexpectedy returned %d\n", ret);
+    }
+    pthread_mutex_lock(&lock);
+    finished += 1;
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+int main(void)
+{
+    pid_t my_pid;
+    cr_callback_id_t id;
+    char *filename;
+    int ret;
+	
+    setlinebuf(stdout);
+
+    my_pid = getpid();
+    filename = crut_aprintf("context.%d", my_pid);
+    printf("000 Process started with pid %d\n", my_pid);
+    printf("#ST_ALARM:60\n");
+
+    (void)cr_init();
+
+    id = cr_register_callback(cb, NULL, CR_SIGNAL_CONTEXT | CR_CONCURRENT);
+    if (id >= 0) {
+        printf("XXX cr_register_callback(CR_SIGNAL_CONTEXT | CR_CONCURRENT) succeeded unexpectedly\n");
+    } else if (errno != EINVAL) {
+        printf("XXX cr_register_callback() returned %d w/ errno=%d(%s)\n", id, errno, cr_strerror(errno));
+    }
+    id = cr_register_callback(cb, "002 concurrent callbacks running\n", CR_THREAD_CONTEXT | CR_CONCURRENT);
+    if (id < 0) {
+        printf("XXX cr_register_callback() #1 returned %d w/ errno=%d(%s)\n", id, errno, cr_strerror(errno));
+    }
+    id = cr_register_callback(cb, NULL, CR_THREAD_CONTEXT | CR_CONCURRENT);
+    if (id < 0) {
+        printf("XXX cr_register_callback() #2 returned %d w/ errno=%d(%s)\n", id, errno, cr_strerror(errno));
+    }
+    printf("001 registered callbacks\n");
+
+    ret = crut_checkpoint_block(filename);
+    if (ret < 0) {
+        printf("XXX crut_checkpoint_block() returned %d w/ errno=%d(%s)\n", ret, errno, cr_strerror(errno));
+    }
+    if (finished != 2) {
+        printf("XXX only %d of 2 callbacks finished\n", finished);
+    }
+    printf("003 callbacks finished\n");
+
+    (void)unlink(filename);	// may fail silently
+
+    printf("004 DONE\n");
+
+    return 0;
+}
@@ -0,0 +1,531 @@
+/*
+ * Berkeley Lab Checkpoint/Restart (BLCR) for Linux is Copyright (c)
+ * 2008, The Regents of the University of California, through Lawrence
+ * Berkeley National Laboratory (subject to receipt of any required
+ * approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Portions may be copyrighted by others, as may be noted in specific
+ * copyright notices within specific files.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Checkpoint/restart throughput benchmark.
+ *
+ * For each point of a sweep over the workload parameters (heap size,
+ * dirty ratio, threads, processes, open fds, pipe fill, shared memory and
+ * hugetlb memory) this forks a target that builds the workload, then
+ * checkpoints it (CR_SCOPE_TREE), kills it and restarts it.  One CSV row
+ * is written per run.  Not part of "make check"; see "make bench".
+ */
+
+#define _GNU_SOURCE	/* For MAP_ANONYMOUS, O_LARGEFILE */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#ifndef O_LARGEFILE
+  #define O_LARGEFILE 0
+#endif
+
+#include "crut_util.h"
+
+/* The workload parameters, in the order of the CSV columns.
+ * With no parameters on the command line, each is swept in turn over
+ * 'sweep' with the others held at 'base'.  Otherwise the cross product
+ * of the given lists is run, w/ unspecified parameters at 'base'.
+ */
+enum { D_HEAP, D_DIRTY, D_THREADS, D_PROCS, D_FDS, D_PIPE, D_SHM, D_HUGETLB, NDIMS };
+static const struct {
+    const char *option;
+    const char *column;
+    int base;
+    const char *sweep;
+} dims[NDIMS] = {
+    { "heap",	 "heap_mb",	64,  "16,64,256,1024" },
+    { "dirty",	 "dirty_pct",	100, "0,25,50,100" },
+    { "threads", "threads",	1,   "1,2,4,8,16" },
+    { "procs",	 "procs",	1,   "1,2,4,8" },
+    { "fds",	 "fds",		0,   "0,64,256,1024" },
+    { "pipe",	 "pipe_kb",	0,   "0,4,16,60" },
+    { "shm",	 "shm_mb",	0,   "0,16,64,256" },
+    { "hugetlb", "hugetlb_mb",	0,   "0,16,64" },
+};
+
+#define MAX_VALUES 32
+struct dim_list {
+    int count;
+    int value[MAX_VALUES];
+};
+
+static int opt_reps = 3;
+static int opt_keep = 0;
+static const char *opt_dir = ".";
+static FILE *out;
+
+static void usage(FILE *stream, const char *argv0)
+{
+    int d;
+
+    fprintf(stream, "Usage: %s [OPTIONS]\n\n", argv0);
+    fprintf(stream, "  -r, --reps N        Runs per point (default %d).\n", opt_reps);
+    fprintf(stream, "  -o, --output FILE   Write CSV to FILE (default stdout).\n");
+    fprintf(stream, "  -d, --dir DIR       Directory for context and temp files (default '.').\n");
+    fprintf(stream, "  -k, --keep          Keep the context files.\n");
+    fprintf(stream, "  -h, --help          Print this help message.\n\n");
+    fprintf(stream, "Workload parameters (comma-separated lists):\n");
+    for (d = 0; d < NDIMS; ++d) {
+	fprintf(stream, "      --%-8s LIST  %s (default %d, sweep %s)\n",
+		dims[d].option, dims[d].column, dims[d].base, dims[d].sweep);
+    }
+    fprintf(stream, "\nWith no workload parameters, each is swept in turn.\n");
+}
+
+static double now_us(void)
+{
+    struct timeval tv;
+    (void)gettimeofday(&tv, NULL);
+    return 1e6 * tv.tv_sec + tv.tv_usec;
+}
+
+static int parse_list(const char *s, struct dim_list *list)
+{
+    char *end;
+
+    list->count = 0;
+    do {
+	long v = strtol(s, &end, 10);
+	if ((end == s) || (v < 0) || (list->count == MAX_VALUES)) return -1;
+	list->value[list->count++] = v;
+	s = end + 1;
+    } while (*end == ',');
+
+    return (*end == '\0') ? 0 : -1;
+}
+
+/*
+ * The target side
+ */
+
+static volatile int target_restarted = 0;
+static volatile double target_stall_us = -1.0;
+
+/* Time the callback spends in cr_checkpoint() is the time we are stalled */
+static int target_cb(void *arg)
+{
+    double start = now_us();
+    int rc = cr_checkpoint(0);
+
+    if (rc > 0) {
+	target_restarted = 1;
+    } else {
+	target_stall_us = now_us() - start;
+    }
+    return 0;
+}
+
+static void *target_thread(void *arg)
+{
+    for (;;) sleep(1);
+    return NULL;
+}
+
+static void *map_anon(size_t len, int flags)
+{
+    void *p = mmap(NULL, len, PROT_READ|PROT_WRITE, flags|MAP_ANONYMOUS, -1, 0);
+    return (p == MAP_FAILED) ? NULL : p;
+}
+
+/* Build the workload, report 'R' (or 'E' on failure) and wait */
+static void run_target(const int *v, int report_fd, const char *fdfile)
+{
+    const long pagesize = sysconf(_SC_PAGESIZE);
+    char c = 'E';
+    size_t len;
+    char *p;
+    long i;
+
+    (void)prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (cr_init() < 0) {
+	perror("cr_init");
+	goto fail;
+    }
+    (void)cr_register_callback(target_cb, NULL, CR_SIGNAL_CONTEXT);
+
+    /* Heap, w/ dirty_pct of every 100 pages written and the rest untouched */
+    len = (size_t)v[D_HEAP] << 20;
+    if (len) {
+	p = malloc(len);
+	if (!p) goto fail;
+	for (i = 0; i < len / pagesize; ++i) {
+	    if ((i % 100) < v[D_DIRTY]) memset(p + i * pagesize, 1 + (i & 0x7f), pagesize);
+	}
+    }
+
+    /* Shared memory, all of it written */
+    len = (size_t)v[D_SHM] << 20;
+    if (len) {
+	if (!(p = map_anon(len, MAP_SHARED))) goto fail;
+	memset(p, 0x5a, len);
+    }
+
+    /* Hugetlb memory, all of it written */
+    len = (size_t)v[D_HUGETLB] << 20;
+    if (len) {
+#ifdef MAP_HUGETLB
+	if (!(p = map_anon(len, MAP_PRIVATE|MAP_HUGETLB))) {
+	    fprintf(stderr, "crbench: could not map %luMB of hugetlb memory\n", (unsigned long)(len >> 20));
+	    goto fail;
+	}
+	memset(p, 0xa5, len);
+#else
+	fprintf(stderr, "crbench: MAP_HUGETLB not available\n");
+	goto fail;
+#endif
+    }
+
+    /* Open fds, each w/ its own file position */
+    for (i = 0; i < v[D_FDS]; ++i) {
+	if (open(fdfile, O_RDWR) < 0) {
+	    perror("open");
+	    goto fail;
+	}
+    }
+
+    /* A pipe w/ both ends held and pipe_kb of data buffered */
+    if (v[D_PIPE]) {
+	int fds[2];
+	char buf[1024];
+
+	memset(buf, 'p', sizeof(buf));
+	if (pipe(fds) < 0) goto fail;
+	(void)fcntl(fds[1], F_SETFL, O_NONBLOCK);
+	for (i = 0; i < v[D_PIPE]; ++i) {
+	    if (write(fds[1], buf, sizeof(buf)) != sizeof(buf)) {
+		fprintf(stderr, "crbench: pipe full after %ldKB\n", i);
+		break;
+	    }
+	}
+    }
+
+    /* Extra processes (before the threads, which fork() would not copy) */
+    for (i = 1; i < v[D_PROCS]; ++i) {
+	int pid = fork();
+	if (pid < 0) goto fail;
+	if (!pid) {
+	    (void)prctl(PR_SET_PDEATHSIG, SIGKILL);
+	    for (;;) pause();
+	}
+    }
+
+    /* Extra threads */
+    for (i = 1; i < v[D_THREADS]; ++i) {
+	pthread_t th;
+	if (crut_pthread_create(&th, NULL, target_thread, NULL)) goto fail;
+    }
+
+    c = 'R';
+    if (write(report_fd, &c, 1) != 1) exit(1);
+
+    for (;;) {
+	if (target_restarted) {
+	    exit(0); /* other procs follow via PDEATHSIG */
+	} else if (target_stall_us >= 0.0) {
+	    double stall = target_stall_us;
+	    target_stall_us = -1.0;
+	    if (write(report_fd, &stall, sizeof(stall)) != sizeof(stall)) exit(1);
+	}
+	usleep(10000);
+    }
+
+fail:
+    (void)write(report_fd, &c, 1);
+    exit(1);
+}
+
+/*
+ * The requester side
+ */
+
+static int read_full(int fd, void *buf, size_t len)
+{
+    ssize_t rc;
+    do {
+	rc = read(fd, buf, len);
+    } while ((rc < 0) && (errno == EINTR));
+    return (rc == len) ? 0 : -1;
+}
+
+/* Checkpoint, kill and restart one target.  Returns 0 after writing a row. */
+static int run_point(const int *v, int rep)
+{
+    char *context = crut_aprintf("%s/context.crbench.%d", opt_dir, (int)getpid());
+    char *fdfile = crut_aprintf("%s/tst.crbench.%d", opt_dir, (int)getpid());
+    cr_checkpoint_handle_t ckpt_handle;
+    cr_checkpoint_args_t ckpt_args;
+    cr_restart_handle_t rstrt_handle;
+    cr_restart_args_t rstrt_args;
+    struct cr_chkpt_stats stats;
+    double t0, ckpt_us, rstrt_us, stall_us, kernel_ms = -1.0;
+    long long bytes;
+    struct stat st;
+    int report[2] = { -1, -1 };
+    int pid = 0, rc, fd, status, d;
+    int retval = -1;
+    char c;
+
+    if (v[D_FDS]) {
+	fd = open(fdfile, O_RDWR|O_CREAT|O_TRUNC, 0600);
+	if (fd < 0) { perror("open"); goto out; }
+	(void)close(fd);
+    }
+
+    if (pipe(report) < 0) {
+	perror("pipe");
+	report[0] = -1;
+	goto out;
+    }
+    pid = fork();
+    if (pid < 0) {
+	perror("fork");
+	goto out;
+    } else if (!pid) {
+	(void)close(report[0]);
+	run_target(v, report[1], fdfile);
+	/* NOT REACHED */
+    }
+    (void)close(report[1]);
+    if (read_full(report[0], &c, 1) || (c != 'R')) {
+	fprintf(stderr, "crbench: target setup failed (point skipped)\n");
+	goto out_kill;
+    }
+
+    /* Checkpoint */
+    fd = open(context, O_WRONLY|O_CREAT|O_TRUNC|O_LARGEFILE, 0600);
+    if (fd < 0) { perror("open"); goto out_kill; }
+    cr_initialize_checkpoint_args_t(&ckpt_args);
+    ckpt_args.cr_fd = fd;
+    ckpt_args.cr_scope = CR_SCOPE_TREE;
+    ckpt_args.cr_target = pid;
+    t0 = now_us();
+    rc = cr_request_checkpoint(&ckpt_args, &ckpt_handle);
+    if (rc < 0) {
+	fprintf(stderr, "cr_request_checkpoint: %s\n", cr_strerror(errno));
+	(void)close(fd);
+	goto out_kill;
+    }
+    do {
+	rc = cr_wait_checkpoint(&ckpt_handle, NULL);
+    } while ((rc < 0) && (errno == EINTR));
+    ckpt_us = now_us() - t0;
+    if (rc < 0) {
+	fprintf(stderr, "cr_wait_checkpoint: %s\n", cr_strerror(errno));
+	(void)close(fd);
+	goto out_kill;
+    }
+    if (!cr_stats_checkpoint(&ckpt_handle, &stats)) {
+	kernel_ms = stats.ns[CR_STATS_TOTAL] / 1e6;
+    }
+    rc = cr_reap_checkpoint(&ckpt_handle);
+    bytes = fstat(fd, &st) ? 0 : st.st_size;
+    (void)close(fd);
+    if (rc < 0) {
+	fprintf(stderr, "cr_reap_checkpoint: %s\n", cr_strerror(errno));
+	goto out_kill;
+    }
+    if (read_full(report[0], &stall_us, sizeof(stall_us))) {
+	fprintf(stderr, "crbench: no stall time from target\n");
+	goto out_kill;
+    }
+
+    (void)kill(pid, SIGKILL);
+    (void)waitpid(pid, NULL, 0);
+    pid = 0;
+
+    /* Restart */
+    fd = open(context, O_RDONLY|O_LARGEFILE);
+    if (fd < 0) { perror("open"); goto out; }
+    cr_initialize_restart_args_t(&rstrt_args);
+    rstrt_args.cr_fd = fd;
+    t0 = now_us();
+    rc = cr_request_restart(&rstrt_args, &rstrt_handle);
+    if (rc >= 0) {
+	do {
+	    rc = cr_poll_restart(&rstrt_handle, NULL);
+	} while ((rc < 0) && (errno == EINTR));
+    }
+    rstrt_us = now_us() - t0;
+    (void)close(fd);
+    if (rc <= 0) {
+	fprintf(stderr, "crbench: restart failed: %s\n", cr_strerror(errno));
+	goto out;
+    }
+    if ((waitpid(rc, &status, 0) != rc) || !WIFEXITED(status) || WEXITSTATUS(status)) {
+	fprintf(stderr, "crbench: restarted target did not exit cleanly\n");
+	goto out;
+    }
+
+    for (d = 0; d < NDIMS; ++d) fprintf(out, "%d,", v[d]);
+    fprintf(out, "%d,%lld,%.3f,%.3f,%.3f,%.1f,%.1f,%.3f\n", rep, bytes,
+	    ckpt_us / 1e3, rstrt_us / 1e3, stall_us / 1e3,
+	    (bytes / (1024. * 1024.)) / (ckpt_us / 1e6),
+	    (bytes / (1024. * 1024.)) / (rstrt_us / 1e6),
+	    kernel_ms);
+    fflush(out);
+    retval = 0;
+
+out_kill:
+    if (pid > 0) {
+	(void)kill(pid, SIGKILL);
+	(void)waitpid(pid, NULL, 0);
+    }
+out:
+    if (report[0] >= 0) (void)close(report[0]);
+    if (!opt_keep) (void)unlink(context);
+    (void)unlink(fdfile);
+    free(context);
+    free(fdfile);
+    return retval;
+}
+
+static int run_reps(const int *v)
+{
+    int rep, failed = 0;
+
+    for (rep = 0; rep < opt_reps; ++rep) {
+	if (run_point(v, rep)) ++failed;
+    }
+    return failed;
+}
+
+/* Cross product of the lists, one dimension per level of recursion */
+static int run_product(const struct dim_list *lists, int *v, int d)
+{
+    int i, failed = 0;
+
+    if (d == NDIMS) return run_reps(v);
+    for (i = 0; i < lists[d].count; ++i) {
+	v[d] = lists[d].value[i];
+	failed += run_product(lists, v, d + 1);
+    }
+    return failed;
+}
+
+int main(int argc, char * const argv[])
+{
+    struct dim_list lists[NDIMS];
+    struct option longflags[NDIMS + 6];
+    int v[NDIMS];
+    int given = 0, failed = 0;
+    int d, i;
+
+    for (d = 0; d < NDIMS; ++d) {
+	lists[d].count = 1;
+	lists[d].value[0] = dims[d].base;
+	longflags[d].name = dims[d].option;
+	longflags[d].has_arg = required_argument;
+	longflags[d].flag = NULL;
+	longflags[d].val = 256 + d;
+    }
+    {
+	static const struct option misc[] = {
+	    {"reps", required_argument, 0, 'r'},
+	    {"output", required_argument, 0, 'o'},
+	    {"dir", required_argument, 0, 'd'},
+	    {"keep", no_argument, 0, 'k'},
+	    {"help", no_argument, 0, 'h'},
+	    {0, 0, 0, 0}
+	};
+	memcpy(&longflags[NDIMS], misc, sizeof(misc));
+    }
+
+    out = stdout;
+    for (;;) {
+	int opt = getopt_long(argc, argv, "r:o:d:kh", longflags, NULL);
+	if (opt == -1) break;
+
+	switch (opt) {
+	case 'r':
+	    opt_reps = atoi(optarg);
+	    break;
+	case 'o':
+	    out = fopen(optarg, "w");
+	    if (!out) {
+		perror(optarg);
+		exit(1);
+	    }
+	    break;
+	case 'd':
+	    opt_dir = optarg;
+	    break;
+	case 'k':
+	    opt_keep = 1;
+	    break;
+	case 'h':
+	    usage(stdout, argv[0]);
+	    exit(0);
+	default:
+	    if ((opt >= 256) && (opt < 256 + NDIMS)) {
+		d = opt - 256;
+		if (parse_list(optarg, &lists[d])) {
+		    fprintf(stderr, "%s: bad list for --%s: '%s'\n", argv[0], dims[d].option, optarg);
+		    exit(1);
+		}
+		given = 1;
+		break;
+	    }
+	    usage(stderr, argv[0]);
+	    exit(1);
+	}
+    }
+    if ((optind != argc) || (opt_reps < 1)) {
+	usage(stderr, argv[0]);
+	exit(1);
+    }
+
+    for (d = 0; d < NDIMS; ++d) fprintf(out, "%s,", dims[d].column);
+    fprintf(out, "rep,bytes,ckpt_ms,restart_ms,stall_ms,ckpt_mbps,restart_mbps,kernel_ms\n");
+
+    if (given) {
+	failed = run_product(lists, v, 0);
+    } else {
+	for (d = 0; d < NDIMS; ++d) {
+	    struct dim_list sweep;
+	    (void)parse_list(dims[d].sweep, &sweep);
+	    for (i = 0; i < sweep.count; ++i) {
+		int j;
+		/* The base point is run once, in the first sweep */
+		if (d && (sweep.value[i] == dims[d].base)) continue;
+		for (j = 0; j < NDIMS; ++j) v[j] = dims[j].base;
+		v[d] = sweep.value[i];
+		failed += run_reps(v);
+	    }
+	}
+    }
+
+    if (out != stdout) (void)fclose(out);
+    if (failed) fprintf(stderr, "%s: %d run(s) failed\n", argv[0], failed);
+    return failed ? 1 : 0;
+}
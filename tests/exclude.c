@@ -0,0 +1,194 @@
+/*
+ * Berkeley Lab Checkpoint/Restart (BLCR) for Linux is Copyright (c)
+ * 2008, The Regents of the University of California, through Lawrence
+ * Berkeley National Laboratory (subject to receipt of any required
+ * approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Portions may be copyrighted by others, as may be noted in specific
+ * copyright notices within specific files.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Test of cr_exclude_region(CR_EXCLUDE_UNMAP) of an entire file map,
+ * given as two abutting ranges (which libcr may pass on as one), when the
+ * same file is mapped again at a higher address.  The name of the file
+ * must be saved with the second map, since it is not with the first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include "libcr.h"
+#include "crut.h"
+
+#define FILENAME "tstexclude"
+#define NPAGES 4
+
+struct exclude_data {
+    char *first;	/* excluded */
+    char *second;	/* same file, saved by reference */
+};
+
+static int pagesize = -1;
+
+/* Non-zero if page i of a map of the file holds the right bytes */
+static int check_page(const char *p, int i)
+{
+    int j;
+
+    for (j = 0; j < pagesize; ++j) {
+	if (p[j] != (char)('A' + i)) return 0;
+    }
+    return 1;
+}
+
+static int check_second(struct exclude_data *d)
+{
+    int i;
+
+    for (i = 0; i < NPAGES; ++i) {
+	if (!check_page(d->second + i * pagesize, i)) {
+	    CRUT_FAIL("Wrong contents in page %d of the second map", i);
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+static int
+exclude_setup(void **testdata)
+{
+    struct exclude_data *d;
+    const size_t len = NPAGES * pagesize;
+    char *reserve, *buf;
+    int fd, i;
+
+    CRUT_DEBUG("Initializing exclude.");
+    (void)cr_init();
+
+    /* File of NPAGES pages, each filled with one letter */
+    buf = malloc(pagesize);
+    (void)unlink(FILENAME);
+    fd = open(FILENAME, O_CREAT|O_RDWR|O_TRUNC, S_IREAD|S_IWRITE);
+    if (!buf || (fd < 0)) {
+	CRUT_FAIL("Failed to create " FILENAME);
+	return -1;
+    }
+    for (i = 0; i < NPAGES; ++i) {
+	memset(buf, 'A' + i, pagesize);
+	if (write(fd, buf, pagesize) != pagesize) {
+	    CRUT_FAIL("Failed to write " FILENAME);
+	    return -1;
+	}
+    }
+    free(buf);
+
+    /* Two maps of the file, apart by a guard page so they stay distinct VMAs */
+    reserve = mmap(NULL, 2 * len + pagesize, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (reserve == MAP_FAILED) {
+	CRUT_FAIL("mmap(reserve) failed: %s", strerror(errno));
+	return -1;
+    }
+    d = malloc(sizeof(*d));
+    d->first = mmap(reserve, len, PROT_READ, MAP_PRIVATE|MAP_FIXED, fd, 0);
+    d->second = mmap(reserve + len + pagesize, len, PROT_READ, MAP_PRIVATE|MAP_FIXED, fd, 0);
+    close(fd);
+    if ((d->first == MAP_FAILED) || (d->second == MAP_FAILED)) {
+	CRUT_FAIL("mmap(" FILENAME ") failed: %s", strerror(errno));
+	return -1;
+    }
+
+    /* Leave out all of the first map, as two pieces */
+    if ((cr_exclude_region(d->first, len / 2, CR_EXCLUDE_UNMAP) < 0) ||
+	(cr_exclude_region(d->first + len / 2, len / 2, CR_EXCLUDE_UNMAP) < 0)) {
+	CRUT_FAIL("cr_exclude_region() failed: %s", strerror(errno));
+	return -1;
+    }
+
+    *testdata = d;
+    return 0;
+}
+
+static int
+exclude_precheckpoint(void *p)
+{
+    return check_second(p);
+}
+
+static int
+exclude_continue(void *p)
+{
+    struct exclude_data *d = p;
+
+    CRUT_DEBUG("Continuing after checkpoint.");
+    if (!check_page(d->first, 0)) {
+	CRUT_FAIL("First map changed by the checkpoint");
+	return -1;
+    }
+    return check_second(d);
+}
+
+static int
+exclude_restart(void *p)
+{
+    struct exclude_data *d = p;
+    unsigned char vec[NPAGES];
+
+    CRUT_DEBUG("Restarting from checkpoint.");
+    if ((mincore(d->first, NPAGES * pagesize, (void *)vec) == 0) || (errno != ENOMEM)) {
+	CRUT_FAIL("First map was restored, but should have been left out");
+	return -1;
+    }
+    return check_second(d);
+}
+
+static int
+exclude_teardown(void *p)
+{
+    (void)unlink(FILENAME);
+    free(p);
+    return 0;
+}
+
+int
+main(int argc, char * const argv[])
+{
+    int ret;
+    struct crut_operations exclude_ops = {
+	test_scope:CR_SCOPE_PROC,
+	test_name:"exclude_unmap",
+        test_description:"Test exclusion of a whole file map, w/ the file mapped again later.",
+	test_setup:exclude_setup,
+	test_precheckpoint:exclude_precheckpoint,
+	test_continue:exclude_continue,
+	test_restart:exclude_restart,
+	test_teardown:exclude_teardown,
+    };
+
+    pagesize = getpagesize();
+
+    crut_add_test(&exclude_ops);
+
+    ret = crut_main(argc, argv);
+
+    return ret;
+}
@@ -53,6 +53,9 @@
 #endif
 
 #include "libcr.h"
+#include "cr_sched.h"
+#include "cr_stage.h"
+#include "cr_stripe.h"
 
 /* can't use argv[0] to get name, since libtool screws it up */
 #define MY_NAME	"cr_checkpoint"
@@ -65,6 +68,7 @@ static enum {
 } kmsg_level = kmsg_err;
 
 static char *to_remove;
+static cr_stripe_set_t *stripes;
 
 static void die(int code, const char *format, ...)
 		__attribute__ ((noreturn, format (printf, 2, 3)));
@@ -84,7 +88,8 @@ static void usage(FILE *stream, int exitcode)
 "\n"
 "Options:\n"
 "General options:\n"
-"  -v, --verbose          print progress messages to stderr.\n"
+"  -v, --verbose          print progress messages to stderr, and a report of\n"
+"                         the processes and callbacks that took longest.\n"
 "  -q, --quiet            suppress error/warning messages to stderr.\n"
 "  -?, --help             print this message and exit.\n"
 "      --version          print version information and exit.\n"
@@ -114,6 +119,30 @@ static void usage(FILE *stream, int exitcode)
 "      --noclobber        checkpoint will fail if the target file exists.\n"
 "  These options are ignored if the destination is a file descriptor.\n"
 "\n"
+"Options for staging through node-local storage:\n"
+"      --stage DIR        checkpoint written first to local directory DIR\n"
+"                         (e.g. on tmpfs or local disk), then copied to the\n"
+"                         destination in the background with verification.\n"
+"                         The staged copy is kept for use by cr_restart\n"
+"                         until the next checkpoint to the same destination\n"
+"                         replaces it; cleaning DIR is left to the user.\n"
+"                         DIR defaults to $CR_STAGE_DIR if that is set.\n"
+"      --stage-wait       with --stage, wait for the background copy to\n"
+"                         complete and report its success or failure.\n"
+"      --nostage          ignore $CR_STAGE_DIR.\n"
+"  Staging is not possible if the destination is a file descriptor.\n"
+"\n"
+"Options for striping a checkpoint across several files:\n"
+"      --stripe DIR       add DIR to the set of directories across which the\n"
+"                         checkpoint is striped.  Give once per stripe, e.g.\n"
+"                         one directory per local disk or per storage target.\n"
+"                         The destination file then holds only a small\n"
+"                         manifest naming the stripes, which cr_restart\n"
+"                         recognizes.\n"
+"      --stripe-size KB   size of each stripe unit (default %d).\n"
+"  Striped checkpoints are always created atomically, and striping is not\n"
+"  possible if the destination is a file descriptor or with --stage.\n"
+"\n"
 "Options for signal sent to process(es) after checkpoint:\n"
 "      --run              no signal sent: continue execution (default).\n"
 "  -S, --signal NUM       signal NUM sent to all processess.\n"
@@ -139,6 +168,19 @@ static void usage(FILE *stream, int exitcode)
 "                         (System V IPC is mapped this way).\n"
 "      --save-all         save all of the above.\n"
 "      --save-none        save none of the above (the default).\n"
+"      --workset          record which pages of mapped files are resident,\n"
+"                         so restart can read ahead just those pages.\n"
+"\n"
+"Options for offline access to the context file:\n"
+"      --toc              append a table of contents, giving the offset of\n"
+"                         each process, thread, memory region and file.\n"
+"                         Ignored unless written to a single regular file.\n"
+"\n"
+"Options for estimating the size of a checkpoint:\n"
+"      --dry-run          report the size of each section of the checkpoint\n"
+"                         without writing it.  The processes are left running\n"
+"                         and the destination, signal, sync, staging and\n"
+"                         striping options are ignored.\n"
 "\n"
 "Options for ptraced processes (default is --ptraced-error):\n"
 "      --ptraced-error    return an error if a checkpoint is requested\n"
@@ -173,10 +215,30 @@ static void usage(FILE *stream, int exitcode)
 "  If more than one is given then only the last will be honored.\n"
 "  Note that --quiet suppresses all stderr output, including these messages.\n"
 "\n"
+"Options for node-level scheduling of concurrent checkpoints:\n"
+"      --sched[=SOCKET]   wait for admission from the scheduling daemon\n"
+"                         before checkpointing, and hold the slot until the\n"
+"                         checkpoint is written and synced.  If no daemon is\n"
+"                         reachable a warning is printed and the checkpoint\n"
+"                         proceeds unscheduled.\n"
+"      --priority NUM     priority of this request (default 0).  Higher\n"
+"                         priorities are admitted first.\n"
+"      --sched-daemon[=SOCKET]\n"
+"                         run as the scheduling daemon (does not return).\n"
+"      --sched-max-active NUM\n"
+"                         daemon admits at most NUM concurrent checkpoints\n"
+"                         (default 2).\n"
+"      --sched-reserve MB daemon leaves MB megabytes of available memory\n"
+"                         free for applications (default 0).\n"
+"      --sched-status[=SOCKET]\n"
+"                         print the daemon's queue and exit.\n"
+"  SOCKET defaults to $CR_SCHED_SOCKET, or " CR_SCHED_SOCKET_DFLT ".\n"
+"  No ID is given with --sched-daemon or --sched-status.\n"
+"\n"
 "Misc Options:\n"
 "  -t, --time SEC         allow only SEC seconds for target to complete\n"
 "                         checkpoint (default: wait indefinitely).\n"
-    );
+    , CR_STRIPE_SIZE_DFLT / 1024);
 
     exit(exitcode);
 }
@@ -228,6 +290,8 @@ static void die(int code, const char *format, ...)
     if (to_remove != NULL) 
 	if (!stat(to_remove, &s)) 
 	    unlink(to_remove);
+    if (stripes != NULL)
+	cr_stripe_write_abort(stripes);
 
     exit(code);
 }
@@ -361,6 +425,9 @@ enum {
    opt_save_shared,
    opt_save_all,
    opt_save_none,
+   opt_workset,
+   opt_toc,
+   opt_dry_run,
    opt_ptraced_error,
    opt_ptraced_allow,
    opt_ptraced_skip,
@@ -369,6 +436,17 @@ enum {
    opt_kmsg_none,
    opt_kmsg_error,
    opt_kmsg_warning,
+   opt_sched,
+   opt_priority,
+   opt_sched_daemon,
+   opt_sched_max_active,
+   opt_sched_reserve,
+   opt_sched_status,
+   opt_stage,
+   opt_stage_wait,
+   opt_nostage,
+   opt_stripe,
+   opt_stripe_size,
 };
 
 /* Type of destination */
@@ -405,6 +483,23 @@ static int my_cb(void *arg)
     return 0;
 }
 
+/* Report the bytes counted by a dry run */
+static void print_estimate(const struct cr_chkpt_stats *stats)
+{
+    const unsigned long long *c = stats->count;
+
+    printf("estimated size: %llu bytes\n",
+	   c[CR_STATS_BYTES_VMADUMP] + c[CR_STATS_BYTES_MMAPS] +
+	   c[CR_STATS_BYTES_FILES] + c[CR_STATS_BYTES_OTHER]);
+    printf("  memory:         %llu bytes\n", c[CR_STATS_BYTES_VMADUMP]);
+    printf("  shared maps:    %llu bytes\n", c[CR_STATS_BYTES_MMAPS]);
+    printf("  files:          %llu bytes\n", c[CR_STATS_BYTES_FILES]);
+    printf("  other:          %llu bytes\n", c[CR_STATS_BYTES_OTHER]);
+    printf("  pages:          %llu saved in %llu chunks, %llu skipped\n",
+	   c[CR_STATS_PAGES], c[CR_STATS_CHUNKS], c[CR_STATS_SKIPPED_PAGES]);
+    printf("  descriptors:    %llu\n", c[CR_STATS_FDS]);
+}
+
 int real_main(int argc, char **argv)
 {
     cr_checkpoint_args_t cr_args;
@@ -430,6 +525,21 @@ int real_main(int argc, char **argv)
     cr_scope_t target_type = CR_SCOPE_TREE;
     int signal = 0;
     unsigned int cr_flags = CR_CHKPT_ASYNC_ERR;
+    enum { sched_none, sched_client, sched_daemon, sched_status } sched_mode = sched_none;
+    char * sched_path = NULL;	/* NULL -> environment or default */
+    int sched_fd = -1;
+    int priority = 0;
+    struct cr_sched_limits sched_lim = { 2, 0, 0 };
+    char * stage_dir = getenv("CR_STAGE_DIR");
+    int stage_wait = 0;
+    char * final_to = NULL;	/* destination when staging */
+    int final_backup = 0;
+    char * stripe_dirs[CR_STRIPE_MAX];
+    int stripe_count = 0;
+    size_t stripe_size = CR_STRIPE_SIZE_DFLT;
+    int old_fd = -1;		/* replaced manifest, to find its stripes */
+    int dry_run = 0;
+    struct cr_chkpt_stats stats;
 
     /* Parse cmdline options */
     char * shortflags = "f:d:F:S:pgsTct:qvh";  /* 1 colon == requires argument */
@@ -471,6 +581,11 @@ int real_main(int argc, char **argv)
 	{ "save-shared",  no_argument,  0, opt_save_shared},
 	{ "save-all",     no_argument,  0, opt_save_all},
 	{ "save-none",    no_argument,  0, opt_save_none},
+	{ "workset",      no_argument,  0, opt_workset},
+	/* table of contents */
+	{ "toc",          no_argument,  0, opt_toc},
+	/* size estimate */
+	{ "dry-run",      no_argument,  0, opt_dry_run},
 	/* ptraced options: */
 	{ "ptraced-error",  no_argument,  0, opt_ptraced_error},
 	{ "ptraced-allow",  no_argument,  0, opt_ptraced_allow},
@@ -482,6 +597,20 @@ int real_main(int argc, char **argv)
 	{ "kmsg-none",    no_argument,  0, opt_kmsg_none},
 	{ "kmsg-error",   no_argument,  0, opt_kmsg_error},
 	{ "kmsg-warning", no_argument,  0, opt_kmsg_warning},
+	/* scheduling options: */
+	{ "sched",        optional_argument, 0, opt_sched},
+	{ "priority",     required_argument, 0, opt_priority},
+	{ "sched-daemon", optional_argument, 0, opt_sched_daemon},
+	{ "sched-max-active", required_argument, 0, opt_sched_max_active},
+	{ "sched-reserve",    required_argument, 0, opt_sched_reserve},
+	{ "sched-status", optional_argument, 0, opt_sched_status},
+	/* staging options: */
+	{ "stage",        required_argument, 0, opt_stage},
+	{ "stage-wait",   no_argument,       0, opt_stage_wait},
+	{ "nostage",      no_argument,       0, opt_nostage},
+	/* striping options: */
+	{ "stripe",       required_argument, 0, opt_stripe},
+	{ "stripe-size",  required_argument, 0, opt_stripe_size},
 	/* misc options: */
 	{ "time",    required_argument, 0, 't' },
 	{ "quiet",   no_argument,       0, 'q' },
@@ -628,6 +757,18 @@ int real_main(int argc, char **argv)
 	    case opt_save_none:
 	        cr_flags &= ~CR_CHKPT_DUMP_ALL;
 	        break;
+	    case opt_workset:
+	        cr_flags |= CR_CHKPT_WORKSET;
+	        break;
+	/* table of contents */
+	    case opt_toc:
+	        cr_flags |= CR_CHKPT_TOC;
+	        break;
+	/* size estimate */
+	    case opt_dry_run:
+	        dry_run = 1;
+	        cr_flags |= CR_CHKPT_DRYRUN;
+	        break;
 	/* ptraced options: */
 #define PTRACED_MASK (CR_CHKPT_PTRACED_ALLOW | CR_CHKPT_PTRACED_SKIP)
 	    case opt_ptraced_allow:
@@ -658,6 +799,65 @@ int real_main(int argc, char **argv)
 	    case opt_kmsg_warning:
 		kmsg_level = kmsg_warn;
 		break;
+	/* scheduling options: */
+	    case opt_sched:
+		sched_mode = sched_client;
+		sched_path = optarg;
+		break;
+	    case opt_priority:
+		priority = readint(optarg, argv[0]);
+		break;
+	    case opt_sched_daemon:
+		sched_mode = sched_daemon;
+		sched_path = optarg;
+		break;
+	    case opt_sched_max_active:
+		sched_lim.max_active = readint(optarg, argv[0]);
+		if (sched_lim.max_active < 1) {
+		    die(EINVAL, "--sched-max-active must be at least 1.\n");
+		}
+		break;
+	    case opt_sched_reserve:
+		{
+		    int mb = readint(optarg, argv[0]);
+		    if (mb < 0) {
+			die(EINVAL, "--sched-reserve must be non-negative.\n");
+		    }
+		    sched_lim.reserve_kb = (unsigned long)mb * 1024;
+		}
+		break;
+	    case opt_sched_status:
+		sched_mode = sched_status;
+		sched_path = optarg;
+		break;
+	/* staging options: */
+	    case opt_stage:
+		stage_dir = optarg;
+		break;
+	    case opt_stage_wait:
+		stage_wait = 1;
+		break;
+	    case opt_nostage:
+		stage_dir = NULL;
+		break;
+	/* striping options: */
+	    case opt_stripe:
+		if (stripe_count == CR_STRIPE_MAX) {
+		    die(EINVAL, "At most %d stripes are supported.\n", CR_STRIPE_MAX);
+		}
+		stripe_dirs[stripe_count++] = optarg;
+		break;
+	    case opt_stripe_size:
+		{
+		    int kb = readint(optarg, argv[0]);
+		    long pagesz = sysconf(_SC_PAGESIZE);
+		    if ((kb <= 0) || (((size_t)kb * 1024) % pagesz)) {
+			die(EINVAL, "--stripe-size must be a positive multiple of %ld.\n",
+			    pagesz / 1024);
+		    }
+		    stripe_size = (size_t)kb * 1024;
+		}
+		break;
 	/* misc options: */
 	    case 't':
 		secs = readint(optarg, argv[0]);
@@ -687,6 +887,22 @@ int real_main(int argc, char **argv)
 	}
     }
 
+    /* Modes that don't checkpoint anything */
+    if (sched_mode == sched_daemon) {
+	if (argc != optind) usage(stderr, -1);
+	sched_lim.verbose = verbose;
+	(void)cr_sched_daemon(sched_path, &sched_lim);
+	die(errno, "Scheduling daemon failed on '%s': %s\n",
+	    cr_sched_path(sched_path), strerror(errno));
+    } else if (sched_mode == sched_status) {
+	if (argc != optind) usage(stderr, -1);
+	if (cr_sched_status(sched_path, stdout) < 0) {
+	    die(errno, "Unable to query scheduling daemon on '%s': %s\n",
+		cr_sched_path(sched_path), strerror(errno));
+	}
+	exit(0);
+    }
+
     /* Grab id if exactly one arg left.
        optind is a magic global set by getopt_long, and is index of first 
        non-flag parameter, if any */
@@ -696,9 +912,31 @@ int real_main(int argc, char **argv)
 	usage(stderr, -1);
     }
 
-    if (dest_type == dest_fd) {
+    if (dry_run) {
+	/* Nothing is created, so there is nothing to stage, stripe or sync */
+	stage_dir = NULL;
+	stripe_count = 0;
+	do_excl = do_atomic = do_backup = do_sync = 0;
+	if (sched_mode == sched_client) sched_mode = sched_none;
+    }
+
+    if (stripe_count) {
+	if (dest_type == dest_fd) {
+	    die(EINVAL, "Cannot stripe a checkpoint to a file descriptor\n");
+	} else if (stage_dir && *stage_dir) {
+	    die(EINVAL, "Cannot combine --stripe with --stage\n");
+	}
+	if (!do_excl) do_atomic = 1;
+    }
+
+    if (dry_run) {
+	chkpt_to = "<dry-run>";
+    } else if (dest_type == dest_fd) {
 	#define NAMELEN 64 
 	char buf[NAMELEN];
+	if (stage_dir && *stage_dir && (verbose > 0)) {
+	    fprintf(stderr, "staging ignored: destination is a file descriptor\n");
+	}
 	snprintf(buf, NAMELEN, "<fd%d>", chkpt_fd);
 	chkpt_to = strdup(buf);
 	if (!chkpt_to)
@@ -726,6 +964,20 @@ int real_main(int argc, char **argv)
 		die(1, "Invalid dest_type\n");
 	}
 
+	if (stage_dir && *stage_dir) {
+	    /* The kernel writes to DIR/NAME; we drain that to chkpt_to later.
+	     * The staged file is always created atomically, while the
+	     * backup policy applies to the final destination.
+	     */
+	    final_to = chkpt_to;
+	    final_backup = do_backup;
+	    chkpt_to = cr_stage_name(stage_dir, final_to);
+	    if (!chkpt_to)
+		die(errno, "Failed to name staged copy of '%s': %s\n", final_to, strerror(errno));
+	    do_excl = do_backup = 0;
+	    do_atomic = 1;
+	}
+
 	/* get parent directory name */
 	parent_dir = strdup(chkpt_to);
 	if (!parent_dir)
@@ -755,8 +1007,28 @@ int real_main(int argc, char **argv)
 		chkpt_to, parent_dir, rename_to);
     }
 
+    /* Wait our turn before creating anything */
+    if (sched_mode == sched_client) {
+	unsigned long mem_kb = cr_sched_estimate_kb(target, target_type);
+	if (verbose > 0) {
+	    fprintf(stderr, "waiting for admission (priority %d, ~%lu KiB)\n",
+		    priority, mem_kb);
+	}
+	sched_fd = cr_sched_admit(sched_path, target, priority, mem_kb);
+	if (sched_fd < 0) {
+	    print_err("Warning: scheduling daemon on '%s' unavailable (%s): proceeding unscheduled\n",
+		      cr_sched_path(sched_path), strerror(errno));
+	} else if (verbose > 0) {
+	    fprintf(stderr, "admitted by scheduling daemon\n");
+	}
+    }
+
     /* TODO:  make sure no other checkpoint is occurring to the same file? */
-    if (chkpt_fd >= 0) {
+    if (dry_run) {
+	/* The kernel ignores cr_fd, and one that predates CR_CHKPT_DRYRUN
+	 * will reject -1 rather than write a real checkpoint somewhere. */
+	chkpt_fd = -1;
+    } else if (chkpt_fd >= 0) {
 	/* silently ignore the atomic/backup flags */
 	do_excl = do_atomic = do_backup = 0;
     } else if (chkpt_file) {
@@ -782,8 +1054,21 @@ int real_main(int argc, char **argv)
     cr_args.cr_scope  = target_type;
     cr_args.cr_target = target;
     cr_args.cr_fd     = chkpt_fd;
+    if (stripe_count) {
+	/* Kernel writes to the striped fd; chkpt_fd receives only the manifest */
+	stripes = cr_stripe_write_start(rename_to ? rename_to : chkpt_to,
+					stripe_dirs, stripe_count, stripe_size,
+					&cr_args.cr_fd);
+	if (!stripes) {
+	    die(errno, "Failed to create stripe files: %s\n", strerror(errno));
+	}
+    }
     cr_args.cr_signal = signal;
     cr_args.cr_timeout = secs;	/* 0 == unbounded */
+    if (verbose > 0) {
+	/* Ask for a report of who held up the checkpoint */
+	cr_flags |= CR_CHKPT_CRITPATH;
+    }
     cr_args.cr_flags  = cr_flags;
 
     /* Record our pid */
@@ -849,6 +1134,10 @@ int real_main(int argc, char **argv)
         }
     }
 
+    if (dry_run && (cr_stats_checkpoint(&cr_handle, &stats) < 0)) {
+	die(errno, "Unable to collect size estimate: %s\n", cr_strerror(errno));
+    }
+
     if (verbose > 0) {
 	fprintf(stderr, "reaping checkpoint request\n");
     }
@@ -878,6 +1167,27 @@ int real_main(int argc, char **argv)
 	fprintf(stderr, "checkpoint request completed\n");
     }
 
+    if (dry_run) {
+	pthread_mutex_unlock(&lock);
+	if ((verbose > 0) || ((verbose >= 0) && (kmsg_level == kmsg_warn))) {
+	    show_kmsgs();
+	}
+	print_estimate(&stats);
+	return 0;
+    }
+
+    if (stripes) {
+	cr_stripe_set_t *tmp = stripes;
+	stripes = NULL; /* finish removes them on failure */
+	if (cr_stripe_write_finish(tmp, chkpt_fd, do_sync) < 0) {
+	    die(errno, "Failed to write striped checkpoint: %s\n", strerror(errno));
+	}
+	if (do_atomic && !do_backup) {
+	    /* Remember what we replace, to reclaim its stripes */
+	    old_fd = open(rename_to, O_RDONLY | O_LARGEFILE);
+	}
+    }
+
     if (do_backup) {
 	struct stat s;
 
@@ -907,12 +1217,18 @@ int real_main(int argc, char **argv)
 	    die(errno, "Unable to rename '%s' to '%s': %s\n",
 		chkpt_to, rename_to, strerror(errno));
     }
+    if (old_fd >= 0) {
+	if (cr_stripe_is_manifest(old_fd)) {
+	    cr_stripe_remove(old_fd);
+	}
+	(void)close(old_fd);
+    }
 
     /* End our critical section */
     pthread_mutex_unlock(&lock);
 
-    /* Show kernel warnings if any. */
-    if ((verbose >= 0) && (kmsg_level == kmsg_warn)) {
+    /* Show kernel warnings (and the critical-path report w/ -v) if any. */
+    if ((verbose > 0) || ((verbose >= 0) && (kmsg_level == kmsg_warn))) {
       show_kmsgs();
     }
 
@@ -939,6 +1255,25 @@ int real_main(int argc, char **argv)
 	}
     }
 
+    /* Release our slot only once the data is on disk */
+    if (sched_fd >= 0) {
+	(void)close(sched_fd);
+    }
+
+    /* Copy the staged image to its real destination */
+    if (final_to) {
+	if (verbose > 0) {
+	    fprintf(stderr, "draining '%s' to '%s'%s\n", rename_to, final_to,
+		    stage_wait ? "" : " in the background");
+	}
+	err = cr_stage_drain(rename_to, final_to, final_backup, backup_to,
+			     stage_wait, verbose);
+	if (err < 0) {
+	    die(errno, "Failed to copy staged checkpoint '%s' to '%s': %s\n",
+		rename_to, final_to, strerror(errno));
+	}
+    }
+
     return 0;
 }
 
@@ -0,0 +1,588 @@
+/*
+ * Berkeley Lab Checkpoint/Restart (BLCR) for Linux is Copyright (c)
+ * 2008, The Regents of the University of California, through Lawrence
+ * Berkeley National Laboratory (subject to receipt of any required
+ * approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Portions may be copyrighted by others, as may be noted in specific
+ * copyright notices within specific files.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Node-local admission control for concurrent checkpoint requests.
+ *
+ * Every cr_checkpoint normally goes straight to the kernel.  When many
+ * are started at once on one node they compete for page cache and disk
+ * bandwidth and aggregate throughput collapses.  With --sched, each
+ * cr_checkpoint instead asks a daemon (cr_checkpoint --sched-daemon)
+ * for a slot and holds it, by keeping its connection open, until the
+ * checkpoint has been written and synced.
+ *
+ * The protocol is line-oriented over a unix stream socket:
+ *   client -> "REQ <target> <priority> <mem_kb>\n"
+ *   daemon -> "GO\n"           when admitted
+ *   client closes the socket   when done (or on death)
+ * or
+ *   client -> "STAT\n"
+ *   daemon -> queue report, then closes
+ *
+ * Admission is strictly by priority (higher first), then FIFO.  The head
+ * of the queue is admitted when fewer than max_active requests are in
+ * progress AND the estimated size of all active requests plus its own
+ * fits in available memory less the reserve.  A lone request is always
+ * admitted, so an over-large estimate can delay but never deadlock.
+ * There is deliberately no backfill: a large high-priority request must
+ * not be starved by a stream of small ones.
+ */
+
+#define _GNU_SOURCE 1	/* For MSG_NOSIGNAL */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <dirent.h>
+
+#include "libcr.h"
+#include "cr_sched.h"
+
+#define LINE_MAX_LEN	128
+
+const char *cr_sched_path(const char *path)
+{
+    if (!path || !*path) {
+	path = getenv("CR_SCHED_SOCKET");
+	if (!path || !*path) {
+	    path = CR_SCHED_SOCKET_DFLT;
+	}
+    }
+    return path;
+}
+
+/*
+ * Resource estimation
+ */
+
+struct proc_ent {
+    pid_t pid, ppid, pgrp, sid;
+    long rss;
+    int in_scope;
+};
+
+/* Sum RSS over /proc/[0-9]* in the given scope.
+ * This is only an estimate (shared pages are counted multiple times and
+ * the kernel dumps only what it must), but it scales correctly.
+ */
+unsigned long cr_sched_estimate_kb(pid_t target, int scope)
+{
+    struct proc_ent *ents = NULL;
+    int count = 0, alloc = 0;
+    unsigned long total = 0;
+    long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    struct dirent *de;
+    DIR *dir;
+    int i, changed;
+
+    dir = opendir("/proc");
+    if (!dir) return 0;
+
+    while ((de = readdir(dir)) != NULL) {
+	char path[300], buf[1024];
+	char *p, state;
+	int fd, len;
+	struct proc_ent *e;
+
+	if ((de->d_name[0] < '0') || (de->d_name[0] > '9')) continue;
+
+	snprintf(path, sizeof(path), "/proc/%s/stat", de->d_name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) continue;
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0) continue;
+	buf[len] = '\0';
+
+	/* comm may contain anything, so parse from the last ')' */
+	p = strrchr(buf, ')');
+	if (!p) continue;
+
+	if (count == alloc) {
+	    struct proc_ent *tmp;
+	    alloc = alloc ? 2 * alloc : 256;
+	    tmp = realloc(ents, alloc * sizeof(*ents));
+	    if (!tmp) break;
+	    ents = tmp;
+	}
+	e = &ents[count];
+	e->pid = atoi(de->d_name);
+	e->rss = 0;
+	if (sscanf(p + 1, " %c %d %d %d %*s %*s %*s %*s %*s %*s %*s %*s %*s"
+			  " %*s %*s %*s %*s %*s %*s %*s %*s %ld",
+		   &state, &e->ppid, &e->pgrp, &e->sid, &e->rss) != 5) {
+	    continue;
+	}
+	switch (scope) {
+	    case CR_SCOPE_PGRP: e->in_scope = (e->pgrp == target); break;
+	    case CR_SCOPE_SESS: e->in_scope = (e->sid == target); break;
+	    default:            e->in_scope = (e->pid == target); break;
+	}
+	++count;
+    }
+    closedir(dir);
+
+    if (scope == CR_SCOPE_TREE) {
+	/* Iterate to closure over parent links */
+	do {
+	    changed = 0;
+	    for (i = 0; i < count; ++i) {
+		int j;
+		if (ents[i].in_scope) continue;
+		for (j = 0; j < count; ++j) {
+		    if (ents[j].in_scope && (ents[j].pid == ents[i].ppid)) {
+			ents[i].in_scope = changed = 1;
+			break;
+		    }
+		}
+	    }
+	} while (changed);
+    }
+
+    for (i = 0; i < count; ++i) {
+	if (ents[i].in_scope && (ents[i].rss > 0)) {
+	    total += ents[i].rss * page_kb;
+	}
+    }
+    free(ents);
+
+    return total;
+}
+
+/* Returns MemAvailable, or MemFree+Cached on kernels that lack it */
+static unsigned long mem_avail_kb(void)
+{
+    unsigned long avail = 0, free_kb = 0, cached = 0, val;
+    int have_avail = 0;
+    char line[LINE_MAX_LEN];
+    FILE *f;
+
+    f = fopen("/proc/meminfo", "r");
+    if (!f) return 0;
+    while (fgets(line, sizeof(line), f)) {
+	if (sscanf(line, "MemAvailable: %lu", &val) == 1) {
+	    avail = val;
+	    have_avail = 1;
+	} else if (sscanf(line, "MemFree: %lu", &val) == 1) {
+	    free_kb = val;
+	} else if (sscanf(line, "Cached: %lu", &val) == 1) {
+	    cached = val;
+	}
+    }
+    fclose(f);
+
+    return have_avail ? avail : (free_kb + cached);
+}
+
+/*
+ * Daemon
+ */
+
+enum { CL_NEW, CL_WAITING, CL_ACTIVE };
+
+struct sched_client {
+    struct sched_client *next;
+    int fd;
+    int state;
+    pid_t target;
+    int priority;
+    unsigned long mem_kb;
+    unsigned long seq;
+    time_t queued, started;
+    int len;
+    char buf[LINE_MAX_LEN];
+};
+
+static struct sched_client *clients = NULL;
+static int nclients = 0;
+
+static int send_str(int fd, const char *s)
+{
+    int len = strlen(s);
+    return (send(fd, s, len, MSG_NOSIGNAL) == len) ? 0 : -1;
+}
+
+static void drop_client(struct sched_client *cl)
+{
+    struct sched_client **pp;
+
+    for (pp = &clients; *pp; pp = &(*pp)->next) {
+	if (*pp == cl) {
+	    *pp = cl->next;
+	    break;
+	}
+    }
+    close(cl->fd);
+    free(cl);
+    --nclients;
+}
+
+static void active_totals(int *count, unsigned long *mem_kb)
+{
+    struct sched_client *cl;
+
+    *count = 0;
+    *mem_kb = 0;
+    for (cl = clients; cl; cl = cl->next) {
+	if (cl->state == CL_ACTIVE) {
+	    *count += 1;
+	    *mem_kb += cl->mem_kb;
+	}
+    }
+}
+
+/* Returns the number of requests still waiting */
+static int admit(const struct cr_sched_limits *lim)
+{
+    for (;;) {
+	struct sched_client *cl, *best = NULL;
+	unsigned long active_kb, avail_kb;
+	int active;
+
+	for (cl = clients; cl; cl = cl->next) {
+	    if (cl->state != CL_WAITING) continue;
+	    if (!best || (cl->priority > best->priority) ||
+		((cl->priority == best->priority) && (cl->seq < best->seq))) {
+		best = cl;
+	    }
+	}
+	if (!best) return 0;
+
+	active_totals(&active, &active_kb);
+	if (active) {
+	    if (active >= lim->max_active) break;
+	    avail_kb = mem_avail_kb();
+	    avail_kb = (avail_kb > lim->reserve_kb) ? (avail_kb - lim->reserve_kb) : 0;
+	    if (active_kb + best->mem_kb > avail_kb) break;
+	}
+
+	if (send_str(best->fd, "GO\n") < 0) {
+	    drop_client(best);
+	    continue;
+	}
+	best->state = CL_ACTIVE;
+	best->started = time(NULL);
+	if (lim->verbose > 0) {
+	    fprintf(stderr, "admitted target %d (prio %d, %lu KiB) after %ld s\n",
+		    (int)best->target, best->priority, best->mem_kb,
+		    (long)(best->started - best->queued));
+	}
+    }
+
+    {
+	struct sched_client *cl;
+	int waiting = 0;
+	for (cl = clients; cl; cl = cl->next) {
+	    waiting += (cl->state == CL_WAITING);
+	}
+	return waiting;
+    }
+}
+
+static void report(int fd, const struct cr_sched_limits *lim)
+{
+    struct sched_client *cl;
+    unsigned long active_kb;
+    int active;
+    time_t now = time(NULL);
+    char line[LINE_MAX_LEN];
+
+    active_totals(&active, &active_kb);
+    snprintf(line, sizeof(line), "active %d/%d mem_kb %lu avail_kb %lu reserve_kb %lu\n",
+	     active, lim->max_active, active_kb, mem_avail_kb(), lim->reserve_kb);
+    (void)send_str(fd, line);
+
+    for (cl = clients; cl; cl = cl->next) {
+	if (cl->state == CL_NEW) continue;
+	snprintf(line, sizeof(line), "%s target %d prio %d mem_kb %lu secs %ld\n",
+		 (cl->state == CL_ACTIVE) ? "ACTIVE " : "WAITING",
+		 (int)cl->target, cl->priority, cl->mem_kb,
+		 (long)(now - ((cl->state == CL_ACTIVE) ? cl->started : cl->queued)));
+	(void)send_str(fd, line);
+    }
+}
+
+/* Returns non-zero if the client should be dropped */
+static int handle_line(struct sched_client *cl, const char *line,
+		       const struct cr_sched_limits *lim)
+{
+    static unsigned long next_seq = 0;
+    int target, priority;
+    unsigned long mem_kb;
+
+    if (cl->state != CL_NEW) {
+	return 1; /* protocol error */
+    } else if (!strcmp(line, "STAT")) {
+	report(cl->fd, lim);
+	return 1;
+    } else if (sscanf(line, "REQ %d %d %lu", &target, &priority, &mem_kb) == 3) {
+	cl->state = CL_WAITING;
+	cl->target = target;
+	cl->priority = priority;
+	cl->mem_kb = mem_kb;
+	cl->seq = next_seq++;
+	cl->queued = time(NULL);
+	if (lim->verbose > 0) {
+	    fprintf(stderr, "queued target %d (prio %d, %lu KiB)\n",
+		    target, priority, mem_kb);
+	}
+	return 0;
+    }
+
+    return 1;
+}
+
+/* Returns non-zero if the client should be dropped */
+static int client_input(struct sched_client *cl, const struct cr_sched_limits *lim)
+{
+    char *nl;
+    int rc;
+
+    rc = read(cl->fd, cl->buf + cl->len, sizeof(cl->buf) - 1 - cl->len);
+    if (rc <= 0) {
+	/* EOF: either finished or died.  Either way the slot is free. */
+	if ((cl->state == CL_ACTIVE) && (lim->verbose > 0)) {
+	    fprintf(stderr, "released target %d after %ld s\n",
+		    (int)cl->target, (long)(time(NULL) - cl->started));
+	}
+	return 1;
+    }
+    cl->len += rc;
+    cl->buf[cl->len] = '\0';
+
+    while ((nl = strchr(cl->buf, '\n')) != NULL) {
+	*nl = '\0';
+	if (handle_line(cl, cl->buf, lim)) return 1;
+	cl->len -= (nl + 1 - cl->buf);
+	memmove(cl->buf, nl + 1, cl->len + 1);
+    }
+
+    return (cl->len == sizeof(cl->buf) - 1); /* overlong line */
+}
+
+static int sched_connect(const char *path)
+{
+    struct sockaddr_un sun;
+    int fd;
+
+    if (strlen(path) >= sizeof(sun.sun_path)) {
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    (void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) {
+	int saved_errno = errno;
+	close(fd);
+	errno = saved_errno;
+	return -1;
+    }
+
+    return fd;
+}
+
+int cr_sched_daemon(const char *path, const struct cr_sched_limits *lim)
+{
+    struct sockaddr_un sun;
+    struct pollfd *pfd = NULL;
+    int pfd_alloc = 0;
+    int listen_fd;
+
+    path = cr_sched_path(path);
+    if (strlen(path) >= sizeof(sun.sun_path)) {
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+
+    /* Remove a stale socket, but never steal one from a live daemon */
+    listen_fd = sched_connect(path);
+    if (listen_fd >= 0) {
+	close(listen_fd);
+	errno = EADDRINUSE;
+	return -1;
+    } else if (errno == ECONNREFUSED) {
+	(void)unlink(path);
+    }
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) return -1;
+    if ((bind(listen_fd, (struct sockaddr *)&sun, sizeof(sun)) < 0) ||
+	(listen(listen_fd, 64) < 0)) {
+	int saved_errno = errno;
+	close(listen_fd);
+	errno = saved_errno;
+	return -1;
+    }
+    (void)signal(SIGPIPE, SIG_IGN);
+
+    if (lim->verbose > 0) {
+	fprintf(stderr, "scheduling checkpoints on '%s': max_active=%d reserve=%lu KiB\n",
+		path, lim->max_active, lim->reserve_kb);
+    }
+
+    for (;;) {
+	struct sched_client *cl, *next;
+	int i, n, timeout;
+
+	/* Memory headroom changes w/o any event, so poll while requests wait */
+	timeout = admit(lim) ? 1000 : -1;
+
+	if (pfd_alloc < nclients + 1) {
+	    struct pollfd *tmp;
+	    int want = 2 * (nclients + 1);
+	    tmp = realloc(pfd, want * sizeof(*pfd));
+	    if (!tmp) {
+		errno = ENOMEM;
+		return -1;
+	    }
+	    pfd = tmp;
+	    pfd_alloc = want;
+	}
+	pfd[0].fd = listen_fd;
+	pfd[0].events = POLLIN;
+	for (cl = clients, i = 1; cl; cl = cl->next, ++i) {
+	    pfd[i].fd = cl->fd;
+	    pfd[i].events = POLLIN;
+	}
+	n = i;
+
+	if (poll(pfd, n, timeout) < 0) {
+	    if (errno == EINTR) continue;
+	    return -1;
+	}
+
+	/* Walk in the same order the pollfd array was built */
+	for (cl = clients, i = 1; cl && (i < n); cl = next, ++i) {
+	    next = cl->next;
+	    if (pfd[i].revents && client_input(cl, lim)) {
+		drop_client(cl);
+	    }
+	}
+
+	if (pfd[0].revents & POLLIN) {
+	    int fd = accept(listen_fd, NULL, NULL);
+	    if (fd >= 0) {
+		cl = calloc(1, sizeof(*cl));
+		if (!cl) {
+		    close(fd);
+		    continue;
+		}
+		(void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+		cl->fd = fd;
+		cl->state = CL_NEW;
+		cl->next = clients;
+		clients = cl;
+		++nclients;
+	    }
+	}
+    }
+
+    /* NOT REACHED */
+    return 0;
+}
+
+/*
+ * Client
+ */
+
+int cr_sched_admit(const char *path, pid_t target, int priority, unsigned long mem_kb)
+{
+    char line[LINE_MAX_LEN];
+    int fd, len, rc;
+
+    fd = sched_connect(cr_sched_path(path));
+    if (fd < 0) return -1;
+
+    snprintf(line, sizeof(line), "REQ %d %d %lu\n", (int)target, priority, mem_kb);
+    if (send_str(fd, line) < 0) goto out_err;
+
+    /* Wait (possibly a long while) for "GO\n" */
+    len = 0;
+    do {
+	rc = read(fd, line + len, sizeof(line) - 1 - len);
+	if ((rc < 0) && (errno == EINTR)) continue;
+	if (rc <= 0) {
+	    if (!rc) errno = ECONNRESET;
+	    goto out_err;
+	}
+	len += rc;
+	line[len] = '\0';
+    } while (!strchr(line, '\n') && (len < sizeof(line) - 1));
+
+    if (strcmp(line, "GO\n")) {
+	errno = EPROTO;
+	goto out_err;
+    }
+
+    return fd;
+
+out_err:
+    {
+	int saved_errno = errno;
+	close(fd);
+	errno = saved_errno;
+    }
+    return -1;
+}
+
+int cr_sched_status(const char *path, FILE *out)
+{
+    char buf[1024];
+    int fd, rc;
+
+    fd = sched_connect(cr_sched_path(path));
+    if (fd < 0) return -1;
+
+    if (send_str(fd, "STAT\n") < 0) {
+	close(fd);
+	return -1;
+    }
+    while ((rc = read(fd, buf, sizeof(buf))) != 0) {
+	if (rc < 0) {
+	    if (errno == EINTR) continue;
+	    break;
+	}
+	fwrite(buf, 1, rc, out);
+    }
+    close(fd);
+
+    return (rc < 0) ? -1 : 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * Berkeley Lab Checkpoint/Restart (BLCR) for Linux is Copyright (c)
+ * 2008, The Regents of the University of California, through Lawrence
+ * Berkeley National Laboratory (subject to receipt of any required
+ * approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Portions may be copyrighted by others, as may be noted in specific
+ * copyright notices within specific files.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Node-local admission control for concurrent checkpoint requests.
+ */
+
+#ifndef _CR_SCHED_H
+#define _CR_SCHED_H	1
+
+#include <sys/types.h>
+#include <stdio.h>
+
+/* Default rendezvous, overridden by $CR_SCHED_SOCKET or an explicit path */
+#define CR_SCHED_SOCKET_DFLT	"/var/run/cr_sched.sock"
+
+struct cr_sched_limits {
+    int max_active;		/* concurrent checkpoint streams (I/O budget) */
+    unsigned long reserve_kb;	/* memory to leave free for applications */
+    int verbose;
+};
+
+/* Resolve NULL to the environment or compiled-in default */
+extern const char *cr_sched_path(const char *path);
+
+/* Approximate resident size (KiB) of all processes in a checkpoint scope */
+extern unsigned long cr_sched_estimate_kb(pid_t target, int scope);
+
+/* Daemon: serve the queue on 'path' until killed.  Returns -1 w/ errno on setup failure. */
+extern int cr_sched_daemon(const char *path, const struct cr_sched_limits *lim);
+
+/* Client: block until admitted.
+ * Returns an fd that must stay open for the duration of the checkpoint
+ * (closing it releases the slot), or -1 w/ errno if no daemon is reachable.
+ */
+extern int cr_sched_admit(const char *path, pid_t target, int priority, unsigned long mem_kb);
+
+/* Client: copy the daemon's queue report to 'out' */
+extern int cr_sched_status(const char *path, FILE *out);
+
+#endif /* _CR_SCHED_H */
@@ -0,0 +1,372 @@
+/*
+ * Berkeley Lab Checkpoint/Restart (BLCR) for Linux is Copyright (c)
+ * 2008, The Regents of the University of California, through Lawrence
+ * Berkeley National Laboratory (subject to receipt of any required
+ * approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Portions may be copyrighted by others, as may be noted in specific
+ * copyright notices within specific files.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Drain of node-local (staged) checkpoints to their final destination.
+ *
+ * With --stage DIR the kernel writes the context file to fast local
+ * storage, so the application is stalled only for as long as local media
+ * takes.  The image is then copied to the real destination here, outside
+ * of the checkpoint, as follows:
+ *   1. copy to a hidden temporary (unique, from mkstemp) next to the
+ *      destination, checksumming the source as it is read,
+ *   2. fsync the copy, then re-read it and compare checksums,
+ *   3. stamp the copy w/ the mtime of the staged file, to the nanosecond,
+ *      so cr_restart can tell that the two are the same image,
+ *   4. back up the old destination if requested, and rename into place.
+ * Failed attempts are retried a few times.  The staged copy is left in
+ * place for cr_restart to prefer.
+ *
+ * The staged copy is named for the full path of its destination (see
+ * cr_stage_name()), so there is exactly one per destination, and the next
+ * checkpoint to that destination replaces it.  Nothing here removes it
+ * otherwise: reclaiming $CR_STAGE_DIR, e.g. at the end of a job, is left
+ * to the site.
+ */
+
+#define _LARGEFILE64_SOURCE 1   /* For O_LARGEFILE */
+#define _GNU_SOURCE 1
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <libgen.h>
+#include <dirent.h>
+#include <limits.h>
+
+#ifndef O_LARGEFILE
+  #define O_LARGEFILE 0
+#endif
+
+#include "cr_stage.h"
+
+#define DRAIN_BUFSZ	(1024 * 1024)
+#define DRAIN_TRIES	3
+
+#define FNV64_INIT	0xcbf29ce484222325ULL
+#define FNV64_PRIME	0x100000001b3ULL
+
+/* FNV-1a, 64-bit */
+static uint64_t fnv64(uint64_t h, const unsigned char *p, size_t len)
+{
+    while (len--) {
+	h ^= *(p++);
+	h *= FNV64_PRIME;
+    }
+    return h;
+}
+
+/* Lexically make 'path' absolute, dropping empty, "." and ".." components.
+ * Used only if realpath() fails, e.g. if the file system holding the
+ * destination is not available at restart.
+ */
+static int abs_path(const char *path, char *out, size_t size)
+{
+    char buf[2 * PATH_MAX];
+    char *comp, *save, *p;
+    size_t len = 0;
+
+    if (path[0] == '/') {
+	buf[0] = '\0';
+    } else if (!getcwd(buf, PATH_MAX)) {
+	return -1;
+    }
+    if (strlen(buf) + strlen(path) + 2 > sizeof(buf)) {
+	errno = ENAMETOOLONG;
+	return -1;
+    }
+    strcat(buf, "/");
+    strcat(buf, path);
+
+    out[0] = '\0';
+    for (comp = strtok_r(buf, "/", &save); comp; comp = strtok_r(NULL, "/", &save)) {
+	if (!strcmp(comp, ".")) {
+	    continue;
+	} else if (!strcmp(comp, "..")) {
+	    if ((p = strrchr(out, '/')) != NULL) {
+		*p = '\0';
+		len = p - out;
+	    }
+	    continue;
+	}
+	if (len + strlen(comp) + 2 > size) {
+	    errno = ENAMETOOLONG;
+	    return -1;
+	}
+	out[len++] = '/';
+	strcpy(out + len, comp);
+	len += strlen(comp);
+    }
+    if (!len) strcpy(out, "/");
+    return 0;
+}
+
+char *cr_stage_name(const char *stage_dir, const char *dst)
+{
+    char dir[PATH_MAX];
+    char *tmp_dir, *tmp_base, *name = NULL;
+    const char *parent, *base;
+    uint64_t h;
+    size_t len;
+
+    tmp_dir = strdup(dst);
+    tmp_base = strdup(dst);
+    if (!tmp_dir || !tmp_base) {
+	errno = ENOMEM;
+	goto out;
+    }
+    parent = dirname(tmp_dir);
+    if (!realpath(parent, dir) && abs_path(parent, dir, sizeof(dir))) {
+	goto out;
+    }
+    base = basename(tmp_base);
+
+    h = fnv64(FNV64_INIT, (const unsigned char *)dir, strlen(dir));
+    h = fnv64(h, (const unsigned char *)"/", 1);
+    h = fnv64(h, (const unsigned char *)base, strlen(base));
+
+    len = strlen(stage_dir) + strlen(base) + 20;
+    name = malloc(len);
+    if (!name) {
+	errno = ENOMEM;
+	goto out;
+    }
+    /* Truncate the readable part, so the hash always fits in NAME_MAX */
+    snprintf(name, len, "%s/%.200s.%016llx", stage_dir, base, (unsigned long long)h);
+
+out:
+    free(tmp_dir);
+    free(tmp_base);
+    return name;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len) {
+	ssize_t rc = write(fd, buf, len);
+	if (rc < 0) {
+	    if (errno == EINTR) continue;
+	    return -1;
+	}
+	buf += rc;
+	len -= rc;
+    }
+    return 0;
+}
+
+/* Returns checksum of an fd's contents from offset 0, or sets errno */
+static int checksum_fd(int fd, char *buf, uint64_t *sum, off_t *len)
+{
+    uint64_t h = FNV64_INIT;
+    off_t total = 0;
+    ssize_t rc;
+
+    if (lseek(fd, 0, SEEK_SET) < 0) return -1;
+#if defined(POSIX_FADV_DONTNEED)
+    /* Try to make the verify pass read the media, not our own page cache */
+    (void)posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    while ((rc = read(fd, buf, DRAIN_BUFSZ)) != 0) {
+	if (rc < 0) {
+	    if (errno == EINTR) continue;
+	    return -1;
+	}
+	h = fnv64(h, (unsigned char *)buf, rc);
+	total += rc;
+    }
+    *sum = h;
+    *len = total;
+    return 0;
+}
+
+static void sync_parent(const char *path)
+{
+    char *tmp = strdup(path);
+    DIR *dir;
+
+    if (!tmp) return;
+    dir = opendir(dirname(tmp));
+    if (dir) {
+	(void)fsync(dirfd(dir)); /* may legitimately fail, e.g. on NFS */
+	closedir(dir);
+    }
+    free(tmp);
+}
+
+static int do_backup_of(const char *dst, const char *backup_to)
+{
+    struct stat s;
+    char *name = NULL;
+    int rc;
+
+    if (stat(dst, &s)) return 0; /* nothing to back up */
+
+    if (!backup_to) {
+	int bnum = 1;
+	int len = strlen(dst) + 10;
+	name = malloc(len);
+	if (!name) return -1;
+	do {
+	    snprintf(name, len, "%s.~%d~", dst, bnum++);
+	} while (!stat(name, &s) && (bnum <= (1<<16)));
+	backup_to = name;
+    }
+    rc = rename(dst, backup_to);
+    free(name);
+    return rc;
+}
+
+/* 'tmp' is a mkstemp() template, overwritten w/ the name used */
+static int drain_once(const char *src, const char *dst, char *tmp,
+		      int do_backup, const char *backup_to, char *buf)
+{
+    uint64_t src_sum = FNV64_INIT, dst_sum;
+    off_t src_len = 0, dst_len;
+    struct timespec ts[2];
+    struct stat st;
+    int in = -1, out = -1;
+    ssize_t rc;
+    int retval = -1;
+
+    in = open(src, O_RDONLY | O_LARGEFILE);
+    if (in < 0) goto out;
+    if (fstat(in, &st) < 0) goto out;
+    out = mkstemp(tmp);
+    if (out < 0) goto out;
+    if (fchmod(out, 0400) < 0) goto out;
+
+    while ((rc = read(in, buf, DRAIN_BUFSZ)) != 0) {
+	if (rc < 0) {
+	    if (errno == EINTR) continue;
+	    goto out;
+	}
+	src_sum = fnv64(src_sum, (unsigned char *)buf, rc);
+	src_len += rc;
+	if (write_all(out, buf, rc) < 0) goto out;
+    }
+    if ((fsync(out) < 0) && (errno != EINVAL)) goto out;
+
+    if (checksum_fd(out, buf, &dst_sum, &dst_len) < 0) goto out;
+    if ((dst_len != src_len) || (dst_sum != src_sum)) {
+	errno = EIO;
+	goto out;
+    }
+
+    /* Same mtime and size on both copies == same image (see cr_restart --stage) */
+    ts[0] = st.st_atim;
+    ts[1] = st.st_mtim;
+    if (futimens(out, ts) < 0) goto out;
+
+    if (do_backup && (do_backup_of(dst, backup_to) < 0)) goto out;
+    if (rename(tmp, dst) < 0) goto out;
+    sync_parent(dst);
+    retval = 0;
+
+out:
+    if ((retval < 0) && (out >= 0)) {
+	int saved_errno = errno;
+	(void)unlink(tmp);
+	errno = saved_errno;
+    }
+    if (out >= 0) close(out);
+    if (in >= 0) close(in);
+    return retval;
+}
+
+static int drain_main(const char *src, const char *dst,
+		      int do_backup, const char *backup_to, int verbose)
+{
+    char *tmpl, *tmp, *base, *dir;
+    char *buf;
+    int i, rc = -1, err = 0;
+
+    buf = malloc(DRAIN_BUFSZ);
+    base = strdup(dst);
+    dir = strdup(dst);
+    tmpl = malloc(strlen(dst) + 16);
+    tmp = malloc(strlen(dst) + 16);
+    if (!buf || !base || !dir || !tmpl || !tmp) {
+	if (verbose >= 0) {
+	    fprintf(stderr, "cr_checkpoint: drain of '%s' failed: %s\n", src, strerror(ENOMEM));
+	}
+	return ENOMEM;
+    }
+    /* use '.context.pid.XXXXXX'-style name for the copy in progress */
+    sprintf(tmpl, "%s/.%s.XXXXXX", dirname(dir), basename(base));
+
+    for (i = 0; i < DRAIN_TRIES; ++i) {
+	strcpy(tmp, tmpl);
+	rc = drain_once(src, dst, tmp, do_backup, backup_to, buf);
+	if (!rc) break;
+	err = errno;
+	if (verbose >= 0) {
+	    fprintf(stderr, "cr_checkpoint: drain of '%s' to '%s' failed (attempt %d of %d): %s\n",
+		    src, dst, i + 1, DRAIN_TRIES, strerror(err));
+	}
+	if (i + 1 < DRAIN_TRIES) sleep(1 << i);
+    }
+    if (!rc && (verbose > 0)) {
+	fprintf(stderr, "cr_checkpoint: drained '%s' to '%s'\n", src, dst);
+    }
+
+    return rc ? (err ? err : EIO) : 0;
+}
+
+int cr_stage_drain(const char *src, const char *dst,
+		   int do_backup, const char *backup_to,
+		   int wait, int verbose)
+{
+    pid_t pid;
+    int status;
+
+    pid = fork();
+    if (pid < 0) {
+	return -1;
+    } else if (!pid) {
+	/* Detach from the caller's session so job control can't kill us */
+	(void)setsid();
+	_exit(drain_main(src, dst, do_backup, backup_to, verbose));
+    } else if (!wait) {
+	return 0;
+    }
+
+    while (waitpid(pid, &status, 0) < 0) {
+	if (errno != EINTR) return -1;
+    }
+    if (!WIFEXITED(status)) {
+	errno = EINTR;
+	return -1;
+    } else if (WEXITSTATUS(status)) {
+	errno = WEXITSTATUS(status);
+	return -1;
+    }
+
+    return 0;
+}
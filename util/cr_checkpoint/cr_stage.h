@@ -0,0 +1,49 @@
+/*
+ * Berkeley Lab Checkpoint/Restart (BLCR) for Linux is Copyright (c)
+ * 2008, The Regents of the University of California, through Lawrence
+ * Berkeley National Laboratory (subject to receipt of any required
+ * approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Portions may be copyrighted by others, as may be noted in specific
+ * copyright notices within specific files.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Drain of node-local (staged) checkpoints to their final destination.
+ */
+
+#ifndef _CR_STAGE_H
+#define _CR_STAGE_H	1
+
+/* Name of the staged copy of 'dst' in 'stage_dir': the basename of 'dst'
+ * and a hash of its absolute path, so destinations that differ only in
+ * their directory never share a staged copy.
+ * Returns a malloc()ed string, or NULL w/ errno set.
+ */
+extern char *cr_stage_name(const char *stage_dir, const char *dst);
+
+/* Copy 'src' to 'dst' w/ verification, atomically replacing 'dst'.
+ * If do_backup, any existing 'dst' is first renamed to backup_to
+ * (or the first free 'dst.~N~' if backup_to is NULL).
+ *
+ * The copy runs in a detached child.  If 'wait' is zero, returns 0 as
+ * soon as the child is started.  Otherwise waits for the child and
+ * returns 0 on success or -1 w/ errno set.
+ */
+extern int cr_stage_drain(const char *src, const char *dst,
+			  int do_backup, const char *backup_to,
+			  int wait, int verbose);
+
+#endif /* _CR_STAGE_H */
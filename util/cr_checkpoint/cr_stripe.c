@@ -0,0 +1,370 @@
+/*
+ * Berkeley Lab Checkpoint/Restart (BLCR) for Linux is Copyright (c)
+ * 2008, The Regents of the University of California, through Lawrence
+ * Berkeley National Laboratory (subject to receipt of any required
+ * approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Portions may be copyrighted by others, as may be noted in specific
+ * copyright notices within specific files.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Striping of one context stream across several files.
+ *
+ * The kernel does the striping itself (CR_OP_STRIPE): we create or open
+ * the N stripe files and cr_open_striped() gives back one seekable fd,
+ * which is the destination or source of the request like a regular file.
+ * Unit i of the stream (stripe_size bytes) lives in file (i % N) at offset
+ * (i / N) * stripe_size.  So the parallel page I/O of the kernel's helper
+ * threads reaches all N files at once, and the table of contents and the
+ * per-section statistics see ordinary offsets.
+ *
+ * The file named on the command line becomes a small text manifest:
+ *	BLCR-STRIPED 1
+ *	stripe_size <bytes>
+ *	length <bytes>
+ *	count <N>
+ *	<absolute path of stripe 0>
+ *	...
+ * Stripe files carry a unique tag in their names, so the manifest remains
+ * the single commit point for atomic replacement.
+ */
+
+#define _LARGEFILE64_SOURCE 1   /* For O_LARGEFILE */
+#define _GNU_SOURCE 1
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <libgen.h>
+
+#ifndef O_LARGEFILE
+  #define O_LARGEFILE 0
+#endif
+
+#include "libcr.h"
+#include "cr_stripe.h"
+
+#define MANIFEST_MAX	(64 * 1024)
+
+struct cr_stripe_set {
+    int count;
+    size_t stripe_size;
+    int stripe_fd;		/* the striped stream */
+    int *fd;			/* writer only */
+    char **path;		/* writer only */
+};
+
+static int write_full(int fd, const char *buf, size_t len)
+{
+    while (len) {
+	ssize_t rc = write(fd, buf, len);
+	if (rc < 0) {
+	    if (errno == EINTR) continue;
+	    return -1;
+	}
+	buf += rc;
+	len -= rc;
+    }
+    return 0;
+}
+
+static void free_set(cr_stripe_set_t *set)
+{
+    int i;
+
+    if (!set) return;
+    for (i = 0; i < set->count; ++i) {
+	if (set->fd && (set->fd[i] >= 0)) close(set->fd[i]);
+	if (set->path) free(set->path[i]);
+    }
+    free(set->fd);
+    free(set->path);
+    if (set->stripe_fd >= 0) close(set->stripe_fd);
+    free(set);
+}
+
+/*
+ * Writer
+ */
+
+static void unlink_stripes(cr_stripe_set_t *set)
+{
+    int i;
+    for (i = 0; i < set->count; ++i) {
+	if (set->path[i]) (void)unlink(set->path[i]);
+    }
+}
+
+cr_stripe_set_t *cr_stripe_write_start(const char *name, char * const *dirs,
+				       int count, size_t stripe_size, int *stripe_fd)
+{
+    cr_stripe_set_t *set;
+    char *tmp = NULL, *base;
+    unsigned int tag;
+    int i, saved_errno;
+
+    if ((count < 1) || (count > CR_STRIPE_MAX) || !stripe_size) {
+	errno = EINVAL;
+	return NULL;
+    }
+    set = calloc(1, sizeof(*set));
+    if (!set) return NULL;
+    set->stripe_size = stripe_size;
+    set->stripe_fd = -1;
+    set->fd = malloc(count * sizeof(int));
+    set->path = calloc(count, sizeof(char *));
+    if (!set->fd || !set->path) goto out_nomem;
+    for (i = 0; i < count; ++i) set->fd[i] = -1;
+    set->count = count;
+
+    tmp = strdup(name);
+    if (!tmp) goto out_nomem;
+    base = basename(tmp);
+    tag = ((unsigned int)time(NULL) << 16) ^ (unsigned int)getpid();
+
+    for (i = 0; i < count; ++i) {
+	char cwd[PATH_MAX];
+	const char *dir = dirs[i];
+	const char *sep = "";
+	int len;
+
+	/* Record absolute paths, so the manifest doesn't depend on cwd */
+	if (dir[0] != '/') {
+	    if (!getcwd(cwd, sizeof(cwd))) goto out_err;
+	    sep = "/";
+	} else {
+	    cwd[0] = '\0';
+	}
+	len = strlen(cwd) + strlen(dir) + strlen(base) + 32;
+	set->path[i] = malloc(len);
+	if (!set->path[i]) goto out_nomem;
+	snprintf(set->path[i], len, "%s%s%s/%s.%08x.s%d", cwd, sep, dir, base, tag, i);
+
+	set->fd[i] = open(set->path[i], O_WRONLY|O_CREAT|O_EXCL|O_NOCTTY|O_LARGEFILE, 0400);
+	if (set->fd[i] < 0) goto out_err;
+	(void)fcntl(set->fd[i], F_SETFD, FD_CLOEXEC);
+    }
+    free(tmp);
+    tmp = NULL;
+
+    set->stripe_fd = cr_open_striped(set->fd, count, stripe_size, 1, 0);
+    if (set->stripe_fd < 0) goto out_err;
+    (void)fcntl(set->stripe_fd, F_SETFD, FD_CLOEXEC);
+
+    *stripe_fd = set->stripe_fd;
+    return set;
+
+out_nomem:
+    errno = ENOMEM;
+out_err:
+    saved_errno = errno;
+    free(tmp);
+    unlink_stripes(set);
+    free_set(set);
+    errno = saved_errno;
+    return NULL;
+}
+
+void cr_stripe_write_abort(cr_stripe_set_t *set)
+{
+    /* Called only on the way to exit() */
+    unlink_stripes(set);
+}
+
+int cr_stripe_write_finish(cr_stripe_set_t *set, int manifest_fd, int do_sync)
+{
+    char line[PATH_MAX + 64];
+    off_t length;
+    int i, err = 0;
+
+    /* The request is reaped, so the kernel is done writing */
+    length = lseek(set->stripe_fd, 0, SEEK_END);
+    if (length < 0) err = errno;
+    close(set->stripe_fd);
+    set->stripe_fd = -1;
+
+    for (i = 0; !err && do_sync && (i < set->count); ++i) {
+	if ((fsync(set->fd[i]) < 0) && (errno != EINVAL)) err = errno;
+    }
+
+    if (!err) {
+	snprintf(line, sizeof(line), CR_STRIPE_MAGIC "stripe_size %lu\nlength %llu\ncount %d\n",
+		 (unsigned long)set->stripe_size, (unsigned long long)length, set->count);
+	if (write_full(manifest_fd, line, strlen(line)) < 0) err = errno;
+    }
+    for (i = 0; !err && (i < set->count); ++i) {
+	snprintf(line, sizeof(line), "%s\n", set->path[i]);
+	if (write_full(manifest_fd, line, strlen(line)) < 0) err = errno;
+    }
+
+    if (err) unlink_stripes(set);
+    free_set(set);
+
+    errno = err;
+    return err ? -1 : 0;
+}
+
+/*
+ * Manifest
+ */
+
+int cr_stripe_is_manifest(int fd)
+{
+    char buf[sizeof(CR_STRIPE_MAGIC)];
+    ssize_t len = sizeof(CR_STRIPE_MAGIC) - 1;
+
+    return (pread(fd, buf, len, 0) == len) && !memcmp(buf, CR_STRIPE_MAGIC, len);
+}
+
+/* Parse a manifest.  Returns an array of 'count' malloc()ed paths */
+static char **parse_manifest(int fd, size_t *stripe_size,
+			     unsigned long long *length, int *count)
+{
+    char *text, *line, *save;
+    char **paths = NULL;
+    unsigned long ss;
+    ssize_t len;
+    int n = 0;
+
+    text = malloc(MANIFEST_MAX + 1);
+    if (!text) return NULL;
+    len = pread(fd, text, MANIFEST_MAX, 0);
+    if (len <= 0) goto out_inval;
+    text[len] = '\0';
+
+    if (strncmp(text, CR_STRIPE_MAGIC, strlen(CR_STRIPE_MAGIC))) goto out_inval;
+    line = strtok_r(text + strlen(CR_STRIPE_MAGIC), "\n", &save);
+    if (!line || (sscanf(line, "stripe_size %lu", &ss) != 1) || !ss) goto out_inval;
+    line = strtok_r(NULL, "\n", &save);
+    if (!line || (sscanf(line, "length %llu", length) != 1)) goto out_inval;
+    line = strtok_r(NULL, "\n", &save);
+    if (!line || (sscanf(line, "count %d", count) != 1) ||
+	(*count < 1) || (*count > CR_STRIPE_MAX)) goto out_inval;
+
+    paths = calloc(*count, sizeof(char *));
+    if (!paths) goto out_nomem;
+    for (n = 0; n < *count; ++n) {
+	line = strtok_r(NULL, "\n", &save);
+	if (!line) goto out_inval;
+	paths[n] = strdup(line);
+	if (!paths[n]) goto out_nomem;
+    }
+    *stripe_size = ss;
+    free(text);
+    return paths;
+
+out_nomem:
+    errno = ENOMEM;
+    goto out;
+out_inval:
+    errno = EINVAL;
+out:
+    if (paths) {
+	while (n--) free(paths[n]);
+	free(paths);
+    }
+    free(text);
+    return NULL;
+}
+
+void cr_stripe_remove(int fd)
+{
+    unsigned long long length;
+    size_t stripe_size;
+    char **paths;
+    int i, count;
+
+    paths = parse_manifest(fd, &stripe_size, &length, &count);
+    if (!paths) return;
+    for (i = 0; i < count; ++i) {
+	(void)unlink(paths[i]);
+	free(paths[i]);
+    }
+    free(paths);
+}
+
+/*
+ * Reader
+ */
+
+cr_stripe_set_t *cr_stripe_read_start(int manifest_fd, int *stripe_fd)
+{
+    cr_stripe_set_t *set = NULL;
+    unsigned long long length;
+    size_t stripe_size;
+    char **paths;
+    int *fds;
+    int i, count, saved_errno;
+
+    paths = parse_manifest(manifest_fd, &stripe_size, &length, &count);
+    if (!paths) return NULL;
+
+    fds = malloc(count * sizeof(int));
+    if (!fds) {
+	errno = ENOMEM;
+	goto out_paths;
+    }
+    for (i = 0; i < count; ++i) fds[i] = -1;
+    for (i = 0; i < count; ++i) {
+	fds[i] = open(paths[i], O_RDONLY|O_LARGEFILE);
+	if (fds[i] < 0) goto out_fds;
+    }
+
+    set = calloc(1, sizeof(*set));
+    if (!set) {
+	errno = ENOMEM;
+	goto out_fds;
+    }
+    set->count = count;
+    set->stripe_size = stripe_size;
+    set->stripe_fd = cr_open_striped(fds, count, stripe_size, 0, length);
+    if (set->stripe_fd < 0) {
+	saved_errno = errno;
+	free(set);
+	set = NULL;
+	errno = saved_errno;
+	goto out_fds;
+    }
+    (void)fcntl(set->stripe_fd, F_SETFD, FD_CLOEXEC);
+    *stripe_fd = set->stripe_fd;
+
+    /* The striped fd holds its own references to the stripes */
+out_fds:
+    saved_errno = errno;
+    for (i = 0; i < count; ++i) {
+	if (fds[i] >= 0) close(fds[i]);
+    }
+    free(fds);
+    errno = saved_errno;
+out_paths:
+    saved_errno = errno;
+    for (i = 0; i < count; ++i) free(paths[i]);
+    free(paths);
+    errno = saved_errno;
+    return set;
+}
+
+void cr_stripe_read_finish(cr_stripe_set_t *set)
+{
+    free_set(set);
+}
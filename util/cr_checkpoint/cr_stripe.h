@@ -0,0 +1,70 @@
+/*
+ * Berkeley Lab Checkpoint/Restart (BLCR) for Linux is Copyright (c)
+ * 2008, The Regents of the University of California, through Lawrence
+ * Berkeley National Laboratory (subject to receipt of any required
+ * approvals from the U.S. Dept. of Energy).  All rights reserved.
+ *
+ * Portions may be copyrighted by others, as may be noted in specific
+ * copyright notices within specific files.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Striping of one context stream across several files.
+ * Shared by cr_checkpoint (writer) and cr_restart (reader).
+ */
+
+#ifndef _CR_STRIPE_H
+#define _CR_STRIPE_H	1
+
+#include <stddef.h>
+
+#include "libcr.h"	/* For CR_STRIPE_MAX */
+
+#define CR_STRIPE_MAGIC		"BLCR-STRIPED 1\n"
+#define CR_STRIPE_SIZE_DFLT	(4 * 1024 * 1024)
+
+typedef struct cr_stripe_set cr_stripe_set_t;
+
+/* Writer: create 'count' stripe files for the image 'name', one in
+ * each of dirs[], and open the striped stream over them.
+ * On success *stripe_fd is the fd to pass to the kernel as the destination.
+ */
+extern cr_stripe_set_t *cr_stripe_write_start(const char *name, char * const *dirs,
+					      int count, size_t stripe_size, int *stripe_fd);
+
+/* Writer: after the request is reaped, close the stream, optionally
+ * fsync the stripes, and write the manifest to manifest_fd.
+ * Returns 0 on success, or -1 w/ errno (stripe files are then removed).
+ */
+extern int cr_stripe_write_finish(cr_stripe_set_t *set, int manifest_fd, int do_sync);
+
+/* Writer: remove the stripe files on a fatal error */
+extern void cr_stripe_write_abort(cr_stripe_set_t *set);
+
+/* Non-zero if fd (at offset 0) holds a stripe manifest */
+extern int cr_stripe_is_manifest(int fd);
+
+/* Unlink the stripe files listed in the manifest open on fd */
+extern void cr_stripe_remove(int fd);
+
+/* Reader: parse the manifest on fd and open the striped stream.
+ * On success *stripe_fd is the fd to pass to the kernel as the source.
+ */
+extern cr_stripe_set_t *cr_stripe_read_start(int manifest_fd, int *stripe_fd);
+
+/* Reader: close the stream and free the set */
+extern void cr_stripe_read_finish(cr_stripe_set_t *set);
+
+#endif /* _CR_STRIPE_H */
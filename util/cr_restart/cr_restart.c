@@ -40,12 +40,15 @@
 #include <errno.h>
 #include <pthread.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #ifndef O_LARGEFILE
   #define O_LARGEFILE 0
 #endif
 
 #include "libcr.h"
+#include "cr_stage.h"
+#include "cr_stripe.h"
 
 /* can't use argv[0] to get name, since libtool screws it up */
 #define MY_NAME	"cr_restart"
@@ -108,6 +111,13 @@ static void usage(FILE *stream, int fail)
 "  If no option is given from this group, the default is to take\n"
 "  the final argument as FILE.\n"
 "\n"
+"Options for checkpoints staged through node-local storage:\n"
+"      --stage DIR     if DIR contains the copy of FILE staged by\n"
+"                      cr_checkpoint --stage and it is at least as new,\n"
+"                      read that instead.\n"
+"                      DIR defaults to $CR_STAGE_DIR if that is set.\n"
+"      --nostage       ignore $CR_STAGE_DIR.\n"
+"\n"
 "Options for signal sent to process(es) after restart:\n"
 "      --run           no signal sent: continue execution (default).\n"
 "  -S, --signal NUM    signal NUM sent to all processes/threads.\n"
@@ -307,6 +317,57 @@ strip_trailing(char *path, char c)
     return path;
 }
 
+/* Compare two mtimes to the nanosecond, strcmp()-style */
+static int
+cmp_mtime(const struct stat *a, const struct stat *b)
+{
+    if (a->st_mtim.tv_sec != b->st_mtim.tv_sec) {
+	return (a->st_mtim.tv_sec < b->st_mtim.tv_sec) ? -1 : 1;
+    }
+    if (a->st_mtim.tv_nsec != b->st_mtim.tv_nsec) {
+	return (a->st_mtim.tv_nsec < b->st_mtim.tv_nsec) ? -1 : 1;
+    }
+    return 0;
+}
+
+/* Returns the copy of 'path' in the staging directory if it is usable
+ * (named for the full path of 'path', see cr_stage_name()),
+ * or 'path' otherwise.  cr_checkpoint --stage gives the drained copy the
+ * same mtime (to the nanosecond) as the staged one.  So the staged file
+ * is used if it has the same mtime and size as the destination (same
+ * image), a strictly newer mtime (not yet drained), or if the destination
+ * does not exist at all.  Any other failure to stat the destination is
+ * left for the normal open of 'path' to report.
+ */
+static char *
+staged_file(const char *stage_dir, char *path)
+{
+    struct stat ss, fs;
+    char *staged;
+    int use_staged, cmp;
+
+    staged = cr_stage_name(stage_dir, path);
+    if (!staged) {
+	return path;
+    } else if (stat(staged, &ss) || !S_ISREG(ss.st_mode)) {
+	use_staged = 0;
+    } else if (stat(path, &fs)) {
+	use_staged = (errno == ENOENT);
+    } else {
+	cmp = cmp_mtime(&ss, &fs);
+	use_staged = (cmp > 0) || (!cmp && (ss.st_size == fs.st_size));
+    }
+    if (!use_staged) {
+	free(staged);
+	return path;
+    }
+
+    if (verbose > 0) {
+	fprintf(stderr, "Using staged checkpoint '%s'\n", staged);
+    }
+    return staged;
+}
+
 /* Note: path[n].oldpath and .newpath share the storage addressed by .oldpath */
 static struct cr_rstrt_relocate *
 parse_relocate_arg(struct cr_rstrt_relocate *reloc, const char *arg)
@@ -413,6 +474,8 @@ enum {
     opt_no_restore_pgid,
     opt_restore_sid,
     opt_no_restore_sid,
+    opt_stage,
+    opt_nostage,
 };
 
 /* try to exit such that our exit code is same as our child */
@@ -555,6 +618,8 @@ int main(int argc, char **argv)
     cr_callback_id_t cb_id;
     cr_restart_handle_t cr_handle;
     int flags = CR_RSTRT_ASYNC_ERR | CR_RSTRT_RESTORE_PID;
+    char *stage_dir = getenv("CR_STAGE_DIR");
+    cr_stripe_set_t *stripes = NULL;
 
     char * shortflags = "qvhS:F:d:f:";  /* 1 colon == requires argument */
     struct option longflags[] = {
@@ -600,6 +665,9 @@ int main(int argc, char **argv)
 	{ "no-restore-pgid",  no_argument,  0, opt_no_restore_pgid},
 	{ "restore-sid",     no_argument,  0, opt_restore_sid},
 	{ "no-restore-sid",  no_argument,  0, opt_no_restore_sid},
+	/* staging: */
+	{ "stage",           required_argument,  0, opt_stage},
+	{ "nostage",         no_argument,  0, opt_nostage},
 	{ 0,	     0,		        0, 0  }
     };
 
@@ -747,6 +815,13 @@ int main(int argc, char **argv)
 	    case opt_no_restore_sid:
 		flags &= ~CR_RSTRT_RESTORE_SID;
 		break;
+	    /* staging */
+	    case opt_stage:
+		stage_dir = optarg;
+		break;
+	    case opt_nostage:
+		stage_dir = NULL;
+		break;
 	    /* General */
 	    case 'q':
 		verbose = -1;
@@ -796,6 +871,9 @@ int main(int argc, char **argv)
 
     /* ... open up the context file */
     if (src_type == src_file) {
+	if (stage_dir && *stage_dir) {
+	    context_filename = staged_file(stage_dir, context_filename);
+	}
 	context_fd = open(context_filename, O_RDONLY | O_LARGEFILE);
 	if (context_fd < 0) {
             die(context_fd, HOOK_FAIL_ARGS, "Failed to open(%s, O_RDONLY): %s\n",
@@ -807,6 +885,20 @@ int main(int argc, char **argv)
         die(cb_id, HOOK_FAIL_PERM, "Internal error - unknow source type %d\n", src_type);
     }
 
+    /* ... open a striped context file as one stream */
+    if (cr_stripe_is_manifest(context_fd)) {
+	int stripe_fd;
+	stripes = cr_stripe_read_start(context_fd, &stripe_fd);
+	if (!stripes) {
+            die(errno, HOOK_FAIL_ENV, "Failed to open stripes of '%s': %s\n",
+		context_filename ? context_filename : "<fd>", strerror(errno));
+	}
+	if (src_type == src_file) {
+	    (void)close(context_fd);
+	}
+	context_fd = stripe_fd;
+    }
+
     /* ... initialize the request structure */
     cr_initialize_restart_args_t(&args);
     args.cr_fd       = context_fd;
@@ -876,6 +968,11 @@ int main(int argc, char **argv)
 
     /* ... collect result and triage any errors */
     err = cr_reap_restart(&cr_handle);
+    if (stripes) {
+	int saved_errno = errno;
+	cr_stripe_read_finish(stripes);
+	errno = saved_errno;
+    }
     if (err < 0) {
 	failure();
     } else {
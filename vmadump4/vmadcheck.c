@@ -19,465 +19,565 @@
  *
  * $Id: vmadcheck.c,v 1.7.40.1 2012/12/18 18:32:09 phargrov Exp $
  *-----------------------------------------------------------------------*/
+
+/*
+ * This reads a complete BLCR context file in place (no copy is made) and
+ * reports the location and size of each vmadump section and of every VMA
+ * in it.  Only headers are read: page data is skipped by offset, so the
+ * time taken depends on the number of VMAs and chunks, not on image size.
+ *
+ * The parts of a context file written by BLCR itself (linkage, files,
+ * shared mappings, etc.) are not decoded, nor are the architecture-specific
+ * registers.  Each vmadump section is found by its magic number, and the
+ * memory map list of a section is found by looking for an mm_info record
+ * followed by a list of VMAs that can be followed to its terminator.
+ * When the file ends w/ a table of contents (cr_checkpoint --toc), the
+ * sections and their map lists are located from it instead.
+ */
+
+#define _FILE_OFFSET_BITS 64
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
 #include <errno.h>
-#include <stdint.h>
-#include <signal.h>
 
-/* Including these files is fairly perilous. */
-#include <asm/page.h>
-#include <asm/ptrace.h>
-struct task_struct;
-#include <asm/types.h>
+#include "vmadump.h"
+#include "blcr_common.h"
 
-#if defined(__i386__)
-/*#include <asm/processor.h>*/
-#endif
+/* Must match the kernel which wrote the file */
+#undef  PAGE_SIZE
+#define PAGE_SIZE	vmad_page_size
+static unsigned long vmad_page_size;
 
-#if defined(__x86_64__)
+#ifndef VMAD_NAMELEN_ARCH
+#define VMAD_NAMELEN_ARCH (PAGE_SIZE+1)
+#endif
+#ifndef VMAD_NAMELEN_REF
+#define VMAD_NAMELEN_REF 0x80000000UL
 #endif
 
-#include "vmadump.h"
+/* Copy of the private definitions in vmadump_common.c */
+enum vmad_prctl_type {
+   vmad_prctl_int_ref,
+   vmad_prctl_int_val,
+   vmad_prctl_bool,
+   vmad_prctl_comm,
+};
+struct vmad_prctl {
+    int option;
+    int type;
+};
+#define VMAD_COMM_LEN	16	/* TASK_COMM_LEN */
+#define VMAD_MAX_PRCTL	64	/* Sanity limit on the list length */
 
-/* This stuff is here because the kernel and glibc disagree about signal datatypes */
-#undef _NSIG
-#undef _NSIG_BPW
-#undef _NSIG_WORDS
-#define _NSIG           64
-#define _NSIG_BPW       (sizeof(long)*8)
-#define _NSIG_WORDS     (_NSIG / _NSIG_BPW)
-typedef struct {
-        unsigned long sig[_NSIG_WORDS];
-} k_sigset_t;
-
-struct k_sigaction {
-    void *ksa_handler;
-    unsigned long ksa_flags;
-    void *ksa_restorer;
-    k_sigset_t ksa_mask;
+/* Limits on how far we look for the memory map list of a section */
+#define MAX_PREAMBLE	(256*1024)
+#define SCAN_BUF	(64*1024)
+
+#define PTRWIDTH ((int)(sizeof(void *)*2))
+char *arch_names[] = {"","i386","sparc", "alpha", "ppc", "x86_64", "ppc64", "arm", "sparc64"};
+
+static char vmad_magic[4] = VMAD_MAGIC;
+
+static int fd;
+static off_t file_size;
+static off_t data_end;			/* file_size, less any table of contents */
+static int list_chunks = 0;
+
+static struct cr_toc_entry *toc = NULL;
+static unsigned long long toc_count = 0;
+
+/* One vmadump section as located by find_header() */
+struct vmad_section {
+    off_t start;			/* offset of the vmadump_header */
+    off_t regs;				/* first byte not decoded */
+    struct vmadump_header head;
+    char comm[VMAD_COMM_LEN+1];
+    int pid;
 };
 
+/* Running totals, for the summary */
+static struct {
+    unsigned long sections, threads, maps, pages;
+    off_t vmad_bytes, page_bytes, other_bytes;
+} total;
+
+/* Returns 0 on success or -1 if the file is too short */
 static
-void read_check(int fd, void *p, size_t bytes) {
-    int r;
-    r = read(fd, p, bytes);
-    if (r < 0) {
-	fprintf(stderr, "Read error: %s\n", strerror(errno));
-	exit(1);
-    }
-    if (r != bytes) {
-	printf("Short file.\n");
-	exit(1);
+int read_at(off_t pos, void *p, size_t bytes) {
+    char *q = p;
+    ssize_t r;
+
+    while (bytes > 0) {
+	r = pread(fd, q, bytes, pos);
+	if (r < 0) {
+	    if (errno == EINTR) continue;
+	    fprintf(stderr, "Read error: %s\n", strerror(errno));
+	    exit(1);
+	}
+	if (r == 0) return -1;
+	q += r;
+	pos += r;
+	bytes -= r;
     }
+    return 0;
 }
 
 static
-void read_skip(int fd, size_t bytes) {
-    int len;
-    char buffer[PAGE_SIZE];
+int page_aligned(unsigned long addr) {
+    return !(addr & (PAGE_SIZE - 1));
+}
 
-    while (bytes > 0) {
-	len = bytes > PAGE_SIZE ? PAGE_SIZE : bytes;
-	read_check(fd, buffer, len);
-	bytes -= len;
-    }
+static
+void print_bytes(off_t bytes) {
+    if (bytes >= (off_t)10 << 30)
+	printf("%lld (%lld GiB)", (long long)bytes, (long long)(bytes >> 30));
+    else if (bytes >= (off_t)10 << 20)
+	printf("%lld (%lld MiB)", (long long)bytes, (long long)(bytes >> 20));
+    else
+	printf("%lld", (long long)bytes);
 }
 
-#define PTRWIDTH ((int)(sizeof(void *)*2))
-char *arch_names[] = {"","i386","sparc", "alpha", "ppc", "x86_64", "ppc64"};
-#define MAX_ARCH ((sizeof(arch_names)/sizeof(char *))-1)
+/*--------------------------------------------------------------------
+ * Section discovery
+ *------------------------------------------------------------------*/
 
-static char vmad_magic[4] = VMAD_MAGIC;
-int main(int argc, char *argv[]) {
-    int fd, i;
-    char filename[PAGE_SIZE];
-    struct vmadump_header      head;
-    struct vmadump_vma_header  map;
-    struct vmadump_page_header page;
-    struct vmadump_mm_info     mm;
-    struct vmadump_hook_header hook;
-    struct pt_regs regs;
-    k_sigset_t blocked;
-    struct k_sigaction sa;
-
-    if (argc != 2) {
-	fprintf(stderr, "Usage: %s dumpfile\n", argv[0]);
-	exit(0);
-    }
-    
-    fd = open(argv[1], O_RDONLY);
-    if (fd == -1) {
-	perror(argv[1]);
-	exit(1);
+/* Decode the arch-neutral start of a section: the header, the list of
+ * prctl() values (which includes the comm) and the pid.
+ * Returns 0 if this looks like a valid section, or -1 if not.
+ */
+static
+int parse_section(off_t pos, struct vmad_section *s) {
+    struct vmad_prctl prctl;
+    unsigned int value;
+    int i;
+
+    s->start = pos;
+    s->comm[0] = '\0';
+    if (read_at(pos, &s->head, sizeof(s->head)) < 0) return -1;
+    if (memcmp(s->head.magic, vmad_magic, sizeof(s->head.magic)) ||
+	(s->head.fmt_vers != VMAD_FMT_VERS) || (s->head.arch != VMAD_ARCH))
+	return -1;
+    pos += sizeof(s->head);
+
+    for (i = 0; i < VMAD_MAX_PRCTL; ++i) {
+	if (read_at(pos, &prctl, sizeof(prctl)) < 0) return -1;
+	pos += sizeof(prctl);
+	if (!prctl.option) break;
+	switch (prctl.type) {
+	case vmad_prctl_comm:
+	    if (read_at(pos, s->comm, VMAD_COMM_LEN) < 0) return -1;
+	    s->comm[VMAD_COMM_LEN] = '\0';
+	    pos += VMAD_COMM_LEN;
+	    break;
+	case vmad_prctl_int_ref:
+	case vmad_prctl_int_val:
+	case vmad_prctl_bool:
+	    if (read_at(pos, &value, sizeof(value)) < 0) return -1;
+	    pos += sizeof(value);
+	    break;
+	default:
+	    return -1;
+	}
     }
+    if ((i == VMAD_MAX_PRCTL) || prctl.type) return -1;
 
-    read_check(fd, &head, sizeof(head));
-    if (memcmp(head.magic, vmad_magic, sizeof(head.magic))) {
-	printf("Invalid magic number.\n");
-	exit(1);
-    }
-    printf("dump version: %d\n", (int) head.fmt_vers);
-    if (head.fmt_vers != VMAD_FMT_VERS) {
-	fprintf(stderr, "I only know about dump format version %d.  (Sorry)\n", VMAD_FMT_VERS);
-	exit(1);
+    if (read_at(pos, &s->pid, sizeof(s->pid)) < 0) return -1;
+    if (s->pid <= 0) return -1;
+    pos += sizeof(s->pid);
+
+    s->regs = pos;
+    return 0;
+}
+
+/* Find the first valid section header in [pos, limit).
+ * Returns its offset, or -1 if there is none.
+ */
+static
+off_t find_header(off_t pos, off_t limit, struct vmad_section *s) {
+    static char buf[SCAN_BUF];
+    const size_t overlap = sizeof(struct vmadump_header) - 1;
+
+    while (pos < limit) {
+	size_t len = (limit - pos < SCAN_BUF) ? (size_t)(limit - pos) : SCAN_BUF;
+	char *p = buf, *end;
+	ssize_t r;
+
+	r = pread(fd, buf, len, pos);
+	if (r <= 0) break;
+	end = buf + r;
+	while ((p = memchr(p, vmad_magic[0], end - p)) != NULL) {
+	    if ((end - p < sizeof(vmad_magic) - 1) ||
+		!memcmp(p, vmad_magic, sizeof(vmad_magic) - 1)) {
+		if (!parse_section(pos + (p - buf), s)) return s->start;
+	    }
+	    ++p;
+	}
+	if ((size_t)r <= overlap) break;
+	pos += r - overlap;
     }
-    printf("kernel: %d.%d.%d\n",
-	   (int) head.major, (int) head.minor, (int) head.patch);
-    if (head.arch <= MAX_ARCH)
-	printf("arch:   %s\n", arch_names[head.arch]);
-    else
-	printf("arch:   %d (unknown arch)\n", (int) head.arch);
+    return -1;
+}
 
-    if (head.arch != VMAD_ARCH) {
-	fprintf(stderr, "I can only inspect dumps from my own architecture.  (Sorry)\n");
+/*--------------------------------------------------------------------
+ * Memory maps
+ *------------------------------------------------------------------*/
+
+/* Follow one page list, as written by store_page_list().
+ * Returns the offset just past it, or -1 if it is not valid.
+ */
+static
+off_t walk_pages(off_t pos, unsigned long *pages, off_t *data, int report) {
+    static struct vmadump_page_header *chunks = NULL;
+    struct vmadump_page_list_header header;
+    unsigned int sizeof_chunks = VMAD_CHUNKHEADER_SIZE;
+    int i, done = 0;
+
+    if (!chunks && !(chunks = malloc(VMAD_CHUNKHEADER_SIZE))) {
+	fprintf(stderr, "Out of memory\n");
 	exit(1);
     }
 
-    read_check(fd, filename, 16);
-    printf("comm:   %s\n", filename);
-
-    {	int pid;
-	read_check(fd, &pid, sizeof(pid));
-	printf("pid:   %d\n", pid);
+    if (read_at(pos, &header, sizeof(header)) < 0) return -1;
+    pos += sizeof(header);
+    if (header.fill == PAGE_SIZE) {
+	/* O_DIRECT was not used: no padding */
+    } else if (header.fill > PAGE_SIZE) {
+	return -1;
+    } else if (header.fill < VMAD_CHUNKHEADER_MIN) {
+	pos += header.fill;	/* padding skipped */
+    } else {
+	sizeof_chunks = header.fill;	/* padding holds the first chunks */
     }
 
-    read_check(fd, &regs, sizeof(regs));
-
-    /*---------------------------------------------------------------------
-     *  There are a bunch of magical numbers being used in here for
-     *  different cpu specific structure sizes.  These are (were)
-     *  correct but they might change at some point.
-     *-------------------------------------------------------------------*/
-#if defined(__i386__)
-    {
-	uint32_t fpu[128];  /* union i387_union */
-	long debug[8], i;
-	char flag;
-	struct {
-	    uint32_t a, b;
-	} tls[3];    /* 3 = GDT_ENTRY_TLS_ENTRIES */
-	uint32_t fs, gs;
-
-	printf("regs:   eax=%08lx  ebx=%08lx  ecx=%08lx  edx=%08lx\n"
-	       "regs:   esi=%08lx  edi=%08lx  esp=%08lx  ebp=%08lx\n"
-	       "regs:   eip=%08lx flgs=%08lx   cs=%04x      ss=%04x\n"
-	       "regs:    ds=%04x       es=%04x\n",
-	       regs.eax, regs.ebx, regs.ecx, regs.edx,
-	       regs.esi, regs.edi, regs.esp, regs.ebp,
-	       regs.eip, regs.eflags, regs.xcs, regs.xss,
-	       regs.xds, regs.xes);
-	read_check(fd, &flag, sizeof(flag));
-	if (flag) {
-	    read_check(fd, &fpu, sizeof(fpu));
-	    printf("fpu:    FPU state present.\n");
-	} else
-	    printf("fpu:    No FPU state.\n");
-
-	read_check(fd, debug, sizeof(long)*8);
-	printf("db:    ");
-	for (i=0; i < 8; i++) printf(" %08lx", debug[i]);
-	printf("\n");
+    while (!done) {
+	const int max_chunks = sizeof_chunks/sizeof(*chunks);
 
-	read_check(fd, &tls, sizeof(tls));
-#define GET_BASE(desc) ( \
-        (((desc)->a >> 16) & 0x0000ffff) | \
-        (((desc)->b << 16) & 0x00ff0000) | \
-        ( (desc)->b        & 0xff000000)   )
-#define GET_LIMIT(desc) ( \
-        ((desc)->a & 0x0ffff) | \
-         ((desc)->b & 0xf0000) )
-#define GET_PRESENT(desc)       (((desc)->b >> 15) & 1)	
-	for (i=0; i < 3; i++)
-	    if (GET_PRESENT(&tls[i]))
-		printf("tls:    %ld  base=0x%08x limit=0x%08x\n", i,
-		       GET_BASE(&tls[i]), GET_LIMIT(&tls[i]));
-	    else
-		printf("tls:    %ld  (not present)\n", i);
+	if (read_at(pos, chunks, sizeof_chunks) < 0) return -1;
+	pos += sizeof_chunks;
+	for (i = 0; i < max_chunks; ++i) {
+	    const off_t len = (off_t)chunks[i].num_pages * PAGE_SIZE;
 
-	read_check(fd, &fs, sizeof(fs));
-	read_check(fd, &gs, sizeof(gs));
-	printf("seg:    fs=0x%04x gs=0x%04x\n", (int) fs, (int) gs);
+	    if (chunks[i].start == VMAD_END_OF_CHUNKS) {
+		done = 1;
+		break;
+	    }
+	    if (!page_aligned(chunks[i].start) || !chunks[i].num_pages) return -1;
+	    if (report && list_chunks)
+		printf("page:   %0*lx %u pages at offset 0x%llx\n",
+		       PTRWIDTH, chunks[i].start, chunks[i].num_pages,
+		       (unsigned long long)pos);
+	    *pages += chunks[i].num_pages;
+	    *data += len;
+	    pos += len;
+	    if (pos > file_size) return -1;
+	}
+	sizeof_chunks = VMAD_CHUNKHEADER_SIZE;
     }
-#elif defined(__sparc__)
-    {
-	int i;
-	printf("regs:   pc=%08lx  npc=%08lx  y=%08lx\n",
-	       regs.pc, regs.npc, regs.y);
-	printf("regs: G");
-	for (i=UREG_G0; i <=UREG_G7; i++) printf(" %08lx", regs.u_regs[i]);
-	printf("\n");
-	printf("regs: I");
-	for (i=UREG_I0; i <=UREG_I7; i++) printf(" %08lx", regs.u_regs[i]);
-	printf("\n");
+
+    return pos;
+}
+
+/* Count the pages set in a resident-page bitmap (VMAD_VM_WORKSET).
+ * Returns the offset just past it, or -1 if it is truncated.
+ */
+static
+off_t walk_workset(off_t pos, unsigned long npages, unsigned long *resident) {
+    unsigned long bits[512];
+    size_t len = ((npages + 8*sizeof(long) - 1) / (8*sizeof(long))) * sizeof(long);
+
+    *resident = 0;
+    while (len) {
+	const size_t n = (len < sizeof(bits)) ? len : sizeof(bits);
+	unsigned long i;
+
+	if (read_at(pos, bits, n) < 0) return -1;
+	for (i = 0; i < n / sizeof(long); ++i)
+	    *resident += __builtin_popcountl(bits[i]);
+	pos += n;
+	len -= n;
     }
-#elif defined(__alpha__)
-    {
-	struct switch_stack ss;
-	unsigned long usp;
-	read_check(fd, &ss,  sizeof(ss));
-	read_check(fd, &usp, sizeof(usp));
-	printf("regs: pc = %016lx  ra = %016lx  ps = %04lx\n"
-	       "regs: r0 = %016lx  r1 = %016lx  r2 = %016lx\n"
-	       "regs: r3 = %016lx  r4 = %016lx  r5 = %016lx\n"
-	       "regs: r6 = %016lx  r7 = %016lx  r8 = %016lx\n"
-	       "regs: r9 = %016lx  r10= %016lx  r11= %016lx\n"
-	       "regs: r12= %016lx  r13= %016lx  r14= %016lx\n"
-	       "regs: r15= %016lx\n"
-	       "regs: r16= %016lx  r17= %016lx  r18= %016lx\n"
-	       "regs: r19= %016lx  r20= %016lx  r21= %016lx\n"
-	       "regs: r22= %016lx  r23= %016lx  r24= %016lx\n"
-	       "regs: r25= %016lx  r27= %016lx  r28= %016lx\n"
-	       "regs: gp = %016lx  sp = %016lx\n",
-               regs.pc,  regs.r26, regs.ps,
-               regs.r0,  regs.r1,  regs.r2,
-               regs.r3,  regs.r4,  regs.r5,
-               regs.r6,  regs.r7,  regs.r8,
-               ss.r9,    ss.r10,   ss.r11,
-               ss.r12,   ss.r13,   ss.r14,
-               ss.r15,
-               regs.r16, regs.r17, regs.r18,
-	       regs.r19, regs.r20, regs.r21,
-               regs.r22, regs.r23, regs.r24,
-               regs.r25, regs.r27, regs.r28,
-	       regs.gp, usp);
+    return pos;
+}
+
+/* Skip a NUMA placement section (VMAD_VM_NUMA), counting its runs.
+ * Returns the offset just past it, or -1 if it is not valid.
+ */
+static
+off_t walk_numa(off_t pos, unsigned long start, unsigned long end,
+		int *mode, unsigned long *runs) {
+    struct vmadump_numa_header hdr;
+    struct vmadump_numa_run run;
+
+    if (read_at(pos, &hdr, sizeof(hdr)) < 0) return -1;
+    if (hdr.nmask_longs > 4096) return -1;
+    pos += sizeof(hdr) + hdr.nmask_longs * sizeof(long);
+    *mode = hdr.mode;
+    *runs = 0;
+    for (;;) {
+	if (read_at(pos, &run, sizeof(run)) < 0) return -1;
+	pos += sizeof(run);
+	if (run.start == ~0UL) break;
+	if ((run.start < start) || (run.end > end) || (run.start >= run.end)) return -1;
+	++*runs;
     }
-#elif defined(powerpc)
-    {
-	double fpr[32];
-	unsigned long fpscr;
-	typedef struct {
-	    __u32 u[4];
-	} vector128;
-	vector128 vr[32];
-	vector128 vscr;
-	read_check(fd, fpr, sizeof(fpr));
-	read_check(fd, &fpscr, sizeof(fpscr));
-	read_check(fd, vr, sizeof(vr));
-	read_check(fd, &vscr, sizeof(vscr));
-
-	for (i=0; i < 32; i++) {
-	    if (i%4 == 0) printf("regs:");
-	    printf(" r%02d = %08lx", i, regs.gpr[i]);
-	    if (i%4 == 3) printf("\n");
-	}
+    return pos;
+}
+
+static
+void free_names(char **names, unsigned long nnames) {
+    while (nnames--) free(names[nnames]);
+    free(names);
+}
 
-	for (i=0; i < 32; i++) {
-	    if (i%4 == 0) printf("regs:");
-	    printf(" fp%02d = %f", i, fpr[i]);
-	    if (i%4 == 3) printf("\n");
+/* Follow the list of VMAs, as written by vmadump_freeze_proc().
+ * Returns the offset just past its terminator, or -1 if it is not valid.
+ */
+static
+off_t walk_maps(off_t pos, int report) {
+    char *filename = NULL;
+    char **names = NULL;		/* names written so far, for VMAD_NAMELEN_REF */
+    unsigned long nnames = 0;
+    struct vmadump_vma_header map;
+    unsigned long count = 0, pages = 0;
+    off_t data = 0;
+
+    for (;;) {
+	const off_t map_pos = pos;
+	unsigned long map_pages = 0, resident = 0, runs = 0;
+	off_t map_data = 0;
+	int mode = 0;
+	unsigned long start;
+
+	if (read_at(pos, &map, sizeof(map)) < 0) goto bad;
+	pos += sizeof(map);
+	if ((map.start == ~0UL) && (map.end == ~0UL)) break;
+
+	start = map.start & ~VMAD_VM_FLAGS;
+	if (!page_aligned(start) || !page_aligned(map.end) || (start >= map.end))
+	    goto bad;
+
+	if (map.namelen == VMAD_NAMELEN_ARCH) {
+	    if (report)
+		printf("map:    %0*lx-%0*lx %04x (arch-specific) bytes=%lld\n",
+		       PTRWIDTH, start, PTRWIDTH, map.end, (int)map.flags,
+		       (long long)(pos - map_pos));
+	    ++count;
+	    continue;
+	}
+	if (map.namelen & VMAD_NAMELEN_REF) {
+	    const unsigned long index = map.namelen & ~VMAD_NAMELEN_REF;
+	    if (index >= nnames) goto bad;
+	    filename = names[index];
+	} else if (map.namelen > PAGE_SIZE) {
+	    goto bad;
+	} else if (map.namelen) {
+	    char **tmp = realloc(names, (nnames + 1) * sizeof(char *));
+	    if (!tmp || !(filename = malloc(map.namelen + 1))) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	    }
+	    names = tmp;
+	    names[nnames++] = filename;
+	    if (read_at(pos, filename, map.namelen) < 0) goto bad;
+	    filename[map.namelen] = '\0';
+	    pos += map.namelen;
 	}
-	printf("regs: fpscr = %08lx\n", fpscr);
-
-	/* XXX We're presuming altivec is present here */
-	for (i=0; i < 32; i++) {
-	    if (i%2 == 0) printf("regs:");
-	    printf(" av%02d = %08x%08x%08x%08x", i,
-		   vr[i].u[0], vr[i].u[1], vr[i].u[2], vr[i].u[3]);
-	    if (i%2 == 1) printf("\n");
+	if (map.start & VMAD_VM_NUMA) {
+	    pos = walk_numa(pos, start, map.end, &mode, &runs);
+	    if (pos < 0) goto bad;
 	}
-	printf("regs: vscr = %08x%08x%08x%08x\n",
-	       vscr.u[0], vscr.u[1], vscr.u[2], vscr.u[3]);
-    }
-#elif defined(__x86_64__)
-    {
-	struct i387_fxsave_struct {
-	    uint16_t     cwd;
-	    uint16_t     swd;
-	    uint16_t     twd;
-	    uint16_t     fop;
-	    uint64_t     rip;
-	    uint64_t     rdp; 
-	    uint32_t     mxcsr;
-	    uint32_t     mxcsr_mask;
-	    uint32_t     st_space[32];
-	    uint32_t     xmm_space[64];
-	    uint32_t     padding[24];
-	} __attribute__ ((aligned (16)));
-	union i387_union {
-	    struct i387_fxsave_struct       fxsave;
-	};
-
-	union i387_union fpu;
-	long debug[8], i;
-	char flag;
-	unsigned long fs, gs;
-	uint16_t fsindex, gsindex;
-	struct {
-	    uint32_t a, b;
-	} tls[3];    /* 3 = GDT_ENTRY_TLS_ENTRIES */
-	printf("regs:   rax=%016lx rbx=%016lx\n"
-	       "regs:   rcx=%016lx rdx=%016lx\n"
-	       "regs:   rbp=%016lx rsi=%016lx\n"
-	       "regs:   rdi=%016lx rsp=%016lx\n"
-	       "regs:   r8 =%016lx r9 =%016lx\n"
-	       "regs:   r10=%016lx r11=%016lx\n"
-	       "regs:   r12=%016lx r13=%016lx\n"
-	       "regs:   r14=%016lx r15=%016lx\n"
-	       "regs:   rip=%016lx efl=%016lx\n",
-	       regs.rax, regs.rbx, regs.rcx, regs.rdx,
-	       regs.rbp, regs.rsi, regs.rdi, regs.rsp,
-	       regs.r8, regs.r9, regs.r10, regs.r11,
-	       regs.r12, regs.r13, regs.r14, regs.r15,
-	       regs.rip, regs.eflags);
-	printf("regs:   cs=%04lx ss=%04lx\n", regs.cs, regs.ss);
-	read_check(fd, &flag, sizeof(flag));
-	if (flag) {
-	    read_check(fd, &fpu, sizeof(fpu));
-	    printf("fpu:    FPU state present.\n");
-	} else
-	    printf("fpu:    No FPU state.\n");
-
-
-	printf("seg:    %d-bit Mode Process.\n", (regs.cs == 0x23) ? 32 : 64);
-
-	/* Segments and crap */
-	read_check(fd, &fs, sizeof(fs));
-	read_check(fd, &gs, sizeof(gs));
-	printf("seg:    fs=%016lx gs=%016lx\n", fs, gs);
-
-	read_check(fd, &fsindex, sizeof(fsindex));
-	read_check(fd, &gsindex, sizeof(gsindex));
-	printf("seg:    fsindex=%04x gsindex=%04x\n", fsindex, gsindex);
-	    
-	read_check(fd, &tls, sizeof(tls));
-
-#define GET_BASE(desc) ( \
-        (((desc)->a >> 16) & 0x0000ffff) | \
-        (((desc)->b << 16) & 0x00ff0000) | \
-        ( (desc)->b        & 0xff000000)   )
-#define GET_LIMIT(desc) ( \
-        ((desc)->a & 0x0ffff) | \
-         ((desc)->b & 0xf0000) )
-#define GET_PRESENT(desc)       (((desc)->b >> 15) & 1)	
-	for (i=0; i < 3; i++)
-	    if (GET_PRESENT(&tls[i]))
-		printf("tls:    %ld  base=0x%08x limit=0x%08x\n", i,
-		       GET_BASE(&tls[i]), GET_LIMIT(&tls[i]));
+	pos = walk_pages(pos, &map_pages, &map_data, report);
+	if (pos < 0) goto bad;
+	if (map.start & VMAD_VM_WORKSET) {
+	    if (!map.namelen) goto bad;
+	    pos = walk_workset(pos, (map.end - start) / PAGE_SIZE, &resident);
+	    if (pos < 0) goto bad;
+	}
+
+	if (report) {
+	    if (map.namelen)
+		printf("map:    %0*lx-%0*lx %04x file %s:%0*lx",
+		       PTRWIDTH, start, PTRWIDTH, map.end, (int)map.flags,
+		       filename, PTRWIDTH, map.pgoff * PAGE_SIZE);
 	    else
-		printf("tls:    %ld  (not present)\n", i);
+		printf("map:    %0*lx-%0*lx %04x (data provided)",
+		       PTRWIDTH, start, PTRWIDTH, map.end, (int)map.flags);
+	    printf(" pages=%lu/%lu", map_pages, (map.end - start) / PAGE_SIZE);
+	    if (map.start & VMAD_VM_WORKSET)
+		printf(" resident=%lu", resident);
+	    if (map.start & VMAD_VM_NUMA)
+		printf(" numa=mode:%d runs=%lu", mode, runs);
+	    printf(" bytes=");
+	    print_bytes(pos - map_pos);
+	    printf("\n");
+	}
+	++count;
+	pages += map_pages;
+	data += map_data;
+    }
 
-	read_check(fd, debug, sizeof(long)*6);
-	printf("db:    ");
-	for (i=0; i < 3; i++) printf(" %016lx", debug[i]);
-	printf("\ndb:    ");
-	for (i=0; i < 3; i++) printf(" %016lx", debug[i]);
+    if (report) {
+	total.maps += count;
+	total.pages += pages;
+	total.page_bytes += data;
+	printf("maps:   count=%lu pages=%lu data=", count, pages);
+	print_bytes(data);
 	printf("\n");
     }
-#elif defined(__powerpc64__)
-    {
-	double fpr[32];
-	unsigned long fpscr;
-	typedef struct {
-	    __u32 u[4];
-	} vector128;
-	vector128 vr[32];
-	vector128 vscr;
-	read_check(fd, fpr, sizeof(fpr));
-	read_check(fd, &fpscr, sizeof(fpscr));
-	read_check(fd, vr, sizeof(vr));
-	read_check(fd, &vscr, sizeof(vscr));
-
-	printf("regs:   %d-bit Mode Process.\n",
-	       (regs.msr & (1L<<63)) ? 64 : 32);
-
-	for (i=0; i < 32; i++) {
-	    if (i%4 == 0) printf("regs:");
-	    printf(" r%02d = %016lx", i, regs.gpr[i]);
-	    if (i%4 == 3) printf("\n");
-	}
+    free_names(names, nnames);
+    return pos;
 
-	for (i=0; i < 32; i++) {
-	    if (i%4 == 0) printf("regs:");
-	    printf(" fp%02d = %f", i, fpr[i]);
-	    if (i%4 == 3) printf("\n");
-	}
-	printf("regs: fpscr = %08lx\n", fpscr);
-
-	/* XXX We're presuming altivec is present here */
-	for (i=0; i < 32; i++) {
-	    if (i%2 == 0) printf("regs:");
-	    printf(" av%02d = %08x%08x%08x%08x", i,
-		   vr[i].u[0], vr[i].u[1], vr[i].u[2], vr[i].u[3]);
-	    if (i%2 == 1) printf("\n");
-	}
-	printf("regs: vscr = %08x%08x%08x%08x\n",
-	       vscr.u[0], vscr.u[1], vscr.u[2], vscr.u[3]);
-    }
-#else
-    printf("regs: no register display for this arch\n");
-#endif
+bad:
+    free_names(names, nnames);
+    return -1;
+}
 
-    /*--- Signal Information ---------------------------------------*/
-    read_check(fd, &blocked, sizeof(blocked));
-    printf("sigblk: ");
-    for (i=0; i < _NSIG; i++) {
-	if (blocked.sig[i / (sizeof(long)*8)] & (1 << (i % (sizeof(long)*8))))
-	    printf(" %d", i+1);
+static
+int mm_plausible(const struct vmadump_mm_info *mm) {
+    return mm->end_code && mm->start_stack &&
+	   (mm->start_code <= mm->end_code) &&
+	   (mm->start_data <= mm->end_data) &&
+	   (mm->start_brk  <= mm->brk) &&
+	   (mm->arg_start  <= mm->arg_end) &&
+	   (mm->env_start  <= mm->env_end) &&
+	   (mm->arg_end    <= mm->env_start);
+}
+
+/* Search [pos, limit) for the mm_info record preceding the memory maps.
+ * The architecture-specific data before it has no length recorded, so we
+ * look for a plausible mm_info followed (after the optional mmap_base) by
+ * a VMA list which can be followed to its terminator.
+ * Returns the offset of the mm_info, and sets *maps, or returns -1.
+ */
+static
+off_t find_maps(off_t pos, off_t limit, struct vmadump_mm_info *mm, off_t *maps) {
+    static char buf[MAX_PREAMBLE + sizeof(struct vmadump_mm_info)];
+    size_t len, i;
+    ssize_t r;
+
+    if (limit - pos > MAX_PREAMBLE) limit = pos + MAX_PREAMBLE;
+    len = limit - pos + sizeof(*mm);
+    r = pread(fd, buf, len, pos);
+    if (r < (ssize_t)sizeof(*mm)) return -1;
+
+    for (i = 0; i + sizeof(*mm) <= (size_t)r; ++i) {
+	memcpy(mm, buf + i, sizeof(*mm));
+	if (!mm_plausible(mm)) continue;
+
+	/* With and without the mmap_base (HAVE_MM_MMAP_BASE) */
+	*maps = pos + i + sizeof(*mm) + sizeof(unsigned long);
+	if (walk_maps(*maps, 0) >= 0) return pos + i;
+	*maps = pos + i + sizeof(*mm);
+	if (walk_maps(*maps, 0) >= 0) return pos + i;
     }
-    printf("\n");
+    return -1;
+}
 
-    {	k_sigset_t pending_set;
-	int flags;
+/*--------------------------------------------------------------------
+ * Reporting
+ *------------------------------------------------------------------*/
 
-	read_check(fd, &flags, sizeof(flags));
+static
+void report_other(off_t start, off_t end) {
+    if (end <= start) return;
+    printf("other:  offset=0x%llx bytes=", (unsigned long long)start);
+    print_bytes(end - start);
+    printf(" (not decoded)\n");
+    total.other_bytes += end - start;
+}
 
-	while (flags != -1) {
-	    siginfo_t info;
+/* Load the table of contents, if the file ends w/ a valid one.
+ * Returns 1 if it did, or 0 if not.
+ */
+static
+int read_toc(void) {
+    struct cr_toc_footer footer;
+    unsigned long long i, procs = 0, threads = 0, vmas = 0, chunks = 0, fds = 0;
+    size_t len;
+
+    if (file_size < sizeof(footer)) return 0;
+    if (read_at(file_size - sizeof(footer), &footer, sizeof(footer)) < 0) return 0;
+    if (memcmp(footer.magic, CR_TOC_MAGIC, sizeof(CR_TOC_MAGIC)) ||
+	(footer.version != CR_TOC_VERSION)) return 0;
+    len = footer.count * sizeof(struct cr_toc_entry);
+    if ((footer.entry_size != sizeof(struct cr_toc_entry)) ||
+	(footer.offset + len + sizeof(footer) != file_size)) {
+	printf("toc:    inconsistent table of contents ignored\n");
+	return 0;
+    }
 
-	    read_check(fd, &info, sizeof(info));
-	    read_check(fd, &flags, sizeof(flags));
-	}
-	read_check(fd, &pending_set, sizeof(pending_set));
-	printf("private sigpend: ");
-	for (i=0; i < _NSIG; i++) {
-	    if (pending_set.sig[i / (sizeof(long)*8)] & (1 << (i % (sizeof(long)*8))))
-		printf(" %d", i+1);
-	}
-	printf("\n");
-	read_check(fd, &pending_set, sizeof(pending_set));
-	printf("shared sigpend: ");
-	for (i=0; i < _NSIG; i++) {
-	    if (pending_set.sig[i / (sizeof(long)*8)] & (1 << (i % (sizeof(long)*8))))
-		printf(" %d", i+1);
-	}
-	printf("\n");
+    toc = malloc(len ? len : 1);
+    if (!toc) {
+	fprintf(stderr, "Out of memory\n");
+	exit(1);
     }
-    
-    for (i=0; i < _NSIG; i++) {
-	read_check(fd, &sa, sizeof(sa));
-	if (sa.ksa_handler == 0) continue;
-	printf("sigact: %2d", i+1);
-	if (sa.ksa_handler == (void *)1)
-	    printf(" IGNORED");
-	else {
-	    printf(" handler=%0*lx", PTRWIDTH,(long)sa.ksa_handler);
-#if 0
-	if (blocked[i / (sizeof(long)*8)] & (1 << (i % (sizeof(long)*8))))
-	    printf(" %d", i+1);
-#endif
+    if (read_at(footer.offset, toc, len) < 0) {
+	free(toc);
+	toc = NULL;
+	return 0;
+    }
+    toc_count = footer.count;
+    data_end = footer.offset;
+
+    for (i = 0; i < toc_count; ++i) {
+	switch (toc[i].type) {
+	case CR_TOC_PROC:   ++procs;   break;
+	case CR_TOC_THREAD: ++threads; break;
+	case CR_TOC_VMA:    ++vmas;    break;
+	case CR_TOC_CHUNKS: ++chunks;  break;
+	case CR_TOC_FD:     ++fds;     break;
 	}
-	printf("\n");
     }
+    printf("toc:    offset=0x%llx entries=%llu procs=%llu threads=%llu vmas=%llu chunks=%llu fds=%llu\n",
+	   footer.offset, toc_count, procs, threads, vmas, chunks, fds);
+    return 1;
+}
 
-    /*--- Misc process information ---------------------------------*/
-    {
-	void *clear_child_tid;
-	unsigned long personality;
-	read_check(fd, &clear_child_tid, sizeof(clear_child_tid));
-	read_check(fd, &personality, sizeof(personality));
-
-	printf("child_tid: %p\n", clear_child_tid);
-	printf("personality: %p\n", (void*)personality);
+/* Report one section, returning the offset at which it ends.
+ * If mm_hint >= 0 it is the only place the mm_info may be (from the toc).
+ */
+static
+off_t report_section(struct vmad_section *s, off_t mm_hint) {
+    struct vmad_section next;
+    struct vmadump_mm_info mm;
+    off_t limit, mm_pos, maps, end;
+
+    printf("\nvmadump: offset=0x%llx version=%d arch=%s kernel=%d.%d.%d\n",
+	   (unsigned long long)s->start, (int)s->head.fmt_vers,
+	   arch_names[s->head.arch], (int)s->head.major,
+	   (int)s->head.minor, (int)s->head.patch);
+    printf("comm:   %s\n", s->comm);
+    printf("pid:    %d\n", s->pid);
+
+    if (mm_hint >= 0) {
+	mm_pos = find_maps(mm_hint, mm_hint + 1, &mm, &maps);
+    } else {
+	/* The map list, if any, comes before the next section */
+	limit = s->regs + MAX_PREAMBLE;
+	if (limit > data_end) limit = data_end;
+	if (find_header(s->regs, limit, &next) >= 0) limit = next.start;
+
+	mm_pos = find_maps(s->regs, limit, &mm, &maps);
+    }
+    if (mm_pos < 0) {
+	/* A thread other than the leader (VMAD_DUMP_REGSONLY) */
+	++total.threads;
+	printf("regs:   offset=0x%llx (not decoded, no memory maps)\n",
+	       (unsigned long long)s->regs);
+	total.vmad_bytes += s->regs - s->start;
+	return s->regs;
     }
 
-    /*--- Memory meta-data -----------------------------------------*/
-    read_check(fd, &mm, sizeof(mm));
+    ++total.sections;
+    printf("regs:   offset=0x%llx bytes=%lld (not decoded)\n",
+	   (unsigned long long)s->regs, (long long)(mm_pos - s->regs));
     printf("code:   %0*lx-%0*lx\n", PTRWIDTH, mm.start_code, PTRWIDTH, mm.end_code);
     printf("data:   %0*lx-%0*lx\n", PTRWIDTH, mm.start_data, PTRWIDTH, mm.end_data);
     printf("brk:    %0*lx-%0*lx\n", PTRWIDTH, mm.start_brk,  PTRWIDTH, mm.brk);
@@ -485,48 +585,106 @@ int main(int argc, char *argv[]) {
     printf("arg:    %0*lx-%0*lx\n", PTRWIDTH, mm.arg_start,  PTRWIDTH, mm.arg_end);
     printf("env:    %0*lx-%0*lx\n", PTRWIDTH, mm.env_start,  PTRWIDTH, mm.env_end);
 
-    /*--- Memory data ----------------------------------------------*/
-    read_check(fd, &map, sizeof(map));
-    while (map.start != ~0 || map.end != ~0) {
-	if (map.namelen) {
-	    if (map.namelen > PAGE_SIZE) {
-		printf("Map has invalid name length: %d\n", (int) map.namelen);
+    end = walk_maps(maps, 1);
+    printf("section: bytes=");
+    print_bytes(end - s->start);
+    printf("\n");
+    total.vmad_bytes += end - s->start;
+    return end;
+}
+
+static
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-p] contextfile\n"
+		    "  -p   list every chunk of pages\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    struct vmad_section s;
+    struct stat st;
+    off_t pos, hpos;
+    int c;
+
+    while ((c = getopt(argc, argv, "ph")) != -1) {
+	switch (c) {
+	case 'p': list_chunks = 1; break;
+	case 'h': usage(argv[0]); exit(0);
+	default:  usage(argv[0]); exit(1);
+	}
+    }
+    if (optind != argc - 1) {
+	usage(argv[0]);
+	exit(1);
+    }
+
+    vmad_page_size = sysconf(_SC_PAGESIZE);
+
+    fd = open(argv[optind], O_RDONLY);
+    if (fd == -1) {
+	perror(argv[optind]);
+	exit(1);
+    }
+    if (fstat(fd, &st) < 0) {
+	perror(argv[optind]);
+	exit(1);
+    }
+    if (!S_ISREG(st.st_mode)) {
+	fprintf(stderr, "%s: not a regular file\n", argv[optind]);
+	exit(1);
+    }
+    file_size = st.st_size;
+#ifdef POSIX_FADV_RANDOM
+    /* Only headers are read, so read-ahead is wasted */
+    posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+
+    printf("file:   %s bytes=", argv[optind]);
+    print_bytes(file_size);
+    printf("\n");
+
+    pos = 0;
+    data_end = file_size;
+    if (read_toc()) {
+	unsigned long long i;
+
+	for (i = 0; i < toc_count; ++i) {
+	    if (toc[i].type != CR_TOC_THREAD) continue;
+	    if (parse_section(toc[i].offset, &s) < 0) {
+		printf("Table of contents entry %llu is not a vmadump section.\n", i);
 		exit(1);
 	    }
-	    read_check(fd, filename, map.namelen);
-	    filename[map.namelen]=0;
-	    printf("map:    %0*lx-%0*lx %04x file %s:%0*lx\n",
-		   PTRWIDTH, map.start, PTRWIDTH, map.end, (int)map.flags,
-		   filename, PTRWIDTH, map.pgoff * PAGE_SIZE);
-	} else {
-	    printf("map:    %0*lx-%0*lx %04x (data provided)\n",
-		   PTRWIDTH, map.start, PTRWIDTH, map.end, (int)map.flags);
+	    report_other(pos, s.start);
+	    pos = report_section(&s, toc[i].offset + toc[i].length);
 	}
-	read_check(fd, &page, sizeof(page));
-	while (page.start != ~0) {
-	    printf("page:   %0*lx (data provided)\n", PTRWIDTH, page.start);
-	    lseek(fd, PAGE_SIZE, SEEK_CUR);
-	    read_check(fd, &page, sizeof(page));
+    } else {
+	while ((hpos = find_header(pos, data_end, &s)) >= 0) {
+	    report_other(pos, hpos);
+	    pos = report_section(&s, -1);
 	}
-	read_check(fd, &map, sizeof(map));
     }
+    report_other(pos, data_end);
 
-    /*--- Read hook data -------------------------------------------*/
-    read_check(fd, &hook, sizeof(hook));
-    while (hook.tag[0]) {
-	printf("hook:   tag=\"%s\"  bytes=%ld\n", hook.tag, hook.size);
-	read_skip(fd, hook.size);
-	read_check(fd, &hook, sizeof(hook));
+    if (!total.sections && !total.threads) {
+	printf("No vmadump sections found.\n");
+	exit(1);
     }
 
-    /* Complain about trailing garbage? */
-    if (read(fd, &i, sizeof(i)) != 0) {
-	fprintf(stderr, "Trailing garbage at end of file.\n");
-	exit(1);
+    printf("\ntotal:  sections=%lu threads=%lu maps=%lu pages=%lu\n",
+	   total.sections, total.threads, total.maps, total.pages);
+    printf("total:  vmadump=");
+    print_bytes(total.vmad_bytes);
+    printf(" page data=");
+    print_bytes(total.page_bytes);
+    printf(" other=");
+    print_bytes(total.other_bytes);
+    if (toc) {
+	printf(" toc=");
+	print_bytes(file_size - data_end);
     }
+    printf("\n");
     exit(0);
 }
-  
+
 /*
  * Local variables:
  * c-basic-offset: 4
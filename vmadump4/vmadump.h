@@ -44,6 +44,24 @@ struct vmadump_vma_header {
 
 /* Flag(s) ORed into start field of struct vmadump_vma_header: */
 #define VMAD_VM_EXECUTABLE 1UL
+#define VMAD_VM_WORKSET    2UL	/* page list is followed by a resident-page bitmap */
+#define VMAD_VM_NUMA       4UL	/* page list is preceded by NUMA placement */
+#define VMAD_VM_FLAGS      (VMAD_VM_EXECUTABLE|VMAD_VM_WORKSET|VMAD_VM_NUMA)
+
+/* NUMA placement of a VMA (VMAD_VM_NUMA) is this header, nmask_longs
+ * longs of node mask, and then runs of pages on the same node, ending
+ * w/ a run whose start is ~0.  Runs may span pages that were not
+ * resident.  There are no runs for an interleaved VMA.
+ */
+struct vmadump_numa_header {
+    int mode;			/* MPOL_* memory policy of the VMA */
+    unsigned int nmask_longs;
+};
+
+struct vmadump_numa_run {
+    unsigned long start, end;
+    int node;
+};
 
 struct vmadump_page_header {
     unsigned long start;	/* ~0 = end of list */
@@ -192,6 +210,16 @@ extern loff_t vmadump_store_dirty_page_list(cr_chkpt_proc_req_t *ctx, struct fil
 extern int vmadump_load_page_list(cr_rstrt_proc_req_t *ctx,
 				  struct file *file, int is_exec);
 
+/* Final protections of a list of maps, applied after all are loaded */
+struct vmadump_prot_range;
+struct vmadump_prots {
+    unsigned int count, max;
+    struct vmadump_prot_range *range;
+};
+extern void vmadump_prot_add(cr_rstrt_proc_req_t *ctx, struct vmadump_prots *prots,
+			     unsigned long start, unsigned long end, unsigned long prot);
+extern void vmadump_prot_apply(cr_rstrt_proc_req_t *ctx, struct vmadump_prots *prots);
+
 extern loff_t vmadump_freeze_proc(cr_chkpt_proc_req_t *, struct file *file,
 				  struct pt_regs *regs, int flags);
 extern long vmadump_thaw_proc  (cr_rstrt_proc_req_t *, struct file *file,
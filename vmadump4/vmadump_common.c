@@ -42,6 +42,8 @@
 #include <linux/ptrace.h>
 #include <linux/init.h>
 #include <linux/prctl.h>
+#include <linux/mempolicy.h>
+#include <linux/nodemask.h>
 #include <asm/pgtable.h>
 #include <asm/pgalloc.h>
 #include <asm/processor.h>
@@ -299,6 +301,156 @@ char *default_map_name(struct file *f, char *buffer, int size) {
 #endif
 }
 
+/*--------------------------------------------------------------------
+ * Map names
+ *
+ * Each distinct file mapped by a process has its name written only with
+ * the first of its VMAs.  The others carry VMAD_NAMELEN_REF|index in the
+ * namelen field.  The names are per process, so each vmadump section can
+ * still be read on its own.
+ *------------------------------------------------------------------*/
+#define VMAD_NAMES_HASH 64
+
+struct vmad_store_name {
+    struct path path;		/* only compared, never dereferenced */
+    unsigned int next;		/* 1 + index of next in the hash chain, or 0 */
+};
+
+struct vmad_store_names {
+    unsigned int count, max;
+    struct vmad_store_name *name;
+    unsigned int head[VMAD_NAMES_HASH];
+    char *buffer;		/* one page for d_path() */
+};
+
+struct vmad_load_names {
+    unsigned int count, max;
+    char **name;
+};
+
+static inline
+unsigned int vmad_names_hash(struct dentry *dentry) {
+    unsigned long tmp = (unsigned long)dentry / L1_CACHE_BYTES;
+    return (unsigned int)((tmp ^ (tmp >> 6)) % VMAD_NAMES_HASH);
+}
+
+static inline
+void vmad_file_path(struct file *f, struct path *path) {
+#if HAVE_NAMEIDATA_DENTRY
+    path->mnt = f->f_vfsmnt;
+    path->dentry = f->f_dentry;
+#elif HAVE_NAMEIDATA_PATH
+    *path = f->f_path;
+#else
+    #error
+#endif
+}
+
+/* Grow an array of 'size'-byte elements, holding *count_p used of *max_p */
+static
+int vmad_grow(void **array_p, unsigned int *max_p, unsigned int count, size_t size) {
+    unsigned int max = *max_p ? 2 * *max_p : 16;
+    void *array = kmalloc(max * size, GFP_KERNEL);
+
+    if (!array) return -ENOMEM;
+    if (*array_p) {
+	memcpy(array, *array_p, count * size);
+	kfree(*array_p);
+    }
+    *array_p = array;
+    *max_p = max;
+    return 0;
+}
+
+static
+struct vmad_store_names *vmad_store_names_alloc(void) {
+    struct vmad_store_names *names = kmalloc(sizeof(*names), GFP_KERNEL);
+
+    if (names) {
+	memset(names, 0, sizeof(*names));
+	names->buffer = (char *) __get_free_page(GFP_KERNEL);
+	if (!names->buffer) {
+	    kfree(names);
+	    names = NULL;
+	}
+    }
+    return names;
+}
+
+static
+void vmad_store_names_free(struct vmad_store_names *names) {
+    if (!names) return;
+    kfree(names->name);
+    free_page((unsigned long)names->buffer);
+    kfree(names);
+}
+
+/* Look for the name of f among those already written.
+ * Returns the index if found.  Otherwise returns -1 and sets *filename_p
+ * to the name in names->buffer (or an ERR_PTR).
+ */
+static
+long vmad_store_name_find(struct vmad_store_names *names, struct file *f,
+			  char **filename_p) {
+    struct path path;
+    unsigned int i;
+
+    vmad_file_path(f, &path);
+    for (i = names->head[vmad_names_hash(path.dentry)]; i; i = names->name[i-1].next) {
+	const struct vmad_store_name *n = &names->name[i-1];
+	if ((n->path.dentry == path.dentry) && (n->path.mnt == path.mnt)) {
+	    return i - 1;
+	}
+    }
+
+#if 0 /* Not supported in BLCR */
+    if (ctx && ctx->map_name)
+	*filename_p = ctx->map_name(ctx, f, names->buffer, PAGE_SIZE);
+    else
+#endif
+	*filename_p = default_map_name(f, names->buffer, PAGE_SIZE);
+    return -1;
+}
+
+/* Record that the name of f is about to be written, as the next index */
+static
+int vmad_store_name_add(struct vmad_store_names *names, struct file *f) {
+    struct vmad_store_name *n;
+    unsigned int h;
+
+    if (names->count == names->max) {
+	int r = vmad_grow((void **)&names->name, &names->max, names->count, sizeof(*n));
+	if (r) return r;
+    }
+    n = &names->name[names->count++];
+    vmad_file_path(f, &n->path);
+    h = vmad_names_hash(n->path.dentry);
+    n->next = names->head[h];
+    names->head[h] = names->count;
+    return 0;
+}
+
+static
+void vmad_load_names_free(struct vmad_load_names *names) {
+    unsigned int i;
+
+    for (i = 0; i < names->count; ++i) {
+	kfree(names->name[i]);
+    }
+    kfree(names->name);
+}
+
+/* Take ownership of a name just read */
+static
+int vmad_load_name_add(struct vmad_load_names *names, char *filename) {
+    if (names->count == names->max) {
+	int r = vmad_grow((void **)&names->name, &names->max, names->count, sizeof(char *));
+	if (r) return r;
+    }
+    names->name[names->count++] = filename;
+    return 0;
+}
+
 
 #if 0 /* Not needed/maintained for BLCR */
 /* this is gonna be handled with contexts too */
@@ -317,6 +469,11 @@ struct file *default_map_open(cr_rstrt_proc_req_t *ctx, const char *filename, in
 	struct file *filp;
 	const char *reloc_filename;
 
+	filp = cr_filecache_get(ctx->req->filecache, filename, flags);
+	if (filp) {
+		goto out;
+	}
+
 	reloc_filename = cr_relocate_path(ctx->req->relocate, filename, 0);
 	if (IS_ERR(reloc_filename)) {
 		filp = (struct file *)reloc_filename;
@@ -330,6 +487,8 @@ struct file *default_map_open(cr_rstrt_proc_req_t *ctx, const char *filename, in
 				reloc_filename, filename);
 		}
 		/* Caller prints flags and return value */
+	} else {
+		filp = cr_filecache_add(ctx->req->filecache, filename, flags, filp);
 	}
 	if (reloc_filename != filename) {
 		__putname(reloc_filename);
@@ -749,13 +908,12 @@ int mmap_file(cr_rstrt_proc_req_t *ctx,
 	return PTR_ERR(file);
     }
 
-    start = head->start;
+    start = head->start & ~VMAD_VM_FLAGS;
     end   = head->end;
     pgoff = head->pgoff;
 
     down_write(&current->mm->mmap_sem);
-    if (start & VMAD_VM_EXECUTABLE) {
-	start ^= VMAD_VM_EXECUTABLE;
+    if (head->start & VMAD_VM_EXECUTABLE) {
 #if defined(CR_KCODE_set_mm_exe_file)
 	if (!current->mm->exe_file)
 	    set_mm_exe_file(current->mm, file);
@@ -772,6 +930,216 @@ int mmap_file(cr_rstrt_proc_req_t *ctx,
     return (mapaddr == start) ? 0 : mapaddr;
 }
 
+/* Start read-ahead of [start, end), without waiting for it.
+ * For a file map this is page cache read-ahead.  For anonymous memory it
+ * reads swapped pages back in, on kernels whose MADV_WILLNEED does so
+ * (others just ignore it).
+ */
+static
+void vmad_willneed(unsigned long start, unsigned long end) {
+#if defined(CR_KCODE_sys_madvise)
+    (void)sys_madvise(start, end - start, MADV_WILLNEED);
+#endif
+}
+
+/*--------------------------------------------------------------------
+ * Page I/O shared w/ the other threads of the process
+ *
+ * The other threads of the process are idle while the leader runs
+ * vmadump_freeze_proc() or vmadump_thaw_proc().  For large regions the
+ * leader queues page I/O at known offsets in the context file, and has
+ * cr_helper_run() work through the queue in all of the threads at once.
+ * Small batches are done by the leader alone.
+ *------------------------------------------------------------------*/
+#define VMAD_PAR_MIN_PAGES	(64UL << (20 - PAGE_SHIFT))	/* 64MB */
+#define VMAD_PAR_PIECE		1024UL		/* pages; multiple of BITS_PER_LONG */
+#define VMAD_PAR_EXTENTS	4096		/* I/Os queued per job */
+
+/* Swap-in ahead of the writer (see store_page_chunks()).
+ * Swapped pages are read ahead in windows of VMAD_SWAP_WINDOW pages,
+ * staying VMAD_SWAP_LEAD windows ahead of the page being written.
+ */
+#define VMAD_SWAP_WINDOW	VMAD_PAR_PIECE
+#define VMAD_SWAP_LEAD		4
+
+struct vmad_par_extent {
+    unsigned long addr;
+    unsigned long len;
+    loff_t pos;
+};
+
+struct vmad_par_io {
+    spinlock_t lock;
+    unsigned long next;		/* next piece or extent to claim */
+    unsigned long count;	/* pieces or extents in the current job */
+    unsigned long pages;	/* pages queued */
+    struct vmad_par_extent *ext;
+    cr_helper_t *helper;
+    wait_queue_head_t *wait;
+    cr_errbuf_t *eb;
+    struct file *file;
+    int use_directio;
+    int is_exec;		/* restart only */
+    int swapin;			/* checkpoint only: read ahead swapped pages */
+};
+
+/* Positional I/O by several threads needs a plain regular (or striped) file */
+static inline int
+vmad_par_ok(struct file *file)
+{
+    return (S_ISREG(file->f_dentry->d_inode->i_mode) || cr_is_stripe_file(file)) &&
+	   !(file->f_flags & O_APPEND);
+}
+
+static int
+vmad_par_init(struct vmad_par_io *io, cr_helper_t *helper,
+	      wait_queue_head_t *wait, cr_errbuf_t *eb, struct file *file)
+{
+    spin_lock_init(&io->lock);
+    io->next = io->count = io->pages = 0;
+    io->helper = helper;
+    io->wait = wait;
+    io->eb = eb;
+    io->file = file;
+    io->use_directio = 0;
+    io->is_exec = 0;
+    io->swapin = 0;
+    io->ext = vmalloc(VMAD_PAR_EXTENTS * sizeof(struct vmad_par_extent));
+    return io->ext ? 0 : -ENOMEM;
+}
+
+static void
+vmad_par_fini(struct vmad_par_io *io)
+{
+    if (io->ext) vfree(io->ext);
+}
+
+static unsigned long
+vmad_par_claim(struct vmad_par_io *io)
+{
+    unsigned long result = ~0UL;
+
+    spin_lock(&io->lock);
+    if (io->next < io->count) result = io->next++;
+    spin_unlock(&io->lock);
+
+    return result;
+}
+
+/* Stop the other threads claiming more work after an error */
+static void
+vmad_par_abort(struct vmad_par_io *io)
+{
+    spin_lock(&io->lock);
+    io->next = io->count;
+    spin_unlock(&io->lock);
+}
+
+static long
+vmad_par_write(void *arg)
+{
+    struct vmad_par_io *io = arg;
+    unsigned long i;
+
+    while ((i = vmad_par_claim(io)) != ~0UL) {
+	const struct vmad_par_extent *e = &io->ext[i];
+	ssize_t r;
+
+	if (io->swapin && (i + VMAD_SWAP_LEAD < io->count)) {
+	    /* Extents are claimed in order, so this one is still ahead of every writer */
+	    const struct vmad_par_extent *ahead = &io->ext[i + VMAD_SWAP_LEAD];
+	    vmad_willneed(ahead->addr, ahead->addr + ahead->len);
+	}
+	r = cr_uwrite_at(io->eb, io->file, (void *)e->addr, e->len, e->pos);
+	if (r != e->len) {
+	    vmad_par_abort(io);
+	    return (r < 0) ? r : -EIO;
+	}
+    }
+
+    return 0;
+}
+
+static long
+vmad_par_read(void *arg)
+{
+    struct vmad_par_io *io = arg;
+    unsigned long i;
+
+    while ((i = vmad_par_claim(io)) != ~0UL) {
+	const struct vmad_par_extent *e = &io->ext[i];
+	ssize_t r = cr_uread_at(io->eb, io->file, (void *)e->addr, e->len, e->pos);
+	if (r != e->len) {
+	    vmad_par_abort(io);
+	    return (r < 0) ? r : -EIO;
+	}
+	if (io->is_exec) { flush_icache_range(e->addr, e->addr + e->len); }
+    }
+
+    return 0;
+}
+
+/* Perform all queued I/O */
+static long
+vmad_par_drain(struct vmad_par_io *io, long (*fn)(void *))
+{
+    unsigned long old_filp_flags = 0;
+    long r;
+
+    if (!io->count) return 0;
+
+    if (io->use_directio)
+	old_filp_flags = directio_start(io->file);
+    if (io->swapin) {
+	/* vmad_par_write() reads ahead the rest as it goes */
+	unsigned long i;
+	for (i = 0; (i < VMAD_SWAP_LEAD) && (i < io->count); ++i)
+	    vmad_willneed(io->ext[i].addr, io->ext[i].addr + io->ext[i].len);
+    }
+    io->next = 0;
+    if (io->pages < VMAD_PAR_MIN_PAGES) {
+	r = fn(io);	/* not worth waking anybody */
+    } else {
+	r = cr_helper_run(io->helper, io->wait, fn, io);
+    }
+    io->count = io->pages = 0;
+    if (io->use_directio)
+	directio_stop(io->file, old_filp_flags);
+
+    return r;
+}
+
+/* Queue I/O of the given pages at the current file position, and skip
+ * the file position over them.  Returns 0 or <0 on error.
+ */
+static long
+vmad_par_queue(struct vmad_par_io *io, long (*fn)(void *),
+	       unsigned long addr, unsigned long num_pages)
+{
+    struct file *file = io->file;
+    long r;
+
+    while (num_pages) {
+	const unsigned long n = min(num_pages, VMAD_PAR_PIECE);
+	struct vmad_par_extent *e;
+
+	if (io->count == VMAD_PAR_EXTENTS) {
+	    r = vmad_par_drain(io, fn);
+	    if (r < 0) return r;
+	}
+	e = &io->ext[io->count++];
+	e->addr = addr;
+	e->len = n << PAGE_SHIFT;
+	e->pos = file->f_pos;
+	file->f_pos += e->len;
+	io->pages += n;
+	addr += e->len;
+	num_pages -= n;
+    }
+
+    return 0;
+}
+
 /* Reads in the header giving the the number of bytes of "fill" to
  * achieve alignment, and returns that value in *buf_len.
  * ONLY if "fill" is less than VMAD_CHUNKHEADER_MIN bytes is the
@@ -870,6 +1238,56 @@ bad_read:
     return r;
 }
 
+/* Parallel version of the loop in vmadump_load_page_list().
+ * The chunk header arrays are read in sequence, while the page data
+ * following each of them is queued and read in all threads.
+ */
+static int
+load_page_list_par(cr_rstrt_proc_req_t *ctx, struct file *file, int is_exec)
+{
+    struct vmad_par_io io;
+    struct vmadump_page_header *chunks;
+    unsigned int sizeof_chunks = VMAD_CHUNKHEADER_SIZE;
+    int done = 0;
+    long r;
+
+    chunks = (struct vmadump_page_header *) kmalloc(sizeof_chunks, GFP_KERNEL);
+    r = vmad_par_init(&io, &ctx->helper, &ctx->wait, ctx->req->errbuf, file);
+    if (!r && !chunks) r = -ENOMEM;
+    if (r < 0) goto out_free;
+    io.is_exec = is_exec;
+
+    r = load_page_list_header(ctx, file, chunks, &sizeof_chunks, &io.use_directio);
+    if (r < 0) goto out_free;
+
+    while (!done) {
+	const int max_chunks = sizeof_chunks/sizeof(*chunks);
+	int i;
+
+	r = read_kern(ctx, file, chunks, sizeof_chunks);
+	if (r != sizeof_chunks) {
+	    if (r >= 0) r = -EIO;	/* map short reads to EIO */
+	    goto out_free;
+	}
+	for (i = 0; i < max_chunks; ++i) {
+	    if (chunks[i].start == VMAD_END_OF_CHUNKS) {
+		done = 1;
+		break;
+	    }
+	    r = vmad_par_queue(&io, vmad_par_read, chunks[i].start, chunks[i].num_pages);
+	    if (r < 0) goto out_free;
+	}
+	sizeof_chunks = VMAD_CHUNKHEADER_SIZE; /* After the first, all chunk arrays are this size */
+    }
+
+    r = vmad_par_drain(&io, vmad_par_read);
+
+out_free:
+    vmad_par_fini(&io);
+    kfree(chunks);
+    return r;
+}
+
 int vmadump_load_page_list(cr_rstrt_proc_req_t *ctx,
 			   struct file *file, int is_exec)
 {
@@ -877,11 +1295,18 @@ int vmadump_load_page_list(cr_rstrt_proc_req_t *ctx,
     long r;
     unsigned int sizeof_chunks = VMAD_CHUNKHEADER_SIZE;
     int use_directio = 0;
+    const loff_t pos = file->f_pos;
+    const u64 t0 = cr_trace_start(blcr_page_list);
+
+    if ((cr_helpers(ctx) > 0) && vmad_par_ok(file)) {
+	r = load_page_list_par(ctx, file, is_exec);
+	goto out;
+    }
 
     chunks = (struct vmadump_page_header *) kmalloc(sizeof_chunks, GFP_KERNEL);
     if (chunks == NULL) {
         r = -ENOMEM;
-        goto err;
+        goto out;
     }
 
     /* handle alignment padding - either skip it or use it for first batch of chunks */
@@ -897,17 +1322,224 @@ int vmadump_load_page_list(cr_rstrt_proc_req_t *ctx,
 
 out_free:
     kfree(chunks);
-err:
+out:
+    trace_blcr_page_list(0, 0, 0, file->f_pos - pos, cr_trace_since(t0));
     return r;
 }
 
+/*--------------------------------------------------------------------
+ * Deferred protections
+ *
+ * Maps are created writable so their pages can be loaded.  Rather than
+ * an mprotect() per map, each final protection is noted here and applied
+ * after the whole list is loaded.  Since maps arrive in address order,
+ * contiguous ranges w/ the same protection become one mprotect().
+ *------------------------------------------------------------------*/
+struct vmadump_prot_range {
+    unsigned long start, end;
+    unsigned long prot;
+};
+
 static
-int load_map(cr_rstrt_proc_req_t *ctx,
-	     struct file *file, struct vmadump_vma_header *head) {
+void vmad_mprotect(cr_rstrt_proc_req_t *ctx, unsigned long start, unsigned long end,
+		   unsigned long prot) {
+    if (sys_mprotect(start, end - start, prot))
+	CR_ERR_CTX(ctx, "thaw: mprotect failed. (ignoring)");
+}
+
+void vmadump_prot_add(cr_rstrt_proc_req_t *ctx, struct vmadump_prots *prots,
+		      unsigned long start, unsigned long end, unsigned long prot) {
+    struct vmadump_prot_range *last = prots->count ? &prots->range[prots->count - 1] : NULL;
+
+    if (last && (last->end == start) && (last->prot == prot)) {
+	last->end = end;
+	return;
+    }
+    if ((prots->count == prots->max) &&
+	vmad_grow((void **)&prots->range, &prots->max, prots->count, sizeof(*last))) {
+	/* Out of memory: just don't defer this one */
+	vmad_mprotect(ctx, start, end, prot);
+	return;
+    }
+    last = &prots->range[prots->count++];
+    last->start = start;
+    last->end = end;
+    last->prot = prot;
+}
+
+void vmadump_prot_apply(cr_rstrt_proc_req_t *ctx, struct vmadump_prots *prots) {
+    unsigned int i;
+
+    for (i = 0; i < prots->count; ++i) {
+	const struct vmadump_prot_range *range = &prots->range[i];
+	vmad_mprotect(ctx, range->start, range->end, range->prot);
+    }
+    kfree(prots->range);
+    prots->range = NULL;
+    prots->count = prots->max = 0;
+}
+
+/*--------------------------------------------------------------------
+ * Working set (VMAD_VM_WORKSET)
+ *
+ * For a file map, a bitmap of the pages which were resident in the page
+ * tables at checkpoint time may follow the page list.  At restart we
+ * start read-ahead of those pages (without waiting for it), so the
+ * restarted process takes minor rather than major faults on them.
+ *------------------------------------------------------------------*/
+#define VMAD_WORKSET_PIECE (PAGE_SIZE * 8)	/* pages per page of bitmap */
+
+static
+int load_workset(cr_rstrt_proc_req_t *ctx, struct file *file,
+		 unsigned long start, unsigned long end) {
+    unsigned long *bits;
+    unsigned long addr = start;
+    long r = 0;
+
+    bits = (unsigned long *) __get_free_page(GFP_KERNEL);
+    if (!bits) return -ENOMEM;
+
+    while (addr < end) {
+	const unsigned long n = min((end - addr) >> PAGE_SHIFT, VMAD_WORKSET_PIECE);
+	const size_t len = BITS_TO_LONGS(n) * sizeof(long);
+	unsigned long i, j;
+
+	r = read_kern(ctx, file, bits, len);
+	if (r != len) goto out;
+
+	/* One madvise() per run of resident pages */
+	for (i = find_first_bit(bits, n); i < n; i = find_next_bit(bits, n, j)) {
+	    j = find_next_zero_bit(bits, n, i);
+	    vmad_willneed(addr + (i << PAGE_SHIFT), addr + (j << PAGE_SHIFT));
+	}
+	addr += n << PAGE_SHIFT;
+    }
+    r = 0;
+
+ out:
+    free_page((unsigned long)bits);
+    if (r > 0) r = -EIO;	/* map short reads to EIO */
+    return r;
+}
+
+/*--------------------------------------------------------------------
+ * NUMA placement (VMAD_VM_NUMA)
+ *
+ * At checkpoint we save each VMA's memory policy, and the node of each
+ * resident page as runs of pages.  At restart, before a VMA's pages are
+ * loaded, each run is mbind()ed MPOL_PREFERRED to its node (if that node
+ * is online).  So the pages land there no matter which thread loads
+ * them.  Then the VMA gets its own policy back, limited to online nodes.
+ *------------------------------------------------------------------*/
+#define VMAD_NUMA_LONGS		BITS_TO_LONGS(MAX_NUMNODES)
+#define VMAD_NUMA_LONGS_MAX	4096	/* sanity limit on nmask_longs */
+#define VMAD_MPOL_MODE(_m)	((_m) & 0xff)	/* w/o any MPOL_F_* mode flags */
+
+struct vmad_numa {
+    int mode;
+    int bound;			/* runs mbind()ed to their nodes */
+    unsigned long nmask[VMAD_NUMA_LONGS];
+};
+
+#if VMAD_HAVE_NUMA
+static
+long vmad_mbind(unsigned long start, unsigned long end, int mode, unsigned long *nmask) {
+    mm_segment_t oldfs;
+    long r;
+
+    oldfs = get_fs(); set_fs(KERNEL_DS);
+    r = sys_mbind(start, end - start, mode, nmask, nmask ? MAX_NUMNODES + 1 : 0, 0);
+    set_fs(oldfs);
+    return r;
+}
+#endif
+
+static
+int load_numa(cr_rstrt_proc_req_t *ctx, struct file *file,
+	      unsigned long start, unsigned long end, struct vmad_numa *numa) {
+    struct vmadump_numa_header hdr;
+    struct vmadump_numa_run run;
+    unsigned int i;
+    long r;
+
+    r = read_kern(ctx, file, &hdr, sizeof(hdr));
+    if (r != sizeof(hdr)) goto bad_read;
+    if (hdr.nmask_longs > VMAD_NUMA_LONGS_MAX) {
+	CR_ERR_CTX(ctx, "thaw: bogus NUMA node mask length %u", hdr.nmask_longs);
+	return -EINVAL;
+    }
+    numa->mode = hdr.mode;
+    numa->bound = 0;
+    memset(numa->nmask, 0, sizeof(numa->nmask));
+    for (i = 0; i < hdr.nmask_longs; ++i) {
+	unsigned long tmp;
+	r = read_kern(ctx, file, &tmp, sizeof(tmp));
+	if (r != sizeof(tmp)) goto bad_read;
+	if (i < VMAD_NUMA_LONGS) numa->nmask[i] = tmp;	/* drop nodes we can't have */
+    }
+
+    for (;;) {
+	r = read_kern(ctx, file, &run, sizeof(run));
+	if (r != sizeof(run)) goto bad_read;
+	if (run.start == ~0UL) break;
+	if ((run.start < start) || (run.end > end) || (run.start >= run.end)) {
+	    CR_ERR_CTX(ctx, "thaw: bogus NUMA run %lx-%lx", run.start, run.end);
+	    return -EINVAL;
+	}
+#if VMAD_HAVE_NUMA
+	if ((run.node >= 0) && (run.node < MAX_NUMNODES) && node_online(run.node)) {
+	    unsigned long mask[VMAD_NUMA_LONGS];
+	    memset(mask, 0, sizeof(mask));
+	    __set_bit(run.node, mask);
+	    if (!vmad_mbind(run.start, run.end, MPOL_PREFERRED, mask))
+		++numa->bound;
+	}
+#endif
+    }
+    return 0;
+
+ bad_read:
+    if (r >= 0) r = -EIO;	/* map short reads to EIO */
+    return r;
+}
+
+/* Put back the VMA's own policy, once its pages are loaded */
+static
+void vmad_numa_restore(cr_rstrt_proc_req_t *ctx, unsigned long start, unsigned long end,
+		       struct vmad_numa *numa) {
+#if VMAD_HAVE_NUMA
+    int mode = numa->mode;
+    int i, any = 0;
+
+    for (i = 0; i < MAX_NUMNODES; ++i) {
+	if (!test_bit(i, numa->nmask)) continue;
+	if (node_online(i)) {
+	    any = 1;
+	} else {
+	    __clear_bit(i, numa->nmask);
+	}
+    }
+    if ((VMAD_MPOL_MODE(mode) == MPOL_DEFAULT) && !numa->bound) {
+	return;	/* Nothing to undo */
+    }
+    if (!any && (VMAD_MPOL_MODE(mode) != MPOL_DEFAULT) && (VMAD_MPOL_MODE(mode) != MPOL_PREFERRED)) {
+	CR_ERR_CTX(ctx, "thaw: no nodes of NUMA policy %d are online. (using default)", mode);
+	mode = MPOL_DEFAULT;
+    }
+    if (vmad_mbind(start, end, mode, (VMAD_MPOL_MODE(mode) == MPOL_DEFAULT) ? NULL : numa->nmask))
+	CR_ERR_CTX(ctx, "thaw: mbind failed. (ignoring)");
+#endif
+}
+
+static
+int load_map(cr_rstrt_proc_req_t *ctx, struct file *file,
+	     struct vmadump_vma_header *head, struct vmad_load_names *names,
+	     struct vmadump_prots *prots) {
     long r;
     unsigned long mmap_prot, mmap_flags, addr;
+    struct vmad_numa numa;
 
-    const unsigned long start = head->start & ~VMAD_VM_EXECUTABLE;
+    const unsigned long start = head->start & ~VMAD_VM_FLAGS;
     const unsigned long len = head->end - start; 
 
     if (head->namelen == VMAD_NAMELEN_ARCH) {
@@ -930,7 +1562,18 @@ int load_map(cr_rstrt_proc_req_t *ctx,
 #endif
     if (head->flags & VM_DENYWRITE) mmap_flags |= MAP_DENYWRITE;
 
-    if (head->namelen > 0) {
+    if (head->namelen & VMAD_NAMELEN_REF) {
+	const unsigned long index = head->namelen & ~VMAD_NAMELEN_REF;
+	if (index >= names->count) {
+	    CR_ERR_CTX(ctx, "thaw: bogus name index %lu", index);
+	    return -EINVAL;
+	}
+	r = mmap_file(ctx, head, names->name[index], mmap_flags);
+	if (r) {
+	    CR_ERR_CTX(ctx, "mmap failed: %s", names->name[index]);
+	    return r;
+	}
+    } else if (head->namelen > 0) {
 	char *filename;
 	if (head->namelen > PAGE_SIZE) {
 	    CR_ERR_CTX(ctx, "thaw: bogus namelen %d", (int) head->namelen);
@@ -947,14 +1590,17 @@ int load_map(cr_rstrt_proc_req_t *ctx,
 	    goto err;
 	}
 	filename[head->namelen] = 0;
+	r = vmad_load_name_add(names, filename);
+	if (r) {
+	    kfree(filename);
+	    return r;
+	}
 
 	r = mmap_file(ctx, head, filename, mmap_flags);
 	if (r) {
 	    CR_ERR_CTX(ctx, "mmap failed: %s", filename);
-	    kfree(filename);
 	    return r;
 	}
-	kfree(filename);
     } else {
 	/* Load the data from the dump file */
 	down_write(&current->mm->mmap_sem);
@@ -974,12 +1620,26 @@ int load_map(cr_rstrt_proc_req_t *ctx,
 	}
     }
 
+    if (head->start & VMAD_VM_NUMA) {
+	r = load_numa(ctx, file, start, head->end, &numa);
+	if (r) goto err;
+    }
+
     /* Read in patched pages */
     r = vmadump_load_page_list(ctx, file, (mmap_prot & PROT_EXEC));
     if (r) goto err;
 
-    if (sys_mprotect(start, len, mmap_prot))
-	CR_ERR_CTX(ctx, "thaw: mprotect failed. (ignoring)");
+    if (head->start & VMAD_VM_NUMA)
+	vmad_numa_restore(ctx, start, head->end, &numa);
+
+    if (head->start & VMAD_VM_WORKSET) {
+	r = load_workset(ctx, file, start, head->end);
+	if (r) goto err;
+    }
+
+    /* Anonymous maps w/ PROT_WRITE already have their final protection */
+    if (head->namelen || !(mmap_prot & PROT_WRITE))
+	vmadump_prot_add(ctx, prots, start, head->end, mmap_prot);
     return 0;
 
  err:
@@ -1249,6 +1909,8 @@ long vmadump_thaw_proc(cr_rstrt_proc_req_t *ctx,
     struct vm_area_struct *map;
     struct vmadump_mm_info mm_info;
     struct vmadump_vma_header mapheader;
+    struct vmad_load_names names = { 0, 0, NULL };
+    struct vmadump_prots prots = { 0, 0, NULL };
 #if HAVE_MM_MMAP_BASE
     unsigned long mmap_base;
 #endif
@@ -1346,9 +2008,16 @@ long vmadump_thaw_proc(cr_rstrt_proc_req_t *ctx,
     r = read_kern(ctx, file, &mapheader, sizeof(mapheader));
     while (r == sizeof(mapheader) &&
 	   (mapheader.start != ~0 || mapheader.end != ~0)) {
-	if ((r = load_map(ctx, file, &mapheader))) goto bad_read;
+	const loff_t pos = file->f_pos;
+	const u64 t0 = cr_trace_start(blcr_load_map);
+	r = load_map(ctx, file, &mapheader, &names, &prots);
+	trace_blcr_load_map(mapheader.start & ~VMAD_VM_FLAGS, mapheader.end,
+			    mapheader.namelen, file->f_pos - pos, r, cr_trace_since(t0));
+	if (r) break;
 	r = read_kern(ctx, file, &mapheader, sizeof(mapheader));
     }
+    vmad_load_names_free(&names);
+    vmadump_prot_apply(ctx, &prots);
     if (r != sizeof(mapheader)) goto bad_read;
 
     down_write(&current->mm->mmap_sem);
@@ -1434,6 +2103,11 @@ pte_t *vmad_follow_addr(struct page **pagep, struct mm_struct *mm, unsigned long
     return pte_offset_map(pmd, addr);
 }
 
+/* need_to_save() result for a page which must be saved and is not
+ * resident (swapped out), so it is worth reading ahead before the write.
+ */
+#define VMAD_PAGE_SWAPPED	2
+
 /* This routine checks if a page from a filemap has been copied via
  * copy on write.  Basically, this is just checking to see if the page
  * is still a member of the map or not.  Note this this should not end
@@ -1457,7 +2131,7 @@ int addr_copied(struct mm_struct *mm, unsigned long addr) {
 	    ret = PageAnon(pg);
 	} else {
 	    /* pte_none is false for a swapped (written) page */
-	    ret = !pte_none(pte);
+	    ret = pte_none(pte) ? 0 : VMAD_PAGE_SWAPPED;
 	}
     } else {
 	ret = pg && PageAnon(pg);
@@ -1484,6 +2158,25 @@ int addr_nonzero_file(struct mm_struct *mm, unsigned long addr) {
     return 0;
 }
 
+/* Is the page at addr present in the page tables? */
+static
+int addr_resident(struct mm_struct *mm, unsigned long addr) {
+    pte_t *ptep;
+    struct page *pg;
+    int ret;
+
+    spin_lock(&mm->page_table_lock);
+    ptep = vmad_follow_addr(&pg, mm, addr);
+    if (ptep) {
+	ret = pte_present(*ptep);
+	pte_unmap(ptep);
+    } else {
+	ret = (pg != NULL);
+    }
+    spin_unlock(&mm->page_table_lock);
+    return ret;
+}
+
 /* This version is for use on regions which are *NOT* file maps.  Here
  * we look at the page tables to see if a page is zero.  If it's never
  * been faulted in, we know it's zero - and we don't fault it in while
@@ -1501,7 +2194,12 @@ int addr_nonzero(struct mm_struct *mm, unsigned long addr) {
 	pte_t pte = *ptep;
 	pte_unmap(ptep);
 	if (pte_none(pte)) goto out_zero; /* Never faulted */
-	if (pte_present(pte) && (pte_page(pte) == ZERO_PAGE(addr))) goto out_zero; /* Only READ faulted */
+	if (!pte_present(pte)) {
+	    /* Swapped: save it rather than fault it in here to look for zeros */
+	    spin_unlock(&mm->page_table_lock);
+	    return VMAD_PAGE_SWAPPED;
+	}
+	if (pte_page(pte) == ZERO_PAGE(addr)) goto out_zero; /* Only READ faulted */
     } else if (!pg) {
 	goto out_zero;
     }
@@ -1567,21 +2265,63 @@ bad_write:
     return r;
 }
 
+/* Read-ahead cursor over an array of chunks: the next page to read
+ * ahead, and how many pages of the array have been read ahead so far.
+ */
+struct vmad_swapin {
+    int chunk;
+    unsigned long addr;
+    unsigned long pages;
+};
+
+/* Read ahead the pages of the chunks array, in order, until the first
+ * "upto" pages of the array have been covered.
+ */
+static void
+vmad_swapin_ahead(struct vmad_swapin *sw, const struct vmadump_page_header *headers,
+		  int num_headers, unsigned long upto)
+{
+    while ((sw->pages < upto) && (sw->chunk < num_headers) &&
+	   (headers[sw->chunk].start != VMAD_END_OF_CHUNKS)) {
+	const struct vmadump_page_header *h = &headers[sw->chunk];
+	const unsigned long chunk_end = h->start + ((unsigned long)h->num_pages << PAGE_SHIFT);
+	const unsigned long n = min((chunk_end - sw->addr) >> PAGE_SHIFT, upto - sw->pages);
+
+	vmad_willneed(sw->addr, sw->addr + (n << PAGE_SHIFT));
+	sw->pages += n;
+	sw->addr += n << PAGE_SHIFT;
+	if ((sw->addr == chunk_end) && (++sw->chunk < num_headers))
+	    sw->addr = headers[sw->chunk].start;
+    }
+}
+
 /* 
  * Returns < 0 on failure, or written byte count on success.
+ *
+ * If "swapin" then some of the pages are swapped out.  Rather than have
+ * write_user() fault them in one at a time, the chunks are written in
+ * windows, and before each window we start read-ahead of the pages up to
+ * VMAD_SWAP_LEAD windows further on.  So swap reads are issued in large
+ * batches and overlap the writes of the context file.
  */
 static 
 long store_page_chunks(cr_chkpt_proc_req_t *ctx, struct file *file,
 		      struct vmadump_page_header *headers,
-		      int sizeof_headers, int use_directio)
+		      int sizeof_headers, int use_directio, int swapin)
 {
     unsigned long old_filp_flags = 0;
     unsigned long chunk_start;
+    unsigned long pages = 0;
+    const loff_t pos = file->f_pos;
+    struct vmad_swapin sw = { 0, headers[0].start, 0 };
     long r, bytes = 0;
     int i;
 
     const int num_headers = sizeof_headers/sizeof(*headers);
 
+    /* A dry run never reads the pages, so must not bring them in either */
+    if (cr_io_sink(file)) swapin = 0;
+
     r = write_kern(ctx, file, headers, sizeof_headers);
     if (r != sizeof_headers) goto bad_write;
     bytes += r;
@@ -1605,15 +2345,30 @@ long store_page_chunks(cr_chkpt_proc_req_t *ctx, struct file *file,
             break;
         }
 
-	r = write_user(ctx, file, (void *)chunk_start, len);
-	if (r != len) goto bad_write;
-	bytes += r;
+	if (swapin) {
+	    long off, n;
+
+	    for (off = 0; off < len; off += n) {
+		n = min(len - off, (long)VMAD_SWAP_WINDOW << PAGE_SHIFT);
+		vmad_swapin_ahead(&sw, headers, num_headers,
+				  pages + (off >> PAGE_SHIFT) + VMAD_SWAP_LEAD * VMAD_SWAP_WINDOW);
+		r = write_user(ctx, file, (void *)(chunk_start + off), n);
+		if (r != n) goto bad_write;
+		bytes += r;
+	    }
+	} else {
+	    r = write_user(ctx, file, (void *)chunk_start, len);
+	    if (r != len) goto bad_write;
+	    bytes += r;
+	}
+	pages += headers[i].num_pages;
     }
 
     if (use_directio)
 	directio_stop(file, old_filp_flags);
 
 empty:
+    cr_toc_add(ctx->req, CR_TOC_CHUNKS, pos, bytes, headers[0].start, pages);
     return bytes;
 
 bad_write:
@@ -1631,12 +2386,13 @@ bad_write:
  * chunks - the chunks array to write
  * *sizeof_chunks - length of chunks in BYTES
  * *chunk_number - next unoccupied entry in array
+ * swapin - some pages of the region are swapped out
  */
 static inline loff_t
 write_chunk(cr_chkpt_proc_req_t *ctx, struct file *file,
              struct vmadump_page_header *chunks, unsigned int *sizeof_chunks,
              int *chunk_number, unsigned long start, unsigned long num_pages,
-             int use_directio)
+             int use_directio, int swapin)
 {
     long r = 0;
 
@@ -1651,7 +2407,7 @@ write_chunk(cr_chkpt_proc_req_t *ctx, struct file *file,
 
         /* Write the array if full or finished */
         if (((index + 1) >= max_chunks) || (start == VMAD_END_OF_CHUNKS)) {
-            r = store_page_chunks(ctx, file, chunks, *sizeof_chunks, use_directio);
+            r = store_page_chunks(ctx, file, chunks, *sizeof_chunks, use_directio, swapin);
             *sizeof_chunks = VMAD_CHUNKHEADER_SIZE;
             *chunk_number = 0;
         }
@@ -1659,6 +2415,164 @@ write_chunk(cr_chkpt_proc_req_t *ctx, struct file *file,
     return r;
 }
 
+/*
+ * Parallel version of store_page_list() for large regions, in two passes:
+ *   1. Scan: pieces of the region are claimed by whichever thread is free
+ *      and need_to_save() is recorded for each page in a bitmap.
+ *   2. Write: the leader forms the chunks from the bitmap exactly as the
+ *      serial code would, writes each array of chunk headers itself and
+ *      queues the page data that follows it at its pre-assigned offset.
+ * The result is byte-for-byte what the serial code would produce.
+ */
+struct vmad_par_pages {
+    struct vmad_par_io io;	/* lock/next/count also used for the scan */
+    unsigned long start;
+    unsigned long npages;
+    unsigned long *bitmap;	/* pages to save */
+    unsigned long swapped;	/* how many of them are swapped out */
+    int (*need_to_save)(struct mm_struct *, unsigned long);
+};
+
+static long
+vmad_par_scan(void *arg)
+{
+    struct vmad_par_pages *ps = arg;
+    struct mm_struct *mm = current->mm;
+    unsigned long piece;
+
+    while ((piece = vmad_par_claim(&ps->io)) != ~0UL) {
+	unsigned long i = piece * VMAD_PAR_PIECE;
+	const unsigned long last = min(i + VMAD_PAR_PIECE, ps->npages);
+	unsigned long swapped = 0;
+
+	for (; i < last; ++i) {
+	    const int save = ps->need_to_save(mm, ps->start + (i << PAGE_SHIFT));
+	    if (save) {
+		/* Non-atomic is safe: no two pieces share a word */
+		__set_bit(i, ps->bitmap);
+		if (save == VMAD_PAGE_SWAPPED) ++swapped;
+	    }
+	}
+	if (swapped) {
+	    spin_lock(&ps->io.lock);
+	    ps->swapped += swapped;
+	    spin_unlock(&ps->io.lock);
+	}
+    }
+
+    return 0;
+}
+
+/* Write one array of chunk headers and queue the page data that follows it */
+static long
+vmad_par_chunks(cr_chkpt_proc_req_t *ctx, struct vmad_par_io *io,
+		struct vmadump_page_header *headers, int sizeof_headers)
+{
+    const int num_headers = sizeof_headers/sizeof(*headers);
+    const loff_t pos = io->file->f_pos;
+    unsigned long pages = 0;
+    long r, bytes = 0;
+    int i;
+
+    r = write_kern(ctx, io->file, headers, sizeof_headers);
+    if (r != sizeof_headers) goto bad_write;
+    bytes += r;
+
+    for (i = 0; i < num_headers; ++i) {
+	if (headers[i].start == VMAD_END_OF_CHUNKS) break;
+
+	r = vmad_par_queue(io, vmad_par_write, headers[i].start, headers[i].num_pages);
+	if (r < 0) return r;
+	bytes += (long)headers[i].num_pages << PAGE_SHIFT;
+	pages += headers[i].num_pages;
+    }
+
+    /* Offsets are assigned at queue time, so the entry is exact even before the drain */
+    cr_toc_add(ctx->req, CR_TOC_CHUNKS, pos, bytes, headers[0].start, pages);
+    return bytes;
+
+bad_write:
+    if (r >= 0) r = -EIO;	/* Map short writes to EIO */
+    return r;
+}
+
+static loff_t
+store_page_list_par(cr_chkpt_proc_req_t * ctx, struct file *file,
+		    unsigned long start, unsigned long end,
+		    int (*need_to_save) (struct mm_struct * mm, unsigned long))
+{
+    struct vmad_par_pages ps;
+    struct vmad_par_io *io = &ps.io;
+    struct vmadump_page_header *chunks;
+    unsigned int sizeof_chunks = VMAD_CHUNKHEADER_SIZE;
+    int chunk_number = 0;
+    unsigned long i, nchunks = 0, npages = 0;
+    loff_t bytes = 0;
+    u64 t0 = cr_trace_start(blcr_page_list);
+    long r;
+
+    ps.start = start;
+    ps.npages = (end - start) >> PAGE_SHIFT;
+    ps.need_to_save = need_to_save;
+    ps.swapped = 0;
+    ps.bitmap = vmalloc(BITS_TO_LONGS(ps.npages) * sizeof(long));
+    chunks = cr_kzalloc(sizeof_chunks, GFP_KERNEL);
+    r = vmad_par_init(io, &ctx->helper, &ctx->wait, ctx->req->errbuf, file);
+    if (!r && (!ps.bitmap || !chunks)) r = -ENOMEM;
+    if (r < 0) goto out_free;
+    memset(ps.bitmap, 0, BITS_TO_LONGS(ps.npages) * sizeof(long));
+
+    /* Pass 1: find the pages to save */
+    io->count = (ps.npages + VMAD_PAR_PIECE - 1) / VMAD_PAR_PIECE;
+    r = cr_helper_run(io->helper, io->wait, vmad_par_scan, &ps);
+    io->next = io->count = 0;
+    if (r < 0) goto out_free;
+    io->swapin = (ps.swapped != 0) && !cr_io_sink(file);
+
+    /* Pass 2: lay out the chunks and write them */
+    r = store_page_list_header(ctx, file, chunks, &sizeof_chunks, &io->use_directio);
+    if (r < 0) goto out_free;
+    bytes += r;
+
+    i = find_first_bit(ps.bitmap, ps.npages);
+    while (i < ps.npages) {
+	const unsigned long run_end = find_next_zero_bit(ps.bitmap, ps.npages, i);
+
+	chunks[chunk_number].start = start + (i << PAGE_SHIFT);
+	chunks[chunk_number].num_pages = run_end - i;
+	nchunks += 1;
+	npages += run_end - i;
+	if (++chunk_number == (sizeof_chunks/sizeof(*chunks))) {
+	    r = vmad_par_chunks(ctx, io, chunks, sizeof_chunks);
+	    if (r < 0) goto out_free;
+	    bytes += r;
+	    sizeof_chunks = VMAD_CHUNKHEADER_SIZE;
+	    chunk_number = 0;
+	}
+	i = (run_end < ps.npages) ? find_next_bit(ps.bitmap, ps.npages, run_end) : ps.npages;
+    }
+
+    /* The end marker forces out the final array (as in write_chunk()) */
+    chunks[chunk_number].start = VMAD_END_OF_CHUNKS;
+    chunks[chunk_number].num_pages = 0;
+    r = vmad_par_chunks(ctx, io, chunks, sizeof_chunks);
+    if (r < 0) goto out_free;
+    bytes += r;
+
+    r = vmad_par_drain(io, vmad_par_write);
+    if (r >= 0) {
+	cr_stats_pages(&ctx->req->stats, nchunks, npages, ps.npages - npages);
+	trace_blcr_page_list(1, nchunks, npages, bytes, cr_trace_since(t0));
+    }
+
+out_free:
+    vmad_par_fini(io);
+    if (ps.bitmap) vfree(ps.bitmap);
+    kfree(chunks);
+
+    return (r < 0) ? r : bytes;
+}
+
 /*
  * SOMEDAY: we may want a field in vmadump_page_header for page hashes
  *
@@ -1674,10 +2588,18 @@ store_page_list(cr_chkpt_proc_req_t * ctx, struct file *file,
     loff_t bytes = 0;
     unsigned long addr;
     unsigned long chunk_start, chunk_end, num_contig_pages;
+    unsigned long nchunks = 0, npages = 0, swapped = 0;
     struct vmadump_page_header *chunks;
     int chunk_number;
     unsigned int sizeof_chunks = VMAD_CHUNKHEADER_SIZE;
     int use_directio = 0;
+    u64 t0;
+
+    if ((cr_helpers(ctx) > 0) && vmad_par_ok(file) &&
+	(((end - start) >> PAGE_SHIFT) >= VMAD_PAR_MIN_PAGES)) {
+	return store_page_list_par(ctx, file, start, end, need_to_save);
+    }
+    t0 = cr_trace_start(blcr_page_list);
 
     /* A page 'chunk' is a contiguous range of pages in virtual memory.
      * 
@@ -1715,7 +2637,11 @@ store_page_list(cr_chkpt_proc_req_t * ctx, struct file *file,
         /* The topmost if clause (need_to_save) is to identify things like 
          * unmodified pages that can be reread from disk, or pages that were 
          * allocated and never touched (zero pages).  */
-        if (need_to_save(current->mm, addr)) {
+        const int save = need_to_save(current->mm, addr);
+        if (save) {
+            ++npages;
+            if (save == VMAD_PAGE_SWAPPED) ++swapped;
+
             /* test for contiguous pages.  (chunk_end == addr)
              *
              * break up a contiguous page range if too large, (num < ...)
@@ -1726,9 +2652,10 @@ store_page_list(cr_chkpt_proc_req_t * ctx, struct file *file,
                 r = write_chunk(ctx, file, chunks,
                                 &sizeof_chunks, &chunk_number,
                                 chunk_start, num_contig_pages,
-                                use_directio);
+                                use_directio, (swapped != 0));
                 if (r < 0) goto out_io;
                 bytes += r;
+                if (num_contig_pages) ++nchunks;
 
                 /* Start a new chunk */
                 chunk_start = addr;
@@ -1744,7 +2671,7 @@ store_page_list(cr_chkpt_proc_req_t * ctx, struct file *file,
     r = write_chunk(ctx, file, chunks,
                     &sizeof_chunks, &chunk_number,
                     chunk_start, num_contig_pages,
-                    use_directio);
+                    use_directio, (swapped != 0));
     if (r < 0) goto out_io;
     bytes += r;
 
@@ -1752,7 +2679,7 @@ store_page_list(cr_chkpt_proc_req_t * ctx, struct file *file,
      * which should force writting of the chunks array */
     r = write_chunk(ctx, file, chunks,
                     &sizeof_chunks, &chunk_number,
-                    VMAD_END_OF_CHUNKS, 0, use_directio);
+                    VMAD_END_OF_CHUNKS, 0, use_directio, (swapped != 0));
     if (r < 0) goto out_io;
     if (r == 0) {
         /* This absolutely should not happen.  At the very least an EOF
@@ -1760,6 +2687,10 @@ store_page_list(cr_chkpt_proc_req_t * ctx, struct file *file,
         printk("write_chunks unexpectedly returned 0!\n");
     }
     bytes += r;
+    if (num_contig_pages) ++nchunks;
+    cr_stats_pages(&ctx->req->stats, nchunks, npages,
+                   ((end - start) >> PAGE_SHIFT) - npages);
+    trace_blcr_page_list(1, nchunks, npages, bytes, cr_trace_since(t0));
 
 out_io:
 out_kfree:
@@ -1782,15 +2713,246 @@ loff_t vmadump_store_dirty_page_list(cr_chkpt_proc_req_t *ctx, struct file *file
 	return store_page_list(ctx, file, start, end, addr_copied);
 }
 
+#if VMAD_HAVE_NUMA
+/* Node of the page at addr, or -1 if it is not resident */
+static
+int addr_node(struct mm_struct *mm, unsigned long addr) {
+    pte_t *ptep;
+    struct page *pg;
+    int nid = -1;
+
+    spin_lock(&mm->page_table_lock);
+    ptep = vmad_follow_addr(&pg, mm, addr);
+    if (ptep) {
+	pte_t pte = *ptep;
+	pte_unmap(ptep);
+	if (pte_present(pte) && (pte_page(pte) != ZERO_PAGE(addr)))
+	    nid = page_to_nid(pte_page(pte));
+    } else if (pg) {
+	nid = page_to_nid(pg);
+    }
+    spin_unlock(&mm->page_table_lock);
+    return nid;
+}
+
+/* Write the NUMA placement of [start, end) */
+static
+loff_t store_numa(cr_chkpt_proc_req_t *ctx, struct file *file,
+		  unsigned long start, unsigned long end) {
+    const unsigned int per_page = PAGE_SIZE / sizeof(struct vmadump_numa_run);
+    struct mm_struct *mm = current->mm;
+    struct vmadump_numa_header hdr;
+    struct vmadump_numa_run *runs, *run = NULL;
+    unsigned long nmask[VMAD_NUMA_LONGS];
+    unsigned long addr;
+    unsigned int n = 0;
+    mm_segment_t oldfs;
+    loff_t r, bytes = 0;
+    int mode;
+
+    runs = (struct vmadump_numa_run *) __get_free_page(GFP_KERNEL);
+    if (!runs) return -ENOMEM;
+
+    memset(nmask, 0, sizeof(nmask));
+    oldfs = get_fs(); set_fs(KERNEL_DS);
+    r = sys_get_mempolicy(&mode, nmask, MAX_NUMNODES, start, MPOL_F_ADDR);
+    set_fs(oldfs);
+    if (r) {
+	mode = MPOL_DEFAULT;
+	memset(nmask, 0, sizeof(nmask));
+    }
+    hdr.mode = mode;
+    hdr.nmask_longs = VMAD_NUMA_LONGS;
+    r = write_kern(ctx, file, &hdr, sizeof(hdr));
+    if (r != sizeof(hdr)) goto err;
+    bytes += r;
+    r = write_kern(ctx, file, nmask, sizeof(nmask));
+    if (r != sizeof(nmask)) goto err;
+    bytes += r;
+
+    /* Placement of an interleaved VMA follows from its policy */
+    for (addr = start; (addr < end) && (VMAD_MPOL_MODE(mode) != MPOL_INTERLEAVE); addr += PAGE_SIZE) {
+	const int nid = addr_node(mm, addr);
+	if (nid < 0) continue;
+	if (run && (run->node == nid)) {
+	    run->end = addr + PAGE_SIZE;
+	    continue;
+	}
+	if (n == per_page) {
+	    r = write_kern(ctx, file, runs, n * sizeof(*runs));
+	    if (r != n * sizeof(*runs)) goto err;
+	    bytes += r;
+	    n = 0;
+	}
+	run = &runs[n++];
+	run->start = addr;
+	run->end = addr + PAGE_SIZE;
+	run->node = nid;
+    }
+    if (n == per_page) {
+	r = write_kern(ctx, file, runs, n * sizeof(*runs));
+	if (r != n * sizeof(*runs)) goto err;
+	bytes += r;
+	n = 0;
+    }
+    run = &runs[n++];
+    run->start = run->end = ~0UL;
+    run->node = -1;
+    r = write_kern(ctx, file, runs, n * sizeof(*runs));
+    if (r != n * sizeof(*runs)) goto err;
+    bytes += r;
+
+    free_page((unsigned long)runs);
+    return bytes;
+
+ err:
+    free_page((unsigned long)runs);
+    if (r >= 0) r = -EIO;	/* Map short writes to EIO */
+    return r;
+}
+#endif
+
+/* Write the resident-page bitmap of [start, end) */
+static
+loff_t store_workset(cr_chkpt_proc_req_t *ctx, struct file *file,
+		     unsigned long start, unsigned long end) {
+    struct mm_struct *mm = current->mm;
+    unsigned long *bits;
+    unsigned long addr = start;
+    loff_t r, bytes = 0;
+
+    bits = (unsigned long *) __get_free_page(GFP_KERNEL);
+    if (!bits) return -ENOMEM;
+
+    while (addr < end) {
+	const unsigned long n = min((end - addr) >> PAGE_SHIFT, VMAD_WORKSET_PIECE);
+	const size_t len = BITS_TO_LONGS(n) * sizeof(long);
+	unsigned long i;
+
+	memset(bits, 0, len);
+	for (i = 0; i < n; ++i, addr += PAGE_SIZE) {
+	    if (addr_resident(mm, addr)) __set_bit(i, bits);
+	}
+	r = write_kern(ctx, file, bits, len);
+	if (r != len) goto err;
+	bytes += r;
+    }
+    free_page((unsigned long)bits);
+    return bytes;
+
+ err:
+    free_page((unsigned long)bits);
+    if (r >= 0) r = -EIO;	/* Map short writes to EIO */
+    return r;
+}
+
+/* Which exclusion (CR_OP_HAND_EXCLUDE) covers addr: returns its
+ * enum cr_exclude_how, or -1 if none.  Sets *next to where that stops
+ * applying, but no further than end.
+ */
+static
+int vmad_exclude_at(cr_chkpt_proc_req_t *ctx, unsigned long addr,
+		    unsigned long end, unsigned long *next) {
+    const struct cr_exclude_range *tbl = ctx->exclude;
+    unsigned int lo = 0, hi = ctx->exclude_count;
+
+    /* Find the first range ending above addr */
+    while (lo < hi) {
+	const unsigned int mid = lo + (hi - lo) / 2;
+	if (tbl[mid].end <= addr) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+    if ((lo == ctx->exclude_count) || (tbl[lo].start >= end)) {
+	*next = end;
+	return -1;
+    } else if (tbl[lo].start > addr) {
+	*next = tbl[lo].start;
+	return -1;
+    }
+    *next = min(end, (unsigned long)tbl[lo].end);
+    return (int)tbl[lo].how;
+}
+
+/* Non-zero if [start, end) is left unmapped in its entirety,
+ * possibly by several abutting ranges.
+ */
+static
+int vmad_exclude_all(cr_chkpt_proc_req_t *ctx, unsigned long start,
+		     unsigned long end) {
+    unsigned long addr, next;
+
+    for (addr = start; addr < end; addr = next) {
+	if (vmad_exclude_at(ctx, addr, end, &next) != CR_EXCLUDE_UNMAP)
+	    return 0;
+    }
+    return 1;
+}
+
+/* Write one VMA record for [start, end) of a map, as described by head */
+static
+loff_t store_map_piece(cr_chkpt_proc_req_t *ctx, struct file *file,
+		       struct vmadump_vma_header *head, const char *filename,
+		       unsigned long start, unsigned long end,
+		       int isfilemap, int zero) {
+    loff_t bytes, r;
+
+    /* Spit out the section header */
+    r = write_kern(ctx, file, head, sizeof(*head));
+    if (r != sizeof(*head)) goto err;
+    bytes = r;
+
+    if ((head->namelen > 0) && !(head->namelen & VMAD_NAMELEN_REF)) {
+	/* Store the filename */
+	r = write_kern(ctx, file, filename, head->namelen);
+	if (r != head->namelen) goto err;
+	bytes += r;
+    }
+
+#if VMAD_HAVE_NUMA
+    if (head->start & VMAD_VM_NUMA) {
+	r = store_numa(ctx, file, start, end);
+	if (r < 0) goto err;
+	bytes += r;
+    }
+#endif
+
+    if (head->namelen > 0) {
+	r = store_page_list(ctx, file, start, zero ? start : end, addr_copied);
+	if (r < 0) goto err;
+	bytes += r;
+	if (head->start & VMAD_VM_WORKSET) {
+	    r = store_workset(ctx, file, start, end);
+	    if (r < 0) goto err;
+	    bytes += r;
+	}
+    } else {
+	/* Store the contents of the VMA as defined by start, end.
+	 * An excluded stretch gets an empty page list, so reads as zeros. */
+	r = store_page_list(ctx, file, start, zero ? start : end,
+			    isfilemap ? addr_nonzero_file : addr_nonzero);
+	if (r < 0) goto err;
+	bytes += r;
+    }
+    return bytes;
+
+ err:
+    if (r >= 0) r = -EIO;	/* Map short writes to EIO */
+    return r;
+}
+
 static
 loff_t store_map(cr_chkpt_proc_req_t *ctx, struct file *file,
-	         struct vm_area_struct *map, int flags) {
+	         struct vm_area_struct *map, int flags,
+		 struct vmad_store_names *names) {
     loff_t bytes;
     struct vmadump_vma_header head;
     char *filename=0;
-    char *buffer = 0;
+    long index = -1;
     loff_t r;
-    unsigned long start, end;
+    unsigned long start, end, addr, next, pgoff, vm_flags;
     int isfilemap = 0;
 
 #if VMAD_HAVE_ARCH_MAPS
@@ -1801,6 +2963,14 @@ loff_t store_map(cr_chkpt_proc_req_t *ctx, struct file *file,
     /* Never store a VM_IO region */
     if (map->vm_flags & VM_IO) { return 0; }
 
+    /* Nor one the process asked to leave unmapped.
+     * This must precede vmad_store_name_add(), since a name is only
+     * written with the first record that uses it.
+     */
+    if (vmad_exclude_all(ctx, map->vm_start, map->vm_end)) {
+	return 0;
+    }
+
     head.start   = map->vm_start;
     head.end     = map->vm_end;
     head.flags   = map->vm_flags;
@@ -1810,21 +2980,21 @@ loff_t store_map(cr_chkpt_proc_req_t *ctx, struct file *file,
     /* Decide Whether or not we're gonna store the map's contents or
      * a reference to the file they came from */
     if (map->vm_file) {
-	buffer = (char *) __get_free_page(GFP_KERNEL);
-	if (!buffer) { return -ENOMEM; }
-#if 0 /* Not supported in BLCR */
-	if (ctx && ctx->map_name)
-	    filename = ctx->map_name(ctx, map->vm_file, buffer, PAGE_SIZE);
-	else
-#endif
-	    filename = default_map_name(map->vm_file, buffer, PAGE_SIZE);
-	head.namelen = strlen(filename);
-
 	if (vmad_is_special_mmap(map, flags)) {
 		/* Let BLCR deal with it */
-		free_page((long)buffer);
 		return 0;
-	} else if (vmad_dentry_unlinked(map->vm_file->f_dentry)) {
+	}
+
+	index = vmad_store_name_find(names, map->vm_file, &filename);
+	if (index >= 0) {
+	    head.namelen = VMAD_NAMELEN_REF | index;
+	} else if (IS_ERR(filename)) {
+	    return PTR_ERR(filename);
+	} else {
+	    head.namelen = strlen(filename);
+	}
+
+	if (vmad_dentry_unlinked(map->vm_file->f_dentry)) {
 	    /* Region is an unlinked file - store contents, not filename */
 	    head.namelen = 0;
 	} else if (vmad_is_exe(map)) {
@@ -1842,42 +3012,57 @@ loff_t store_map(cr_chkpt_proc_req_t *ctx, struct file *file,
 		head.namelen=0;
 	}
 	isfilemap = 1;
+
+	if ((index < 0) && (head.namelen > 0)) {
+	    /* First reference to this file - its name is written below */
+	    r = vmad_store_name_add(names, map->vm_file);
+	    if (r) return r;
+	    index = names->count - 1;
+	}
+	if ((head.namelen > 0) && (flags & VMAD_DUMP_WORKSET)) {
+	    head.start |= VMAD_VM_WORKSET;
+	}
+    }
+#if VMAD_HAVE_NUMA
+    if (num_online_nodes() > 1) {
+	head.start |= VMAD_VM_NUMA;
     }
+#endif
 
     start     = map->vm_start;
     end       = map->vm_end;
+    pgoff     = head.pgoff;
+    vm_flags  = head.start & VMAD_VM_FLAGS;
     /* Release the mm_sem here to avoid deadlocks with page faults and
      * write locks that may happen during the writes.  (We can't use
      * the "map" pointer beyond this point. */
     up_read(&current->mm->mmap_sem);
 
-    /* Spit out the section header */
-    r = write_kern(ctx, file, &head, sizeof(head));
-    if (r != sizeof(head)) goto err;
-    bytes = r;
+    /* One record per stretch of the map that is not left unmapped */
+    bytes = 0;
+    for (addr = start; addr < end; addr = next) {
+	const int how = vmad_exclude_at(ctx, addr, end, &next);
 
-    if (head.namelen > 0) {
-	/* Store the filename */
-	r = write_kern(ctx, file, filename, head.namelen);
-	if (r != head.namelen) goto err;
-	bytes += r;
-	r = store_page_list(ctx, file, start, end, addr_copied);
-	if (r < 0) goto err;
-	bytes += r;
-    } else {
-	/* Store the contents of the VMA as defined by start, end */
-	r = store_page_list(ctx, file, start, end,
-			    isfilemap ? addr_nonzero_file : addr_nonzero);
+	if (how == CR_EXCLUDE_UNMAP) continue;
+
+	head.start = addr | vm_flags;
+	head.end   = next;
+	head.pgoff = pgoff + ((addr - start) >> PAGE_SHIFT);
+	r = store_map_piece(ctx, file, &head, filename, addr, next,
+			    isfilemap, (how == CR_EXCLUDE_ZERO));
 	if (r < 0) goto err;
 	bytes += r;
+
+	if ((head.namelen > 0) && !(head.namelen & VMAD_NAMELEN_REF)) {
+	    /* Any further pieces refer back to the name just written */
+	    head.namelen = VMAD_NAMELEN_REF | index;
+	}
     }
-    if (buffer)   free_page((long)buffer);
     down_read(&current->mm->mmap_sem);
     return bytes;
 
  err:
     if (r >= 0) r = -EIO;	/* Map short writes to EIO */
-    if (buffer)   free_page((long)buffer);
     down_read(&current->mm->mmap_sem);
     return r;
 }
@@ -2094,6 +3279,7 @@ int vmadump_store_prctl(cr_chkpt_proc_req_t *ctx, struct file *file) {
 
 loff_t vmadump_freeze_proc(cr_chkpt_proc_req_t *ctx, struct file *file,
 			   struct pt_regs *regs, int flags) {
+    const loff_t pos0 = file->f_pos;
     loff_t r, bytes=0;
     static struct vmadump_header header ={VMAD_MAGIC, VMAD_FMT_VERS, VMAD_ARCH,
 					  (LINUX_VERSION_CODE >> 16) & 0xFF,
@@ -2187,13 +3373,19 @@ loff_t vmadump_freeze_proc(cr_chkpt_proc_req_t *ctx, struct file *file,
 
     /* XXX Will we need FUTEX related stuff here as well? */
 
+    cr_toc_add(ctx->req, CR_TOC_THREAD, pos0, file->f_pos - pos0, 0, 0);
+
     /*--- Memory Information ---------------------------------------*/
     if (!(flags & VMAD_DUMP_REGSONLY)) {
     struct vm_area_struct     *map, *next_map;
     struct vmadump_mm_info     mm_info;
     struct mm_struct          *mm = current->mm;
     struct vmadump_vma_header  term;
+    struct vmad_store_names   *names;
     unsigned long              next_addr;
+    unsigned long              map_start, map_end;
+    loff_t                     map_pos;
+    u64                        t0;
 #if HAVE_MM_MMAP_BASE
     unsigned long mmap_base;
 #endif
@@ -2225,6 +3417,12 @@ loff_t vmadump_freeze_proc(cr_chkpt_proc_req_t *ctx, struct file *file,
     bytes += r;
 #endif
 
+    names = vmad_store_names_alloc();
+    if (!names) {
+	r = -ENOMEM;
+	goto err;
+    }
+
     down_read(&mm->mmap_sem);
     next_map = mm->mmap;
     next_addr = next_map ? next_map->vm_start : 0;
@@ -2236,14 +3434,24 @@ loff_t vmadump_freeze_proc(cr_chkpt_proc_req_t *ctx, struct file *file,
 	if (map != next_map) break;
 	next_map = map->vm_next;
 	next_addr = next_map ? next_map->vm_start : 0;
-	r = store_map(ctx, file, map, flags);
+	map_start = map->vm_start;
+	map_end = map->vm_end;
+	map_pos = file->f_pos;
+	t0 = cr_trace_start(blcr_store_map);
+	r = store_map(ctx, file, map, flags, names);
+	trace_blcr_store_map(map_start, map_end, r, cr_trace_since(t0));
 	if (r < 0) {
 	    up_read(&mm->mmap_sem);
+	    vmad_store_names_free(names);
 	    goto err;
 	}
+	if (r > 0) {
+	    cr_toc_add(ctx->req, CR_TOC_VMA, map_pos, r, map_start, map_end);
+	}
 	bytes += r;
     }
     up_read(&mm->mmap_sem);
+    vmad_store_names_free(names);
 
     /* Terminate maps list */
     term.start = term.end = ~0L;